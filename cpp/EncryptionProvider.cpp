@@ -4,6 +4,7 @@
 
 #include <sstream>
 #include <iostream>
+#include <cstring>
 #include "EncryptionProvider.hpp"
 #include "crypto/Cryptor.hpp"
 #include "util/Base64.hpp"
@@ -119,3 +120,23 @@ void Snowflake::Client::EncryptionProvider::serializeEncMatDecriptor(
      << "\"}";
   fileMetadata->encryptionMetadata.matDesc = ss.str();
 }
+
+size_t Snowflake::Client::EncryptionProvider::decryptPart(
+  FileMetadata *fileMetadata, const char *iv, const char *in, size_t inLen,
+  bool lastPart, char *out)
+{
+  Crypto::CryptoIV partIv;
+  memcpy(partIv.data, iv, sizeof(partIv.data));
+
+  Crypto::CipherContext context =
+    Crypto::Cryptor::getInstance().createCipherContext(
+      Crypto::CryptoAlgo::AES,
+      Crypto::CryptoMode::CBC,
+      lastPart ? Crypto::CryptoPadding::PKCS5 : Crypto::CryptoPadding::NONE,
+      fileMetadata->encryptionMetadata.fileKey,
+      partIv);
+
+  context.initialize(Crypto::CryptoOperation::DECRYPT);
+  size_t nextSize = context.next(out, in, inLen);
+  return nextSize + context.finalize(out + nextSize);
+}
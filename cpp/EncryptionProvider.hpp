@@ -43,6 +43,17 @@ public:
   static void serializeEncMatDecriptor(FileMetadata *fileMetadata,
                                        EncryptionMaterial *encryptionMaterial);
 
+  /**
+   * Decrypt one part of an AES CBC encrypted file independently of other
+   * parts. Part must start at a cipher block boundary, iv is the last cipher
+   * block of previous part (file iv for the first part). Padding is only
+   * removed from the last part.
+   * @return size of the plain text written to out
+   */
+  static size_t decryptPart(FileMetadata *fileMetadata, const char *iv,
+                            const char *in, size_t inLen, bool lastPart,
+                            char *out);
+
 };
 }
 }
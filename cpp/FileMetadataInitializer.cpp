@@ -236,29 +236,45 @@ populateSrcLocDownloadMetadata(std::string &sourceLocation,
                                EncryptionMaterial *encMat,
                                std::string const& presignedUrl)
 {
-  std::string fullPath = *remoteLocation + sourceLocation;
-  size_t dirSep = fullPath.find_last_of('/');
-  std::string dstFileName = fullPath.substr(dirSep + 1);
-
   FileMetadata fileMetadata;
-  fileMetadata.presignedUrl = presignedUrl;
-  RemoteStorageRequestOutcome outcome = storageClient->GetRemoteFileMetadata(
-    &fullPath, &fileMetadata);
+  RemoteStorageRequestOutcome outcome = initDownloadFileMetadata(
+    sourceLocation, *remoteLocation, storageClient, encMat, presignedUrl,
+    fileMetadata);
 
   if (outcome == RemoteStorageRequestOutcome::SUCCESS)
   {
-    CXX_LOG_DEBUG("Success on getting remote file metadata");
     std::vector<FileMetadata> &metaListToPush =
       fileMetadata.srcFileSize > DOWNLOAD_DATA_SIZE_THRESHOLD ?
       m_largeFileMetadata : m_smallFileMetadata;
-
     metaListToPush.push_back(fileMetadata);
-    metaListToPush.back().srcFileName = fullPath;
-    metaListToPush.back().destFileName = dstFileName;
-    EncryptionProvider::decryptFileKey(&(metaListToPush.back()), encMat, getRandomDev());
   }
 
   return outcome;
 }
 
+Snowflake::Client::RemoteStorageRequestOutcome
+Snowflake::Client::FileMetadataInitializer::
+initDownloadFileMetadata(const std::string &sourceLocation,
+                         const std::string &remoteLocation,
+                         IStorageClient *storageClient,
+                         EncryptionMaterial *encMat,
+                         std::string const& presignedUrl,
+                         FileMetadata &fileMetadata)
+{
+  std::string fullPath = remoteLocation + sourceLocation;
+
+  fileMetadata.presignedUrl = presignedUrl;
+  RemoteStorageRequestOutcome outcome = storageClient->GetRemoteFileMetadata(
+    &fullPath, &fileMetadata);
+
+  if (outcome == RemoteStorageRequestOutcome::SUCCESS)
+  {
+    CXX_LOG_DEBUG("Success on getting remote file metadata");
+    size_t dirSep = fullPath.find_last_of('/');
+    fileMetadata.srcFileName = fullPath;
+    fileMetadata.destFileName = fullPath.substr(dirSep + 1);
+    EncryptionProvider::decryptFileKey(&fileMetadata, encMat, getRandomDev());
+  }
 
+  return outcome;
+}
@@ -42,6 +42,16 @@ public:
     IStorageClient *storageClient, EncryptionMaterial *encMat,
     std::string const& presignedUrl);
 
+  /**
+   * Fetch remote metadata of a file to download and decrypt its file key,
+   * without adding the file to the small/large file lists.
+   * @param fileMetadata metadata to fill
+   */
+  RemoteStorageRequestOutcome initDownloadFileMetadata(
+    const std::string &sourceLocation, const std::string &remoteLocation,
+    IStorageClient *storageClient, EncryptionMaterial *encMat,
+    std::string const& presignedUrl, FileMetadata &fileMetadata);
+
   /**
    * Init encryption metadata in file metadata
    */
@@ -16,10 +16,16 @@
 #include "crypto/Cryptor.hpp"
 #include "util/CompressionUtil.hpp"
 #include "util/ThreadPool.hpp"
+#include "util/TransferExecutor.hpp"
 #include "EncryptionProvider.hpp"
 #include "logger/SFLogger.hpp"
 #include "snowflake/platform.h"
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
 #ifdef _WIN32
 #include <windows.h>
 #else
@@ -64,6 +70,7 @@ Snowflake::Client::FileTransferAgent::FileTransferAgent(
   TransferConfig *transferConfig) :
   m_stmtPutGet(statement),
   m_FileMetadataInitializer(m_smallFilesMeta, m_largeFilesMeta),
+  m_urlPrefetcher(nullptr),
   m_executionResults(nullptr),
   m_storageClient(nullptr),
   m_lastRefreshTokenSec(0),
@@ -75,16 +82,25 @@ Snowflake::Client::FileTransferAgent::FileTransferAgent(
   m_fastFail(false)
 {
   _mutex_init(&m_parallelTokRenewMutex);
+  _mutex_init(&m_parallelFailedMsgMutex);
 }
 
 Snowflake::Client::FileTransferAgent::~FileTransferAgent()
 {
   reset();
   _mutex_term(&m_parallelTokRenewMutex);
+  _mutex_term(&m_parallelFailedMsgMutex);
 }
 
 void Snowflake::Client::FileTransferAgent::reset()
 {
+  // stop fetching urls before file metadata goes away
+  if (m_urlPrefetcher != nullptr)
+  {
+    delete m_urlPrefetcher;
+    m_urlPrefetcher = nullptr;
+  }
+
   if (m_executionResults != nullptr)
   {
     delete m_executionResults;
@@ -99,6 +115,7 @@ void Snowflake::Client::FileTransferAgent::reset()
 
   m_largeFilesMeta.clear();
   m_smallFilesMeta.clear();
+  m_downloadFilesMeta.clear();
 }
 
 Snowflake::Client::ITransferResult *
@@ -179,38 +196,23 @@ void Snowflake::Client::FileTransferAgent::initFileMetadata(std::string *command
   }
 
   vector<string> *sourceLocations = &response.srcLocations;
-  for (size_t i = 0; i < sourceLocations->size(); i++)
+  switch (response.command)
   {
-    switch (response.command)
-    {
-      case CommandType::UPLOAD:
+    case CommandType::UPLOAD:
+      for (size_t i = 0; i < sourceLocations->size(); i++)
+      {
         m_FileMetadataInitializer.populateSrcLocUploadMetadata(
             sourceLocations->at(i), response.threshold);
-        break;
-      case CommandType::DOWNLOAD:
-        {
-        std::string presignedUrl =
-          (m_storageClient->requirePresignedUrl() && (response.presignedUrls.size() > i)) ?
-            response.presignedUrls.at(i) : "";
-          RemoteStorageRequestOutcome outcome =
-            m_FileMetadataInitializer.populateSrcLocDownloadMetadata(
-              sourceLocations->at(i), &response.stageInfo.location,
-              m_storageClient, &response.encryptionMaterials.at(i),
-              presignedUrl);
-
-          if (outcome == TOKEN_EXPIRED)
-          {
-            CXX_LOG_DEBUG("Token expired when getting download metadata");
-            this->renewToken(command);
-            i--;
-          }
-          break;
-        }
-      default:
-        CXX_LOG_FATAL(CXX_LOG_NS, "Invalid command type");
-        throw SnowflakeTransferException(TransferError::INTERNAL_ERROR,
-                                         "Invalid command type.");
-    }
+      }
+      break;
+    case CommandType::DOWNLOAD:
+      // remote metadata is fetched on the transfer executor while files
+      // are downloading, see downloadFilesInParallel()
+      break;
+    default:
+      CXX_LOG_FATAL(CXX_LOG_NS, "Invalid command type");
+      throw SnowflakeTransferException(TransferError::INTERNAL_ERROR,
+                                       "Invalid command type.");
   }
 }
 
@@ -221,6 +223,39 @@ void Snowflake::Client::FileTransferAgent::upload(string *command)
   numFiles = (numFiles > 0) ? numFiles : 1;
   m_executionResults = new FileTransferExecutionResult(CommandType::UPLOAD, numFiles);
 
+  if (m_storageClient->requirePresignedUrl())
+  {
+    // each url is a query to server, fetch them in the background in result
+    // index order (large files then small files) while files are uploading
+    std::vector<FileMetadata *> urlFiles;
+    for (size_t i = 0; i < m_largeFilesMeta.size(); i++)
+    {
+      urlFiles.push_back(&m_largeFilesMeta[i]);
+    }
+    for (size_t i = 0; i < m_smallFilesMeta.size(); i++)
+    {
+      urlFiles.push_back(&m_smallFilesMeta[i]);
+    }
+
+    std::string urlCommand = *command;
+    m_urlPrefetcher = new PresignedUrlPrefetcher(urlFiles,
+      [this, urlCommand](FileMetadata &fileMetadata)->void
+      {
+        // statement is shared with token renewal
+        _mutex_lock(&m_parallelTokRenewMutex);
+        try
+        {
+          getPresignedUrlForUploading(fileMetadata, urlCommand);
+        }
+        catch (...)
+        {
+          _mutex_unlock(&m_parallelTokRenewMutex);
+          throw;
+        }
+        _mutex_unlock(&m_parallelTokRenewMutex);
+      });
+  }
+
   if (m_largeFilesMeta.size() > 0)
   {
     for (size_t i=0; i<m_largeFilesMeta.size(); i++)
@@ -228,9 +263,9 @@ void Snowflake::Client::FileTransferAgent::upload(string *command)
       m_largeFilesMeta[i].overWrite = response.overwrite;
       m_executionResults->SetFileMetadata(&m_largeFilesMeta[i], i);
 
-      if (m_storageClient->requirePresignedUrl())
+      if (m_urlPrefetcher != nullptr)
       {
-        getPresignedUrlForUploading(m_largeFilesMeta[i], *command);
+        m_urlPrefetcher->waitForUrl(i);
       }
       CXX_LOG_DEBUG("Putget serial large file upload, %s file", m_largeFilesMeta[i].srcFileName.c_str());
       RemoteStorageRequestOutcome outcome = uploadSingleFile(m_storageClient,
@@ -240,7 +275,18 @@ void Snowflake::Client::FileTransferAgent::upload(string *command)
       if (outcome == RemoteStorageRequestOutcome::TOKEN_EXPIRED)
       {
         CXX_LOG_DEBUG("Putget serial large file upload, %s file renewToken", m_largeFilesMeta[i].srcFileName.c_str());
-        renewToken(command);
+        // url prefetch thread may be using the statement
+        _mutex_lock(&m_parallelTokRenewMutex);
+        try
+        {
+          renewToken(command);
+        }
+        catch (...)
+        {
+          _mutex_unlock(&m_parallelTokRenewMutex);
+          throw;
+        }
+        _mutex_unlock(&m_parallelTokRenewMutex);
         i--;
       }
       else if( outcome == RemoteStorageRequestOutcome::FAILED)
@@ -259,14 +305,6 @@ void Snowflake::Client::FileTransferAgent::upload(string *command)
 
   if (m_smallFilesMeta.size() > 0)
   {
-    if (m_storageClient->requirePresignedUrl())
-    {
-      for (size_t i = 0; i < m_smallFilesMeta.size(); i++)
-      {
-        std::string localCommand = *command;
-        getPresignedUrlForUploading(m_smallFilesMeta[i], localCommand);
-      }
-    }
     uploadFilesInParallel(command);
   }
   if( m_largeFilesMeta.size() + m_smallFilesMeta.size() == 0)
@@ -279,7 +317,7 @@ void Snowflake::Client::FileTransferAgent::upload(string *command)
 
 void Snowflake::Client::FileTransferAgent::uploadFilesInParallel(std::string *command)
 {
-  Snowflake::Client::Util::ThreadPool tp((unsigned int)response.parallel);
+  Snowflake::Client::Util::TransferGroup tp((unsigned int)response.parallel);
   std::string failedTransfers;
   for (size_t i=0; i<m_smallFilesMeta.size(); i++)
   {
@@ -302,6 +340,10 @@ void Snowflake::Client::FileTransferAgent::uploadFilesInParallel(std::string *co
           CXX_LOG_DEBUG("Sequential upload, put fast fail enabled, Skipping file.");
           break;
         }
+        if (m_urlPrefetcher != nullptr)
+        {
+          m_urlPrefetcher->waitForUrl(resultIndex);
+        }
         outcome = uploadSingleFile(m_storageClient, metadata, resultIndex);
         if (outcome == RemoteStorageRequestOutcome::TOKEN_EXPIRED)
         {
@@ -347,6 +389,10 @@ void Snowflake::Client::FileTransferAgent::uploadFilesInParallel(std::string *co
           // and take it as transfer failure.
           try
           {
+            if (m_urlPrefetcher != nullptr)
+            {
+              m_urlPrefetcher->waitForUrl(resultIndex);
+            }
             outcome = uploadSingleFile(m_storageClient, metadata,
                                                        resultIndex);
             if (outcome == RemoteStorageRequestOutcome::TOKEN_EXPIRED)
@@ -377,12 +423,17 @@ void Snowflake::Client::FileTransferAgent::uploadFilesInParallel(std::string *co
           }
           break;
         } while (true);
-    });
+    }, metadata->srcFileSize > 0 ? (size_t)metadata->srcFileSize : 0);
   }
 
   // wait till all jobs have been finished
   tp.WaitAll();
   CXX_LOG_DEBUG("All threads exited, Parallel put done.");
+  if (m_urlPrefetcher != nullptr)
+  {
+    // surface failure of fetching presigned url as it was before uploading
+    m_urlPrefetcher->waitForUrl(m_largeFilesMeta.size() + m_smallFilesMeta.size() - 1);
+  }
   if(!failedTransfers.empty())
   {
     CXX_LOG_DEBUG("%s command FAILED.",command);
@@ -414,10 +465,15 @@ void Snowflake::Client::FileTransferAgent::renewToken(std::string *command)
       throw SnowflakeTransferException(TransferError::INTERNAL_ERROR,
                                        "Failed to parse response.");
     }
-    m_storageClient = StorageClientFactory::getClient(&response.stageInfo,
-                                                      (unsigned int) response.parallel,
-                                                      response.threshold,
-                                                      m_transferConfig);
+    // swap credentials in place so that other threads keep using the same
+    // client, only create a new one if the client can not do it
+    if (!m_storageClient->renewCredentials(&response.stageInfo))
+    {
+      m_storageClient = StorageClientFactory::getClient(&response.stageInfo,
+                                                        (unsigned int) response.parallel,
+                                                        response.threshold,
+                                                        m_transferConfig);
+    }
     m_lastRefreshTokenSec = now;
   }
 }
@@ -444,7 +500,11 @@ RemoteStorageRequestOutcome Snowflake::Client::FileTransferAgent::uploadSingleFi
   // calculate digest
   updateFileDigest(fileMetadata);
   CXX_LOG_TRACE("Encryption metadata init start");
-  m_FileMetadataInitializer.initEncryptionMetadata(fileMetadata);
+  // an upload interrupted by expired token is resumed with its key and iv
+  if (!client->restoreEncryptionMetadata(fileMetadata))
+  {
+    m_FileMetadataInitializer.initEncryptionMetadata(fileMetadata);
+  }
   CXX_LOG_TRACE("Encryption metadata init done");
 
   RemoteStorageRequestOutcome outcome = RemoteStorageRequestOutcome::SUCCESS;
@@ -585,8 +645,9 @@ void Snowflake::Client::FileTransferAgent::compressSourceFile(
 
 void Snowflake::Client::FileTransferAgent::download(string *command)
 {
+  size_t numFiles = response.srcLocations.size();
   m_executionResults = new FileTransferExecutionResult(CommandType::DOWNLOAD,
-    m_largeFilesMeta.size() + m_smallFilesMeta.size());
+                                                       numFiles);
 
   int ret = sf_create_directory_if_not_exists((const char *)response.localLocation);
   if (ret != 0)
@@ -596,92 +657,209 @@ void Snowflake::Client::FileTransferAgent::download(string *command)
       response.localLocation, ret);
   }
 
-  if (m_largeFilesMeta.size() > 0)
+  // each file keeps the result index of its source location, files whose
+  // remote metadata is not found are dropped from the result at the end
+  m_downloadFilesMeta.resize(numFiles);
+
+  // workaround for incident 00212627
+  // Do not use thread pool when parallel = 1
+  if ((unsigned int)response.parallel <= 1 || numFiles <= 1)
   {
-    for (size_t i=0; i<m_largeFilesMeta.size(); i++)
+    for (size_t i = 0; i < numFiles; i++)
     {
-      m_executionResults->SetFileMetadata(&m_largeFilesMeta[i], i);
-      RemoteStorageRequestOutcome outcome = downloadSingleFile(m_storageClient,
-                                                               &m_largeFilesMeta[i], i);
+      if (initDownloadFileMetadata(i, command))
+      {
+        downloadFile(i, command);
+      }
+    }
+  }
+  else
+  {
+    downloadFilesInParallel(command);
+  }
 
-      if (outcome == RemoteStorageRequestOutcome::TOKEN_EXPIRED)
+  m_executionResults->removeEntriesWithoutMetadata();
+}
+
+bool Snowflake::Client::FileTransferAgent::initDownloadFileMetadata(
+  size_t index, std::string *command)
+{
+  FileMetadata *metadata = &m_downloadFilesMeta[index];
+  while (true)
+  {
+    // response is parsed again when another thread renews the token
+    _mutex_lock(&m_parallelTokRenewMutex);
+    std::string sourceLocation = response.srcLocations.at(index);
+    std::string remoteLocation = response.stageInfo.location;
+    EncryptionMaterial encMat = response.encryptionMaterials.at(index);
+    std::string presignedUrl =
+      (m_storageClient->requirePresignedUrl() &&
+       response.presignedUrls.size() > index) ?
+        response.presignedUrls.at(index) : "";
+    IStorageClient *client = m_storageClient;
+    _mutex_unlock(&m_parallelTokRenewMutex);
+
+    RemoteStorageRequestOutcome outcome =
+      m_FileMetadataInitializer.initDownloadFileMetadata(
+        sourceLocation, remoteLocation, client, &encMat, presignedUrl,
+        *metadata);
+
+    if (outcome == RemoteStorageRequestOutcome::TOKEN_EXPIRED)
+    {
+      CXX_LOG_DEBUG("Token expired when getting download metadata");
+      _mutex_lock(&m_parallelTokRenewMutex);
+      try
       {
-        renewToken(command);
-        i--;
+        this->renewToken(command);
       }
+      catch (...)
+      {
+        _mutex_unlock(&m_parallelTokRenewMutex);
+        throw;
+      }
+      _mutex_unlock(&m_parallelTokRenewMutex);
+      continue;
     }
+
+    if (outcome != RemoteStorageRequestOutcome::SUCCESS)
+    {
+      return false;
+    }
+    m_executionResults->SetFileMetadata(metadata, index);
+    return true;
   }
+}
 
-  if (m_smallFilesMeta.size() > 0)
+void Snowflake::Client::FileTransferAgent::downloadFile(size_t index,
+                                                        std::string *command)
+{
+  FileMetadata *metadata = &m_downloadFilesMeta[index];
+  while (downloadSingleFile(m_storageClient, metadata, index) ==
+         RemoteStorageRequestOutcome::TOKEN_EXPIRED)
   {
-    downloadFilesInParallel(command);
+    CXX_LOG_DEBUG("Token expired, Renewing token.");
+    _mutex_lock(&m_parallelTokRenewMutex);
+    try
+    {
+      this->renewToken(command);
+    }
+    catch (...)
+    {
+      _mutex_unlock(&m_parallelTokRenewMutex);
+      throw;
+    }
+    _mutex_unlock(&m_parallelTokRenewMutex);
   }
 }
 
 void Snowflake::Client::FileTransferAgent::downloadFilesInParallel(std::string *command)
 {
-  Snowflake::Client::Util::ThreadPool tp((unsigned int)response.parallel);
-  for (size_t i=0; i<m_smallFilesMeta.size(); i++)
+  size_t numFiles = m_downloadFilesMeta.size();
+
+  // guards the members below, shared with the lookup jobs
+  std::mutex lookupMutex;
+  std::condition_variable lookupDone;
+  std::deque<size_t> largeFiles;
+  size_t nextLookup = (std::min)((size_t)response.parallel, numFiles);
+  size_t doneLookups = 0;
+  std::exception_ptr lookupError;
+  std::function<void(size_t)> lookup;
+
+  // declared last so that jobs finish before the state above is destroyed
+  Snowflake::Client::Util::TransferGroup tp((unsigned int)response.parallel);
+
+  // Only a few lookups are queued at a time. Each one queues the download of
+  // its file before the next lookup, so small files start transferring with
+  // the first metadata instead of after all of it. Large files are
+  // downloaded in sequence on this thread as their metadata arrives.
+  lookup = [&, command](size_t index)->void
   {
-    size_t resultIndex = i + m_largeFilesMeta.size();
-    FileMetadata * metadata = &m_smallFilesMeta[i];
-    m_executionResults->SetFileMetadata(&m_smallFilesMeta[i], resultIndex);
+    bool found = false;
+    std::exception_ptr error;
+    try
+    {
+      found = initDownloadFileMetadata(index, command);
+    }
+    catch (...)
+    {
+      error = std::current_exception();
+    }
 
-    // workaround for incident 00212627
-    // Do not use thread pool when parallel = 1
-    if ((unsigned int)response.parallel <= 1)
+    FileMetadata *metadata = &m_downloadFilesMeta[index];
+    if (found && metadata->srcFileSize <= DOWNLOAD_DATA_SIZE_THRESHOLD)
     {
-      do
-      {
-        RemoteStorageRequestOutcome outcome = downloadSingleFile(m_storageClient, metadata,
-          resultIndex);
-        if (outcome == RemoteStorageRequestOutcome::TOKEN_EXPIRED)
+      tp.AddJob([index, command, this]()->void {
+        // SNOW-218025: Upload and download is not exception safe, catch exception
+        // and take it as transfer failure.
+        try
         {
-          _mutex_lock(&m_parallelTokRenewMutex);
-          this->renewToken(command);
-          _mutex_unlock(&m_parallelTokRenewMutex);
+          downloadFile(index, command);
         }
-        else
+        catch (...)
         {
-          break;
+          m_executionResults->SetTransferOutCome(
+            RemoteStorageRequestOutcome::FAILED, index);
         }
-      } while (true);
+      }, metadata->srcFileSize > 0 ? (size_t)metadata->srcFileSize : 0);
+    }
 
-      continue;
+    size_t next = numFiles;
+    {
+      std::lock_guard<std::mutex> guard(lookupMutex);
+      if (error && !lookupError)
+      {
+        lookupError = error;
+      }
+      if (found && metadata->srcFileSize > DOWNLOAD_DATA_SIZE_THRESHOLD)
+      {
+        largeFiles.push_back(index);
+      }
+      if (nextLookup < numFiles)
+      {
+        next = nextLookup++;
+      }
+      doneLookups++;
     }
+    lookupDone.notify_one();
 
-    tp.AddJob([metadata, resultIndex, command, this]()->void {
-        do
-        {
-          // SNOW-218025: Upload and download is not exception safe, catch exception
-          // and take it as transfer failure.
-          try
-          {
-            RemoteStorageRequestOutcome outcome = downloadSingleFile(m_storageClient, metadata,
-                                                                   resultIndex);
-            if (outcome == RemoteStorageRequestOutcome::TOKEN_EXPIRED)
-            {
-              CXX_LOG_DEBUG("Token expired, Renewing token.")
-              _mutex_lock(&m_parallelTokRenewMutex);
-              this->renewToken(command);
-              _mutex_unlock(&m_parallelTokRenewMutex);
+    if (next < numFiles)
+    {
+      tp.AddJob([&lookup, next]()->void { lookup(next); });
+    }
+  };
 
-              continue;
-            }
-          }
-          catch (...)
-          {
-            m_executionResults->SetTransferOutCome(
-              RemoteStorageRequestOutcome::FAILED, resultIndex);
-          }
+  CXX_LOG_DEBUG("Fetching remote metadata of %ld files with %d threads.",
+                (long)numFiles, response.parallel);
+  for (size_t i = 0; i < nextLookup; i++)
+  {
+    tp.AddJob([&lookup, i]()->void { lookup(i); });
+  }
 
-          break;
-        } while (true);
+  std::unique_lock<std::mutex> guard(lookupMutex);
+  while (true)
+  {
+    lookupDone.wait(guard, [&]()->bool {
+      return !largeFiles.empty() || doneLookups == numFiles;
     });
+    if (largeFiles.empty())
+    {
+      break;
+    }
+    size_t index = largeFiles.front();
+    largeFiles.pop_front();
+    guard.unlock();
+    downloadFile(index, command);
+    guard.lock();
   }
+  guard.unlock();
 
   // wait till all jobs have been finished
   tp.WaitAll();
+
+  if (lookupError)
+  {
+    std::rethrow_exception(lookupError);
+  }
 }
 
 RemoteStorageRequestOutcome Snowflake::Client::FileTransferAgent::downloadSingleFile(
@@ -692,6 +870,16 @@ RemoteStorageRequestOutcome Snowflake::Client::FileTransferAgent::downloadSingle
    fileMetadata->destPath = std::string(response.localLocation) + PATH_SEP +
     fileMetadata->destFileName;
 
+  // large files are written part by part straight into destination if the
+  // client supports it, otherwise downloaded through the decrypting stream
+  if (client->supportsDownloadToFile() &&
+      fileMetadata->srcFileSize > DOWNLOAD_DATA_SIZE_THRESHOLD)
+  {
+    RemoteStorageRequestOutcome outcome = client->downloadToFile(fileMetadata);
+    m_executionResults->SetTransferOutCome(outcome, resultIndex);
+    return outcome;
+  }
+
   std::basic_fstream<char> dstFile(fileMetadata->destPath.c_str(),
                                 std::ios_base::out | std::ios_base::binary );
   if( ! dstFile.is_open())
@@ -14,6 +14,7 @@
 #include "FileTransferExecutionResult.hpp"
 #include "FileMetadata.hpp"
 #include "FileMetadataInitializer.hpp"
+#include "PresignedUrlPrefetcher.hpp"
 #include "snowflake/platform.h"
 #include <algorithm>
 #ifdef _WIN32
@@ -197,8 +198,8 @@ private:
   void initFileMetadata(std::string* command);
 
   /**
-   * Upload large files in sequence, upload small files in parallel in
-   * a thread pool object
+   * Upload large files in sequence, upload small files in parallel on
+   * the process wide transfer executor
    */
   void upload(std::string *command);
 
@@ -225,13 +226,30 @@ private:
   void uploadFilesInParallel(std::string *command);
 
   /**
-   * Download large files in sequence, download small files in parallel in
-   * a thread pool object
+   * Download large files in sequence, download small files in parallel on
+   * the process wide transfer executor
    */
   void download(std::string *command);
 
+  /**
+   * Fetch remote metadata of files on the process wide transfer executor and
+   * start downloading each file as soon as its metadata is known.
+   */
   void downloadFilesInParallel(std::string *command);
 
+  /**
+   * Fetch remote metadata of the file of a source location, renewing token
+   * if expired.
+   * @param index index of the source location, also its result index
+   * @return false if the remote file metadata could not be fetched
+   */
+  bool initDownloadFileMetadata(size_t index, std::string *command);
+
+  /**
+   * Download the file of a source location, renewing token if expired.
+   */
+  void downloadFile(size_t index, std::string *command);
+
   /**
    * Download single file.
    */
@@ -277,6 +295,9 @@ private:
   /// Files that will be uploaded in parallel
   std::vector<FileMetadata> m_smallFilesMeta;
 
+  /// Files to download, one per source location
+  std::vector<FileMetadata> m_downloadFilesMeta;
+
   /// vectors to store newly created execution result
   FileTransferExecutionResult *m_executionResults;
 
@@ -286,6 +307,9 @@ private:
   /// used to initialize file metadata
   FileMetadataInitializer m_FileMetadataInitializer;
 
+  /// fetch presigned urls ahead of uploads, for storage requires them
+  PresignedUrlPrefetcher * m_urlPrefetcher;
+
   /// mutex to prevent from multiple thread renewing token same time
   SF_MUTEX_HANDLE m_parallelTokRenewMutex;
 
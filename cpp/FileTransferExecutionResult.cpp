@@ -54,7 +54,7 @@ FileTransferExecutionResult::FileTransferExecutionResult(
   m_resultEntryNum(resultEntryNum),
   m_currentIndex(-1)
 {
-  m_fileMetadatas = new FileMetadata*[resultEntryNum];
+  m_fileMetadatas = new FileMetadata*[resultEntryNum]();
   m_outcomes = new RemoteStorageRequestOutcome[resultEntryNum];
 }
 
@@ -64,6 +64,21 @@ FileTransferExecutionResult::~FileTransferExecutionResult()
   delete[] m_outcomes;
 }
 
+void FileTransferExecutionResult::removeEntriesWithoutMetadata()
+{
+  size_t kept = 0;
+  for (size_t i = 0; i < m_resultEntryNum; i++)
+  {
+    if (m_fileMetadatas[i] != nullptr)
+    {
+      m_fileMetadatas[kept] = m_fileMetadatas[i];
+      m_outcomes[kept] = m_outcomes[i];
+      kept++;
+    }
+  }
+  m_resultEntryNum = kept;
+}
+
 bool FileTransferExecutionResult::next()
 {
   m_currentIndex ++;
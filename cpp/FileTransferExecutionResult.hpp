@@ -40,6 +40,12 @@ public:
     m_fileMetadatas[index] = fileMetadata;
   }
 
+  /**
+   * Drop entries that were given no file metadata, e.g. remote files whose
+   * metadata could not be fetched. Keeps the order of other entries.
+   */
+  void removeEntriesWithoutMetadata();
+
   bool next();
 
   size_t getResultSize();
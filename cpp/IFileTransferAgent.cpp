@@ -4,6 +4,8 @@
 
 #include "snowflake/IFileTransferAgent.hpp"
 #include "FileTransferAgent.hpp"
+#include "StorageClientFactory.hpp"
+#include "util/TransferExecutor.hpp"
 #include "logger/SFLogger.hpp"
 #include "snowflake/version.h"
 
@@ -22,3 +24,16 @@ void Snowflake::Client::IFileTransferAgent::injectExternalLogger(
   CXX_LOG_INFO("External logger injected. libsnowflakeclient version: %s",
     SF_API_VERSION);
 }
+
+void Snowflake::Client::IFileTransferAgent::releaseCachedStorageClients()
+{
+  Snowflake::Client::StorageClientFactory::releaseCachedClients();
+  Snowflake::Client::Util::TransferExecutor::shutdown();
+}
+
+void Snowflake::Client::IFileTransferAgent::setTransferExecutorLimits(
+  unsigned int maxThreads, size_t maxInFlightBytes)
+{
+  Snowflake::Client::Util::TransferExecutor::configure(maxThreads,
+                                                      maxInFlightBytes);
+}
@@ -50,6 +50,44 @@ public:
     return false;
   }
 
+  /**
+  * @return Whether this client can download large files straight into the
+  * destination file with downloadToFile(), decrypting and writing parts in
+  * any order. True for S3.
+  */
+  virtual bool supportsDownloadToFile()
+  {
+    return false;
+  }
+
+  /**
+   * Download remote file into fileMetadata->destPath and decrypt it.
+   * Only called when supportsDownloadToFile() returns true.
+   */
+  virtual RemoteStorageRequestOutcome downloadToFile(FileMetadata *fileMetadata)
+  {
+    return RemoteStorageRequestOutcome::FAILED;
+  }
+
+  /**
+   * Use credentials of a renewed stage info without creating a new client.
+   * @return false if not supported, caller should create a new client.
+   */
+  virtual bool renewCredentials(StageInfo *stageInfo)
+  {
+    return false;
+  }
+
+  /**
+   * Restore encryption metadata of an interrupted upload of the same content,
+   * so that the upload can be resumed instead of started over.
+   * @return false if there is no such upload, caller creates a new key.
+   */
+  virtual bool restoreEncryptionMetadata(FileMetadata *fileMetadata)
+  {
+    return false;
+  }
+
   virtual void setMaxRetries(unsigned int maxRetries) {};
 };
 }
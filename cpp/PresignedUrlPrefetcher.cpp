@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#include "PresignedUrlPrefetcher.hpp"
+#include "logger/SFLogger.hpp"
+#include "snowflake/SnowflakeTransferException.hpp"
+
+Snowflake::Client::PresignedUrlPrefetcher::PresignedUrlPrefetcher(
+  std::vector<FileMetadata *> &files, UrlFetcher fetcher) :
+  m_files(files),
+  m_fetcher(fetcher),
+  m_numReady(0),
+  m_done(false),
+  m_shutdown(false)
+{
+  _critical_section_init(&m_mutex);
+  _cond_init(&m_urlReadyCv);
+  _thread_init(&m_thread, fetchThread, (void *)this);
+}
+
+Snowflake::Client::PresignedUrlPrefetcher::~PresignedUrlPrefetcher()
+{
+  _critical_section_lock(&m_mutex);
+  m_shutdown = true;
+  _critical_section_unlock(&m_mutex);
+  _thread_join(m_thread);
+
+  _cond_term(&m_urlReadyCv);
+  _critical_section_term(&m_mutex);
+}
+
+void * Snowflake::Client::PresignedUrlPrefetcher::fetchThread(void *arg)
+{
+  static_cast<PresignedUrlPrefetcher *>(arg)->fetchUrls();
+  return nullptr;
+}
+
+void Snowflake::Client::PresignedUrlPrefetcher::fetchUrls()
+{
+  std::exception_ptr error;
+  for (size_t i = 0; i < m_files.size(); i++)
+  {
+    _critical_section_lock(&m_mutex);
+    bool shutdown = m_shutdown;
+    _critical_section_unlock(&m_mutex);
+    if (shutdown)
+    {
+      break;
+    }
+
+    try
+    {
+      m_fetcher(*m_files[i]);
+    }
+    catch (...)
+    {
+      CXX_LOG_ERROR("Fetching presigned url for %s failed.",
+                    m_files[i]->destFileName.c_str());
+      error = std::current_exception();
+      break;
+    }
+
+    _critical_section_lock(&m_mutex);
+    m_numReady++;
+    _cond_broadcast(&m_urlReadyCv);
+    _critical_section_unlock(&m_mutex);
+  }
+
+  _critical_section_lock(&m_mutex);
+  m_error = error;
+  m_done = true;
+  _cond_broadcast(&m_urlReadyCv);
+  _critical_section_unlock(&m_mutex);
+}
+
+void Snowflake::Client::PresignedUrlPrefetcher::waitForUrl(size_t index)
+{
+  _critical_section_lock(&m_mutex);
+  while (m_numReady <= index && !m_done)
+  {
+    _cond_wait(&m_urlReadyCv, &m_mutex);
+  }
+  bool ready = m_numReady > index;
+  std::exception_ptr error = m_error;
+  _critical_section_unlock(&m_mutex);
+
+  if (!ready)
+  {
+    if (error)
+    {
+      std::rethrow_exception(error);
+    }
+    throw SnowflakeTransferException(TransferError::INTERNAL_ERROR,
+                                     "Failed to get presigned url.");
+  }
+}
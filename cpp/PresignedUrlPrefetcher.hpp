@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#ifndef SNOWFLAKECLIENT_PRESIGNEDURLPREFETCHER_HPP
+#define SNOWFLAKECLIENT_PRESIGNEDURLPREFETCHER_HPP
+
+#include <exception>
+#include <functional>
+#include <vector>
+#include "FileMetadata.hpp"
+#include "snowflake/platform.h"
+
+namespace Snowflake
+{
+namespace Client
+{
+
+/**
+ * Fetch presigned urls of files to be uploaded on a background thread,
+ * ahead of the uploads, so that the server round trip of each url overlaps
+ * with uploading the files before it.
+ *
+ * Urls are fetched one at a time in file order since they are obtained
+ * through the same statement.
+ */
+class PresignedUrlPrefetcher
+{
+public:
+  typedef std::function<void(FileMetadata &)> UrlFetcher;
+
+  /**
+   * @param files files to fetch presigned url for, fetcher fills in
+   *        presignedUrl of each file. (NOT OWN)
+   * @param fetcher function to fetch presigned url of one file
+   */
+  PresignedUrlPrefetcher(std::vector<FileMetadata *> &files,
+                         UrlFetcher fetcher);
+
+  /**
+   * Stop fetching remaining urls and wait for background thread to exit.
+   */
+  ~PresignedUrlPrefetcher();
+
+  /**
+   * Block until presigned url of files[index] has been fetched.
+   * Rethrows the exception thrown by fetcher if fetching url failed.
+   */
+  void waitForUrl(size_t index);
+
+private:
+  static void * fetchThread(void * arg);
+
+  void fetchUrls();
+
+  std::vector<FileMetadata *> m_files;
+
+  UrlFetcher m_fetcher;
+
+  SF_THREAD_HANDLE m_thread;
+
+  SF_CRITICAL_SECTION_HANDLE m_mutex;
+
+  /// signaled when one more url is fetched or fetching stops
+  SF_CONDITION_HANDLE m_urlReadyCv;
+
+  /// number of files at the beginning whose url is ready
+  size_t m_numReady;
+
+  /// true if background thread has stopped fetching
+  bool m_done;
+
+  /// true if prefetcher is being destroyed
+  bool m_shutdown;
+
+  /// exception thrown by fetcher, rethrown to the thread waiting for url
+  std::exception_ptr m_error;
+};
+
+}
+}
+
+#endif //SNOWFLAKECLIENT_PRESIGNEDURLPREFETCHER_HPP
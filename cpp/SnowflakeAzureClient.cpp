@@ -4,6 +4,7 @@
 
 #include "SnowflakeAzureClient.hpp"
 #include "FileMetadataInitializer.hpp"
+#include "FileTransferAgent.hpp"
 #include "snowflake/client.h"
 #include "util/Base64.hpp"
 #include "util/ByteArrayStreamBuf.hpp"
@@ -16,11 +17,13 @@
 #include "storage_account.h"
 #include "blob/blob_client.h"
 #include <algorithm>
+#include <cstdio>
 #include <iostream>
 #include <fstream>
 #include <string>
 
 #define CONTENT_TYPE_OCTET_STREAM "application/octet-stream"
+#define AZURE_AUTHENTICATION_FAILED "AuthenticationFailed"
 
 namespace Snowflake
 {
@@ -34,6 +37,7 @@ SnowflakeAzureClient::SnowflakeAzureClient(StageInfo *stageInfo,
                                            TransferConfig *transferConfig) :
   m_stageInfo(stageInfo),
   m_threadPool(nullptr),
+  m_maxRetries(0),
   m_uploadThreshold(uploadThreshold),
   m_parallel(std::min(parallel, std::thread::hardware_concurrency()))
 {
@@ -69,6 +73,7 @@ SnowflakeAzureClient::SnowflakeAzureClient(StageInfo *stageInfo,
   std::shared_ptr<azure::storage_lite::storage_account> account = std::make_shared<azure::storage_lite::storage_account>(account_name, cred, true, endpoint);
   auto bc = std::make_shared<azure::storage_lite::blob_client>(account, m_parallel, caBundleFile);
   m_blobclient= new azure::storage_lite::blob_client_wrapper(bc);
+  m_asyncBlobClient = bc;
 
   CXX_LOG_TRACE("Successfully created Azure client. End of constructor.");
 }
@@ -136,7 +141,37 @@ RemoteStorageRequestOutcome SnowflakeAzureClient::doSingleUpload(FileMetadata *f
 
 void Snowflake::Client::SnowflakeAzureClient::uploadParts(MultiUploadCtx_a * uploadCtx)
 {
-	return;
+  // rewind buffer, it has been consumed if this is a retry
+  uploadCtx->buf->updateSize(uploadCtx->buf->getSize());
+  std::istream partStream(uploadCtx->buf);
+
+  auto outcome = m_asyncBlobClient->upload_block_from_stream(
+    uploadCtx->m_container, uploadCtx->m_blob, uploadCtx->m_blockId,
+    partStream).get();
+
+  if (outcome.success())
+  {
+    uploadCtx->m_outcome = RemoteStorageRequestOutcome::SUCCESS;
+    CXX_LOG_INFO("Put block request succeed. part number %d, block id %s",
+                 uploadCtx->m_partNumber, uploadCtx->m_blockId.c_str());
+  }
+  else
+  {
+    uploadCtx->m_outcome = handleError(outcome.error());
+  }
+}
+
+RemoteStorageRequestOutcome SnowflakeAzureClient::handleError(
+  const azure::storage_lite::storage_error &error)
+{
+  CXX_LOG_ERROR("Azure request failed, status: %s, error code: %s, message: %s",
+                error.code.c_str(), error.code_name.c_str(),
+                error.message.c_str());
+  if (error.code == "403" && error.code_name == AZURE_AUTHENTICATION_FAILED)
+  {
+    return RemoteStorageRequestOutcome::TOKEN_EXPIRED;
+  }
+  return RemoteStorageRequestOutcome::FAILED;
 }
 
 RemoteStorageRequestOutcome SnowflakeAzureClient::doMultiPartUpload(FileMetadata *fileMetadata,
@@ -146,33 +181,98 @@ RemoteStorageRequestOutcome SnowflakeAzureClient::doMultiPartUpload(FileMetadata
                fileMetadata->srcFileToUpload.c_str());
   std::string containerName = m_stageInfo->location;
 
-    //Remove the trailing '/' in containerName
-    containerName.pop_back();
-
-    std::string blobName = fileMetadata->destFileName;
-
-    //metadata azure uses.
-    std::vector<std::pair<std::string, std::string>> userMetadata;
-    addUserMetadata(&userMetadata, fileMetadata);
-    //Calculate the length of the stream.
-    unsigned int len = (unsigned int) ((fileMetadata->encryptionMetadata.cipherStreamSize > 0) ? fileMetadata->encryptionMetadata.cipherStreamSize: fileMetadata->srcFileToUploadSize) ;
-    if(! fileMetadata->overWrite ) {
-        //Azure does not provide to SHA256 or MD5 or checksum check of a file to check if it already exists.
-        bool exists = m_blobclient->blob_exists(containerName, blobName);
-        if (exists) {
-          CXX_LOG_DEBUG("File already exists skipping the file upload %s",
-                        fileMetadata->srcFileToUpload.c_str());
-            return RemoteStorageRequestOutcome::SKIP_UPLOAD_FILE;
-        }
+  //Remove the trailing '/' in containerName
+  containerName.pop_back();
+
+  std::string blobName = fileMetadata->destFileName;
+
+  //metadata azure uses.
+  std::vector<std::pair<std::string, std::string>> userMetadata;
+  addUserMetadata(&userMetadata, fileMetadata);
+  if(! fileMetadata->overWrite ) {
+    //Azure does not provide to SHA256 or MD5 or checksum check of a file to check if it already exists.
+    bool exists = m_blobclient->blob_exists(containerName, blobName);
+    if (exists) {
+      CXX_LOG_DEBUG("File already exists skipping the file upload %s",
+                    fileMetadata->srcFileToUpload.c_str());
+      return RemoteStorageRequestOutcome::SKIP_UPLOAD_FILE;
     }
-    m_blobclient->multipart_upload_block_blob_from_stream(containerName, blobName, *dataStream, userMetadata, len);
-    if (errno != 0)
+  }
+
+  if (m_threadPool == nullptr)
+  {
+    m_threadPool = new Util::ThreadPool(m_parallel);
+  }
+
+  Util::StreamSplitter splitter(dataStream, m_parallel, m_uploadThreshold);
+  unsigned int totalParts = splitter.getTotalParts(
+    fileMetadata->encryptionMetadata.cipherStreamSize);
+  CXX_LOG_INFO("Total file size: %d, split into %d blocks.",
+              fileMetadata->encryptionMetadata.cipherStreamSize, totalParts);
+
+  std::vector<MultiUploadCtx_a> uploadParts;
+  uploadParts.reserve(totalParts);
+  for (unsigned int i = 0; i < totalParts; i++)
+  {
+    // block ids of a blob must all have the same length
+    char blockIdRaw[16];
+    sb_sprintf(blockIdRaw, sizeof(blockIdRaw), "%08u", i);
+    char blockId[32] = {0};
+    Util::Base64::encode(blockIdRaw, 8, blockId);
+    uploadParts.emplace_back(containerName, blobName, i,
+      std::string(blockId, Util::Base64::encodedLength(8)));
+  }
+
+  for (unsigned int i = 0; i < totalParts; i++)
+  {
+    m_threadPool->AddJob([&splitter, this, &uploadParts]()->void
+                         {
+                           int tid = m_threadPool->GetThreadIdx();
+                           int partId;
+                           Util::ByteArrayStreamBuf * buf = splitter.FillAndGetBuf(tid, partId);
+                           MultiUploadCtx_a &ctx = uploadParts[partId];
+                           ctx.buf = buf;
+
+                           char retryPartBuflog[200];
+                           sprintf(retryPartBuflog, "Retrying block %d threadID=%d.", partId, tid);
+                           RetryContext partRetryCtx(retryPartBuflog, m_maxRetries);
+                           do
+                           {
+                             //Sleeps only when its a retry
+                             partRetryCtx.waitForNextRetry();
+                             this->uploadParts(&ctx);
+                           } while(partRetryCtx.isRetryable(ctx.m_outcome));
+                         });
+  }
+
+  m_threadPool->WaitAll();
+
+  // uncommitted blocks of a failed upload are garbage collected by azure
+  std::vector<azure::storage_lite::put_block_list_request_base::block_item> blockList;
+  for (unsigned int i = 0; i < totalParts; i++)
+  {
+    if (uploadParts[i].m_outcome != RemoteStorageRequestOutcome::SUCCESS)
     {
-      CXX_LOG_ERROR("%s file upload failed, errno = %d.", fileMetadata->srcFileToUpload.c_str(), errno);
-        return RemoteStorageRequestOutcome::FAILED;
+      CXX_LOG_ERROR("%s file upload failed, block %d not uploaded.",
+                    fileMetadata->srcFileToUpload.c_str(), i);
+      return uploadParts[i].m_outcome;
     }
-    CXX_LOG_DEBUG("%s file upload success.", fileMetadata->srcFileToUpload.c_str());
-    return RemoteStorageRequestOutcome::SUCCESS;
+    azure::storage_lite::put_block_list_request_base::block_item item;
+    item.id = uploadParts[i].m_blockId;
+    item.type = azure::storage_lite::put_block_list_request_base::block_type::uncommitted;
+    blockList.push_back(item);
+  }
+
+  auto outcome = m_asyncBlobClient->put_block_list(containerName, blobName,
+                                                   blockList, userMetadata).get();
+  if (!outcome.success())
+  {
+    CXX_LOG_ERROR("%s file upload failed, put block list failed.",
+                  fileMetadata->srcFileToUpload.c_str());
+    return handleError(outcome.error());
+  }
+  CXX_LOG_DEBUG("%s file upload success.", fileMetadata->srcFileToUpload.c_str());
+  return RemoteStorageRequestOutcome::SUCCESS;
 }
 
 std::string buildEncryptionMetadataJSON(std::string iv64, std::string enkek64)
@@ -227,57 +327,60 @@ RemoteStorageRequestOutcome SnowflakeAzureClient::doMultiPartDownload(
         m_threadPool = new Util::ThreadPool(m_parallel);
     }
 
-    //To fetch size of file.
-    auto blobprop = m_blobclient->get_blob_property(cont, blob);
-    std::string origEtag = blobprop.etag ;
-    fileMetadata->srcFileSize = (long)blobprop.size;
-    unsigned int partNum = (unsigned int)(fileMetadata->srcFileSize / DOWNLOAD_DATA_SIZE_THRESHOLD) + 1;
+    // srcFileSize has been filled by GetRemoteFileMetadata
+    unsigned int partNum = (unsigned int)((fileMetadata->srcFileSize +
+      DOWNLOAD_DATA_SIZE_THRESHOLD - 1) / DOWNLOAD_DATA_SIZE_THRESHOLD);
 
     Util::StreamAppender appender(dataStream, partNum, m_parallel, DOWNLOAD_DATA_SIZE_THRESHOLD);
-    std::vector<MultiDownloadCtx_a> downloadParts;
+    std::vector<MultiDownloadCtx_a> downloadParts(partNum);
     for (unsigned int i = 0; i < partNum; i++)
     {
-        downloadParts.emplace_back();
-        downloadParts.back().m_partNumber = i;
-        downloadParts.back().startbyte = i * DOWNLOAD_DATA_SIZE_THRESHOLD ;
+        downloadParts[i].m_partNumber = i;
+        downloadParts[i].startbyte = (unsigned long long)i * DOWNLOAD_DATA_SIZE_THRESHOLD;
+        downloadParts[i].m_outcome = RemoteStorageRequestOutcome::FAILED;
     }
 
-    for (int i = 0; i < downloadParts.size(); i++)
+    for (unsigned int i = 0; i < partNum; i++)
     {
         MultiDownloadCtx_a &ctx = downloadParts[i];
 
         m_threadPool->AddJob([&]()-> void {
 
-            int partSize = ctx.m_partNumber == partNum - 1 ?
-                           (int)(fileMetadata->srcFileSize -
-                                 ctx.m_partNumber * DOWNLOAD_DATA_SIZE_THRESHOLD)
-                                                           : DOWNLOAD_DATA_SIZE_THRESHOLD;
-            Util::ByteArrayStreamBuf * buf = appender.GetBuffer(
-                    m_threadPool->GetThreadIdx());
+            long partSize = (long)std::min<long long>(DOWNLOAD_DATA_SIZE_THRESHOLD,
+              fileMetadata->srcFileSize - ctx.startbyte);
+            int tid = m_threadPool->GetThreadIdx();
+            ctx.buf = appender.GetBuffer(tid);
 
-            CXX_LOG_DEBUG("Start downloading part %d, Start Byte: %d, part size: %d",
-                          ctx.m_partNumber, ctx.startbyte,
-                          partSize);
-            std::shared_ptr <std::stringstream> chunkbuff = std::make_shared<std::stringstream>();
+            CXX_LOG_DEBUG("Start downloading part %d, Start Byte: %llu, part size: %ld",
+                          ctx.m_partNumber, ctx.startbyte, partSize);
 
-            m_blobclient->get_chunk(cont, blob, ctx.startbyte, partSize, origEtag, chunkbuff );
-
-            if ( ! errno)
+            char retryLog[200];
+            sprintf(retryLog, "Retrying download part %d.", ctx.m_partNumber);
+            RetryContext partRetryCtx(retryLog, m_maxRetries);
+            do
+            {
+                partRetryCtx.waitForNextRetry();
+                // range is written straight into the part buffer
+                ctx.buf->updateSize(partSize);
+                std::ostream partStream(ctx.buf);
+                auto outcome = m_asyncBlobClient->download_blob_to_stream(
+                  cont, blob, ctx.startbyte, partSize, partStream).get();
+                ctx.m_outcome = outcome.success() ?
+                  RemoteStorageRequestOutcome::SUCCESS :
+                  handleError(outcome.error());
+            } while (partRetryCtx.isRetryable(ctx.m_outcome));
+
+            if (ctx.m_outcome == RemoteStorageRequestOutcome::SUCCESS)
             {
-                chunkbuff->read(buf->getDataBuffer(), chunkbuff->str().size());
-                buf->updateSize(partSize);
-                CXX_LOG_DEBUG("Download part %d succeed, download size: %d",
+                CXX_LOG_DEBUG("Download part %d succeed, download size: %ld",
                               ctx.m_partNumber, partSize);
-                ctx.m_outcome = RemoteStorageRequestOutcome::SUCCESS;
-                appender.WritePartToOutputStream(m_threadPool->GetThreadIdx(),
-                                                 ctx.m_partNumber);
-                chunkbuff->str(std::string());
+                appender.WritePartToOutputStream(tid, ctx.m_partNumber);
             }
             else
             {
-                CXX_LOG_DEBUG("Download part %d FAILED, download size: %d",
+                CXX_LOG_DEBUG("Download part %d FAILED, download size: %ld",
                               ctx.m_partNumber, partSize);
-                ctx.m_outcome = RemoteStorageRequestOutcome::FAILED;
+                appender.SkipPart(ctx.m_partNumber);
             }
         });
     }
@@ -305,13 +408,13 @@ RemoteStorageRequestOutcome SnowflakeAzureClient::doSingleDownload(
   unsigned long dirSep = (unsigned long)fileMetadata->srcFileName.find_last_of('/');
   std::string blob = fileMetadata->srcFileName.substr(dirSep + 1);
   std::string cont = fileMetadata->srcFileName.substr(0,dirSep);
-  unsigned long long offset=0;
-  m_blobclient->download_blob_to_stream(cont, blob, offset, fileMetadata->srcFileSize, *dataStream);
+  auto outcome = m_asyncBlobClient->download_blob_to_stream(
+    cont, blob, 0, fileMetadata->srcFileSize, *dataStream).get();
   dataStream->flush();
-  if(errno == 0)
+  if (outcome.success())
     return RemoteStorageRequestOutcome::SUCCESS;
 
-  return RemoteStorageRequestOutcome ::FAILED;
+  return handleError(outcome.error());
 }
 
 RemoteStorageRequestOutcome SnowflakeAzureClient::GetRemoteFileMetadata(
@@ -35,20 +35,34 @@ namespace Client
 
 struct MultiUploadCtx_a
 {
-  MultiUploadCtx_a(std::string &uploadId,
+  MultiUploadCtx_a(const std::string &container,
+    const std::string &blob,
     unsigned int partNumber,
-    std::string &key,
-    std::string &bucket)
+    const std::string &blockId) :
+    m_container(container),
+    m_blob(blob),
+    m_partNumber(partNumber),
+    m_blockId(blockId),
+    buf(nullptr),
+    m_outcome(RemoteStorageRequestOutcome::FAILED)
   {
-
   }
 
-  /// in memory buffer used to store current part data
-  Util::ByteArrayStreamBuf *buf;
+  /// container name
+  std::string m_container;
+
+  /// blob name
+  std::string m_blob;
 
   /// part number
   unsigned int m_partNumber;
 
+  /// base64 encoded block id, same length for all blocks of a blob
+  std::string m_blockId;
+
+  /// in memory buffer used to store current part data
+  Util::ByteArrayStreamBuf *buf;
+
   /// upload outcome
   RemoteStorageRequestOutcome m_outcome;
 };
@@ -101,6 +115,11 @@ public:
   RemoteStorageRequestOutcome GetRemoteFileMetadata(
     std::string * filePathFull, FileMetadata *fileMetadata);
 
+  virtual void setMaxRetries(unsigned int maxRetries) override
+  {
+    m_maxRetries = maxRetries;
+  }
+
 private:
 
 
@@ -109,6 +128,11 @@ private:
   Util::ThreadPool * m_threadPool;
   azure::storage_lite::blob_client_wrapper *m_blobclient;
 
+  /// underlying client of m_blobclient, used where http status is needed
+  std::shared_ptr<azure::storage_lite::blob_client> m_asyncBlobClient;
+
+  unsigned int m_maxRetries;
+
   const size_t m_uploadThreshold;
   unsigned int m_parallel;
 
@@ -137,9 +161,16 @@ private:
   RemoteStorageRequestOutcome doMultiPartUpload(FileMetadata * fileMetadata,
                                     std::basic_iostream<char> *dataStream);
 
+  /**
+   * Upload one block of a multi part upload (Put Block).
+   */
   void uploadParts(MultiUploadCtx_a * uploadCtx);
 
-  //RemoteStorageRequestOutcome handleError(const Aws::Client::AWSError<Aws::S3::S3Errors> &error);
+  /**
+   * Map azure error to request outcome. Expired or invalid SAS token is
+   * reported as 403 and needs the token to be renewed.
+   */
+  RemoteStorageRequestOutcome handleError(const azure::storage_lite::storage_error &error);
 
 };
 }
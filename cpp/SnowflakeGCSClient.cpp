@@ -4,14 +4,17 @@
 
 #include "SnowflakeGCSClient.hpp"
 #include "FileMetadataInitializer.hpp"
+#include "FileTransferAgent.hpp"
 #include "EncryptionProvider.hpp"
 #include "util/Base64.hpp"
 #include "crypto/CipherStreamBuf.hpp"
 #include "logger/SFLogger.hpp"
 #include "cJSON.h"
 #include <algorithm>
+#include <cstdio>
 #include <iostream>
 #include <sstream>
+#include <thread>
 
 namespace
 {
@@ -28,14 +31,23 @@ namespace Client
 SnowflakeGCSClient::SnowflakeGCSClient(StageInfo *stageInfo, unsigned int parallel,
   TransferConfig * transferConfig, IStatementPutGet* statement) :
   m_stageInfo(stageInfo),
-  m_statement(statement)
+  m_statement(statement),
+  m_threadPool(nullptr),
+  m_parallel(std::min(parallel, std::thread::hardware_concurrency())),
+  m_maxRetries(0)
 {
-  // Do nothing.
+  if (m_parallel == 0)
+  {
+    m_parallel = 1;
+  }
 }
 
 SnowflakeGCSClient::~SnowflakeGCSClient()
 {
-  // Do nothing;
+  if (m_threadPool != nullptr)
+  {
+    delete m_threadPool;
+  }
 }
 
 RemoteStorageRequestOutcome SnowflakeGCSClient::upload(FileMetadata *fileMetadata,
@@ -63,6 +75,97 @@ RemoteStorageRequestOutcome SnowflakeGCSClient::upload(FileMetadata *fileMetadat
 RemoteStorageRequestOutcome SnowflakeGCSClient::download(
   FileMetadata *fileMetadata,
   std::basic_iostream<char>* dataStream)
+{
+  if (fileMetadata->srcFileSize > DOWNLOAD_DATA_SIZE_THRESHOLD)
+    return doMultiPartDownload(fileMetadata, dataStream);
+  else
+    return doSingleDownload(fileMetadata, dataStream);
+}
+
+RemoteStorageRequestOutcome SnowflakeGCSClient::doMultiPartDownload(
+  FileMetadata *fileMetadata,
+  std::basic_iostream<char>* dataStream)
+{
+  CXX_LOG_DEBUG("Start multi part download for file %s, parallel: %d",
+               fileMetadata->srcFileName.c_str(), m_parallel);
+
+  if (m_threadPool == nullptr)
+  {
+    m_threadPool = new Util::ThreadPool(m_parallel);
+  }
+
+  unsigned int partNum = (unsigned int)((fileMetadata->srcFileSize +
+    DOWNLOAD_DATA_SIZE_THRESHOLD - 1) / DOWNLOAD_DATA_SIZE_THRESHOLD);
+  Util::StreamAppender appender(dataStream, partNum, m_parallel, DOWNLOAD_DATA_SIZE_THRESHOLD);
+  std::vector<RemoteStorageRequestOutcome> outcomes(partNum,
+    RemoteStorageRequestOutcome::FAILED);
+
+  for (unsigned int i = 0; i < partNum; i++)
+  {
+    m_threadPool->AddJob([&, i]()-> void {
+      long long rangeStart = (long long)i * DOWNLOAD_DATA_SIZE_THRESHOLD;
+      long partSize = (long)std::min<long long>(DOWNLOAD_DATA_SIZE_THRESHOLD,
+        fileMetadata->srcFileSize - rangeStart);
+      std::stringstream rangeStream;
+      rangeStream << "Range: bytes=" << rangeStart << '-'
+                  << rangeStart + partSize - 1;
+      std::vector<std::string> reqHeaders(1, rangeStream.str());
+
+      int tid = m_threadPool->GetThreadIdx();
+      Util::ByteArrayStreamBuf * buf = appender.GetBuffer(tid);
+
+      CXX_LOG_DEBUG("Start downloading part %d, %s, part size: %ld",
+                   i, reqHeaders[0].c_str(), partSize);
+
+      char retryLog[200];
+      sprintf(retryLog, "Retrying download part %d of %s.", i,
+              fileMetadata->srcFileName.c_str());
+      RetryContext partRetryCtx(retryLog, m_maxRetries);
+      do
+      {
+        partRetryCtx.waitForNextRetry();
+        // reset put area, previous attempt may have written into it
+        buf->updateSize(partSize);
+        std::iostream partStream(buf);
+        std::string respHeaders;
+        outcomes[i] = m_statement->http_get(fileMetadata->presignedUrl,
+                                            reqHeaders, &partStream,
+                                            respHeaders, false) ?
+          RemoteStorageRequestOutcome::SUCCESS :
+          RemoteStorageRequestOutcome::FAILED;
+      } while (partRetryCtx.isRetryable(outcomes[i]));
+
+      if (outcomes[i] == RemoteStorageRequestOutcome::SUCCESS)
+      {
+        CXX_LOG_DEBUG("Download part %d succeed, download size: %ld",
+                     i, partSize);
+        appender.WritePartToOutputStream(tid, i);
+      }
+      else
+      {
+        CXX_LOG_ERROR("Download part %d of %s failed.", i,
+                      fileMetadata->srcFileName.c_str());
+        appender.SkipPart(i);
+      }
+    });
+  }
+
+  m_threadPool->WaitAll();
+
+  for (unsigned int i = 0; i < partNum; i++)
+  {
+    if (outcomes[i] != RemoteStorageRequestOutcome::SUCCESS)
+    {
+      return outcomes[i];
+    }
+  }
+
+  return RemoteStorageRequestOutcome::SUCCESS;
+}
+
+RemoteStorageRequestOutcome SnowflakeGCSClient::doSingleDownload(
+  FileMetadata *fileMetadata,
+  std::basic_iostream<char>* dataStream)
 {
   CXX_LOG_DEBUG("Start download for file %s",
     fileMetadata->srcFileName.c_str());
@@ -10,6 +10,7 @@
 #include "snowflake/PutGetParseResponse.hpp"
 #include "FileMetadata.hpp"
 #include "util/ByteArrayStreamBuf.hpp"
+#include "util/ThreadPool.hpp"
 #include <map>
 
 #ifdef _WIN32
@@ -57,7 +58,22 @@ public:
     return true;
   }
 
+  virtual void setMaxRetries(unsigned int maxRetries) override
+  {
+    m_maxRetries = maxRetries;
+  }
+
 private:
+  RemoteStorageRequestOutcome doSingleDownload(FileMetadata *fileMetadata,
+    std::basic_iostream<char>* dataStream);
+
+  /**
+   * Download large object with parallel ranged GETs on the presigned url,
+   * parts are appended to the data stream in order.
+   */
+  RemoteStorageRequestOutcome doMultiPartDownload(FileMetadata *fileMetadata,
+    std::basic_iostream<char>* dataStream);
+
   /**
   * Add snowflake specific metadata to the put object metadata.
   * This includes encryption metadata and source file
@@ -85,6 +101,12 @@ private:
   StageInfo * m_stageInfo;
 
   IStatementPutGet* m_statement;
+
+  Util::ThreadPool * m_threadPool;
+
+  unsigned int m_parallel;
+
+  unsigned int m_maxRetries;
 };
 }
 }
@@ -0,0 +1,378 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#include "SnowflakeLocalFSClient.hpp"
+#include "FileMetadataInitializer.hpp"
+#include "util/Base64.hpp"
+#include "util/FilePartWriter.hpp"
+#include "crypto/CipherStreamBuf.hpp"
+#include "logger/SFLogger.hpp"
+#include "cJSON.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <algorithm>
+#include <sys/stat.h>
+
+namespace
+{
+  static const char * const LOCAL_FS_KEY = "key";
+  static const char * const LOCAL_FS_IV = "iv";
+  static const char * const LOCAL_FS_MATDESC = "matdesc";
+  static const char * const SFC_DIGEST = "sfc-digest";
+  static const char * const TMP_FILE_SUFFIX = ".sfctmp";
+
+  bool fileExists(const std::string &path)
+  {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+  }
+
+  /// move temp file to its final name, replacing existing file if any
+  bool commitFile(const std::string &tmpFile, const std::string &dstFile)
+  {
+#ifdef _WIN32
+    remove(dstFile.c_str());
+#endif
+    return rename(tmpFile.c_str(), dstFile.c_str()) == 0;
+  }
+}
+
+namespace Snowflake
+{
+namespace Client
+{
+
+const char * const SnowflakeLocalFSClient::METADATA_FILE_SUFFIX = ".sfcmeta";
+
+SnowflakeLocalFSClient::SnowflakeLocalFSClient(StageInfo *stageInfo,
+                                               unsigned int parallel,
+                                               size_t uploadThreshold,
+                                               TransferConfig *transferConfig) :
+  m_stageInfo(stageInfo),
+  m_threadPool(nullptr),
+  m_uploadThreshold(uploadThreshold),
+  m_parallel(std::max(1u, std::min(parallel,
+                                   std::thread::hardware_concurrency())))
+{
+  CXX_LOG_TRACE("Local fs client created on stage location %s.",
+                m_stageInfo->location.c_str());
+}
+
+SnowflakeLocalFSClient::~SnowflakeLocalFSClient()
+{
+  if (m_threadPool != nullptr)
+  {
+    delete m_threadPool;
+  }
+}
+
+std::string SnowflakeLocalFSClient::getStageFilePath(const std::string &fileName)
+{
+  std::string location = m_stageInfo->location;
+  if (!location.empty() && location.back() != '/' && location.back() != '\\')
+  {
+    location += PATH_SEP;
+  }
+  return location + fileName;
+}
+
+RemoteStorageRequestOutcome SnowflakeLocalFSClient::upload(FileMetadata *fileMetadata,
+                                                           std::basic_iostream<char> *dataStream)
+{
+  std::string dstFile = getStageFilePath(fileMetadata->destFileName);
+  CXX_LOG_DEBUG("Start local fs upload for file %s to %s",
+                fileMetadata->srcFileToUpload.c_str(), dstFile.c_str());
+
+  if (!fileMetadata->overWrite && fileExists(dstFile))
+  {
+    CXX_LOG_DEBUG("File %s already exists in the staging area. skip upload",
+                  fileMetadata->srcFileToUpload.c_str());
+    return RemoteStorageRequestOutcome::SKIP_UPLOAD_FILE;
+  }
+
+  if (sf_create_directory_if_not_exists(m_stageInfo->location.c_str()) != 0)
+  {
+    CXX_LOG_ERROR("Failed to create stage directory %s.",
+                  m_stageInfo->location.c_str());
+    return RemoteStorageRequestOutcome::FAILED;
+  }
+
+  // Data goes to a temp file first so that a concurrent reader never sees a
+  // partially written file.
+  std::string tmpFile = dstFile + TMP_FILE_SUFFIX;
+  RemoteStorageRequestOutcome outcome =
+    fileMetadata->srcFileSize > (long)m_uploadThreshold ?
+      doMultiPartUpload(fileMetadata, dataStream, tmpFile) :
+      doSingleUpload(fileMetadata, dataStream, tmpFile);
+
+  if (outcome != RemoteStorageRequestOutcome::SUCCESS)
+  {
+    remove(tmpFile.c_str());
+    return outcome;
+  }
+
+  if (!writeMetadataFile(dstFile, fileMetadata) ||
+      !commitFile(tmpFile, dstFile))
+  {
+    CXX_LOG_ERROR("Failed to commit file %s: %s", dstFile.c_str(),
+                  std::strerror(errno));
+    remove(tmpFile.c_str());
+    return RemoteStorageRequestOutcome::FAILED;
+  }
+
+  CXX_LOG_DEBUG("%s file uploaded successfully.",
+                fileMetadata->srcFileToUpload.c_str());
+  return RemoteStorageRequestOutcome::SUCCESS;
+}
+
+RemoteStorageRequestOutcome SnowflakeLocalFSClient::doSingleUpload(
+  FileMetadata *fileMetadata,
+  std::basic_iostream<char> *dataStream,
+  const std::string &tmpFile)
+{
+  CXX_LOG_DEBUG("Start single part upload for file %s",
+                fileMetadata->srcFileToUpload.c_str());
+
+  std::ofstream dstStream(tmpFile.c_str(),
+                          std::ios_base::out | std::ios_base::binary |
+                          std::ios_base::trunc);
+  if (!dstStream.is_open())
+  {
+    CXX_LOG_ERROR("Could not open file %s to upload: %s", tmpFile.c_str(),
+                  std::strerror(errno));
+    return RemoteStorageRequestOutcome::FAILED;
+  }
+
+  // operator<< fails the stream if nothing is inserted, empty input is valid
+  if (dataStream->peek() != std::char_traits<char>::eof())
+  {
+    dstStream << dataStream->rdbuf();
+  }
+  dstStream.close();
+
+  if (dstStream.fail())
+  {
+    CXX_LOG_ERROR("Failed to write file %s.", tmpFile.c_str());
+    return RemoteStorageRequestOutcome::FAILED;
+  }
+  return RemoteStorageRequestOutcome::SUCCESS;
+}
+
+RemoteStorageRequestOutcome SnowflakeLocalFSClient::doMultiPartUpload(
+  FileMetadata *fileMetadata,
+  std::basic_iostream<char> *dataStream,
+  const std::string &tmpFile)
+{
+  CXX_LOG_DEBUG("Start multi part upload for file %s, parallel: %d",
+                fileMetadata->srcFileToUpload.c_str(), m_parallel);
+
+  if (m_threadPool == nullptr)
+  {
+    m_threadPool = new Util::ThreadPool(m_parallel);
+  }
+
+  Util::FilePartWriter writer(tmpFile);
+  if (!writer.isOpen())
+  {
+    CXX_LOG_ERROR("Could not open file %s to upload: %s", tmpFile.c_str(),
+                  std::strerror(errno));
+    return RemoteStorageRequestOutcome::FAILED;
+  }
+
+  Util::StreamSplitter splitter(dataStream, m_parallel,
+                                (unsigned int)m_uploadThreshold);
+  unsigned int totalParts = splitter.getTotalParts(
+    fileMetadata->encryptionMetadata.cipherStreamSize);
+  CXX_LOG_INFO("Total file size: %lld, split into %d parts.",
+               fileMetadata->encryptionMetadata.cipherStreamSize, totalParts);
+
+  std::vector<RemoteStorageRequestOutcome> outcomes(
+    totalParts, RemoteStorageRequestOutcome::FAILED);
+
+  for (unsigned int i = 0; i < totalParts; i++)
+  {
+    m_threadPool->AddJob([&splitter, &outcomes, &writer, this]()->void
+                         {
+                           int partId;
+                           Util::ByteArrayStreamBuf * buf = splitter.FillAndGetBuf(
+                             m_threadPool->GetThreadIdx(), partId);
+                           long long offset = (long long)partId * m_uploadThreshold;
+                           if (writer.WriteAt(buf->getDataBuffer(), buf->getSize(), offset))
+                           {
+                             outcomes[partId] = RemoteStorageRequestOutcome::SUCCESS;
+                           }
+                           else
+                           {
+                             CXX_LOG_ERROR("Failed to write part %d: %s", partId,
+                                           std::strerror(errno));
+                           }
+                         });
+  }
+
+  m_threadPool->WaitAll();
+
+  if (!writer.Close())
+  {
+    CXX_LOG_ERROR("Failed to close file %s: %s", tmpFile.c_str(),
+                  std::strerror(errno));
+    return RemoteStorageRequestOutcome::FAILED;
+  }
+
+  for (unsigned int i = 0; i < totalParts; i++)
+  {
+    if (outcomes[i] != RemoteStorageRequestOutcome::SUCCESS)
+    {
+      CXX_LOG_DEBUG("%s file upload failed.",
+                    fileMetadata->srcFileToUpload.c_str());
+      return outcomes[i];
+    }
+  }
+  return RemoteStorageRequestOutcome::SUCCESS;
+}
+
+RemoteStorageRequestOutcome SnowflakeLocalFSClient::download(
+  FileMetadata *fileMetadata,
+  std::basic_iostream<char> *dataStream)
+{
+  CXX_LOG_DEBUG("Start local fs download for file %s",
+                fileMetadata->srcFileName.c_str());
+
+  std::ifstream srcStream(fileMetadata->srcFileName.c_str(),
+                          std::ios_base::in | std::ios_base::binary);
+  if (!srcStream.is_open())
+  {
+    CXX_LOG_ERROR("Could not open file %s to download: %s",
+                  fileMetadata->srcFileName.c_str(), std::strerror(errno));
+    return RemoteStorageRequestOutcome::FAILED;
+  }
+
+  // The output is a decrypting stream which consumes data in order, so the
+  // file is read sequentially in large parts.
+  Util::ByteArrayStreamBuf buf(DOWNLOAD_DATA_SIZE_THRESHOLD);
+  while (srcStream)
+  {
+    srcStream.read(buf.getDataBuffer(), DOWNLOAD_DATA_SIZE_THRESHOLD);
+    std::streamsize readSize = srcStream.gcount();
+    if (readSize > 0)
+    {
+      dataStream->write(buf.getDataBuffer(), readSize);
+    }
+  }
+  dataStream->flush();
+
+  if (srcStream.bad() || dataStream->fail())
+  {
+    CXX_LOG_ERROR("Failed to download file %s.",
+                  fileMetadata->srcFileName.c_str());
+    return RemoteStorageRequestOutcome::FAILED;
+  }
+
+  CXX_LOG_DEBUG("Download for file %s succeed",
+                fileMetadata->srcFileName.c_str());
+  return RemoteStorageRequestOutcome::SUCCESS;
+}
+
+RemoteStorageRequestOutcome SnowflakeLocalFSClient::GetRemoteFileMetadata(
+  std::string *filePathFull, FileMetadata *fileMetadata)
+{
+  struct stat st;
+  if (stat(filePathFull->c_str(), &st) != 0)
+  {
+    CXX_LOG_ERROR("Failed to stat file %s: %s", filePathFull->c_str(),
+                  std::strerror(errno));
+    return RemoteStorageRequestOutcome::FAILED;
+  }
+
+  fileMetadata->srcFileSize = (long)st.st_size;
+  CXX_LOG_INFO("Local file %s size: %ld.", filePathFull->c_str(),
+               fileMetadata->srcFileSize);
+
+  if (!readMetadataFile(*filePathFull, fileMetadata))
+  {
+    return RemoteStorageRequestOutcome::FAILED;
+  }
+  return RemoteStorageRequestOutcome::SUCCESS;
+}
+
+bool SnowflakeLocalFSClient::writeMetadataFile(const std::string &filePath,
+                                               FileMetadata *fileMetadata)
+{
+  char ivEncoded[64];
+  Util::Base64::encode(fileMetadata->encryptionMetadata.iv.data,
+                       Crypto::cryptoAlgoBlockSize(Crypto::CryptoAlgo::AES),
+                       ivEncoded);
+  size_t ivEncodeSize = Util::Base64::encodedLength(
+    Crypto::cryptoAlgoBlockSize(Crypto::CryptoAlgo::AES));
+  std::string ivEncodedStr(ivEncoded, ivEncodeSize);
+
+  cJSON *json = snowflake_cJSON_CreateObject();
+  snowflake_cJSON_AddStringToObject(json, LOCAL_FS_KEY,
+    fileMetadata->encryptionMetadata.enKekEncoded.c_str());
+  snowflake_cJSON_AddStringToObject(json, LOCAL_FS_IV, ivEncodedStr.c_str());
+  snowflake_cJSON_AddStringToObject(json, LOCAL_FS_MATDESC,
+    fileMetadata->encryptionMetadata.matDesc.c_str());
+  snowflake_cJSON_AddStringToObject(json, SFC_DIGEST,
+    fileMetadata->sha256Digest.c_str());
+  char *jsonStr = snowflake_cJSON_PrintUnformatted(json);
+  snowflake_cJSON_Delete(json);
+
+  std::string metaFile = filePath + METADATA_FILE_SUFFIX;
+  std::ofstream metaStream(metaFile.c_str(),
+                           std::ios_base::out | std::ios_base::trunc);
+  metaStream << jsonStr;
+  metaStream.close();
+  snowflake_cJSON_free(jsonStr);
+
+  if (metaStream.fail())
+  {
+    CXX_LOG_ERROR("Failed to write metadata file %s.", metaFile.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool SnowflakeLocalFSClient::readMetadataFile(const std::string &filePath,
+                                              FileMetadata *fileMetadata)
+{
+  std::string metaFile = filePath + METADATA_FILE_SUFFIX;
+  std::ifstream metaStream(metaFile.c_str());
+  if (!metaStream.is_open())
+  {
+    CXX_LOG_ERROR("Could not open metadata file %s: %s", metaFile.c_str(),
+                  std::strerror(errno));
+    return false;
+  }
+  std::string jsonStr((std::istreambuf_iterator<char>(metaStream)),
+                      std::istreambuf_iterator<char>());
+
+  cJSON *json = snowflake_cJSON_Parse(jsonStr.c_str());
+  char *key = snowflake_cJSON_GetStringValue(
+    snowflake_cJSON_GetObjectItem(json, LOCAL_FS_KEY));
+  char *iv = snowflake_cJSON_GetStringValue(
+    snowflake_cJSON_GetObjectItem(json, LOCAL_FS_IV));
+  if (key == NULL || iv == NULL)
+  {
+    CXX_LOG_ERROR("Invalid metadata file %s.", metaFile.c_str());
+    snowflake_cJSON_Delete(json);
+    return false;
+  }
+
+  Util::Base64::decode(iv, strlen(iv),
+                       fileMetadata->encryptionMetadata.iv.data);
+  fileMetadata->encryptionMetadata.enKekEncoded = key;
+  char *matDesc = snowflake_cJSON_GetStringValue(
+    snowflake_cJSON_GetObjectItem(json, LOCAL_FS_MATDESC));
+  if (matDesc != NULL)
+  {
+    fileMetadata->encryptionMetadata.matDesc = matDesc;
+  }
+  snowflake_cJSON_Delete(json);
+  return true;
+}
+
+}
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#ifndef SNOWFLAKECLIENT_SNOWFLAKELOCALFSCLIENT_HPP
+#define SNOWFLAKECLIENT_SNOWFLAKELOCALFSCLIENT_HPP
+
+#include "snowflake/IFileTransferAgent.hpp"
+#include "IStorageClient.hpp"
+#include "snowflake/PutGetParseResponse.hpp"
+#include "FileMetadata.hpp"
+#include "util/ThreadPool.hpp"
+#include "util/ByteArrayStreamBuf.hpp"
+
+namespace Snowflake
+{
+namespace Client
+{
+
+/**
+ * Storage client for LOCAL_FS stages. Stage location is a directory on the
+ * local file system, every staged file is a plain file in that directory and
+ * its encryption metadata is kept in a sidecar file next to it.
+ */
+class SnowflakeLocalFSClient : public Snowflake::Client::IStorageClient
+{
+public:
+  SnowflakeLocalFSClient(StageInfo *stageInfo, unsigned int parallel,
+                         size_t uploadThreshold,
+                         TransferConfig *transferConfig);
+
+  ~SnowflakeLocalFSClient();
+
+  /**
+   * Write data stream into the stage directory. Existing file is kept
+   * unless overwrite is requested.
+   * @param fileMetadata
+   * @param dataStream
+   * @return
+   */
+  RemoteStorageRequestOutcome upload(FileMetadata *fileMetadata,
+                                     std::basic_iostream<char> *dataStream) override;
+
+  RemoteStorageRequestOutcome download(FileMetadata *fileMetadata,
+                                       std::basic_iostream<char> *dataStream) override;
+
+  RemoteStorageRequestOutcome GetRemoteFileMetadata(
+    std::string *filePathFull, FileMetadata *fileMetadata) override;
+
+  /// suffix of the file that stores encryption metadata of a staged file
+  static const char * const METADATA_FILE_SUFFIX;
+
+private:
+  RemoteStorageRequestOutcome doSingleUpload(FileMetadata *fileMetadata,
+                                             std::basic_iostream<char> *dataStream,
+                                             const std::string &tmpFile);
+
+  /**
+   * Split the stream into parts of uploadThreshold bytes and write them in
+   * parallel at their own offset in the target file.
+   */
+  RemoteStorageRequestOutcome doMultiPartUpload(FileMetadata *fileMetadata,
+                                                std::basic_iostream<char> *dataStream,
+                                                const std::string &tmpFile);
+
+  /**
+   * Persist encryption metadata and message digest of a staged file.
+   */
+  bool writeMetadataFile(const std::string &filePath,
+                         FileMetadata *fileMetadata);
+
+  bool readMetadataFile(const std::string &filePath,
+                        FileMetadata *fileMetadata);
+
+  /// full path of a file in stage directory
+  std::string getStageFilePath(const std::string &fileName);
+
+  StageInfo * m_stageInfo;
+
+  Util::ThreadPool * m_threadPool;
+
+  size_t m_uploadThreshold;
+
+  unsigned int m_parallel;
+};
+}
+}
+
+#endif //SNOWFLAKECLIENT_SNOWFLAKELOCALFSCLIENT_HPP
@@ -8,6 +8,8 @@
 #include "snowflake/client.h"
 #include "util/Base64.hpp"
 #include "util/ByteArrayStreamBuf.hpp"
+#include "util/FilePartWriter.hpp"
+#include "EncryptionProvider.hpp"
 #include "util/Proxy.hpp"
 #include "crypto/CipherStreamBuf.hpp"
 #include "logger/SFAwsLogger.hpp"
@@ -15,6 +17,8 @@
 #include <aws/core/Aws.h>
 #include <aws/s3/model/CreateMultipartUploadRequest.h>
 #include <aws/s3/model/CompleteMultipartUploadRequest.h>
+#include <aws/s3/model/AbortMultipartUploadRequest.h>
+#include <aws/s3/model/ListPartsRequest.h>
 #include <aws/s3/model/GetObjectRequest.h>
 #include <aws/s3/model/HeadObjectRequest.h>
 #include <aws/s3/model/PutObjectRequest.h>
@@ -23,8 +27,11 @@
 #include <aws/core/utils/logging/DefaultLogSystem.h>
 #include <aws/core/utils/logging/ConsoleLogSystem.h>
 #include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <fstream>
+#include <map>
+#include <sstream>
 #include <string>
 
 
@@ -39,24 +46,92 @@
 #define AWS_TOKEN "AWS_TOKEN"
 #define SFC_DIGEST "sfc-digest"
 
+/// max number of idle s3 clients kept for the same configuration
+#define S3_CLIENT_CACHE_MAX_IDLE 8
+
 namespace Snowflake
 {
 namespace Client
 {
 
+namespace
+{
+  /**
+   * S3 client kept for reuse. Keeping the client keeps its connection pool,
+   * so later commands skip TLS handshake as well as sdk initialization.
+   */
+  struct CachedS3Client
+  {
+    Aws::S3::S3Client *s3Client;
+
+    std::shared_ptr<SnowflakeS3CredentialsProvider>
+      credentialsProvider;
+  };
+
+  /// protects all statics below
+  std::mutex s_s3ClientCacheMutex;
+
+  /// idle s3 clients keyed on region, endpoint and connection settings
+  std::multimap<std::string, CachedS3Client> s_idleS3Clients;
+
+  /// number of s3 clients (in use or idle) relying on aws sdk
+  unsigned int s_awsSdkRefCount = 0;
+
+  Aws::SDKOptions s_awsSdkOptions;
+
+  /**
+   * Initialize aws sdk when first s3 client is created.
+   * Must be called with s_s3ClientCacheMutex held.
+   */
+  void acquireAwsSdk()
+  {
+    if (s_awsSdkRefCount++ == 0)
+    {
+      CXX_LOG_INFO("Initializing aws sdk.");
+      Aws::Utils::Logging::InitializeAWSLogging(
+        Aws::MakeShared<SFAwsLogger>(""));
+      Aws::InitAPI(s_awsSdkOptions);
+    }
+  }
+
+  /**
+   * Shut down aws sdk when last s3 client is deleted.
+   * Must be called with s_s3ClientCacheMutex held.
+   */
+  void releaseAwsSdk()
+  {
+    if (--s_awsSdkRefCount == 0)
+    {
+      CXX_LOG_INFO("Shutting down aws sdk.");
+      Aws::ShutdownAPI(s_awsSdkOptions);
+      Aws::Utils::Logging::ShutdownAWSLogging();
+    }
+  }
+}
+
+Aws::Auth::AWSCredentials SnowflakeS3CredentialsProvider::GetAWSCredentials()
+{
+  std::lock_guard<std::mutex> guard(m_credentialsMutex);
+  return m_credentials;
+}
+
+void SnowflakeS3CredentialsProvider::SetAWSCredentials(
+  const Aws::Auth::AWSCredentials &credentials)
+{
+  std::lock_guard<std::mutex> guard(m_credentialsMutex);
+  m_credentials = credentials;
+}
 
 SnowflakeS3Client::SnowflakeS3Client(StageInfo *stageInfo,
                                      unsigned int parallel,
                                      size_t uploadThreshold,
                                      TransferConfig *transferConfig) :
+  s3Client(nullptr),
   m_stageInfo(stageInfo),
   m_threadPool(nullptr),
   m_uploadThreshold(uploadThreshold),
   m_parallel(std::min(parallel, std::thread::hardware_concurrency()))
 {
-  Aws::Utils::Logging::InitializeAWSLogging(
-    Aws::MakeShared<Snowflake::Client::SFAwsLogger>(""));
-
   Aws::String caFile;
   if (transferConfig != nullptr)
   {
@@ -73,12 +148,30 @@ SnowflakeS3Client::SnowflakeS3Client(StageInfo *stageInfo,
     throw SnowflakeTransferException(TransferError::INTERNAL_ERROR,
                                      "CA bundle file is empty.");
   }
-  //TODO move this to global init
-  Aws::InitAPI(options);
   clientConfiguration.region = stageInfo->region;
   clientConfiguration.caFile = caFile;
   clientConfiguration.requestTimeoutMs = 40000;
   clientConfiguration.connectTimeoutMs = 30000;
+
+  // endpoint override, plain http endpoint (e.g. local s3 mock) uses
+  // path style addressing since bucket host names can't be resolved there.
+  bool useVirtualAddressing = true;
+  if (!stageInfo->endPoint.empty())
+  {
+    const std::string httpPrefix("http://");
+    if (stageInfo->endPoint.compare(0, httpPrefix.size(), httpPrefix) == 0)
+    {
+      clientConfiguration.scheme = Aws::Http::Scheme::HTTP;
+      clientConfiguration.endpointOverride =
+        stageInfo->endPoint.substr(httpPrefix.size());
+      useVirtualAddressing = false;
+    }
+    else
+    {
+      clientConfiguration.endpointOverride = stageInfo->endPoint;
+    }
+  }
+
   Util::Proxy proxy;
   proxy.setProxyFromEnv();
 
@@ -102,27 +195,125 @@ SnowflakeS3Client::SnowflakeS3Client(StageInfo *stageInfo,
 
   CXX_LOG_DEBUG("CABundleFile used in aws sdk: %s", caFile.c_str());
 
-  Aws::Auth::AWSCredentials credentials(
-    Aws::String(stageInfo->credentials.at(AWS_KEY_ID)),
-    Aws::String(stageInfo->credentials.at(AWS_SECRET_KEY)),
-    Aws::String(stageInfo->credentials.at(AWS_TOKEN)));
+  // Credentials are not part of the key, they are swapped in once a client
+  // is taken out of the cache.
+  std::stringstream cacheKey;
+  cacheKey << clientConfiguration.region << '|' << stageInfo->endPoint << '|'
+           << caFile << '|' << clientConfiguration.proxyHost << '|'
+           << clientConfiguration.proxyPort << '|'
+           << static_cast<int>(clientConfiguration.proxyScheme) << '|'
+           << clientConfiguration.proxyUserName << '|'
+           << clientConfiguration.proxyPassword;
+  m_cacheKey = cacheKey.str();
+
+  {
+    std::lock_guard<std::mutex> guard(s_s3ClientCacheMutex);
+    auto cached = s_idleS3Clients.find(m_cacheKey);
+    if (cached != s_idleS3Clients.end())
+    {
+      s3Client = cached->second.s3Client;
+      m_credentialsProvider = cached->second.credentialsProvider;
+      s_idleS3Clients.erase(cached);
+      CXX_LOG_DEBUG("Reuse cached s3 client for region %s.",
+                    clientConfiguration.region.c_str());
+    }
+    else
+    {
+      acquireAwsSdk();
+    }
+  }
 
-  s3Client = new Aws::S3::S3Client(credentials,
-          clientConfiguration,
-          Aws::Client::AWSAuthV4Signer::PayloadSigningPolicy::Never,
-          true); // explicitly set virtual addressing style to be true
+  if (s3Client == nullptr)
+  {
+    m_credentialsProvider =
+      std::make_shared<SnowflakeS3CredentialsProvider>();
+    s3Client = new Aws::S3::S3Client(m_credentialsProvider,
+            clientConfiguration,
+            Aws::Client::AWSAuthV4Signer::PayloadSigningPolicy::Never,
+            useVirtualAddressing);
+  }
+  renewCredentials(stageInfo);
   CXX_LOG_TRACE("Successfully created s3 client. End of constructor.");
 }
 
 SnowflakeS3Client::~SnowflakeS3Client()
 {
-  delete s3Client;
-  //TODO move this to global shutdown
-  //Aws::ShutdownAPI(options);
   if (m_threadPool != nullptr)
   {
     delete m_threadPool;
   }
+
+  // uploads kept for resume that were never resumed
+  for (auto &pending : m_pendingUploads)
+  {
+    std::string fileFullPath = pending.first;
+    std::string bucket, key;
+    extractBucketAndKey(&fileFullPath, bucket, key);
+    abortMultiPartUpload(bucket, key, pending.second.uploadId);
+  }
+
+  // keep the s3 client for next command with same configuration
+  std::lock_guard<std::mutex> guard(s_s3ClientCacheMutex);
+  if (s_idleS3Clients.count(m_cacheKey) < S3_CLIENT_CACHE_MAX_IDLE)
+  {
+    m_credentialsProvider->SetAWSCredentials(Aws::Auth::AWSCredentials());
+    s_idleS3Clients.insert({m_cacheKey, {s3Client, m_credentialsProvider}});
+  }
+  else
+  {
+    delete s3Client;
+    releaseAwsSdk();
+  }
+}
+
+bool SnowflakeS3Client::renewCredentials(StageInfo *stageInfo)
+{
+  m_credentialsProvider->SetAWSCredentials(Aws::Auth::AWSCredentials(
+    Aws::String(stageInfo->credentials.at(AWS_KEY_ID)),
+    Aws::String(stageInfo->credentials.at(AWS_SECRET_KEY)),
+    Aws::String(stageInfo->credentials.at(AWS_TOKEN))));
+  return true;
+}
+
+bool SnowflakeS3Client::restoreEncryptionMetadata(FileMetadata *fileMetadata)
+{
+  std::string fileFullPath = m_stageInfo->location + fileMetadata->destFileName;
+  std::lock_guard<std::mutex> guard(m_pendingUploadsMutex);
+  auto pending = m_pendingUploads.find(fileFullPath);
+  if (pending == m_pendingUploads.end() ||
+      pending->second.sha256Digest != fileMetadata->sha256Digest)
+  {
+    return false;
+  }
+
+  fileMetadata->encryptionMetadata = pending->second.encryptionMetadata;
+  fileMetadata->destFileSize =
+    (long)(fileMetadata->encryptionMetadata.cipherStreamSize);
+  CXX_LOG_DEBUG("Restored encryption metadata of upload %s.",
+                pending->second.uploadId.c_str());
+  return true;
+}
+
+void SnowflakeS3Client::keepPendingUpload(const std::string &fileFullPath,
+                                          const Aws::String &uploadId,
+                                          FileMetadata *fileMetadata)
+{
+  std::lock_guard<std::mutex> guard(m_pendingUploadsMutex);
+  PendingUpload &pending = m_pendingUploads[fileFullPath];
+  pending.uploadId = uploadId;
+  pending.encryptionMetadata = fileMetadata->encryptionMetadata;
+  pending.sha256Digest = fileMetadata->sha256Digest;
+}
+
+void SnowflakeS3Client::releaseCachedClients()
+{
+  std::lock_guard<std::mutex> guard(s_s3ClientCacheMutex);
+  for (auto &cached : s_idleS3Clients)
+  {
+    delete cached.second.s3Client;
+    releaseAwsSdk();
+  }
+  s_idleS3Clients.clear();
 }
 
 RemoteStorageRequestOutcome SnowflakeS3Client::upload(FileMetadata *fileMetadata,
@@ -205,6 +396,9 @@ void Snowflake::Client::SnowflakeS3Client::uploadParts(MultiUploadCtx * uploadCt
   uploadPartRequest.WithBucket(uploadCtx->m_bucket)
                    .WithKey(uploadCtx->m_key);
 
+  // rewind buffer, it has been consumed if this is a retry
+  uploadCtx->buf->updateSize(uploadCtx->buf->getSize());
+
   uploadPartRequest.SetContentType(CONTENT_TYPE_OCTET_STREAM);
   uploadPartRequest.SetContentLength(uploadCtx->buf->getSize());
   uploadPartRequest.SetBody(Aws::MakeShared<Aws::IOStream>("", uploadCtx->buf));
@@ -223,6 +417,63 @@ void Snowflake::Client::SnowflakeS3Client::uploadParts(MultiUploadCtx * uploadCt
   else
   {
     uploadCtx->m_outcome = handleError(outcome.GetError());
+    uploadCtx->m_retryable = outcome.GetError().ShouldRetry() ||
+      uploadCtx->m_outcome == RemoteStorageRequestOutcome::TOKEN_EXPIRED;
+  }
+}
+
+bool SnowflakeS3Client::listUploadedParts(
+  const std::string &bucket, const std::string &key,
+  const Aws::String &uploadId,
+  std::map<int, Aws::S3::Model::Part> &uploadedParts)
+{
+  Aws::S3::Model::ListPartsRequest request;
+  request.WithBucket(bucket)
+         .WithKey(key)
+         .WithUploadId(uploadId);
+
+  while (true)
+  {
+    Aws::S3::Model::ListPartsOutcome outcome = s3Client->ListParts(request);
+    if (!outcome.IsSuccess())
+    {
+      CXX_LOG_WARN("List parts of upload %s failed: %s", uploadId.c_str(),
+                   outcome.GetError().GetMessage().c_str());
+      return false;
+    }
+
+    for (const Aws::S3::Model::Part &part : outcome.GetResult().GetParts())
+    {
+      uploadedParts[part.GetPartNumber()] = part;
+    }
+
+    if (!outcome.GetResult().GetIsTruncated())
+    {
+      return true;
+    }
+    request.SetPartNumberMarker(outcome.GetResult().GetNextPartNumberMarker());
+  }
+}
+
+void SnowflakeS3Client::abortMultiPartUpload(const std::string &bucket,
+                                             const std::string &key,
+                                             const Aws::String &uploadId)
+{
+  Aws::S3::Model::AbortMultipartUploadRequest request;
+  request.WithBucket(bucket)
+         .WithKey(key)
+         .WithUploadId(uploadId);
+
+  Aws::S3::Model::AbortMultipartUploadOutcome outcome =
+    s3Client->AbortMultipartUpload(request);
+  if (outcome.IsSuccess())
+  {
+    CXX_LOG_DEBUG("Multi part upload %s aborted.", uploadId.c_str());
+  }
+  else
+  {
+    CXX_LOG_WARN("Abort multi part upload %s failed: %s", uploadId.c_str(),
+                 outcome.GetError().GetMessage().c_str());
   }
 }
 
@@ -244,97 +495,176 @@ RemoteStorageRequestOutcome SnowflakeS3Client::doMultiPartUpload(FileMetadata *f
   std::string fileFullPath = m_stageInfo->location + fileMetadata->destFileName;
   extractBucketAndKey(&fileFullPath, bucket, key);
 
-  Aws::S3::Model::CreateMultipartUploadRequest request;
-  request.WithBucket(bucket)
-    .WithKey(key)
-    .WithContentType(CONTENT_TYPE_OCTET_STREAM)
-    .WithMetadata(userMetadata) ;
+  // resume upload left by previous attempt (token expired or transient error)
+  // only if the stream is encrypted with the key and iv of its parts
+  Aws::String uploadId;
+  bool sameEncryption = false;
+  std::map<int, Aws::S3::Model::Part> uploadedParts;
+  {
+    std::lock_guard<std::mutex> guard(m_pendingUploadsMutex);
+    auto pending = m_pendingUploads.find(fileFullPath);
+    if (pending != m_pendingUploads.end())
+    {
+      const EncryptionMetadata &pendingEncryption =
+        pending->second.encryptionMetadata;
+      const EncryptionMetadata &encryption = fileMetadata->encryptionMetadata;
+      uploadId = pending->second.uploadId;
+      sameEncryption =
+        pending->second.sha256Digest == fileMetadata->sha256Digest &&
+        pendingEncryption.enKekEncoded == encryption.enKekEncoded &&
+        memcmp(pendingEncryption.iv.data, encryption.iv.data,
+               sizeof(encryption.iv.data)) == 0;
+      m_pendingUploads.erase(pending);
+    }
+  }
+  if (!uploadId.empty())
+  {
+    if (!sameEncryption)
+    {
+      CXX_LOG_INFO("Encryption of %s changed, abort upload %s.",
+                   fileMetadata->srcFileToUpload.c_str(), uploadId.c_str());
+      abortMultiPartUpload(bucket, key, uploadId);
+      uploadId.clear();
+    }
+    else if (listUploadedParts(bucket, key, uploadId, uploadedParts))
+    {
+      CXX_LOG_INFO("Resume multi part upload %s, %ld parts already uploaded.",
+                   uploadId.c_str(), (long)uploadedParts.size());
+    }
+    else
+    {
+      abortMultiPartUpload(bucket, key, uploadId);
+      uploadId.clear();
+    }
+  }
 
-  auto createMultiPartResp = s3Client->CreateMultipartUpload(request);
-  if (createMultiPartResp.IsSuccess())
+  if (uploadId.empty())
   {
-    Aws::String uploadId = createMultiPartResp.GetResult().GetUploadId();
+    Aws::S3::Model::CreateMultipartUploadRequest request;
+    request.WithBucket(bucket)
+      .WithKey(key)
+      .WithContentType(CONTENT_TYPE_OCTET_STREAM)
+      .WithMetadata(userMetadata) ;
+
+    auto createMultiPartResp = s3Client->CreateMultipartUpload(request);
+    if (!createMultiPartResp.IsSuccess())
+    {
+      CXX_LOG_DEBUG("%s file upload failed.", fileMetadata->srcFileToUpload.c_str());
+      return handleError(createMultiPartResp.GetError());
+    }
+    uploadId = createMultiPartResp.GetResult().GetUploadId();
     CXX_LOG_DEBUG("Create multi part upload request succeed, uploadId: %s",
                   uploadId.c_str());
+  }
 
-    Util::StreamSplitter splitter(dataStream, m_parallel, m_uploadThreshold);
-    unsigned int totalParts = splitter.getTotalParts(
-      fileMetadata->encryptionMetadata.cipherStreamSize);
-    CXX_LOG_INFO("Total file size: %d, split into %d parts.",
-                fileMetadata->encryptionMetadata.cipherStreamSize, totalParts);
+  Util::StreamSplitter splitter(dataStream, m_parallel, m_uploadThreshold);
+  unsigned int totalParts = splitter.getTotalParts(
+    fileMetadata->encryptionMetadata.cipherStreamSize);
+  CXX_LOG_INFO("Total file size: %d, split into %d parts.",
+              fileMetadata->encryptionMetadata.cipherStreamSize, totalParts);
 
-    std::vector<MultiUploadCtx> uploadParts;
-    uploadParts.reserve(totalParts);
+  std::vector<MultiUploadCtx> uploadParts;
+  uploadParts.reserve(totalParts);
 
-    for (unsigned int i = 0; i < totalParts; i++)
-    {
-      uploadParts.emplace_back(uploadId, i+1, key, bucket);
-    }
+  for (unsigned int i = 0; i < totalParts; i++)
+  {
+    uploadParts.emplace_back(uploadId, i+1, key, bucket);
+  }
 
-    for (unsigned int i = 0; i < totalParts; i++)
-    {
-      m_threadPool->AddJob([&splitter, i, this, &uploadParts]()->void
+  for (unsigned int i = 0; i < totalParts; i++)
+  {
+    m_threadPool->AddJob([&splitter, i, this, &uploadParts, &uploadedParts]()->void
+                         {
+                           int tid = m_threadPool->GetThreadIdx();
+                           int partId;
+                           Util::ByteArrayStreamBuf * buf = splitter.FillAndGetBuf(tid, partId);
+                           MultiUploadCtx &ctx = uploadParts[partId];
+                           ctx.buf = buf;
+
+                           // part is still read, encryption is sequential,
+                           // but not sent again if it was uploaded before
+                           auto uploaded = uploadedParts.find(ctx.m_partNumber);
+                           if (uploaded != uploadedParts.end() &&
+                               uploaded->second.GetSize() == buf->getSize())
                            {
-                             int tid = m_threadPool->GetThreadIdx();
-                             int partId;
-                             Util::ByteArrayStreamBuf * buf = splitter.FillAndGetBuf(tid, partId);
-                             uploadParts[partId].buf = buf;
-                             char retryPartBuflog[200];
-                             sprintf(retryPartBuflog, "Retrying partNumber=%d threadID=%d partId=%d.", i, tid, partId);
-                             RetryContext partRetryCtx(retryPartBuflog, m_maxRetries);
-                             do
-                             {
-                               //Sleeps only when its a retry
-                               partRetryCtx.waitForNextRetry();
-                               this->uploadParts(&uploadParts[partId]);
-                             } while(partRetryCtx.isRetryable(uploadParts[partId].m_outcome));
-                           });
-    }
+                             ctx.m_etag = uploaded->second.GetETag();
+                             ctx.m_outcome = RemoteStorageRequestOutcome::SUCCESS;
+                             return;
+                           }
+
+                           char retryPartBuflog[200];
+                           sprintf(retryPartBuflog, "Retrying partNumber=%d threadID=%d partId=%d.", i, tid, partId);
+                           RetryContext partRetryCtx(retryPartBuflog, m_maxRetries);
+                           do
+                           {
+                             //Sleeps only when its a retry
+                             partRetryCtx.waitForNextRetry();
+                             this->uploadParts(&ctx);
+                           } while(ctx.m_retryable &&
+                                   partRetryCtx.isRetryable(ctx.m_outcome));
+                         });
+  }
 
-    m_threadPool->WaitAll();
+  m_threadPool->WaitAll();
 
-    Aws::S3::Model::CompletedMultipartUpload completedMultipartUpload;
-    for (unsigned int i=0; i< totalParts; i++)
+  Aws::S3::Model::CompletedMultipartUpload completedMultipartUpload;
+  for (unsigned int i=0; i< totalParts; i++)
+  {
+    if (uploadParts[i].m_outcome == RemoteStorageRequestOutcome::SUCCESS)
     {
-      if (uploadParts[i].m_outcome == RemoteStorageRequestOutcome::SUCCESS)
-      {
-        Aws::S3::Model::CompletedPart completedPart;
-        completedPart.WithETag(uploadParts[i].m_etag)
-          .WithPartNumber(uploadParts[i].m_partNumber);
+      Aws::S3::Model::CompletedPart completedPart;
+      completedPart.WithETag(uploadParts[i].m_etag)
+        .WithPartNumber(uploadParts[i].m_partNumber);
 
-        completedMultipartUpload.AddParts(completedPart);
-      }
-      else
-      {
-        //TODO abort existing upload
-        return uploadParts[i].m_outcome;
-      }
+      completedMultipartUpload.AddParts(completedPart);
     }
-
-    Aws::S3::Model::CompleteMultipartUploadRequest completeRequest;
-    completeRequest.WithBucket(bucket)
-                   .WithKey(key)
-                   .WithUploadId(uploadId)
-                   .WithMultipartUpload(completedMultipartUpload);
-
-    Aws::S3::Model::CompleteMultipartUploadOutcome outcome =
-      s3Client->CompleteMultipartUpload(completeRequest);
-
-    if (outcome.IsSuccess())
+    else if (uploadParts[i].m_retryable)
     {
-      CXX_LOG_DEBUG("Complete multi part upload request succeed. %s file uploaded successfully.", fileMetadata->srcFileToUpload.c_str());
-      return RemoteStorageRequestOutcome::SUCCESS;
+      // keep the upload so that next attempt only sends missing parts
+      CXX_LOG_WARN("Part %d of %s failed, keep upload %s to resume.",
+                   uploadParts[i].m_partNumber,
+                   fileMetadata->srcFileToUpload.c_str(), uploadId.c_str());
+      keepPendingUpload(fileFullPath, uploadId, fileMetadata);
+      return uploadParts[i].m_outcome;
     }
     else
     {
-      CXX_LOG_DEBUG("%s file upload failed.", fileMetadata->srcFileToUpload.c_str());
-      return handleError(outcome.GetError());
+      CXX_LOG_ERROR("Part %d of %s failed, abort upload %s.",
+                    uploadParts[i].m_partNumber,
+                    fileMetadata->srcFileToUpload.c_str(), uploadId.c_str());
+      abortMultiPartUpload(bucket, key, uploadId);
+      return uploadParts[i].m_outcome;
     }
   }
+
+  Aws::S3::Model::CompleteMultipartUploadRequest completeRequest;
+  completeRequest.WithBucket(bucket)
+                 .WithKey(key)
+                 .WithUploadId(uploadId)
+                 .WithMultipartUpload(completedMultipartUpload);
+
+  Aws::S3::Model::CompleteMultipartUploadOutcome outcome =
+    s3Client->CompleteMultipartUpload(completeRequest);
+
+  if (outcome.IsSuccess())
+  {
+    CXX_LOG_DEBUG("Complete multi part upload request succeed. %s file uploaded successfully.", fileMetadata->srcFileToUpload.c_str());
+    return RemoteStorageRequestOutcome::SUCCESS;
+  }
   else
   {
     CXX_LOG_DEBUG("%s file upload failed.", fileMetadata->srcFileToUpload.c_str());
-    return handleError(createMultiPartResp.GetError());
+    RemoteStorageRequestOutcome completeOutcome = handleError(outcome.GetError());
+    if (outcome.GetError().ShouldRetry() ||
+        completeOutcome == RemoteStorageRequestOutcome::TOKEN_EXPIRED)
+    {
+      keepPendingUpload(fileFullPath, uploadId, fileMetadata);
+    }
+    else
+    {
+      abortMultiPartUpload(bucket, key, uploadId);
+    }
+    return completeOutcome;
   }
 }
 
@@ -463,6 +793,7 @@ RemoteStorageRequestOutcome SnowflakeS3Client::doMultiPartDownload(
       else
       {
         ctx.m_outcome = handleError(outcome.GetError());
+        appender.SkipPart(ctx.m_partNumber);
       }
     });
   }
@@ -480,6 +811,134 @@ RemoteStorageRequestOutcome SnowflakeS3Client::doMultiPartDownload(
   return RemoteStorageRequestOutcome::SUCCESS;
 }
 
+RemoteStorageRequestOutcome SnowflakeS3Client::downloadToFile(
+  FileMetadata *fileMetadata)
+{
+  CXX_LOG_DEBUG("Start multi part download for file %s to %s, parallel: %d",
+               fileMetadata->srcFileName.c_str(),
+               fileMetadata->destPath.c_str(), m_parallel);
+
+  if (m_threadPool == nullptr)
+  {
+    m_threadPool = new Util::ThreadPool(m_parallel);
+  }
+
+  Util::FilePartWriter writer(fileMetadata->destPath);
+  if (!writer.isOpen())
+  {
+    CXX_LOG_ERROR("Could not open file %s to download: %s",
+                  fileMetadata->destPath.c_str(), std::strerror(errno));
+    return RemoteStorageRequestOutcome::FAILED;
+  }
+
+  std::string bucket, key;
+  extractBucketAndKey(&fileMetadata->srcFileName, bucket, key);
+  const long long fileSize = fileMetadata->srcFileSize;
+  const long long partSize = DOWNLOAD_DATA_SIZE_THRESHOLD;
+  const size_t blockSize = Crypto::cryptoAlgoBlockSize(Crypto::CryptoAlgo::AES);
+  unsigned int partNum = (unsigned int)((fileSize + partSize - 1) / partSize);
+
+  // every range but the first one starts one cipher block early, that block
+  // is the iv to decrypt the range with
+  std::vector<MultiDownloadCtx> downloadParts(partNum);
+  for (unsigned int i = 0; i < partNum; i++)
+  {
+    long long rangeStart = i * partSize - (i > 0 ? blockSize : 0);
+    long long rangeEnd = (std::min)((i + 1) * partSize, fileSize) - 1;
+    std::stringstream rangeStream;
+    rangeStream << "bytes=" << rangeStart << '-' << rangeEnd;
+
+    downloadParts[i].m_partNumber = i;
+    downloadParts[i].m_outcome = RemoteStorageRequestOutcome::FAILED;
+    downloadParts[i].getObjectRequest
+      .WithBucket(bucket)
+      .WithKey(key)
+      .WithRange(rangeStream.str());
+  }
+
+  std::vector<Util::ByteArrayStreamBuf *> cipherBufs(m_parallel, nullptr);
+  std::vector<Util::ByteArrayStreamBuf *> plainBufs(m_parallel, nullptr);
+
+  for (unsigned int i = 0; i < partNum; i++)
+  {
+    m_threadPool->AddJob([&, i]()-> void {
+      MultiDownloadCtx &ctx = downloadParts[i];
+      int tid = m_threadPool->GetThreadIdx();
+      if (cipherBufs[tid] == nullptr)
+      {
+        cipherBufs[tid] = new Util::ByteArrayStreamBuf(partSize + blockSize);
+        plainBufs[tid] = new Util::ByteArrayStreamBuf(partSize + blockSize);
+      }
+      Util::ByteArrayStreamBuf *buf = cipherBufs[tid];
+      buf->updateSize(buf->getCapacity());
+
+      CXX_LOG_DEBUG("Start downloading part %d, range: %s",
+                   ctx.m_partNumber, ctx.getObjectRequest.GetRange().c_str());
+      ctx.getObjectRequest.SetResponseStreamFactory([&buf]()-> Aws::IOStream *
+        { return Aws::New<Aws::IOStream>("SF_MULTI_PART_DOWNLOAD", buf); });
+
+      Aws::S3::Model::GetObjectOutcome outcome = s3Client->GetObject(
+        ctx.getObjectRequest);
+      if (!outcome.IsSuccess())
+      {
+        ctx.m_outcome = handleError(outcome.GetError());
+        return;
+      }
+
+      const char *iv = fileMetadata->encryptionMetadata.iv.data;
+      const char *data = buf->getDataBuffer();
+      size_t dataSize = (size_t)outcome.GetResult().GetContentLength();
+      if (i > 0)
+      {
+        iv = data;
+        data += blockSize;
+        dataSize -= blockSize;
+      }
+      size_t plainSize = EncryptionProvider::decryptPart(fileMetadata, iv,
+        data, dataSize, i == partNum - 1, plainBufs[tid]->getDataBuffer());
+
+      if (writer.WriteAt(plainBufs[tid]->getDataBuffer(), plainSize,
+                         i * partSize))
+      {
+        CXX_LOG_DEBUG("Download part %d succeed, download size: %ld",
+                     ctx.m_partNumber, (long)dataSize);
+        ctx.m_outcome = RemoteStorageRequestOutcome::SUCCESS;
+      }
+      else
+      {
+        CXX_LOG_ERROR("Failed to write part %d to file %s: %s",
+                      ctx.m_partNumber, fileMetadata->destPath.c_str(),
+                      std::strerror(errno));
+      }
+    });
+  }
+
+  m_threadPool->WaitAll();
+
+  for (unsigned int i = 0; i < cipherBufs.size(); i++)
+  {
+    delete cipherBufs[i];
+    delete plainBufs[i];
+  }
+
+  if (!writer.Close())
+  {
+    CXX_LOG_ERROR("Failed to close file %s: %s",
+                  fileMetadata->destPath.c_str(), std::strerror(errno));
+    return RemoteStorageRequestOutcome::FAILED;
+  }
+
+  for (unsigned int i = 0; i < partNum; i++)
+  {
+    if (downloadParts[i].m_outcome != RemoteStorageRequestOutcome::SUCCESS)
+    {
+      return downloadParts[i].m_outcome;
+    }
+  }
+
+  return RemoteStorageRequestOutcome::SUCCESS;
+}
+
 RemoteStorageRequestOutcome SnowflakeS3Client::doSingleDownload(
   FileMetadata *fileMetadata,
   std::basic_iostream<char> * dataStream)
@@ -9,12 +9,14 @@
 #include <aws/core/auth/AWSCredentialsProvider.h>
 #include <aws/s3/S3Client.h>
 #include <aws/s3/model/GetObjectRequest.h>
+#include <aws/s3/model/Part.h>
 #include "snowflake/IFileTransferAgent.hpp"
 #include "IStorageClient.hpp"
 #include "snowflake/PutGetParseResponse.hpp"
 #include "FileMetadata.hpp"
 #include "util/ThreadPool.hpp"
 #include "util/ByteArrayStreamBuf.hpp"
+#include <mutex>
 
 #ifdef _WIN32
  // see https://github.com/aws/aws-sdk-cpp/issues/402
@@ -42,6 +44,8 @@ struct MultiUploadCtx
     m_partNumber = partNumber;
     m_key = key;
     m_bucket = bucket;
+    m_outcome = RemoteStorageRequestOutcome::FAILED;
+    m_retryable = true;
   }
 
   /// in memory buffer used to store current part data
@@ -64,6 +68,9 @@ struct MultiUploadCtx
 
   /// upload outcome
   RemoteStorageRequestOutcome m_outcome;
+
+  /// false if the part failed with an error that retrying will not fix
+  bool m_retryable;
 };
 
 struct MultiDownloadCtx
@@ -81,6 +88,24 @@ struct MultiDownloadCtx
   RemoteStorageRequestOutcome m_outcome;
 };
 
+/**
+ * Credentials provider whose credentials can be replaced while the s3 client
+ * using it is alive, so that a cached client can be reused with the
+ * credentials of another command or a renewed token.
+ */
+class SnowflakeS3CredentialsProvider : public Aws::Auth::AWSCredentialsProvider
+{
+public:
+  Aws::Auth::AWSCredentials GetAWSCredentials() override;
+
+  void SetAWSCredentials(const Aws::Auth::AWSCredentials &credentials);
+
+private:
+  std::mutex m_credentialsMutex;
+
+  Aws::Auth::AWSCredentials m_credentials;
+};
+
 /**
  * Wrapper over Amazon s3 client
  */
@@ -116,13 +141,47 @@ public:
   RemoteStorageRequestOutcome GetRemoteFileMetadata(
     std::string * filePathFull, FileMetadata *fileMetadata);
 
-private:
-  Aws::SDKOptions options;
+  bool supportsDownloadToFile() override
+  {
+    return true;
+  }
+
+  /**
+   * Download ranges in parallel. Each range is fetched together with the
+   * last cipher block of the previous range, decrypted on its own and
+   * written at its offset in the destination file, so that one slow range
+   * does not hold the others back.
+   */
+  RemoteStorageRequestOutcome downloadToFile(FileMetadata *fileMetadata) override;
+
+  /**
+   * Swap credentials of the underlying s3 client in place.
+   */
+  bool renewCredentials(StageInfo *stageInfo) override;
+
+  /**
+   * Restore the key and iv of a multipart upload kept for resume, when the
+   * content to upload has the same digest.
+   */
+  bool restoreEncryptionMetadata(FileMetadata *fileMetadata) override;
 
+  /**
+   * Delete idle s3 clients kept for reuse and shut down aws sdk if no other
+   * client is alive.
+   */
+  static void releaseCachedClients();
+
+private:
   Aws::Client::ClientConfiguration clientConfiguration;
 
   Aws::S3::S3Client *s3Client;
 
+  /// credentials used by s3Client
+  std::shared_ptr<SnowflakeS3CredentialsProvider> m_credentialsProvider;
+
+  /// key of s3Client in the client cache
+  std::string m_cacheKey;
+
   StageInfo * m_stageInfo;
 
   Util::ThreadPool * m_threadPool;
@@ -163,6 +222,48 @@ private:
 
   void uploadParts(MultiUploadCtx * uploadCtx);
 
+  /**
+   * Get parts already uploaded to a multipart upload, used to resume it.
+   * @param uploadedParts part number to part (etag and size)
+   * @return false if upload can not be listed (e.g. no longer exists)
+   */
+  bool listUploadedParts(const std::string &bucket, const std::string &key,
+                         const Aws::String &uploadId,
+                         std::map<int, Aws::S3::Model::Part> &uploadedParts);
+
+  /**
+   * Abort multipart upload so that its parts are not left in the bucket.
+   */
+  void abortMultiPartUpload(const std::string &bucket, const std::string &key,
+                            const Aws::String &uploadId);
+
+  /**
+   * Multipart upload that failed and can be resumed. Parts already uploaded
+   * are encrypted with its key and iv, missing parts must use the same ones.
+   */
+  struct PendingUpload
+  {
+    Aws::String uploadId;
+
+    EncryptionMetadata encryptionMetadata;
+
+    /// digest of the content the parts were read from
+    std::string sha256Digest;
+  };
+
+  /// pending uploads, keyed on full path
+  std::map<std::string, PendingUpload> m_pendingUploads;
+
+  /**
+   * Keep upload for resume.
+   */
+  void keepPendingUpload(const std::string &fileFullPath,
+                         const Aws::String &uploadId,
+                         FileMetadata *fileMetadata);
+
+  /// protects m_pendingUploads
+  std::mutex m_pendingUploadsMutex;
+
   RemoteStorageRequestOutcome handleError(const Aws::Client::AWSError<Aws::S3::S3Errors> &error);
 
   void setMaxRetries(unsigned int maxRetries);
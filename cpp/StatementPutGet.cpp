@@ -79,6 +79,10 @@ bool StatementPutGet::parsePutGetCommand(std::string *sql,
             {"AWS_SECRET_KEY", response->stage_info->stage_cred->aws_secret_key},
             {"AWS_TOKEN",      response->stage_info->stage_cred->aws_token}
       };
+    if (response->stage_info->endPoint)
+    {
+      putGetParseResponse->stageInfo.endPoint = response->stage_info->endPoint;
+    }
   } else if (sf_strncasecmp(response->stage_info->location_type, "azure", 5) == 0)
   {
     putGetParseResponse->stageInfo.stageType = StageType::AZURE;
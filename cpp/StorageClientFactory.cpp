@@ -7,6 +7,7 @@
 #include "SnowflakeS3Client.hpp"
 #include "SnowflakeAzureClient.hpp"
 #include "SnowflakeGCSClient.hpp"
+#include "SnowflakeLocalFSClient.hpp"
 #include "logger/SFLogger.hpp"
 
 namespace Snowflake
@@ -35,6 +36,9 @@ IStorageClient * StorageClientFactory::getClient(StageInfo *stageInfo,
     case StageType::GCS:
       CXX_LOG_INFO("Creating GCS client");
       return new SnowflakeGCSClient(stageInfo, parallel, transferConfig, statement);
+    case StageType::LOCAL_FS:
+      CXX_LOG_INFO("Creating local fs client");
+      return new SnowflakeLocalFSClient(stageInfo, parallel, uploadThreshold, transferConfig);
     default:
       // invalid stage type
       throw SnowflakeTransferException(TransferError::UNSUPPORTED_FEATURE,
@@ -47,5 +51,10 @@ void StorageClientFactory::injectMockedClient(IStorageClient *client)
   injectedClient = client;
 }
 
+void StorageClientFactory::releaseCachedClients()
+{
+  SnowflakeS3Client::releaseCachedClients();
+}
+
 }
 }
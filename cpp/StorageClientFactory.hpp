@@ -40,6 +40,11 @@ public:
    */
   static void injectMockedClient(IStorageClient *client);
 
+  /**
+   * Release resources storage clients keep for reuse across commands.
+   */
+  static void releaseCachedClients();
+
 private:
 
   static IStorageClient * injectedClient;
@@ -3,13 +3,25 @@
  */
 
 #include <snowflake/Connection.hpp>
+#include <snowflake/Exceptions.hpp>
 
 Snowflake::Client::Connection::Connection() {
     this->m_connection = snowflake_init();
+    this->m_pool = nullptr;
+}
+
+Snowflake::Client::Connection::Connection(SF_CONNECT *connection_,
+                                          ConnectionPool *pool_) {
+    this->m_connection = connection_;
+    this->m_pool = pool_;
 }
 
 Snowflake::Client::Connection::~Connection() {
-    snowflake_term(this->m_connection);
+    if (this->m_pool) {
+        snowflake_pool_return(this->m_pool->m_pool, this->m_connection);
+    } else {
+        snowflake_term(this->m_connection);
+    }
 }
 
 void Snowflake::Client::Connection::connect() {
@@ -25,7 +37,39 @@ void Snowflake::Client::Connection::connect() {
 }
 
 void Snowflake::Client::Connection::setAttribute(SF_ATTRIBUTE type_, const void *value_) {
-    // TODO implement this
+    if (snowflake_set_attribute(this->m_connection, type_, value_) !=
+        SF_STATUS_SUCCESS) {
+        throw GeneralException(snowflake_error(this->m_connection));
+    }
+}
+
+Snowflake::Client::ConnectionPool::ConnectionPool(Connection &config_,
+                                                  uint64 minSize_,
+                                                  uint64 maxSize_,
+                                                  int64 maxIdleTime_) {
+    this->m_pool = snowflake_pool_init(config_.m_connection, minSize_,
+                                       maxSize_, maxIdleTime_);
+    if (!this->m_pool) {
+        throw GeneralException(snowflake_error(config_.m_connection));
+    }
 }
 
+Snowflake::Client::ConnectionPool::~ConnectionPool() {
+    snowflake_pool_term(this->m_pool);
+}
 
+Snowflake::Client::Connection *
+Snowflake::Client::ConnectionPool::borrow(int64 timeout_) {
+    SF_CONNECT *connection = nullptr;
+    // The error is this caller's copy, other callers fail concurrently
+    std::shared_ptr<SF_ERROR_STRUCT> error(
+        new SF_ERROR_STRUCT(), [](SF_ERROR_STRUCT *error_) {
+            snowflake_clear_error(error_);
+            delete error_;
+        });
+    if (snowflake_pool_borrow(this->m_pool, &connection, timeout_,
+                              error.get()) != SF_STATUS_SUCCESS) {
+        throw GeneralException(error);
+    }
+    return new Connection(connection, this);
+}
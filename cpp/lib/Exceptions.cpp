@@ -2,3 +2,41 @@
  * Copyright (c) 2018-2019 Snowflake Computing, Inc. All rights reserved.
  */
 
+#include <snowflake/Exceptions.hpp>
+
+SnowflakeException::SnowflakeException(SF_ERROR_STRUCT *error) {
+    this->error = error;
+}
+
+SnowflakeException::SnowflakeException(std::shared_ptr<SF_ERROR_STRUCT> error) {
+    this->error = error.get();
+    this->m_ownedError = error;
+}
+
+const char *SnowflakeException::what() const throw() {
+    return this->error->msg;
+}
+
+SF_STATUS SnowflakeException::code() {
+    return this->error->error_code;
+}
+
+const char *SnowflakeException::sqlstate() {
+    return this->error->sqlstate;
+}
+
+const char *SnowflakeException::msg() {
+    return this->error->msg;
+}
+
+const char *SnowflakeException::sfqid() {
+    return this->error->sfqid;
+}
+
+const char *SnowflakeException::file() {
+    return this->error->file;
+}
+
+int SnowflakeException::line() {
+    return this->error->line;
+}
@@ -4,6 +4,7 @@
 
 #include "SFLogger.hpp"
 #include "SecretDetector.hpp"
+#include <cstring>
 
 Snowflake::Client::ISFLogger *
   Snowflake::Client::SFLogger::m_externalLogger = nullptr;
@@ -24,6 +25,20 @@ void log_masked_va_list(FILE* fp, const char *fmt, va_list args)
   fprintf(fp, "%s", maskedMsg.c_str());
 }
 
+size_t log_masked_vsnprintf(char *buf, size_t size, const char *fmt,
+                            va_list args)
+{
+  std::string maskedMsg = Snowflake::Client::SFLogger::getMaskedMsgVA(fmt, args);
+  if (size == 0)
+  {
+    return maskedMsg.size();
+  }
+  size_t copyLen = maskedMsg.size() < size ? maskedMsg.size() : size - 1;
+  memcpy(buf, maskedMsg.c_str(), copyLen);
+  buf[copyLen] = '\0';
+  return maskedMsg.size();
+}
+
 std::string Snowflake::Client::SFLogger::getMaskedMsg(const char* fmt, ...)
 {
   va_list args;
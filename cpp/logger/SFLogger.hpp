@@ -28,59 +28,33 @@ public:
 private:
   static ISFLogger * m_externalLogger;
 
-#define CXX_LOG_FATAL(...)  \
+/**
+ * Log through the external logger if one is injected, otherwise through
+ * the C logger. Nothing is formatted or masked when the level is disabled.
+ */
+#define CXX_LOG_AT_LEVEL(level, ...)  \
   if (SFLogger::getExternalLogger() != NULL) \
   { \
-    SFLogger::getExternalLogger()->logLine(SF_LOG_LEVEL::SF_LOG_FATAL, __FILE__, \
-                                           SFLogger::getMaskedMsg(__VA_ARGS__).c_str()); \
-  } else { \
-    sf_log_fatal(CXX_LOG_NS, __VA_ARGS__); \
+    if (SFLogger::getExternalLogger()->isLevelEnabled(level)) \
+    { \
+      SFLogger::getExternalLogger()->logLine(level, __FILE__, \
+                                             SFLogger::getMaskedMsg(__VA_ARGS__).c_str()); \
+    } \
+  } else if (log_is_enabled(level)) { \
+    log_log(level, __FILE__, __LINE__, CXX_LOG_NS, __VA_ARGS__); \
   } \
 
-#define CXX_LOG_ERROR(...)  \
-  if (SFLogger::getExternalLogger() != NULL) \
-  { \
-    SFLogger::getExternalLogger()->logLine(SF_LOG_LEVEL::SF_LOG_ERROR, __FILE__, \
-                                           SFLogger::getMaskedMsg(__VA_ARGS__).c_str()); \
-  } else { \
-    sf_log_error(CXX_LOG_NS, __VA_ARGS__); \
-  } \
+#define CXX_LOG_FATAL(...) CXX_LOG_AT_LEVEL(SF_LOG_LEVEL::SF_LOG_FATAL, __VA_ARGS__)
 
-#define CXX_LOG_WARN(...)  \
-  if (SFLogger::getExternalLogger() != NULL) \
-  { \
-    SFLogger::getExternalLogger()->logLine(SF_LOG_LEVEL::SF_LOG_WARN, __FILE__, \
-                                           SFLogger::getMaskedMsg(__VA_ARGS__).c_str()); \
-  } else { \
-    sf_log_warn(CXX_LOG_NS, __VA_ARGS__); \
-  } \
+#define CXX_LOG_ERROR(...) CXX_LOG_AT_LEVEL(SF_LOG_LEVEL::SF_LOG_ERROR, __VA_ARGS__)
 
-#define CXX_LOG_INFO(...)  \
-  if (SFLogger::getExternalLogger() != NULL) \
-  { \
-    SFLogger::getExternalLogger()->logLine(SF_LOG_LEVEL::SF_LOG_INFO, __FILE__, \
-                                           SFLogger::getMaskedMsg(__VA_ARGS__).c_str()); \
-  } else { \
-    sf_log_info(CXX_LOG_NS, __VA_ARGS__); \
-  } \
+#define CXX_LOG_WARN(...) CXX_LOG_AT_LEVEL(SF_LOG_LEVEL::SF_LOG_WARN, __VA_ARGS__)
 
-#define CXX_LOG_DEBUG(...)  \
-  if (SFLogger::getExternalLogger() != NULL) \
-  { \
-    SFLogger::getExternalLogger()->logLine(SF_LOG_LEVEL::SF_LOG_DEBUG, __FILE__, \
-                                           SFLogger::getMaskedMsg(__VA_ARGS__).c_str()); \
-  } else { \
-    sf_log_debug(CXX_LOG_NS, __VA_ARGS__); \
-  } \
+#define CXX_LOG_INFO(...) CXX_LOG_AT_LEVEL(SF_LOG_LEVEL::SF_LOG_INFO, __VA_ARGS__)
 
-#define CXX_LOG_TRACE(...)  \
-  if (SFLogger::getExternalLogger() != NULL) \
-  { \
-    SFLogger::getExternalLogger()->logLine(SF_LOG_LEVEL::SF_LOG_TRACE, __FILE__, \
-                                           SFLogger::getMaskedMsg(__VA_ARGS__).c_str()); \
-  } else { \
-    sf_log_trace(CXX_LOG_NS, __VA_ARGS__); \
-  } \
+#define CXX_LOG_DEBUG(...) CXX_LOG_AT_LEVEL(SF_LOG_LEVEL::SF_LOG_DEBUG, __VA_ARGS__)
+
+#define CXX_LOG_TRACE(...) CXX_LOG_AT_LEVEL(SF_LOG_LEVEL::SF_LOG_TRACE, __VA_ARGS__)
 
 };
 
@@ -7,6 +7,35 @@ namespace Snowflake
 {
 namespace Client
 {
+namespace
+{
+  /// lower case keyword without which a pattern cannot match
+  struct Keyword
+  {
+    const char *word;
+    unsigned int patterns;
+  };
+
+  inline char toLowerAscii(char c)
+  {
+    return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+  }
+
+  /// true if the text at pos starts with the lower case keyword
+  inline bool matchKeyword(const std::string &text, size_t pos,
+                           const char *word)
+  {
+    for (; *word; ++word, ++pos)
+    {
+      if (pos >= text.size() || toLowerAscii(text[pos]) != *word)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+}
+
   std::regex SecretDetector::AWS_KEY_PATTERN = std::regex("(aws_key_id|aws_secret_key|access_key_id|secret_access_key)(\\s*=\\s*)'([^']+)'", std::regex::icase);
 
   std::regex SecretDetector::AWS_TOKEN_PATTERN = std::regex("(accessToken|tempToken|keySecret)\"\\s*:\\s*\"([A-Za-z0-9/+]{32,}={0,2})\"", std::regex::icase);
@@ -63,28 +92,109 @@ namespace Client
    */
   std::string SecretDetector::escape(std::string text)
   {
-    return std::regex_replace(text, SecretDetector::ESCAPE_PATTERN, "$1$1");
+    size_t count = 0;
+    for (char c : text)
+    {
+      if (c == '%' || c == '\\')
+      {
+        count++;
+      }
+    }
+    if (count == 0)
+    {
+      return text;
+    }
+
+    std::string escaped;
+    escaped.reserve(text.size() + count);
+    for (char c : text)
+    {
+      escaped.push_back(c);
+      if (c == '%' || c == '\\')
+      {
+        escaped.push_back(c);
+      }
+    }
+    return escaped;
   }
 
+  unsigned int SecretDetector::findCandidates(const std::string &text)
+  {
+    const unsigned int all = AWS_KEY | AWS_TOKEN | SAS_TOKEN | PRIVATE_KEY |
+                             PRIVATE_KEY_DATA | CONNECTION_TOKEN | PASSWORD;
+    static const Keyword keywords[] = {
+      // password, passcode
+      {"pass", PASSWORD | SAS_TOKEN},
+      {"pwd", PASSWORD},
+      {"token", CONNECTION_TOKEN},
+      {"assertion content", CONNECTION_TOKEN},
+      {"privatekeydata", PRIVATE_KEY_DATA},
+      {"-----begin private key-----", PRIVATE_KEY},
+      // sig, signature
+      {"sig", SAS_TOKEN},
+      {"awsaccesskeyid", SAS_TOKEN},
+      {"accesstoken", AWS_TOKEN},
+      {"temptoken", AWS_TOKEN},
+      {"keysecret", AWS_TOKEN},
+      {"aws_key_id", AWS_KEY},
+      {"aws_secret_key", AWS_KEY},
+      {"access_key_id", AWS_KEY},
+      {"secret_access_key", AWS_KEY},
+    };
+    const size_t keywordCount = sizeof(keywords) / sizeof(keywords[0]);
+
+    unsigned int candidates = 0;
+    for (size_t pos = 0; pos < text.size() && candidates != all; pos++)
+    {
+      char c = toLowerAscii(text[pos]);
+      for (size_t i = 0; i < keywordCount; i++)
+      {
+        if (keywords[i].word[0] == c &&
+            matchKeyword(text, pos, keywords[i].word))
+        {
+          candidates |= keywords[i].patterns;
+        }
+      }
+    }
+    return candidates;
+  }
+
+  /* Patterns are applied in the same order as before. Masking never adds
+   * a keyword to the text, so a pattern whose keyword is not in the
+   * original text cannot match after other patterns have been applied.
+   */
   std::string SecretDetector::maskSecrets(std::string text)
   {
-    return SecretDetector::escape(
-      SecretDetector::maskAwsKeys(
-        SecretDetector::maskAwsTokens(
-          SecretDetector::maskSasTokens(
-            SecretDetector::maskPrivateKey(
-              SecretDetector::maskPrivateKeyData(
-                SecretDetector::maskConnectionToken(
-                  SecretDetector::maskPassword(
-                    text
-                    )
-                  )
-                )
-              )
-            )
-          )
-        )
-      );
+    unsigned int candidates = findCandidates(text);
+    if (candidates & PASSWORD)
+    {
+      text = SecretDetector::maskPassword(std::move(text));
+    }
+    if (candidates & CONNECTION_TOKEN)
+    {
+      text = SecretDetector::maskConnectionToken(std::move(text));
+    }
+    if (candidates & PRIVATE_KEY_DATA)
+    {
+      text = SecretDetector::maskPrivateKeyData(std::move(text));
+    }
+    if (candidates & PRIVATE_KEY)
+    {
+      text = SecretDetector::maskPrivateKey(std::move(text));
+    }
+    if (candidates & SAS_TOKEN)
+    {
+      text = SecretDetector::maskSasTokens(std::move(text));
+    }
+    if (candidates & AWS_TOKEN)
+    {
+      text = SecretDetector::maskAwsTokens(std::move(text));
+    }
+    if (candidates & AWS_KEY)
+    {
+      text = SecretDetector::maskAwsKeys(std::move(text));
+    }
+    return SecretDetector::escape(std::move(text));
   }
 }
 }
@@ -13,6 +13,10 @@ namespace Client
 {
 /**
  * Class SecretDetector
+ *
+ * Every pattern needs one of a few keywords to match. The text is scanned
+ * once for those keywords and only patterns whose keyword is found are
+ * applied, so text without secrets is never run through std::regex.
  */
 class SecretDetector
 {
@@ -20,6 +24,24 @@ class SecretDetector
     static std::string maskSecrets(std::string); 
 
   private:
+    /// patterns that may match a text, see findCandidates()
+    enum Pattern
+    {
+      AWS_KEY = 1 << 0,
+      AWS_TOKEN = 1 << 1,
+      SAS_TOKEN = 1 << 2,
+      PRIVATE_KEY = 1 << 3,
+      PRIVATE_KEY_DATA = 1 << 4,
+      CONNECTION_TOKEN = 1 << 5,
+      PASSWORD = 1 << 6
+    };
+
+    /**
+     * Scan the text once for keywords of all patterns, case insensitive.
+     * @return bit mask of Pattern that may match the text
+     */
+    static unsigned int findCandidates(const std::string &text);
+
     static std::regex AWS_KEY_PATTERN;
     static std::regex AWS_TOKEN_PATTERN;
     static std::regex SAS_TOKEN_PATTERN;
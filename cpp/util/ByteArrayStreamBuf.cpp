@@ -6,6 +6,8 @@
 #include "ByteArrayStreamBuf.hpp"
 #include <cstring>
 
+#define SPLITTER_READ_AHEAD_BUFFERS 2
+
 Snowflake::Client::Util::ByteArrayStreamBuf::ByteArrayStreamBuf(
   unsigned int capacity) :
   m_capacity(capacity)
@@ -30,19 +32,91 @@ void * Snowflake::Client::Util::ByteArrayStreamBuf::updateSize(
   return nullptr;
 }
 
+std::streambuf::pos_type Snowflake::Client::Util::ByteArrayStreamBuf::seekoff(
+  off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which)
+{
+  if (!(which & std::ios_base::in))
+  {
+    return pos_type(off_type(-1));
+  }
+
+  off_type base = dir == std::ios_base::beg ? 0 :
+                  dir == std::ios_base::end ? (off_type)(egptr() - eback()) :
+                  (off_type)(gptr() - eback());
+  off_type target = base + off;
+  if (target < 0 || target > (off_type)(egptr() - eback()))
+  {
+    return pos_type(off_type(-1));
+  }
+  setg(eback(), eback() + target, egptr());
+  return pos_type(target);
+}
+
+std::streambuf::pos_type Snowflake::Client::Util::ByteArrayStreamBuf::seekpos(
+  pos_type pos, std::ios_base::openmode which)
+{
+  return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
 Snowflake::Client::Util::StreamSplitter::StreamSplitter(
   std::basic_iostream<char> *inputStream,
   unsigned int numOfBuffer,
   unsigned int partMaxSize) :
   m_inputStream(inputStream),
   m_partMaxSize(partMaxSize),
-  m_currentPartIndex(-1)
+  m_currentPartIndex(-1),
+  m_readEnds(false),
+  m_shutdown(false),
+  m_heldBuffers(numOfBuffer, nullptr)
 {
   _critical_section_init(&streamMutex);
-  for (unsigned int i=0; i<numOfBuffer; i++)
+  _cond_init(&m_bufferFreeCv);
+  _cond_init(&m_partReadyCv);
+  // one buffer held by each consumer, plus two for the reader so that it
+  // can fill one while the other is waiting to be picked up
+  for (unsigned int i=0; i<numOfBuffer + SPLITTER_READ_AHEAD_BUFFERS; i++)
   {
     buffers.push_back(new ByteArrayStreamBuf(partMaxSize));
+    m_freeBuffers.push_back(buffers.back());
+  }
+  _thread_init(&m_readerThread, readerThread, (void *)this);
+}
+
+void * Snowflake::Client::Util::StreamSplitter::readerThread(void *arg)
+{
+  static_cast<StreamSplitter *>(arg)->readParts();
+  return nullptr;
+}
+
+void Snowflake::Client::Util::StreamSplitter::readParts()
+{
+  _critical_section_lock(&streamMutex);
+  while (!m_readEnds && !m_shutdown)
+  {
+    while (m_freeBuffers.empty() && !m_shutdown)
+    {
+      _cond_wait(&m_bufferFreeCv, &streamMutex);
+    }
+    if (m_shutdown)
+    {
+      break;
+    }
+    ByteArrayStreamBuf * buf = m_freeBuffers.front();
+    m_freeBuffers.pop_front();
+    _critical_section_unlock(&streamMutex);
+
+    // only this thread touches the input stream, read outside of the lock
+    m_inputStream->read(buf->getDataBuffer(), m_partMaxSize);
+    long readSize = (long)m_inputStream->gcount();
+    buf->updateSize(readSize);
+
+    _critical_section_lock(&streamMutex);
+    m_currentPartIndex ++;
+    m_readyParts.emplace_back(m_currentPartIndex, buf);
+    m_readEnds = readSize < (long)m_partMaxSize;
+    _cond_broadcast(&m_partReadyCv);
   }
+  _critical_section_unlock(&streamMutex);
 }
 
 Snowflake::Client::Util::ByteArrayStreamBuf*
@@ -50,19 +124,50 @@ Snowflake::Client::Util::StreamSplitter::FillAndGetBuf(
   int bufIndex, int &partIndex)
 {
   _critical_section_lock(&streamMutex);
-  ByteArrayStreamBuf * buf = buffers[bufIndex];
-  memset(buf->getDataBuffer(), 0, m_partMaxSize);
-  m_inputStream->read(buf->getDataBuffer(), m_partMaxSize);
-  buf->updateSize((long)m_inputStream->gcount());
-  m_currentPartIndex ++;
-  partIndex = m_currentPartIndex;
+  if (m_heldBuffers[bufIndex] != nullptr)
+  {
+    m_freeBuffers.push_back(m_heldBuffers[bufIndex]);
+    m_heldBuffers[bufIndex] = nullptr;
+    _cond_signal(&m_bufferFreeCv);
+  }
+
+  while (m_readyParts.empty() && !m_readEnds)
+  {
+    _cond_wait(&m_partReadyCv, &streamMutex);
+  }
+
+  ByteArrayStreamBuf * buf;
+  if (!m_readyParts.empty())
+  {
+    partIndex = m_readyParts.front().first;
+    buf = m_readyParts.front().second;
+    m_readyParts.pop_front();
+  }
+  else
+  {
+    // asked for more parts than stream has, hand out an empty one
+    buf = m_freeBuffers.front();
+    m_freeBuffers.pop_front();
+    buf->updateSize(0);
+    m_currentPartIndex ++;
+    partIndex = m_currentPartIndex;
+  }
+  m_heldBuffers[bufIndex] = buf;
   _critical_section_unlock(&streamMutex);
   return buf;
 }
 
 Snowflake::Client::Util::StreamSplitter::~StreamSplitter()
 {
+  _critical_section_lock(&streamMutex);
+  m_shutdown = true;
+  _cond_broadcast(&m_bufferFreeCv);
+  _critical_section_unlock(&streamMutex);
+  _thread_join(m_readerThread);
+
   _critical_section_term(&streamMutex);
+  _cond_term(&m_bufferFreeCv);
+  _cond_term(&m_partReadyCv);
   for (unsigned int i=0; i<buffers.size(); i++)
   {
     delete buffers[i];
@@ -138,3 +243,15 @@ void Snowflake::Client::Util::StreamAppender::WritePartToOutputStream(
   _cond_broadcast(&m_streamCv);
   _critical_section_unlock(&m_streamMutex);
 }
+
+void Snowflake::Client::Util::StreamAppender::SkipPart(int partIndex)
+{
+  _critical_section_lock(&m_streamMutex);
+  while(partIndex > m_currentPartIndex)
+  {
+    _cond_wait(&m_streamCv, &m_streamMutex);
+  }
+  m_currentPartIndex ++;
+  _cond_broadcast(&m_streamCv);
+  _critical_section_unlock(&m_streamMutex);
+}
@@ -45,6 +45,15 @@ public:
     return size;
   }
 
+protected:
+  /**
+   * Seek within read area, clients computing content length of an input
+   * stream seek to its end and back.
+   */
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                   std::ios_base::openmode which) override;
+
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
 
 private:
   const unsigned int m_capacity;
@@ -56,6 +65,10 @@ private:
 
 /**
  * Split stream into parts. Manage in memory buffer to be reused.
+ *
+ * Parts are read ahead by a dedicated reader thread with double buffering,
+ * so that reading (and encrypting) the input stream overlaps with consumers
+ * uploading the parts they already hold.
  */
 class StreamSplitter
 {
@@ -67,7 +80,9 @@ public:
   ~StreamSplitter();
 
   /**
-   * Read data from input stream into in memory buffer
+   * Get next part of input stream. Buffer previously returned to the same
+   * bufIndex is given back to the reader, so a consumer must be done with it
+   * before asking for the next part.
    */
   ByteArrayStreamBuf * FillAndGetBuf(int bufIndex, int &partIndex);
 
@@ -75,9 +90,23 @@ public:
   unsigned int getTotalParts(long long int streamSize);
 
 private:
-  /// mutex for threads to read data
+  static void * readerThread(void * arg);
+
+  /// read parts from input stream until it ends or splitter is destroyed
+  void readParts();
+
+  /// mutex protecting buffer queues
   SF_CRITICAL_SECTION_HANDLE streamMutex;
 
+  /// signaled when a buffer is given back to the reader
+  SF_CONDITION_HANDLE m_bufferFreeCv;
+
+  /// signaled when a part has been read
+  SF_CONDITION_HANDLE m_partReadyCv;
+
+  /// reader thread
+  SF_THREAD_HANDLE m_readerThread;
+
   /// input stream to be splitted.
   std::basic_iostream<char> * m_inputStream;
 
@@ -87,8 +116,23 @@ private:
   /// current parts have been read
   int m_currentPartIndex;
 
+  /// true if input stream has been consumed
+  bool m_readEnds;
+
+  /// true if splitter is being destroyed
+  bool m_shutdown;
+
   /// array of in memory buffer
   std::vector<ByteArrayStreamBuf *> buffers;
+
+  /// buffer currently held by each consumer
+  std::vector<ByteArrayStreamBuf *> m_heldBuffers;
+
+  /// buffers available to the reader
+  std::deque<ByteArrayStreamBuf *> m_freeBuffers;
+
+  /// parts read and not yet handed to a consumer
+  std::deque<std::pair<int, ByteArrayStreamBuf *>> m_readyParts;
 };
 
 /**
@@ -108,6 +152,13 @@ public:
    */
   void WritePartToOutputStream(int threadId, int partIndex);
 
+  /**
+   * Give up a part that failed to download. Waits for its turn like
+   * WritePartToOutputStream so that threads holding later parts are not
+   * blocked forever, but nothing is written.
+   */
+  void SkipPart(int partIndex);
+
   /**
    * Get in memory buffer to store the data downloaded before writing to
    * output stream
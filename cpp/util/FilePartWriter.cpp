@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#include "FilePartWriter.hpp"
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+Snowflake::Client::Util::FilePartWriter::FilePartWriter(
+  const std::string &filePath)
+{
+#ifdef _WIN32
+  _critical_section_init(&m_writeMutex);
+  m_fd = _open(filePath.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY,
+               _S_IREAD | _S_IWRITE);
+#else
+  m_fd = open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+#endif
+}
+
+Snowflake::Client::Util::FilePartWriter::~FilePartWriter()
+{
+  Close();
+#ifdef _WIN32
+  _critical_section_term(&m_writeMutex);
+#endif
+}
+
+bool Snowflake::Client::Util::FilePartWriter::WriteAt(const char *data,
+                                                      size_t len,
+                                                      long long offset)
+{
+#ifdef _WIN32
+  _critical_section_lock(&m_writeMutex);
+  bool ret = _lseeki64(m_fd, offset, SEEK_SET) == offset;
+  while (ret && len > 0)
+  {
+    int written = _write(m_fd, data, (unsigned int)len);
+    if (written <= 0)
+    {
+      ret = false;
+      break;
+    }
+    data += written;
+    len -= written;
+  }
+  _critical_section_unlock(&m_writeMutex);
+  return ret;
+#else
+  while (len > 0)
+  {
+    ssize_t written = pwrite(m_fd, data, len, (off_t)offset);
+    if (written < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return false;
+    }
+    data += written;
+    len -= (size_t)written;
+    offset += written;
+  }
+  return true;
+#endif
+}
+
+bool Snowflake::Client::Util::FilePartWriter::Close()
+{
+  if (m_fd < 0)
+  {
+    return true;
+  }
+#ifdef _WIN32
+  int ret = _close(m_fd);
+#else
+  int ret = close(m_fd);
+#endif
+  m_fd = -1;
+  return ret == 0;
+}
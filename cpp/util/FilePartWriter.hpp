@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#ifndef SNOWFLAKECLIENT_FILEPARTWRITER_HPP
+#define SNOWFLAKECLIENT_FILEPARTWRITER_HPP
+
+#include <string>
+#include <snowflake/platform.h>
+
+namespace Snowflake
+{
+namespace Client
+{
+namespace Util
+{
+
+/**
+ * Write parts of a file at their own offset. Parts can be written by
+ * multiple threads in any order.
+ */
+class FilePartWriter
+{
+public:
+  /**
+   * Open (and truncate) the target file.
+   */
+  FilePartWriter(const std::string &filePath);
+
+  ~FilePartWriter();
+
+  inline bool isOpen()
+  {
+    return m_fd >= 0;
+  }
+
+  /**
+   * Write whole buffer at given offset of the file.
+   * @return false if write failed, errno is set.
+   */
+  bool WriteAt(const char *data, size_t len, long long offset);
+
+  /**
+   * Close the file.
+   * @return false if close failed, errno is set.
+   */
+  bool Close();
+
+private:
+  /// file descriptor of the target file
+  int m_fd;
+
+#ifdef _WIN32
+  /// no positional write on windows, seek and write under a lock
+  SF_CRITICAL_SECTION_HANDLE m_writeMutex;
+#endif
+};
+
+}
+}
+}
+
+#endif //SNOWFLAKECLIENT_FILEPARTWRITER_HPP
@@ -14,6 +14,8 @@
 #include <vector>
 #include <deque>
 #include <functional>
+#include <future>
+#include <memory>
 #include <atomic>
 #include <cstring>
 #include "snowflake/platform.h"
@@ -29,25 +31,83 @@ namespace Util
 {
 
 /**
- * A naive implementation of thread pool
+ * Priority of a job. High priority jobs (e.g. metadata requests, small
+ * files) are taken by any idle worker before normal ones.
+ */
+enum class JobPriority
+{
+  NORMAL,
+  HIGH
+};
+
+/**
+ * Thread pool with one job queue per worker.
+ *
+ * Jobs added from outside the pool are spread over worker queues round
+ * robin, jobs added by a worker go to its own queue. A worker takes jobs
+ * from the front of its own queue and steals from the front of other
+ * queues when its own is empty, so jobs of a queue start in the order
+ * they were added. High priority jobs go to a shared queue that is always
+ * checked first.
+ *
+ * If maxQueuedJobs is not 0, adding a job from outside the pool blocks
+ * while that many jobs are waiting to start.
+ *
+ * Adding, taking and finishing a job only lock the queue the job is in.
+ * queue_mutex is taken to put idle workers, blocked producers and
+ * WaitAll to sleep and to wake them, and only when one of them sleeps.
  */
 class ThreadPool {
 private:
 
+  /// job queue owned by one worker
+  struct WorkerQueue
+  {
+    SF_CRITICAL_SECTION_HANDLE mutex;
+
+    std::deque<std::function<void(void)>> jobs;
+  };
+
   /// thread count
   const unsigned int threadCount;
 
+  /// max number of jobs waiting to start, 0 for no limit
+  const size_t maxQueuedJobs;
+
   /// threads vector
   std::vector<SF_THREAD_HANDLE > threads;
 
-  /// task queue
-  std::deque<std::function<void(void)>> queue;
+  /// per worker job queues
+  std::vector<WorkerQueue *> workerQueues;
+
+  /// high priority jobs, guarded by highPriorityMutex
+  std::deque<std::function<void(void)>> highPriorityQueue;
+
+  SF_CRITICAL_SECTION_HANDLE highPriorityMutex;
+
+  /// jobs in highPriorityQueue
+  std::atomic<size_t> highPriorityJobs;
+
+  /// jobs added and not yet taken by a worker
+  std::atomic<size_t> pendingJobs;
+
+  /// jobs being executed
+  std::atomic<unsigned int> runningJobs;
 
-  /// threads not sleeping (initialize to thread count)
-  unsigned int busyThreads;
+  /// workers sleeping on job_available_var
+  std::atomic<unsigned int> idleWorkers;
+
+  /// producers sleeping on queue_not_full_var
+  std::atomic<unsigned int> blockedProducers;
+
+  /// threads sleeping in WaitAll
+  std::atomic<unsigned int> waiters;
+
+  /// worker queue that next job from outside the pool goes to
+  std::atomic<unsigned int> nextQueue;
 
   /// true if thread pool is going to be shutdown
-  bool finished;
+  std::atomic<bool> finished;
 
   /// condition variable that threads wait on task queue
   SF_CONDITION_HANDLE job_available_var;
@@ -55,7 +115,10 @@ private:
   /// cv that main threads wait on all worker to finish task queue
   SF_CONDITION_HANDLE wait_var;
 
-  /// queue mutex
+  /// cv that producers wait on when queue is full
+  SF_CONDITION_HANDLE queue_not_full_var;
+
+  /// mutex that threads sleep on condition variables with
   SF_CRITICAL_SECTION_HANDLE queue_mutex;
 
 #ifdef _WIN32
@@ -88,7 +151,7 @@ private:
 #else
     pthread_setspecific(*ctx->key, &ctx->threadIdx);
 #endif
-    ctx->tp->execute_thread();
+    ctx->tp->execute_thread(ctx->threadIdx);
     delete ctx;
 #ifdef _WIN32
     delete lpData;
@@ -96,52 +159,133 @@ private:
     return nullptr;
   }
 
+  /// @return index of calling worker, -1 if not called from the pool
+  int currentWorkerIdx()
+  {
+#ifdef _WIN32
+    void *idx = TlsGetValue(key);
+#else
+    void *idx = pthread_getspecific(key);
+#endif
+    return idx == nullptr ? -1 : *(int *)idx;
+  }
+
   /**
-   *  Get the next job; pop the first item in the queue,
-   *  otherwise wait for a signal from the main thread.
+   * Take a job from the front of a queue. The job is counted as running
+   * before it stops being pending, so WaitAll never sees both at 0 while
+   * a job is moving between them.
+   * @param queuedJobs counter of the queue to decrease, may be null
+   * @return false if the queue is empty
    */
-  void execute_thread() {
-    std::function<void(void)> res;
-    while(true)
+  bool popJob(SF_CRITICAL_SECTION_HANDLE *mutex,
+              std::deque<std::function<void(void)>> &jobs,
+              std::function<void(void)> &job,
+              std::atomic<size_t> *queuedJobs = nullptr)
+  {
+    bool found = false;
+    _critical_section_lock(mutex);
+    if (!jobs.empty())
     {
-      _critical_section_lock(&queue_mutex);
-
-      busyThreads --;
-      if (busyThreads == 0)
-        _cond_signal(&wait_var);
+      runningJobs ++;
+      job = std::move(jobs.front());
+      jobs.pop_front();
+      if (queuedJobs != nullptr)
+      {
+        (*queuedJobs) --;
+      }
+      pendingJobs --;
+      found = true;
+    }
+    _critical_section_unlock(mutex);
+    return found;
+  }
 
-      // Wait for a job if we don't have any.
-      while (queue.empty() && !finished)
+  /**
+   * Take the next job: high priority queue first, then own queue, then
+   * steal from other workers.
+   * @return false if all queues are empty
+   */
+  bool takeJob(unsigned int threadIdx, std::function<void(void)> &job)
+  {
+    if (highPriorityJobs > 0 &&
+        popJob(&highPriorityMutex, highPriorityQueue, job, &highPriorityJobs))
+    {
+      return true;
+    }
+    for (unsigned int i = 0; i < threadCount; i++)
+    {
+      WorkerQueue *workerQueue = workerQueues[(threadIdx + i) % threadCount];
+      if (popJob(&workerQueue->mutex, workerQueue->jobs, job))
       {
-        _cond_wait(&job_available_var, &queue_mutex);
+        return true;
       }
+    }
+    return false;
+  }
 
-      // Get job from the queue
-      if (finished)
+  /// wake producers blocked on a full queue, if any
+  void notifyNotFull()
+  {
+    if (blockedProducers > 0)
+    {
+      _critical_section_lock(&queue_mutex);
+      _cond_broadcast(&queue_not_full_var);
+      _critical_section_unlock(&queue_mutex);
+    }
+  }
+
+  /// wake threads in WaitAll, if any, once no job is left
+  void notifyIfDone()
+  {
+    if (waiters > 0 && runningJobs == 0 && pendingJobs == 0)
+    {
+      _critical_section_lock(&queue_mutex);
+      _cond_broadcast(&wait_var);
+      _critical_section_unlock(&queue_mutex);
+    }
+  }
+
+  /**
+   *  Run jobs until the pool is shut down. Sleep on job_available_var
+   *  only when every queue is empty.
+   */
+  void execute_thread(unsigned int threadIdx) {
+    std::function<void(void)> res;
+    while (!finished)
+    {
+      if (!takeJob(threadIdx, res))
       {
+        _critical_section_lock(&queue_mutex);
+        idleWorkers ++;
+        // a job counted as pending may not be in its queue yet, look again
+        while (pendingJobs == 0 && !finished)
+        {
+          _cond_wait(&job_available_var, &queue_mutex);
+        }
+        idleWorkers --;
         _critical_section_unlock(&queue_mutex);
-        break;
+        continue;
       }
-      else
+
+      if (maxQueuedJobs > 0)
       {
-        busyThreads ++;
-        res = queue.front();
-        queue.pop_front();
-        _critical_section_unlock(&queue_mutex);
-        res();
+        notifyNotFull();
       }
+      res();
+      res = nullptr;
+
+      runningJobs --;
+      notifyIfDone();
     }
   }
 
-public:
-  ThreadPool(unsigned int threadNum)
-    : finished( false )
-    , threadCount (threadNum)
-    , busyThreads (threadNum)
+  void init()
   {
     _critical_section_init(&queue_mutex);
+    _critical_section_init(&highPriorityMutex);
     _cond_init(&job_available_var);
     _cond_init(&wait_var);
+    _cond_init(&queue_not_full_var);
 
 #ifdef _WIN32
     key = TlsAlloc();
@@ -161,6 +305,13 @@ public:
     }
 #endif
 
+    for( unsigned i = 0; i < threadCount; ++i )
+    {
+      WorkerQueue *workerQueue = new WorkerQueue;
+      _critical_section_init(&workerQueue->mutex);
+      workerQueues.push_back(workerQueue);
+    }
+
     for( unsigned i = 0; i < threadCount; ++i )
     {
       SF_THREAD_HANDLE tid;
@@ -174,6 +325,42 @@ public:
     }
   }
 
+public:
+  ThreadPool(unsigned int threadNum)
+    : threadCount (threadNum)
+    , maxQueuedJobs (0)
+    , highPriorityJobs (0)
+    , pendingJobs (0)
+    , runningJobs (0)
+    , idleWorkers (0)
+    , blockedProducers (0)
+    , waiters (0)
+    , nextQueue (0)
+    , finished( false )
+  {
+    init();
+  }
+
+  /**
+   * @param threadNum number of worker threads
+   * @param maxQueuedJobs number of jobs waiting to start above which
+   *        adding a job blocks, 0 for no limit
+   */
+  ThreadPool(unsigned int threadNum, size_t maxQueuedJobs)
+    : threadCount (threadNum)
+    , maxQueuedJobs (maxQueuedJobs)
+    , highPriorityJobs (0)
+    , pendingJobs (0)
+    , runningJobs (0)
+    , idleWorkers (0)
+    , blockedProducers (0)
+    , waiters (0)
+    , nextQueue (0)
+    , finished( false )
+  {
+    init();
+  }
+
   int GetThreadIdx()
   {
 #ifdef _WIN32
@@ -196,37 +383,142 @@ public:
 #else
     pthread_key_delete(key);
 #endif
+    for (auto workerQueue : workerQueues)
+    {
+      _critical_section_term(&workerQueue->mutex);
+      delete workerQueue;
+    }
     _critical_section_term(&queue_mutex);
+    _critical_section_term(&highPriorityMutex);
     _cond_term(&job_available_var);
     _cond_term(&wait_var);
+    _cond_term(&queue_not_full_var);
   }
 
   /**
-   *  Add a new job to the pool. If there are no jobs in the queue,
-   *  a thread is woken up to take the job. If all threads are busy,
-   *  the job is added to the end of the queue.
+   *  Add a new job to the pool. High priority jobs go to the shared high
+   *  priority queue, others to the end of a worker queue. A sleeping
+   *  worker is woken up to take the job.
+   *  Blocks while the queue is full, unless called from a worker, which
+   *  could otherwise wait for itself. Producers adding at the same time
+   *  may go over maxQueuedJobs by one job each.
    */
-  void AddJob( std::function<void(void)> job ) {
-    _critical_section_lock(&queue_mutex);
-    queue.emplace_back( job );
-    _cond_signal(&job_available_var);
-    _critical_section_unlock(&queue_mutex);
+  void AddJob( std::function<void(void)> job,
+               JobPriority priority = JobPriority::NORMAL ) {
+    int workerIdx = currentWorkerIdx();
+
+    if (maxQueuedJobs > 0 && workerIdx < 0 && pendingJobs >= maxQueuedJobs)
+    {
+      _critical_section_lock(&queue_mutex);
+      blockedProducers ++;
+      while (pendingJobs >= maxQueuedJobs && !finished)
+      {
+        _cond_wait(&queue_not_full_var, &queue_mutex);
+      }
+      blockedProducers --;
+      _critical_section_unlock(&queue_mutex);
+    }
+
+    // counted before it is queued so that it is never taken uncounted
+    pendingJobs ++;
+    if (priority == JobPriority::HIGH)
+    {
+      _critical_section_lock(&highPriorityMutex);
+      highPriorityQueue.emplace_back(std::move(job));
+      highPriorityJobs ++;
+      _critical_section_unlock(&highPriorityMutex);
+    }
+    else
+    {
+      unsigned int queueIdx = workerIdx >= 0 ? (unsigned int)workerIdx :
+                              nextQueue++ % threadCount;
+      WorkerQueue *workerQueue = workerQueues[queueIdx];
+      _critical_section_lock(&workerQueue->mutex);
+      workerQueue->jobs.emplace_back(std::move(job));
+      _critical_section_unlock(&workerQueue->mutex);
+    }
+
+    if (idleWorkers > 0)
+    {
+      _critical_section_lock(&queue_mutex);
+      _cond_signal(&job_available_var);
+      _critical_section_unlock(&queue_mutex);
+    }
+  }
+
+  /**
+   * Add a new job and get a future of its result. Exception thrown by
+   * the job is stored in the future. If the job is dropped by
+   * CancelPendingJobs, the future gets a broken_promise error.
+   */
+  template <typename F>
+  std::future<typename std::result_of<F()>::type> submit(
+    F job, JobPriority priority = JobPriority::NORMAL)
+  {
+    typedef typename std::result_of<F()>::type ResultType;
+    std::shared_ptr<std::packaged_task<ResultType()>> task =
+      std::make_shared<std::packaged_task<ResultType()>>(std::move(job));
+    std::future<ResultType> result = task->get_future();
+    AddJob([task]() { (*task)(); }, priority);
+    return result;
+  }
+
+  /**
+   * Drop jobs that have not started yet. Running jobs are not affected.
+   * @return number of jobs dropped
+   */
+  size_t CancelPendingJobs()
+  {
+    std::vector<std::function<void(void)>> dropped;
+    _critical_section_lock(&highPriorityMutex);
+    for (auto &job : highPriorityQueue)
+    {
+      dropped.push_back(std::move(job));
+    }
+    highPriorityJobs -= highPriorityQueue.size();
+    pendingJobs -= highPriorityQueue.size();
+    highPriorityQueue.clear();
+    _critical_section_unlock(&highPriorityMutex);
+
+    for (unsigned int i = 0; i < threadCount; i++)
+    {
+      WorkerQueue *workerQueue = workerQueues[i];
+      _critical_section_lock(&workerQueue->mutex);
+      for (auto &job : workerQueue->jobs)
+      {
+        dropped.push_back(std::move(job));
+      }
+      pendingJobs -= workerQueue->jobs.size();
+      workerQueue->jobs.clear();
+      _critical_section_unlock(&workerQueue->mutex);
+    }
+    notifyNotFull();
+    notifyIfDone();
+
+    // destroy jobs outside of the lock, futures of them are notified
+    size_t numDropped = dropped.size();
+    dropped.clear();
+    return numDropped;
   }
 
   /**
    *  Join with all threads. Block until all threads have completed.
-   *  Params: WaitForAll: If true, will wait for the queue to empty
-   *          before joining with threads. If false, will complete
-   *          current jobs, then inform the threads to exit.
-   *  The queue will be empty after this call, and the threads will
-   *  be done. After invoking `ThreadPool::JoinAll`, the pool can no
+   *  Jobs that are running are completed, then threads are informed
+   *  to exit. The queue will be empty after this call, and the threads
+   *  will be done. After invoking `ThreadPool::JoinAll`, the pool can no
    *  longer be used. If you need the pool to exist past completion
    *  of jobs, look to use `ThreadPool::WaitAll`.
    */
   void JoinAll() {
     _critical_section_lock(&queue_mutex);
+    if (finished)
+    {
+      _critical_section_unlock(&queue_mutex);
+      return;
+    }
     finished = true;
     _cond_broadcast(&job_available_var);
+    _cond_broadcast(&queue_not_full_var);
     _critical_section_unlock(&queue_mutex);
 
     for (auto &x : threads)
@@ -240,10 +532,12 @@ public:
    */
   void WaitAll() {
     _critical_section_lock(&queue_mutex);
-    while(busyThreads > 0 || !queue.empty())
+    waiters ++;
+    while(runningJobs > 0 || pendingJobs > 0)
     {
       _cond_wait(&wait_var, &queue_mutex);
     }
+    waiters --;
     _critical_section_unlock(&queue_mutex);
   }
 };
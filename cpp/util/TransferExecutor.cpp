@@ -0,0 +1,300 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#include <mutex>
+#include <algorithm>
+#include "TransferExecutor.hpp"
+#include "snowflake/SnowflakeTransferException.hpp"
+#include "../logger/SFLogger.hpp"
+
+namespace Snowflake
+{
+namespace Client
+{
+namespace Util
+{
+
+namespace
+{
+  /// protects all statics below
+  std::mutex s_executorMutex;
+
+  TransferExecutor *s_executor = nullptr;
+
+  unsigned int s_maxThreads = TRANSFER_EXECUTOR_DEFAULT_THREADS;
+
+  size_t s_maxInFlightBytes = 0;
+}
+
+TransferExecutor *TransferExecutor::getInstance()
+{
+  std::lock_guard<std::mutex> guard(s_executorMutex);
+  if (s_executor == nullptr)
+  {
+    s_executor = new TransferExecutor(s_maxThreads, s_maxInFlightBytes);
+  }
+  return s_executor;
+}
+
+void TransferExecutor::configure(unsigned int maxThreads,
+                                 size_t maxInFlightBytes)
+{
+  std::lock_guard<std::mutex> guard(s_executorMutex);
+  if (maxThreads > 0)
+  {
+    s_maxThreads = maxThreads;
+  }
+  s_maxInFlightBytes = maxInFlightBytes;
+  CXX_LOG_INFO("Transfer executor max threads: %u, max in flight bytes: %llu",
+               s_maxThreads, (unsigned long long)s_maxInFlightBytes);
+
+  if (s_executor != nullptr)
+  {
+    _critical_section_lock(&s_executor->m_mutex);
+    s_executor->m_maxThreads = s_maxThreads;
+    s_executor->m_maxInFlightBytes = s_maxInFlightBytes;
+    // a raised limit may let queued jobs start
+    _cond_broadcast(&s_executor->m_jobAvailable);
+    _critical_section_unlock(&s_executor->m_mutex);
+  }
+}
+
+void TransferExecutor::shutdown()
+{
+  std::lock_guard<std::mutex> guard(s_executorMutex);
+  delete s_executor;
+  s_executor = nullptr;
+}
+
+TransferExecutor::TransferExecutor(unsigned int maxThreads,
+                                   size_t maxInFlightBytes) :
+  m_nextGroup(0),
+  m_maxThreads(maxThreads),
+  m_maxInFlightBytes(maxInFlightBytes),
+  m_inFlightBytes(0),
+  m_runningJobs(0),
+  m_idleThreads(0),
+  m_finished(false)
+{
+  _critical_section_init(&m_mutex);
+  _cond_init(&m_jobAvailable);
+}
+
+TransferExecutor::~TransferExecutor()
+{
+  _critical_section_lock(&m_mutex);
+  m_finished = true;
+  _cond_broadcast(&m_jobAvailable);
+  _critical_section_unlock(&m_mutex);
+
+  for (auto &thread : m_threads)
+  {
+    _thread_join(thread);
+  }
+  CXX_LOG_DEBUG("Transfer executor stopped %d threads.", (int)m_threads.size());
+
+  _cond_term(&m_jobAvailable);
+  _critical_section_term(&m_mutex);
+}
+
+size_t TransferExecutor::getInFlightBytes()
+{
+  _critical_section_lock(&m_mutex);
+  size_t bytes = m_inFlightBytes;
+  _critical_section_unlock(&m_mutex);
+  return bytes;
+}
+
+void *TransferExecutor::workerThread(void *arg)
+{
+  static_cast<TransferExecutor *>(arg)->execute();
+  return nullptr;
+}
+
+bool TransferExecutor::pickJob(TransferGroup *&group, Job &job)
+{
+  if (m_runningJobs >= m_maxThreads)
+  {
+    return false;
+  }
+
+  size_t groupCount = m_groups.size();
+  for (size_t i = 0; i < groupCount; i++)
+  {
+    size_t idx = (m_nextGroup + i) % groupCount;
+    TransferGroup *candidate = m_groups[idx];
+    if (candidate->m_jobs.empty() ||
+        candidate->m_runningJobs >= candidate->m_parallel)
+    {
+      continue;
+    }
+
+    size_t bytes = candidate->m_jobs.front().bytes;
+    if (m_maxInFlightBytes > 0 && m_inFlightBytes > 0 &&
+        m_inFlightBytes + bytes > m_maxInFlightBytes)
+    {
+      // keep its turn so that it starts as soon as enough bytes finish
+      m_nextGroup = idx;
+      return false;
+    }
+
+    job = std::move(candidate->m_jobs.front());
+    candidate->m_jobs.pop_front();
+    group = candidate;
+    m_nextGroup = (idx + 1) % groupCount;
+    return true;
+  }
+  return false;
+}
+
+void TransferExecutor::execute()
+{
+  _critical_section_lock(&m_mutex);
+  while (true)
+  {
+    TransferGroup *group = nullptr;
+    Job job;
+    if (!pickJob(group, job))
+    {
+      if (m_finished)
+      {
+        break;
+      }
+      m_idleThreads++;
+      _cond_wait(&m_jobAvailable, &m_mutex);
+      m_idleThreads--;
+      continue;
+    }
+
+    group->m_runningJobs++;
+    m_runningJobs++;
+    m_inFlightBytes += job.bytes;
+    _critical_section_unlock(&m_mutex);
+
+    try
+    {
+      job.func();
+    }
+    catch (...)
+    {
+      CXX_LOG_ERROR("Transfer executor job ended with an exception.");
+    }
+    job.func = nullptr;
+
+    _critical_section_lock(&m_mutex);
+    group->m_runningJobs--;
+    m_runningJobs--;
+    m_inFlightBytes -= job.bytes;
+    if (group->m_runningJobs == 0 && group->m_jobs.empty())
+    {
+      _cond_broadcast(&group->m_idle);
+    }
+    // freed bytes and slots may let several queued jobs start
+    _cond_broadcast(&m_jobAvailable);
+  }
+  _critical_section_unlock(&m_mutex);
+}
+
+void TransferExecutor::addGroup(TransferGroup *group)
+{
+  _critical_section_lock(&m_mutex);
+  m_groups.push_back(group);
+  _critical_section_unlock(&m_mutex);
+}
+
+void TransferExecutor::removeGroup(TransferGroup *group)
+{
+  _critical_section_lock(&m_mutex);
+  auto it = std::find(m_groups.begin(), m_groups.end(), group);
+  if (it != m_groups.end())
+  {
+    size_t idx = (size_t)(it - m_groups.begin());
+    m_groups.erase(it);
+    if (m_nextGroup > idx)
+    {
+      m_nextGroup--;
+    }
+    if (m_nextGroup >= m_groups.size())
+    {
+      m_nextGroup = 0;
+    }
+  }
+  _critical_section_unlock(&m_mutex);
+}
+
+void TransferExecutor::addJob(TransferGroup *group,
+                              std::function<void(void)> job,
+                              size_t bytes)
+{
+  _critical_section_lock(&m_mutex);
+  group->m_jobs.push_back(Job{std::move(job), bytes});
+  if (m_idleThreads == 0 && m_threads.size() < m_maxThreads)
+  {
+    SF_THREAD_HANDLE tid;
+    if (_thread_init(&tid, workerThread, (void *)this) == 0)
+    {
+      m_threads.push_back(tid);
+    }
+    else if (m_threads.empty())
+    {
+      // nothing would ever run the job
+      group->m_jobs.pop_back();
+      _critical_section_unlock(&m_mutex);
+      CXX_LOG_ERROR("Unable to start transfer executor thread.");
+      throw SnowflakeTransferException(TransferError::INTERNAL_ERROR,
+                                       "Failed to start transfer thread.");
+    }
+    else
+    {
+      CXX_LOG_WARN("Unable to start transfer executor thread, continuing "
+                   "with %d threads.", (int)m_threads.size());
+      _cond_signal(&m_jobAvailable);
+    }
+  }
+  else
+  {
+    _cond_signal(&m_jobAvailable);
+  }
+  _critical_section_unlock(&m_mutex);
+}
+
+void TransferExecutor::waitGroup(TransferGroup *group)
+{
+  _critical_section_lock(&m_mutex);
+  while (group->m_runningJobs > 0 || !group->m_jobs.empty())
+  {
+    _cond_wait(&group->m_idle, &m_mutex);
+  }
+  _critical_section_unlock(&m_mutex);
+}
+
+TransferGroup::TransferGroup(unsigned int parallel) :
+  m_executor(TransferExecutor::getInstance()),
+  m_parallel(parallel > 0 ? parallel : 1),
+  m_runningJobs(0)
+{
+  _cond_init(&m_idle);
+  m_executor->addGroup(this);
+}
+
+TransferGroup::~TransferGroup()
+{
+  WaitAll();
+  m_executor->removeGroup(this);
+  _cond_term(&m_idle);
+}
+
+void TransferGroup::AddJob(std::function<void(void)> job, size_t bytes)
+{
+  m_executor->addJob(this, std::move(job), bytes);
+}
+
+void TransferGroup::WaitAll()
+{
+  m_executor->waitGroup(this);
+}
+
+}
+}
+}
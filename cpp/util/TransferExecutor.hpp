@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#ifndef SNOWFLAKECLIENT_TRANSFEREXECUTOR_HPP
+#define SNOWFLAKECLIENT_TRANSFEREXECUTOR_HPP
+
+#include <deque>
+#include <functional>
+#include <vector>
+#include "snowflake/platform.h"
+
+/// default max number of threads of the transfer executor
+#define TRANSFER_EXECUTOR_DEFAULT_THREADS 64
+
+namespace Snowflake
+{
+namespace Client
+{
+namespace Util
+{
+
+class TransferGroup;
+
+/**
+ * Process wide executor that put/get commands of all FileTransferAgents
+ * run their file transfers on.
+ *
+ * Each command submits its jobs through a TransferGroup. Groups are served
+ * round robin, one job at a time, so a command with many files does not
+ * hold back a command with few. A group never runs more jobs at the same
+ * time than its own parallel setting, and all groups together never run
+ * more than maxThreads jobs.
+ *
+ * Every job declares how many bytes it transfers. Jobs are not started
+ * while that would take bytes in flight above maxInFlightBytes, except
+ * when nothing else is in flight, so a file larger than the limit still
+ * goes through. A job that does not fit holds back jobs of other groups
+ * until it does, so large files are not starved by small ones.
+ *
+ * Threads are started when jobs are queued and no worker is idle, up to
+ * maxThreads, and are kept until shutdown.
+ */
+class TransferExecutor
+{
+public:
+  /**
+   * @return executor of the process, created on first use
+   */
+  static TransferExecutor *getInstance();
+
+  /**
+   * Set limits of the executor. Takes effect for jobs started afterwards.
+   * @param maxThreads max number of jobs running at the same time, 0 to
+   *        keep the current value
+   * @param maxInFlightBytes max number of bytes of running jobs, 0 for
+   *        no limit
+   */
+  static void configure(unsigned int maxThreads, size_t maxInFlightBytes);
+
+  /**
+   * Wait for queued jobs to finish and stop all threads. Must not be
+   * called while a transfer is running, the executor is created again on
+   * next use.
+   */
+  static void shutdown();
+
+  /// @return bytes of jobs currently running
+  size_t getInFlightBytes();
+
+private:
+  friend class TransferGroup;
+
+  struct Job
+  {
+    std::function<void(void)> func;
+
+    size_t bytes;
+  };
+
+  TransferExecutor(unsigned int maxThreads, size_t maxInFlightBytes);
+
+  ~TransferExecutor();
+
+  static void *workerThread(void *arg);
+
+  void execute();
+
+  /**
+   * Pick the next job round robin over groups. Must be called with
+   * m_mutex held.
+   * @return false if no job can be started now
+   */
+  bool pickJob(TransferGroup *&group, Job &job);
+
+  void addGroup(TransferGroup *group);
+
+  void removeGroup(TransferGroup *group);
+
+  void addJob(TransferGroup *group, std::function<void(void)> job,
+              size_t bytes);
+
+  void waitGroup(TransferGroup *group);
+
+  /// guards all state of the executor and its groups
+  SF_CRITICAL_SECTION_HANDLE m_mutex;
+
+  /// workers wait on it for a job to be available
+  SF_CONDITION_HANDLE m_jobAvailable;
+
+  std::vector<SF_THREAD_HANDLE> m_threads;
+
+  /// groups with a command running, served round robin
+  std::vector<TransferGroup *> m_groups;
+
+  /// index in m_groups of the group served next
+  size_t m_nextGroup;
+
+  unsigned int m_maxThreads;
+
+  size_t m_maxInFlightBytes;
+
+  size_t m_inFlightBytes;
+
+  /// jobs running over all groups
+  unsigned int m_runningJobs;
+
+  /// workers waiting for a job
+  unsigned int m_idleThreads;
+
+  bool m_finished;
+};
+
+/**
+ * Jobs of one put/get command, run on the process wide TransferExecutor.
+ * Destruction waits for all jobs of the group to finish.
+ */
+class TransferGroup
+{
+public:
+  /**
+   * @param parallel max number of jobs of this group running at the same
+   *        time
+   */
+  TransferGroup(unsigned int parallel);
+
+  ~TransferGroup();
+
+  /**
+   * Queue a job of the group. Throws SnowflakeTransferException if the
+   * executor has no thread and none can be started to run it.
+   * @param job
+   * @param bytes number of bytes the job transfers, counted against the
+   *        in flight limit of the executor while it runs
+   */
+  void AddJob(std::function<void(void)> job, size_t bytes = 0);
+
+  /**
+   * Wait till all jobs of the group have finished.
+   */
+  void WaitAll();
+
+private:
+  friend class TransferExecutor;
+
+  TransferExecutor *m_executor;
+
+  const unsigned int m_parallel;
+
+  /// jobs waiting to start, guarded by executor mutex
+  std::deque<TransferExecutor::Job> m_jobs;
+
+  /// jobs running, guarded by executor mutex
+  unsigned int m_runningJobs;
+
+  /// signaled when the group has no job queued or running
+  SF_CONDITION_HANDLE m_idle;
+};
+
+}
+}
+}
+
+#endif //SNOWFLAKECLIENT_TRANSFEREXECUTOR_HPP
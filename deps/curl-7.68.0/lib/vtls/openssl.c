@@ -1092,6 +1092,9 @@ static int Curl_ossl_init(void)
 /* Global cleanup */
 static void Curl_ossl_cleanup(void)
 {
+  /* stop refreshing OCSP responses before curl and OpenSSL go away */
+  stopCertOCSPRefresh();
+
 #if (OPENSSL_VERSION_NUMBER >= 0x10100000L) && \
     !defined(LIBRESSL_VERSION_NUMBER)
   /* OpenSSL 1.1 deprecates all these cleanup functions and
@@ -73,6 +73,7 @@ typedef pthread_mutex_t SF_MUTEX_HANDLE;
 
 #define DEFAULT_OCSP_RESPONSE_CACHE_HOST "http://ocsp.snowflakecomputing.com"
 #define OCSP_RESPONSE_CACHE_JSON "ocsp_response_cache.json"
+#define OCSP_RESPONSE_CACHE_BIN "ocsp_response_cache.bin"
 #define OCSP_RESPONSE_CACHE_URL "%s/%s"
 #define OCSP_RESPONDER_RETRY_URL "http://ocsp.snowflakecomputing.com/retry"
 
@@ -95,6 +96,39 @@ typedef pthread_mutex_t SF_MUTEX_HANDLE;
 // Max number of connection retry attempts for OCSP Cache Server
 #define OCSP_CACHE_SERVER_MAX_RETRY 1
 
+// Cache entries are valid for 120 hours
+#define OCSP_CACHE_ENTRY_LIFETIME (24*60*60*5)
+
+// Seconds between background refreshes of the cached responses
+#define OCSP_REFRESH_INTERVAL (10*60)
+
+// Cached responses are refreshed in the background this many seconds
+// before they expire
+#define OCSP_REFRESH_LEAD_TIME (24*60*60)
+
+// Max number of certificates whose responses are refreshed in the background
+#define OCSP_REFRESH_MAX_CERTS 256
+
+// Number of buckets of the in memory cache. Must be a power of 2
+#define OCSP_CACHE_BUCKET_COUNT 1024
+
+/*
+ * Binary cache file. The file starts with the magic and is followed by
+ * records of:
+ *   timestamp (4 bytes), cert id length (4 bytes), response length
+ *   (4 bytes), DER encoded cert id, DER encoded response
+ * numbers are in little endian. Updates are appended and a later record
+ * replaces an earlier one with the same cert id. A record with no
+ * response removes the entry.
+ */
+#define OCSP_CACHE_FILE_MAGIC "SFOCSP01"
+#define OCSP_CACHE_FILE_MAGIC_LEN 8
+#define OCSP_CACHE_RECORD_HEADER_LEN 12
+
+// Rewrite the cache file once it has this many times more records than
+// live entries
+#define OCSP_CACHE_FILE_COMPACT_RATIO 2
+
 typedef enum
 {
     INVALID,
@@ -129,9 +163,40 @@ typedef enum
   SF_TEST_OCSP_FORCE_BAD_RESPONSE_VALIDITY,
   SF_TEST_CA_OCSP_RESPONDER_CONNECTION_TIMEOUT,
   SF_TEST_OCSP_CERT_STATUS_REVOKED,
-  SF_TEST_OCSP_CERT_STATUS_UNKNOWN
+  SF_TEST_OCSP_CERT_STATUS_UNKNOWN,
+  SF_TEST_OCSP_REFRESH_INTERVAL,
+  SF_TEST_OCSP_REFRESH_LEAD_TIME
 }SF_OCSP_TEST;
 
+typedef struct ocsp_cache_entry
+{
+  struct ocsp_cache_entry *next;
+  unsigned int hash;
+  /* decoded once so that lookups need no decoding */
+  OCSP_CERTID *certid;
+  unsigned char *cert_id_der;
+  size_t cert_id_der_len;
+  /* NULL if the entry was removed but the cache file still has it */
+  unsigned char *resp_der;
+  size_t resp_der_len;
+  unsigned long timestamp;
+  /* written to the cache file */
+  int persisted;
+} OCSP_CACHE_ENTRY;
+
+/* certificate validated in a handshake, refreshed in the background */
+typedef struct ocsp_refresh_entry
+{
+  struct ocsp_refresh_entry *next;
+  OCSP_CERTID *certid;
+  /* for the OCSP responder URLs */
+  X509 *cert;
+  /* to verify refreshed responses the way the handshake does */
+  STACK_OF(X509) *chain;
+  X509_STORE *store;
+  char *hostname;
+} OCSP_REFRESH_ENTRY;
+
 /* private function declarations */
 static char *ossl_strerror(unsigned long error, char *buf, size_t size);
 static SF_CERT_STATUS checkResponse(OCSP_RESPONSE *resp,
@@ -167,18 +232,27 @@ static void initOCSPCacheServer(struct Curl_easy *data);
 static void downloadOCSPCache(struct Curl_easy *data, SF_OTD *ocsp_log_data);
 static char* encodeOCSPCertIDToBase64(OCSP_CERTID *certid, struct Curl_easy *data);
 static char* encodeOCSPRequestToBase64(OCSP_REQUEST *reqp, struct Curl_easy *data);
-static char* encodeOCSPResponseToBase64(OCSP_RESPONSE* resp, struct Curl_easy *data);
 static OCSP_CERTID* decodeOCSPCertIDFromBase64(char* src, struct Curl_easy *data);
-static OCSP_RESPONSE* decodeOCSPResponseFromBase64(char* src, struct Curl_easy *data);
 static SF_OCSP_STATUS checkResponseTimeValidity(OCSP_RESPONSE *resp,
                                                 struct Curl_easy *data,
                                                 SF_OTD *ocsp_log_data);
-static OCSP_RESPONSE* extractOCSPRespFromValue(cJSON *cache_value,
-                                               struct Curl_easy *data,
-                                               SF_OTD *ocsp_log_dataa);
-static cJSON *getCacheEntry(OCSP_CERTID* certid, struct Curl_easy *data);
+static unsigned int hashOCSPCertID(OCSP_CERTID *certid);
+static OCSP_CACHE_ENTRY *newCacheEntry(const unsigned char *cert_id_der,
+                                       size_t cert_id_der_len,
+                                       const unsigned char *resp_der,
+                                       size_t resp_der_len,
+                                       unsigned long timestamp);
+static void freeCacheEntry(OCSP_CACHE_ENTRY *entry);
+static OCSP_CACHE_ENTRY *getCacheEntry(OCSP_CERTID *certid, unsigned int hash);
+static void putCacheEntry(OCSP_CACHE_ENTRY *entry);
+static void clearCache(void);
 static void deleteCacheEntry(OCSP_CERTID* certid, struct Curl_easy *data);
 static void updateCacheWithBulkEntries(cJSON* tmp_cache, struct Curl_easy *data);
+static size_t serializeCache(unsigned char **buf, int all);
+static void loadOCSPCacheFile(char *cache_file, struct Curl_easy *data,
+                              SF_OTD *ocsp_log_data, int merge);
+static void loadLegacyOCSPCacheFile(char *cache_file, struct Curl_easy *data,
+                                    SF_OTD *ocsp_log_data);
 static char * getOCSPPostReqData(const char *hname, OCSP_CERTID *cid,
                                  const char * ocsp_url, const char *ocsp_req,
                                  struct Curl_easy *data);
@@ -187,16 +261,56 @@ static void termCertOCSP();
 static void printOCSPFailOpenWarning(SF_OTD *ocsp_log, struct Curl_easy *data);
 static char * generateOCSPTelemetryData(SF_OTD *ocsp_log);
 static SF_TESTMODE_STATUS getTestStatus(SF_OCSP_TEST test_name);
+static void addRefreshEntry(X509 *cert, X509 *issuer, STACK_OF(X509) *ch,
+                            X509_STORE *st, char *hostname,
+                            struct Curl_easy *data);
+static void startOCSPRefresh(struct Curl_easy *data);
+static void refreshOCSPCache(struct Curl_easy *data, long lead_time);
+static int isOCSPRefreshStopped(void);
+static void abortOnOCSPRefreshStop(CURL *curlh, struct Curl_easy *data);
 
 static int _mutex_init(SF_MUTEX_HANDLE *lock);
 static int _mutex_lock(SF_MUTEX_HANDLE *lock);
 static int _mutex_unlock(SF_MUTEX_HANDLE *lock);
 static int _mutex_term(SF_MUTEX_HANDLE *lock);
 
-/* in memory response cache */
-static cJSON * ocsp_cache_root = NULL;
+static int _rwlock_init(SF_RWLOCK_HANDLE *lock);
+static int _rwlock_rdlock(SF_RWLOCK_HANDLE *lock);
+static int _rwlock_rdunlock(SF_RWLOCK_HANDLE *lock);
+static int _rwlock_wrlock(SF_RWLOCK_HANDLE *lock);
+static int _rwlock_wrunlock(SF_RWLOCK_HANDLE *lock);
+static int _rwlock_term(SF_RWLOCK_HANDLE *lock);
+
+static int _critical_section_init(SF_CRITICAL_SECTION_HANDLE *lock);
+static int _critical_section_lock(SF_CRITICAL_SECTION_HANDLE *lock);
+static int _critical_section_unlock(SF_CRITICAL_SECTION_HANDLE *lock);
+static int _critical_section_term(SF_CRITICAL_SECTION_HANDLE *lock);
+
+static int _cond_init(SF_CONDITION_HANDLE *cond);
+static int _cond_broadcast(SF_CONDITION_HANDLE *cond);
+static int _cond_timedwait(SF_CONDITION_HANDLE *cond,
+                           SF_CRITICAL_SECTION_HANDLE *lock, long seconds);
+static int _cond_term(SF_CONDITION_HANDLE *cond);
+
+/* in memory response cache, a hash table keyed by OCSP CertID */
+static OCSP_CACHE_ENTRY *ocsp_cache_buckets[OCSP_CACHE_BUCKET_COUNT];
 
-/* mutex for ocsp_cache_root */
+/* number of entries with a response in the cache */
+static size_t ocsp_cache_entry_count = 0;
+
+/* number of entries not written to the cache file yet */
+static size_t ocsp_cache_dirty_count = 0;
+
+/* number of records in the cache file, including overwritten ones */
+static size_t ocsp_cache_file_records = 0;
+
+/* the cache file was read onto memory */
+static int ocsp_cache_loaded = 0;
+
+/* read write lock for the in memory response cache. Lookups share it. */
+static SF_RWLOCK_HANDLE ocsp_response_cache_lock;
+
+/* mutex for the cache file and the cache server settings */
 static SF_MUTEX_HANDLE ocsp_response_cache_mutex;
 
 /** OCSP Cache Server is used if enabled */
@@ -208,6 +322,26 @@ static char ocsp_cache_server_url[4096] = "";
 
 static char ocsp_cache_server_retry_url_pattern[4096];
 
+/* guards the background refresh state below */
+static SF_CRITICAL_SECTION_HANDLE ocsp_refresh_lock;
+
+/* signaled to stop the refresh thread */
+static SF_CONDITION_HANDLE ocsp_refresh_cond;
+
+static SF_THREAD_HANDLE ocsp_refresh_thread;
+
+static int ocsp_refresh_initialized = 0;
+
+static int ocsp_refresh_started = 0;
+
+static int ocsp_refresh_stop = 0;
+
+/* certificates to refresh. Entries are only added at the head and freed
+ * once the refresh thread stopped, so the thread walks them unlocked. */
+static OCSP_REFRESH_ENTRY *ocsp_refresh_entries = NULL;
+
+static size_t ocsp_refresh_entry_count = 0;
+
 /* Mutex */
 int _mutex_init(SF_MUTEX_HANDLE *lock) {
 #ifdef _WIN32
@@ -247,6 +381,136 @@ int _mutex_term(SF_MUTEX_HANDLE *lock) {
 #endif
 }
 
+/* Read Write Lock */
+int _rwlock_init(SF_RWLOCK_HANDLE *lock) {
+#ifdef _WIN32
+  InitializeSRWLock(lock);
+  return 0;
+#else
+  return pthread_rwlock_init(lock, NULL);
+#endif
+}
+
+int _rwlock_rdlock(SF_RWLOCK_HANDLE *lock) {
+#ifdef _WIN32
+  AcquireSRWLockShared(lock);
+  return 0;
+#else
+  return pthread_rwlock_rdlock(lock);
+#endif
+}
+
+int _rwlock_rdunlock(SF_RWLOCK_HANDLE *lock) {
+#ifdef _WIN32
+  ReleaseSRWLockShared(lock);
+  return 0;
+#else
+  return pthread_rwlock_unlock(lock);
+#endif
+}
+
+int _rwlock_wrlock(SF_RWLOCK_HANDLE *lock) {
+#ifdef _WIN32
+  AcquireSRWLockExclusive(lock);
+  return 0;
+#else
+  return pthread_rwlock_wrlock(lock);
+#endif
+}
+
+int _rwlock_wrunlock(SF_RWLOCK_HANDLE *lock) {
+#ifdef _WIN32
+  ReleaseSRWLockExclusive(lock);
+  return 0;
+#else
+  return pthread_rwlock_unlock(lock);
+#endif
+}
+
+int _rwlock_term(SF_RWLOCK_HANDLE *lock) {
+#ifdef _WIN32
+  return 0;
+#else
+  return pthread_rwlock_destroy(lock);
+#endif
+}
+
+/* Critical Section */
+int _critical_section_init(SF_CRITICAL_SECTION_HANDLE *lock) {
+#ifdef _WIN32
+  InitializeCriticalSection(lock);
+  return 0;
+#else
+  return pthread_mutex_init(lock, NULL);
+#endif
+}
+
+int _critical_section_lock(SF_CRITICAL_SECTION_HANDLE *lock) {
+#ifdef _WIN32
+  EnterCriticalSection(lock);
+  return 0;
+#else
+  return pthread_mutex_lock(lock);
+#endif
+}
+
+int _critical_section_unlock(SF_CRITICAL_SECTION_HANDLE *lock) {
+#ifdef _WIN32
+  LeaveCriticalSection(lock);
+  return 0;
+#else
+  return pthread_mutex_unlock(lock);
+#endif
+}
+
+int _critical_section_term(SF_CRITICAL_SECTION_HANDLE *lock) {
+#ifdef _WIN32
+  DeleteCriticalSection(lock);
+  return 0;
+#else
+  return pthread_mutex_destroy(lock);
+#endif
+}
+
+/* Condition Variable */
+int _cond_init(SF_CONDITION_HANDLE *cond) {
+#ifdef _WIN32
+  InitializeConditionVariable(cond);
+  return 0;
+#else
+  return pthread_cond_init(cond, NULL);
+#endif
+}
+
+int _cond_broadcast(SF_CONDITION_HANDLE *cond) {
+#ifdef _WIN32
+  WakeAllConditionVariable(cond);
+  return 0;
+#else
+  return pthread_cond_broadcast(cond);
+#endif
+}
+
+int _cond_timedwait(SF_CONDITION_HANDLE *cond,
+                    SF_CRITICAL_SECTION_HANDLE *lock, long seconds) {
+#ifdef _WIN32
+  return SleepConditionVariableCS(cond, lock, (DWORD)(seconds * 1000)) == 0;
+#else
+  struct timespec ts;
+  ts.tv_sec = time(NULL) + seconds;
+  ts.tv_nsec = 0;
+  return pthread_cond_timedwait(cond, lock, &ts);
+#endif
+}
+
+int _cond_term(SF_CONDITION_HANDLE *cond) {
+#ifdef _WIN32
+  return 0;
+#else
+  return pthread_cond_destroy(cond);
+#endif
+}
+
 #ifdef _WIN32
 /** start to sleep for 1s before retrying (milliseconds) */
 static const long START_SLEEP_TIME = 1000;
@@ -341,6 +605,28 @@ static SF_TESTMODE_STATUS getTestStatus(SF_OCSP_TEST test_name) {
         return TEST_DISABLED;
       }
       break;
+    case SF_TEST_OCSP_REFRESH_INTERVAL:
+      env = getenv("SF_TEST_OCSP_REFRESH_INTERVAL");
+      if (env != NULL)
+      {
+        return atol(env);
+      }
+      else
+      {
+        return 0;
+      }
+      break;
+    case SF_TEST_OCSP_REFRESH_LEAD_TIME:
+      env = getenv("SF_TEST_OCSP_REFRESH_LEAD_TIME");
+      if (env != NULL)
+      {
+        return atol(env);
+      }
+      else
+      {
+        return 0;
+      }
+      break;
     default:
       return TEST_DISABLED;
   }
@@ -534,6 +820,39 @@ write_callback(void *contents, size_t size, size_t nmemb, void *userp)
   return realsize;
 }
 
+static int
+ocspRefreshProgress(void *clientp, curl_off_t dltotal, curl_off_t dlnow,
+                    curl_off_t ultotal, curl_off_t ulnow)
+{
+  (void)clientp;
+  (void)dltotal;
+  (void)dlnow;
+  (void)ultotal;
+  (void)ulnow;
+  /* non zero aborts the transfer with CURLE_ABORTED_BY_CALLBACK */
+  return isOCSPRefreshStopped();
+}
+
+/**
+ * Let stopCertOCSPRefresh abort the transfers of the refresh thread, so it
+ * doesn't wait for the responders. The refresh handle is tagged with the
+ * address of ocsp_refresh_stop as private data.
+ *
+ * @param curlh curl handle of the transfer
+ * @param data curl handle the transfer is made for
+ */
+static void abortOnOCSPRefreshStop(CURL *curlh, struct Curl_easy *data)
+{
+  char *tag = NULL;
+
+  if (curl_easy_getinfo(data, CURLINFO_PRIVATE, &tag) == CURLE_OK &&
+      tag == (char *)&ocsp_refresh_stop)
+  {
+    curl_easy_setopt(curlh, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(curlh, CURLOPT_XFERINFOFUNCTION, ocspRefreshProgress);
+  }
+}
+
 static char * getOCSPPostReqData(const char *hname,
         OCSP_CERTID *cid,
                                  const char * ocsp_url, const char *ocsp_req,
@@ -658,6 +977,7 @@ static OCSP_RESPONSE * queryResponderUsingCurl(char *url, OCSP_CERTID *certid, c
   if (ocsp_curl)
   {
     curl_easy_setopt(ocsp_curl, CURLOPT_NOPROGRESS, 1L);
+    abortOnOCSPRefreshStop(ocsp_curl, data);
     curl_easy_setopt(ocsp_curl, CURLOPT_NOSIGNAL, 1);
     curl_easy_setopt(ocsp_curl, CURLOPT_TIMEOUT, sf_timeout);
     curl_easy_setopt(ocsp_curl, CURLOPT_URL, urlbuf);
@@ -688,6 +1008,11 @@ static OCSP_RESPONSE * queryResponderUsingCurl(char *url, OCSP_CERTID *certid, c
       char error_msg[4096];
       CURLcode res = curl_easy_perform(ocsp_curl);
 
+      if (res == CURLE_ABORTED_BY_CALLBACK)
+      {
+        infof(data, "OCSP request aborted as the refresh stopped\n");
+        break;
+      }
       if (res != CURLE_OK)
       {
         failf(data, "OCSP checking curl_easy_perform() failed: %s\n",
@@ -794,52 +1119,48 @@ err:
 void updateOCSPResponseInMem(OCSP_CERTID *certid, OCSP_RESPONSE *resp,
                              struct Curl_easy *data)
 {
-  char * cert_id_encode= NULL;
-  char * ocsp_response_encode = NULL;
+  unsigned char *cert_id_der = NULL;
+  unsigned char *resp_der = NULL;
+  int cert_id_der_len;
+  int resp_der_len;
+  OCSP_CACHE_ENTRY *entry = NULL;
 
-  unsigned long unix_time;
-
-  cJSON * cache_val_array = NULL;
-  cJSON *found = NULL;
+  if (resp == NULL)
+  {
+    infof(data, "UpdateOCSPResponseInMem - no OCSP response to cache\n");
+    goto end;
+  }
 
   /* encode OCSP CertID and OCSP Response */
-  cert_id_encode = encodeOCSPCertIDToBase64(certid, data);
-  if (cert_id_encode == NULL)
+  cert_id_der_len = i2d_OCSP_CERTID(certid, &cert_id_der);
+  if (cert_id_der_len <= 0 || cert_id_der == NULL)
   {
     failf(data, "UpdateOCSPResponseInMem - cert id encode failed");
     goto end;
   }
-  ocsp_response_encode = encodeOCSPResponseToBase64(resp, data);
-  if (ocsp_response_encode == NULL)
+  resp_der_len = i2d_OCSP_RESPONSE(resp, &resp_der);
+  if (resp_der_len <= 0 || resp_der == NULL)
   {
-    failf(data, "UpdateOCSPResponseInMem - ocsp response encode failed %s", cert_id_encode);
+    failf(data, "UpdateOCSPResponseInMem - ocsp response encode failed");
     goto end;
   }
 
-  /* timestamp */
-  unix_time = (unsigned long)time(NULL);
-
-  /* write to mem cache */
-  cache_val_array = cJSON_CreateArray();
-  cJSON_AddItemToArray(cache_val_array, cJSON_CreateNumber((double) unix_time));
-  cJSON_AddItemToArray(cache_val_array, cJSON_CreateString(ocsp_response_encode));
-
-  _mutex_lock(&ocsp_response_cache_mutex);
-  if (ocsp_cache_root == NULL)
-  {
-    ocsp_cache_root = cJSON_CreateObject();
-  }
-  found = getCacheEntry(certid, data);
-  if (found != NULL)
+  entry = newCacheEntry(cert_id_der, (size_t)cert_id_der_len,
+                        resp_der, (size_t)resp_der_len,
+                        (unsigned long)time(NULL));
+  if (entry == NULL)
   {
-    /* delete existing entry first if exists. */
-    cJSON_DeleteItemFromObject(ocsp_cache_root, found->string);
+    failf(data, "UpdateOCSPResponseInMem - failed to create cache entry");
+    goto end;
   }
-  cJSON_AddItemToObject(ocsp_cache_root, cert_id_encode, cache_val_array);
-  _mutex_unlock(&ocsp_response_cache_mutex);
+
+  /* write to mem cache */
+  _rwlock_wrlock(&ocsp_response_cache_lock);
+  putCacheEntry(entry);
+  _rwlock_wrunlock(&ocsp_response_cache_lock);
 end:
-  if (cert_id_encode) curl_free(cert_id_encode);
-  if (ocsp_response_encode) curl_free(ocsp_response_encode);
+  if (cert_id_der) OPENSSL_free(cert_id_der);
+  if (resp_der) OPENSSL_free(resp_der);
 }
 
 /**
@@ -909,41 +1230,6 @@ end:
   return ret;
 }
 
-/**
- * Encode OCSP Response to Base 64 string
- *
- * @param resp OCSP_RESPONSE
- * @param data curl handle
- * @return base64 string
- */
-char *encodeOCSPResponseToBase64(OCSP_RESPONSE* resp, struct Curl_easy *data)
-{
-  int len;
-  char* ret = NULL;
-  unsigned char *der_buf = NULL;
-  size_t encode_len = 0;
-  CURLcode result;
-
-  len = i2d_OCSP_RESPONSE(resp, &der_buf);
-  if (len <= 0 || der_buf == NULL)
-  {
-    infof(data, "Failed to encode OCSP response");
-    goto end;
-  }
-
-  result = Curl_base64_encode(data, (char *)der_buf, (size_t)len,
-                              &ret, &encode_len);
-  if (result != CURLE_OK)
-  {
-    infof(data, "Failed to encode OCSP response to base64: %s",
-          curl_easy_strerror(result));
-    goto end;
-  }
-end:
-  if (der_buf) OPENSSL_free(der_buf);
-  return ret;
-}
-
 /**
  * Decoede OCSP CertID from Base 64 string
  * @param src a base64 string
@@ -987,49 +1273,6 @@ OCSP_CERTID* decodeOCSPCertIDFromBase64(char* src, struct Curl_easy *data)
   return target_certid;
 }
 
-/**
- * Decode OCSP Response from Base 64 string
- * @param src a base64 string
- * @param data curl handle
- * @return OCSP_RESPONSE or NULL
- */
-OCSP_RESPONSE * decodeOCSPResponseFromBase64(char* src, struct Curl_easy *data)
-{
-  OCSP_RESPONSE *resp = NULL;
-  unsigned char *ocsp_response_der;
-  unsigned char *ocsp_response_der_org;
-  size_t ocsp_response_der_len;
-  CURLcode result;
-
-  if (src == NULL)
-  {
-    infof(data, "Base64 input is NULL for decoding OCSP Response\n");
-    return NULL;
-  }
-  result = Curl_base64_decode(src,
-                              &ocsp_response_der, &ocsp_response_der_len);
-  if (result)
-  {
-    infof(data, "Failed to decode OCSP response from base64 string: %s\n",
-          curl_easy_strerror(result));
-    return NULL;
-  }
-  /* keep the original pointer as it will be updated in d2i function */
-  ocsp_response_der_org = ocsp_response_der;
-
-  resp = d2i_OCSP_RESPONSE(NULL, (const unsigned char **) &ocsp_response_der,
-                           (long) ocsp_response_der_len);
-  curl_free(ocsp_response_der_org);
-  if (resp == NULL)
-  {
-    infof(data, "Failed to decode OCSP response cache from der format\n");
-    return NULL;
-  }
-  return resp;
-}
-
-
-
 /**
  * Validate OCSP Response time validity
  */
@@ -1104,137 +1347,251 @@ static SF_OCSP_STATUS checkResponseTimeValidity(OCSP_RESPONSE *resp, struct Curl
 
 
 /**
- * Extract OCSP Response from the cache value.
+ * Hash of OCSP CertID over the issuer name hash, issuer key hash and
+ * serial number, i.e., the fields OCSP_id_cmp compares besides the hash
+ * algorithm.
  *
- * Must mutex protected as it may delete the existing element if the last
- * query time is older than 24 hours.
- *
- * @param cache_value a cache value to update
- * @param data curl handle
- * @return OCSP_RESPONSE
+ * @param certid OCSP CertID
+ * @return hash value
  */
-OCSP_RESPONSE* extractOCSPRespFromValue(cJSON *cache_value, struct Curl_easy *data,
-                                        SF_OTD *ocsp_log_data)
+unsigned int hashOCSPCertID(OCSP_CERTID *certid)
 {
-  long last_query_time_l = 0L;
-  cJSON * resp_bas64_j = NULL;
-  cJSON * last_query_time = NULL;
-  OCSP_RESPONSE *resp = NULL;
+  ASN1_OCTET_STRING *name_hash = NULL;
+  ASN1_OCTET_STRING *key_hash = NULL;
+  ASN1_INTEGER *serial = NULL;
+  const ASN1_STRING *fields[3];
+  unsigned int hash = 2166136261U; /* FNV-1a */
+  int i, j;
 
-  if (cache_value == NULL || !cJSON_IsArray(cache_value))
+  if (!OCSP_id_get0_info(&name_hash, NULL, &key_hash, &serial, certid))
   {
-    infof(data, "OCSP Cache value is invalid\n");
-    goto end;
+    return 0;
   }
-
-  /* First item is the timestamp when the cache entry was created. */
-  last_query_time = cJSON_GetArrayItem(cache_value, 0);
-  if (!cJSON_IsNumber(last_query_time))
+  fields[0] = name_hash;
+  fields[1] = key_hash;
+  fields[2] = serial;
+  for (i = 0; i < 3; i++)
   {
-    infof(data, "OCSP Cache Last query time is invalid\n");
-    cJSON_DeleteItemFromObjectCaseSensitive(ocsp_cache_root,
-                                            cache_value->string);
-    goto end;
+    const unsigned char *p = ASN1_STRING_get0_data(fields[i]);
+    int len = ASN1_STRING_length(fields[i]);
+    for (j = 0; j < len; j++)
+    {
+      hash ^= p[j];
+      hash *= 16777619U;
+    }
   }
+  return hash;
+}
 
-  last_query_time_l = (long)last_query_time->valuedouble;
-
-  /* valid for 120 hours */
-  if ((unsigned long)time(NULL) - last_query_time_l >= 24*60*60*5)
+/**
+ * Create a cache entry. The buffers are copied.
+ *
+ * @param cert_id_der DER encoded OCSP CertID
+ * @param cert_id_der_len length of cert_id_der
+ * @param resp_der DER encoded OCSP Response or NULL for a removed entry
+ * @param resp_der_len length of resp_der
+ * @param timestamp time when the response was fetched
+ * @return cache entry or NULL if the CertID is invalid
+ */
+OCSP_CACHE_ENTRY *newCacheEntry(const unsigned char *cert_id_der,
+                                size_t cert_id_der_len,
+                                const unsigned char *resp_der,
+                                size_t resp_der_len,
+                                unsigned long timestamp)
+{
+  const unsigned char *p = cert_id_der;
+  OCSP_CACHE_ENTRY *entry = (OCSP_CACHE_ENTRY *)calloc(1, sizeof(*entry));
+  if (entry == NULL)
   {
-    infof(data, "OCSP Response Cache Expired\n");
-    goto end;
+    return NULL;
   }
 
-  /* Second item is the actual OCSP response data */
-  resp_bas64_j = cJSON_GetArrayItem(cache_value, 1);
-  if (!cJSON_IsString(resp_bas64_j) || resp_bas64_j->valuestring == NULL)
+  entry->certid = d2i_OCSP_CERTID(NULL, &p, (long)cert_id_der_len);
+  entry->cert_id_der = (unsigned char *)malloc(cert_id_der_len);
+  if (entry->certid == NULL || entry->cert_id_der == NULL)
   {
-    infof(data, "OCSP Response cache is invalid. Deleting it from the cache.\n");
-    cJSON_DeleteItemFromObjectCaseSensitive(ocsp_cache_root,
-                                            cache_value->string);
-    goto end;
+    goto err;
   }
+  memcpy(entry->cert_id_der, cert_id_der, cert_id_der_len);
+  entry->cert_id_der_len = cert_id_der_len;
 
-  /* decode OCSP Response from base64 string */
-  resp = decodeOCSPResponseFromBase64(resp_bas64_j->valuestring, data);
-  if (checkResponseTimeValidity(resp, data, ocsp_log_data) == INVALID)
+  if (resp_der != NULL && resp_der_len > 0)
   {
-      resp = NULL;
+    entry->resp_der = (unsigned char *)malloc(resp_der_len);
+    if (entry->resp_der == NULL)
+    {
+      goto err;
+    }
+    memcpy(entry->resp_der, resp_der, resp_der_len);
+    entry->resp_der_len = resp_der_len;
   }
-  end:
-  return resp;
+  entry->timestamp = timestamp;
+  entry->hash = hashOCSPCertID(entry->certid);
+  return entry;
+
+err:
+  freeCacheEntry(entry);
+  return NULL;
 }
 
 /**
- * Find OCSP Response in memory cache.
- * @param certid OCSP CertID
- * @param data curl handle
- * @return OCSP Response if success otherwise NULL
+ * Free a cache entry
+ * @param entry cache entry
  */
-OCSP_RESPONSE * findOCSPRespInMem(OCSP_CERTID *certid, struct Curl_easy *data, SF_OTD *ocsp_log_data)
+void freeCacheEntry(OCSP_CACHE_ENTRY *entry)
 {
-  /* calculate certid */
-  OCSP_RESPONSE *resp = NULL;
-  cJSON *found = NULL;
-
-  _mutex_lock(&ocsp_response_cache_mutex);
-  found = getCacheEntry(certid, data);
-  if (!found)
+  if (entry == NULL)
   {
-    infof(data, "OCSP Response not found in the cache");
-    goto end;
+    return;
   }
-  resp = extractOCSPRespFromValue(found, data, ocsp_log_data);
-  if (resp)
+  if (entry->certid) OCSP_CERTID_free(entry->certid);
+  if (entry->cert_id_der) free(entry->cert_id_der);
+  if (entry->resp_der) free(entry->resp_der);
+  free(entry);
+}
+
+/**
+ * Get the cache entry for the CertID. Must be called with
+ * ocsp_response_cache_lock held.
+ *
+ * @param certid OCSP CertID
+ * @param hash hash of the CertID
+ * @return cache entry if found otherwise NULL. The entry may have no
+ * response if it was removed.
+ */
+OCSP_CACHE_ENTRY *getCacheEntry(OCSP_CERTID *certid, unsigned int hash)
+{
+  OCSP_CACHE_ENTRY *entry =
+    ocsp_cache_buckets[hash & (OCSP_CACHE_BUCKET_COUNT - 1)];
+
+  for (; entry != NULL; entry = entry->next)
   {
-    /* NOTE encode to base64 only for logging */
-    char* cert_id_encode = encodeOCSPCertIDToBase64(certid, data);
-    infof(data, "OCSP Response Cache found!!!: %s\n", cert_id_encode);
-    if (cert_id_encode) curl_free(cert_id_encode);
+    if (entry->hash == hash && OCSP_id_cmp(entry->certid, certid) == 0)
+    {
+      return entry;
+    }
   }
-end:
-  _mutex_unlock(&ocsp_response_cache_mutex);
-  return resp;
+  return NULL;
 }
 
 /**
- * Get the cache entry for the CertID.
+ * Add a cache entry, replacing the existing one for the same CertID.
+ * Must be called with ocsp_response_cache_lock held for writing.
  *
- * @param certid OCSP CertID
- * @param data curl handle
- * @return cJSON cache entry if found otherwise NULL
+ * @param entry cache entry, owned by the cache afterwards
  */
-cJSON *getCacheEntry(OCSP_CERTID* certid, struct Curl_easy *data)
+void putCacheEntry(OCSP_CACHE_ENTRY *entry)
 {
-  cJSON *ret = NULL;
-  cJSON *element_pointer = NULL;
+  OCSP_CACHE_ENTRY **slot =
+    &ocsp_cache_buckets[entry->hash & (OCSP_CACHE_BUCKET_COUNT - 1)];
+  OCSP_CACHE_ENTRY *old = NULL;
+
+  for (; *slot != NULL; slot = &(*slot)->next)
+  {
+    if ((*slot)->hash == entry->hash &&
+        OCSP_id_cmp((*slot)->certid, entry->certid) == 0)
+    {
+      old = *slot;
+      break;
+    }
+  }
 
-  if (ocsp_cache_root == NULL)
+  entry->next = old ? old->next : NULL;
+  *slot = entry;
+  if (old)
   {
-    ocsp_cache_root = cJSON_CreateObject();
+    if (old->resp_der) ocsp_cache_entry_count--;
+    if (!old->persisted) ocsp_cache_dirty_count--;
+    freeCacheEntry(old);
   }
+  if (entry->resp_der) ocsp_cache_entry_count++;
+  if (!entry->persisted) ocsp_cache_dirty_count++;
+}
 
-  cJSON_ArrayForEach(element_pointer, ocsp_cache_root)
+/**
+ * Remove all entries from the in memory cache.
+ */
+void clearCache(void)
+{
+  int i;
+  _rwlock_wrlock(&ocsp_response_cache_lock);
+  for (i = 0; i < OCSP_CACHE_BUCKET_COUNT; i++)
   {
-    int cmp = 0;
-    OCSP_CERTID *target_certid = decodeOCSPCertIDFromBase64(
-      element_pointer->string, data);
+    OCSP_CACHE_ENTRY *entry = ocsp_cache_buckets[i];
+    while (entry != NULL)
+    {
+      OCSP_CACHE_ENTRY *next = entry->next;
+      freeCacheEntry(entry);
+      entry = next;
+    }
+    ocsp_cache_buckets[i] = NULL;
+  }
+  ocsp_cache_entry_count = 0;
+  ocsp_cache_dirty_count = 0;
+  _rwlock_wrunlock(&ocsp_response_cache_lock);
+}
 
-    if (target_certid == NULL)
+/**
+ * Find OCSP Response in memory cache. Lookups share the cache lock, so
+ * concurrent handshakes do not wait for each other.
+ *
+ * @param certid OCSP CertID
+ * @param data curl handle
+ * @return OCSP Response if success otherwise NULL
+ */
+OCSP_RESPONSE * findOCSPRespInMem(OCSP_CERTID *certid, struct Curl_easy *data, SF_OTD *ocsp_log_data)
+{
+  OCSP_RESPONSE *resp = NULL;
+  OCSP_CACHE_ENTRY *found = NULL;
+  unsigned int hash = hashOCSPCertID(certid);
+  int expired = 0;
+
+  _rwlock_rdlock(&ocsp_response_cache_lock);
+  found = getCacheEntry(certid, hash);
+  if (found != NULL && found->resp_der != NULL)
+  {
+    /* valid for 120 hours */
+    if ((unsigned long)time(NULL) - found->timestamp >=
+        OCSP_CACHE_ENTRY_LIFETIME)
     {
-      infof(data, "Failed to decode OCSP CertID in the cache.\n");
-      continue;
+      expired = 1;
     }
-    cmp = OCSP_id_cmp(target_certid, certid);
-    OCSP_CERTID_free(target_certid);
-    if (cmp == 0)
+    else
     {
-      ret = element_pointer;
-      break;
+      const unsigned char *p = found->resp_der;
+      resp = d2i_OCSP_RESPONSE(NULL, &p, (long)found->resp_der_len);
     }
   }
-  return ret;
+  else
+  {
+    found = NULL;
+  }
+  _rwlock_rdunlock(&ocsp_response_cache_lock);
+
+  if (found == NULL)
+  {
+    infof(data, "OCSP Response not found in the cache");
+    goto end;
+  }
+  if (expired)
+  {
+    infof(data, "OCSP Response Cache Expired\n");
+    goto end;
+  }
+  if (resp == NULL)
+  {
+    infof(data, "Failed to decode OCSP response cache from der format\n");
+    goto end;
+  }
+  if (checkResponseTimeValidity(resp, data, ocsp_log_data) == INVALID)
+  {
+    OCSP_RESPONSE_free(resp);
+    resp = NULL;
+    goto end;
+  }
+  infof(data, "OCSP Response Cache found!!!\n");
+end:
+  return resp;
 }
 
 /**
@@ -1244,47 +1601,94 @@ cJSON *getCacheEntry(OCSP_CERTID* certid, struct Curl_easy *data)
  */
 void deleteCacheEntry(OCSP_CERTID* certid, struct Curl_easy *data)
 {
-  cJSON *found = NULL;
-
-  _mutex_lock(&ocsp_response_cache_mutex);
-  found = getCacheEntry(certid, data);
-  if (found)
-  {
-    cJSON_DeleteItemFromObject(ocsp_cache_root, found->string);
+  OCSP_CACHE_ENTRY *found = NULL;
+
+  _rwlock_wrlock(&ocsp_response_cache_lock);
+  found = getCacheEntry(certid, hashOCSPCertID(certid));
+  if (found && found->resp_der)
+  {
+    /* keep the entry without response till the removal is written to
+     * the cache file */
+    free(found->resp_der);
+    found->resp_der = NULL;
+    found->resp_der_len = 0;
+    ocsp_cache_entry_count--;
+    if (found->persisted)
+    {
+      found->persisted = 0;
+      ocsp_cache_dirty_count++;
+    }
+    infof(data, "Deleted OCSP Response from the cache\n");
   }
-  _mutex_unlock(&ocsp_response_cache_mutex);
+  _rwlock_wrunlock(&ocsp_response_cache_lock);
 }
 
 /**
- * Update OCSP cache with the cJSON data
+ * Update OCSP cache with the cJSON data. The values are arrays of the
+ * timestamp and the base64 encoded OCSP response keyed by the base64
+ * encoded OCSP CertID.
+ *
  * @param tmp_cache a cJSON data
  * @param data curl handle
  */
 void updateCacheWithBulkEntries(cJSON* tmp_cache, struct Curl_easy *data)
 {
   cJSON *element_pointer = NULL;
-  cJSON *found = NULL;
-  cJSON *new_value = NULL;
+  OCSP_CACHE_ENTRY *entries = NULL;
+  OCSP_CACHE_ENTRY *entry = NULL;
 
-  /* Detect the existing elements */
+  /* decode outside of the lock, lookups go on meanwhile */
   cJSON_ArrayForEach(element_pointer, tmp_cache)
   {
-    OCSP_CERTID *cert_id = decodeOCSPCertIDFromBase64(
-      element_pointer->string, data);
-    if (cert_id == NULL)
+    unsigned char *cert_id_der = NULL;
+    unsigned char *resp_der = NULL;
+    size_t cert_id_der_len = 0;
+    size_t resp_der_len = 0;
+    cJSON *last_query_time = cJSON_GetArrayItem(element_pointer, 0);
+    cJSON *resp_bas64_j = cJSON_GetArrayItem(element_pointer, 1);
+
+    if (!cJSON_IsArray(element_pointer) ||
+        !cJSON_IsNumber(last_query_time) ||
+        !cJSON_IsString(resp_bas64_j) || resp_bas64_j->valuestring == NULL)
     {
-      infof(data, "CertID is NULL\n");
+      infof(data, "OCSP Cache value is invalid\n");
       continue;
     }
-    found = getCacheEntry(cert_id, data);
-    OCSP_CERTID_free(cert_id);
-    new_value = cJSON_Duplicate(element_pointer, 1);
-    if (found != NULL)
+    if (Curl_base64_decode(element_pointer->string,
+                           &cert_id_der, &cert_id_der_len) != CURLE_OK ||
+        Curl_base64_decode(resp_bas64_j->valuestring,
+                           &resp_der, &resp_der_len) != CURLE_OK)
     {
-      cJSON_DeleteItemFromObject(ocsp_cache_root, found->string);
+      infof(data, "Failed to decode OCSP Cache entry. Ignored.\n");
     }
-    cJSON_AddItemToObject(ocsp_cache_root, element_pointer->string, new_value);
+    else
+    {
+      entry = newCacheEntry(cert_id_der, cert_id_der_len,
+                            resp_der, resp_der_len,
+                            (unsigned long)last_query_time->valuedouble);
+      if (entry == NULL)
+      {
+        infof(data, "CertID is NULL\n");
+      }
+      else
+      {
+        entry->next = entries;
+        entries = entry;
+      }
+    }
+    if (cert_id_der) curl_free(cert_id_der);
+    if (resp_der) curl_free(resp_der);
   }
+
+  _rwlock_wrlock(&ocsp_response_cache_lock);
+  while (entries != NULL)
+  {
+    entry = entries;
+    entries = entries->next;
+    putCacheEntry(entry);
+  }
+  infof(data, "Number of cache entries: %d\n", (int)ocsp_cache_entry_count);
+  _rwlock_wrunlock(&ocsp_response_cache_lock);
 }
 
 /**
@@ -1328,6 +1732,7 @@ void downloadOCSPCache(struct Curl_easy *data, SF_OTD *ocsp_log_data)
   }
 
   curl_easy_setopt(curlh, CURLOPT_NOPROGRESS, 1L);
+  abortOnOCSPRefreshStop(curlh, data);
   curl_easy_setopt(curlh, CURLOPT_NOSIGNAL, 1);
   curl_easy_setopt(curlh, CURLOPT_TIMEOUT, sf_timeout);
   curl_easy_setopt(curlh, CURLOPT_URL, ocsp_cache_server_url);
@@ -1365,19 +1770,10 @@ void downloadOCSPCache(struct Curl_easy *data, SF_OTD *ocsp_log_data)
     goto end;
   }
 
-  _mutex_lock(&ocsp_response_cache_mutex);
-  if (ocsp_cache_root == NULL)
-  {
-    ocsp_cache_root = cJSON_CreateObject();
-  }
   tmp_cache = cJSON_Parse(ocsp_response_cache_json_mem.memory_ptr);
 
   /* update OCSP cache with the downloaded cache */
   updateCacheWithBulkEntries(tmp_cache, data);
-  infof(data, "Number of cache entries: %d\n",
-        cJSON_GetArraySize(ocsp_cache_root));
-
-  _mutex_unlock(&ocsp_response_cache_mutex);
 end:
   if (tmp_cache) cJSON_Delete(tmp_cache);
   if (curlh) curl_easy_cleanup(curlh);
@@ -1604,6 +2000,8 @@ CURLcode checkOneCert(X509 *cert, X509 *issuer,
 
     if (sf_cert_status == CERT_STATUS_GOOD)
     {
+      /* keep the response fresh for the next handshakes */
+      addRefreshEntry(cert, issuer, ch, st, conn->host.name, data);
       result = CURLE_OK;
       break;
     }
@@ -1795,23 +2193,122 @@ err:
   return NULL;
 }
 
+static void putUInt32(unsigned char *p, unsigned long v)
+{
+  p[0] = (unsigned char)(v & 0xff);
+  p[1] = (unsigned char)((v >> 8) & 0xff);
+  p[2] = (unsigned char)((v >> 16) & 0xff);
+  p[3] = (unsigned char)((v >> 24) & 0xff);
+}
+
+static unsigned long getUInt32(const unsigned char *p)
+{
+  return (unsigned long)p[0] | ((unsigned long)p[1] << 8) |
+         ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+/**
+ * Serialize cache entries to records of the binary cache file and mark
+ * them written. Removed entries are dropped from the cache. Must be
+ * called with ocsp_response_cache_lock held for writing.
+ *
+ * @param buf the records, to be freed by the caller
+ * @param all non zero to serialize all entries for a new file, otherwise
+ * only entries not written yet, to append to the existing file
+ * @return length of buf
+ */
+size_t serializeCache(unsigned char **buf, int all)
+{
+  size_t len = 0;
+  size_t pos = 0;
+  int i;
+  OCSP_CACHE_ENTRY **slot;
+
+  for (i = 0; i < OCSP_CACHE_BUCKET_COUNT; i++)
+  {
+    OCSP_CACHE_ENTRY *entry;
+    for (entry = ocsp_cache_buckets[i]; entry != NULL; entry = entry->next)
+    {
+      if (all ? entry->resp_der != NULL : !entry->persisted)
+      {
+        len += OCSP_CACHE_RECORD_HEADER_LEN + entry->cert_id_der_len +
+               entry->resp_der_len;
+      }
+    }
+  }
+
+  *buf = len > 0 ? (unsigned char *)malloc(len) : NULL;
+  if (*buf == NULL)
+  {
+    return 0;
+  }
+
+  for (i = 0; i < OCSP_CACHE_BUCKET_COUNT; i++)
+  {
+    slot = &ocsp_cache_buckets[i];
+    while (*slot != NULL)
+    {
+      OCSP_CACHE_ENTRY *entry = *slot;
+      if (all ? entry->resp_der != NULL : !entry->persisted)
+      {
+        unsigned char *p = *buf + pos;
+        putUInt32(p, entry->timestamp);
+        putUInt32(p + 4, (unsigned long)entry->cert_id_der_len);
+        putUInt32(p + 8, (unsigned long)entry->resp_der_len);
+        p += OCSP_CACHE_RECORD_HEADER_LEN;
+        memcpy(p, entry->cert_id_der, entry->cert_id_der_len);
+        if (entry->resp_der_len > 0)
+        {
+          memcpy(p + entry->cert_id_der_len, entry->resp_der,
+                 entry->resp_der_len);
+        }
+        pos += OCSP_CACHE_RECORD_HEADER_LEN + entry->cert_id_der_len +
+               entry->resp_der_len;
+        entry->persisted = 1;
+      }
+      if (entry->resp_der == NULL)
+      {
+        /* the removal is in the file now, or the file is rewritten */
+        *slot = entry->next;
+        freeCacheEntry(entry);
+        continue;
+      }
+      slot = &entry->next;
+    }
+  }
+  ocsp_cache_dirty_count = 0;
+  return len;
+}
+
 /**
- * Write OCSP cache onto a file in the cache directory
+ * Write OCSP cache onto a file in the cache directory. Only updates since
+ * the last write are appended to the file. The file is rewritten into a
+ * temporary file and renamed over the existing one when it does not exist
+ * yet or has many overwritten records, so readers never see a partial
+ * file. Records other processes appended are merged in before rewriting.
+ *
  * @param data curl handle
  */
 void writeOCSPCacheFile(struct Curl_easy* data)
 {
   char cache_dir[PATH_MAX] = "";
   char cache_file[PATH_MAX] = "";
+  char cache_tmp_file[PATH_MAX] = "";
   char cache_lock_file[PATH_MAX] = "";
   FILE *fh;
   FILE *fp;
-  char * jsonText;
+  unsigned char *records = NULL;
+  size_t records_len = 0;
+  size_t record_count = 0;
+  size_t file_records;
+  int exists;
+  int rewrite;
+  struct stat statbuf;
 
   _mutex_lock(&ocsp_response_cache_mutex);
-  if (ocsp_cache_root == NULL)
+  if (!ocsp_cache_loaded || ocsp_cache_dirty_count == 0)
   {
-      infof(data, "Skipping writing OCSP cache file as no OCSP cache root exists.\n");
+      infof(data, "Skipping writing OCSP cache file as no OCSP cache entry was updated.\n");
       goto end;
   }
 
@@ -1824,9 +2321,13 @@ void writeOCSPCacheFile(struct Curl_easy* data)
   /* cache file */
   strcpy(cache_file, cache_dir);
   strcat(cache_file, PATH_SEP);
-  strcat(cache_file, OCSP_RESPONSE_CACHE_JSON);
+  strcat(cache_file, OCSP_RESPONSE_CACHE_BIN);
   infof(data, "OCSP Cache file: %s\n", cache_file);
 
+  /* temporary file for rewriting */
+  strcpy(cache_tmp_file, cache_file);
+  strcat(cache_tmp_file, ".tmp");
+
   /* cache lock directory/file */
   strcpy(cache_lock_file, cache_file);
   strcat(cache_lock_file, ".lck");
@@ -1834,7 +2335,6 @@ void writeOCSPCacheFile(struct Curl_easy* data)
   if (access(cache_lock_file, F_OK) != -1)
   {
     /* lck file exists */
-    struct stat statbuf;
     if (stat(cache_lock_file, &statbuf) != -1)
     {
       if ((long)time(NULL) - (long) statbuf.st_mtime < 60*60)
@@ -1868,53 +2368,279 @@ void writeOCSPCacheFile(struct Curl_easy* data)
     goto end;
   }
 
-  fp = fopen(cache_file, "w");
+  file_records = ocsp_cache_file_records;
+  exists = stat(cache_file, &statbuf) != -1 &&
+           statbuf.st_size >= OCSP_CACHE_FILE_MAGIC_LEN;
+  _rwlock_rdlock(&ocsp_response_cache_lock);
+  rewrite = file_records == 0 || !exists ||
+            file_records + ocsp_cache_dirty_count >
+            OCSP_CACHE_FILE_COMPACT_RATIO * ocsp_cache_entry_count;
+  _rwlock_rdunlock(&ocsp_response_cache_lock);
+
+  if (rewrite && exists)
+  {
+    /* other processes may have appended since the file was loaded, keep
+     * their records. Nobody writes the file while the lock file exists. */
+    loadOCSPCacheFile(cache_file, data, NULL, 1);
+  }
+
+  _rwlock_wrlock(&ocsp_response_cache_lock);
+  record_count = rewrite ? ocsp_cache_entry_count : ocsp_cache_dirty_count;
+  records_len = serializeCache(&records, rewrite);
+  _rwlock_wrunlock(&ocsp_response_cache_lock);
+
+  /* in case writing fails, the next write starts a new file */
+  ocsp_cache_file_records = 0;
+
+  fp = fopen(rewrite ? cache_tmp_file : cache_file, rewrite ? "wb" : "ab");
   if (fp == NULL)
   {
     infof(data, "Failed to open OCSP response cache file. Skipping writing OCSP cache file.\n");
-    goto end;
+    goto unlock;
   }
-  jsonText = cJSON_PrintUnformatted(ocsp_cache_root);
-  if (fprintf(fp, "%s", jsonText) < 0)
+  if ((rewrite && fwrite(OCSP_CACHE_FILE_MAGIC, 1, OCSP_CACHE_FILE_MAGIC_LEN,
+                         fp) != OCSP_CACHE_FILE_MAGIC_LEN) ||
+      (records_len > 0 && fwrite(records, 1, records_len, fp) != records_len))
   {
     infof(data, "Failed to write OCSP response cache file. Skipping\n");
+    fclose(fp);
+    goto unlock;
   }
-
   if (fclose(fp) != 0)
   {
     infof(data, "Failed to close OCSP response cache file: %s. Ignored\n", cache_file);
+    goto unlock;
   }
-  infof(data, "Write OCSP Response to cache file\n");
 
-  /* deallocate json string */
-  cJSON_free(jsonText);
+  if (rewrite)
+  {
+#ifdef _WIN32
+    if (!MoveFileExA(cache_tmp_file, cache_file, MOVEFILE_REPLACE_EXISTING))
+#else
+    if (rename(cache_tmp_file, cache_file) != 0)
+#endif
+    {
+      infof(data, "Failed to rename OCSP response cache file: %s. Ignored\n", cache_tmp_file);
+      remove(cache_tmp_file);
+      goto unlock;
+    }
+    ocsp_cache_file_records = record_count;
+  }
+  else
+  {
+    ocsp_cache_file_records = file_records + record_count;
+  }
+  infof(data, "Write OCSP Response to cache file\n");
 
+unlock:
   if (remove(cache_lock_file) != 0)
   {
     infof(data, "Failed to delete the lock file: %s, ignored\n", cache_lock_file);
   }
 end:
-  if (ocsp_cache_root != NULL)
+  if (records) free(records);
+  _mutex_unlock(&ocsp_response_cache_mutex);
+}
+
+/**
+ * Read the whole content of a file
+ * @param file file name
+ * @param len length of the content
+ * @return content to be freed by the caller or NULL
+ */
+static unsigned char *readWholeFile(char *file, size_t *len)
+{
+  unsigned char *buf = NULL;
+  long size;
+  FILE *pfile = fopen(file, "rb");
+  if (pfile == NULL)
   {
-    cJSON_Delete(ocsp_cache_root);
-    ocsp_cache_root = NULL;
+    return NULL;
   }
-  _mutex_unlock(&ocsp_response_cache_mutex);
+  if (fseek(pfile, 0, SEEK_END) != 0 || (size = ftell(pfile)) < 0 ||
+      fseek(pfile, 0, SEEK_SET) != 0)
+  {
+    goto end;
+  }
+  /* one more byte to terminate text content */
+  buf = (unsigned char *)malloc((size_t)size + 1);
+  if (buf == NULL)
+  {
+    goto end;
+  }
+  *len = fread(buf, 1, (size_t)size, pfile);
+  buf[*len] = '\0';
+end:
+  fclose(pfile);
+  return buf;
+}
+
+/**
+ * Load the binary cache file onto memory. A truncated last record, as
+ * left by an interrupted append, is ignored and makes the next write
+ * rewrite the file.
+ *
+ * @param cache_file cache file name
+ * @param data curl handle
+ * @param merge non zero to keep the entries not written to the file yet,
+ * for merging the records other processes wrote since the file was loaded.
+ * Entries loaded earlier are replaced with their current records.
+ */
+void loadOCSPCacheFile(char *cache_file, struct Curl_easy *data,
+                       SF_OTD *ocsp_log_data, int merge)
+{
+  size_t len = 0;
+  size_t pos = OCSP_CACHE_FILE_MAGIC_LEN;
+  size_t records = 0;
+  unsigned long now = (unsigned long)time(NULL);
+  unsigned char *buf = readWholeFile(cache_file, &len);
+
+  if (buf == NULL)
+  {
+    infof(data, "Failed to read OCSP response cache file. Ignored.\n");
+    sf_otd_set_event_sub_type(OCSP_CACHE_READ_FAILURE, ocsp_log_data);
+    return;
+  }
+  if (len < OCSP_CACHE_FILE_MAGIC_LEN ||
+      memcmp(buf, OCSP_CACHE_FILE_MAGIC, OCSP_CACHE_FILE_MAGIC_LEN) != 0)
+  {
+    infof(data, "Invalid OCSP response cache file. Ignored.\n");
+    sf_otd_set_event_sub_type(OCSP_CACHE_READ_FAILURE, ocsp_log_data);
+    free(buf);
+    return;
+  }
+
+  _rwlock_wrlock(&ocsp_response_cache_lock);
+  while (len - pos >= OCSP_CACHE_RECORD_HEADER_LEN)
+  {
+    OCSP_CACHE_ENTRY *entry;
+    unsigned long timestamp = getUInt32(buf + pos);
+    size_t cert_id_der_len = getUInt32(buf + pos + 4);
+    size_t resp_der_len = getUInt32(buf + pos + 8);
+    unsigned char *cert_id_der = buf + pos + OCSP_CACHE_RECORD_HEADER_LEN;
+
+    if (cert_id_der_len > len - pos - OCSP_CACHE_RECORD_HEADER_LEN ||
+        resp_der_len > len - pos - OCSP_CACHE_RECORD_HEADER_LEN -
+                       cert_id_der_len)
+    {
+      infof(data, "Truncated OCSP response cache record. Ignored.\n");
+      break;
+    }
+    pos += OCSP_CACHE_RECORD_HEADER_LEN + cert_id_der_len + resp_der_len;
+    records++;
+
+    /* expired entries are dropped when the file is rewritten */
+    if (resp_der_len > 0 && now - timestamp >= OCSP_CACHE_ENTRY_LIFETIME)
+    {
+      resp_der_len = 0;
+    }
+    entry = newCacheEntry(cert_id_der, cert_id_der_len,
+                          resp_der_len > 0 ? cert_id_der + cert_id_der_len
+                                           : NULL,
+                          resp_der_len, timestamp);
+    if (entry == NULL)
+    {
+      infof(data, "Failed to decode OCSP CertID in the cache.\n");
+      continue;
+    }
+    if (merge)
+    {
+      /* updates of this process win over the file */
+      OCSP_CACHE_ENTRY *found = getCacheEntry(entry->certid, entry->hash);
+      if (found != NULL && !found->persisted)
+      {
+        freeCacheEntry(entry);
+        continue;
+      }
+    }
+    entry->persisted = 1;
+    putCacheEntry(entry);
+  }
+  /* appending after a torn record would hide the appended records */
+  ocsp_cache_file_records = pos == len ? records : 0;
+
+  /* removed entries are not needed as the file already has the removal */
+  if (records > 0)
+  {
+    int i;
+    for (i = 0; i < OCSP_CACHE_BUCKET_COUNT; i++)
+    {
+      OCSP_CACHE_ENTRY **slot = &ocsp_cache_buckets[i];
+      while (*slot != NULL)
+      {
+        OCSP_CACHE_ENTRY *entry = *slot;
+        if (entry->resp_der == NULL && entry->persisted)
+        {
+          *slot = entry->next;
+          freeCacheEntry(entry);
+          continue;
+        }
+        slot = &entry->next;
+      }
+    }
+  }
+  infof(data, "OCSP cache file was successfully loaded. Number of cache entries: %d\n",
+        (int)ocsp_cache_entry_count);
+  _rwlock_wrunlock(&ocsp_response_cache_lock);
+  free(buf);
+}
+
+/**
+ * Load the cache file in json format written by earlier versions. The
+ * entries are written to the binary cache file next time.
+ *
+ * @param cache_file cache file name
+ * @param data curl handle
+ */
+void loadLegacyOCSPCacheFile(char *cache_file, struct Curl_easy *data,
+                             SF_OTD *ocsp_log_data)
+{
+  size_t len = 0;
+  cJSON *tmp_cache = NULL;
+  unsigned char *buf = readWholeFile(cache_file, &len);
+
+  if (buf == NULL)
+  {
+    infof(data, "Failed to open OCSP response cache file. Ignored.\n");
+    sf_otd_set_event_sub_type(OCSP_CACHE_READ_FAILURE, ocsp_log_data);
+    return;
+  }
+  tmp_cache = cJSON_Parse((char *)buf);
+  if (tmp_cache == NULL)
+  {
+    infof(data, "Failed to parse cache file content in json format\n");
+    sf_otd_set_event_sub_type(OCSP_CACHE_READ_FAILURE, ocsp_log_data);
+  }
+  else
+  {
+    updateCacheWithBulkEntries(tmp_cache, data);
+    infof(data, "OCSP cache file was successfully loaded\n");
+    cJSON_Delete(tmp_cache);
+  }
+  free(buf);
 }
 
 /**
- * Read OCSP cache from from the local cache directory
+ * Read OCSP cache from from the local cache directory. The cache file is
+ * read only once, later updates are kept in memory and appended to it.
+ *
  * @param data curl handle
  */
 void readOCSPCacheFile(struct Curl_easy* data, SF_OTD *ocsp_log_data)
 {
   char cache_dir[PATH_MAX] = "";
   char cache_file[PATH_MAX] = "";
-  char ocsp_resp_cache_str[20 * 1200]; /* TODO: malloc? */
-  FILE* pfile = NULL;
 
   _mutex_lock(&ocsp_response_cache_mutex);
 
+  if (ocsp_cache_loaded)
+  {
+    infof(data, "OCSP cache was already read onto memory\n");
+    goto end;
+  }
+  /* don't retry on failure, entries are cached in memory anyway */
+  ocsp_cache_loaded = 1;
+
   if (ensureCacheDir(cache_dir, data) == NULL)
   {
     infof(data, "Could not ensure the presence of Cache Directory. "
@@ -1927,54 +2653,451 @@ void readOCSPCacheFile(struct Curl_easy* data, SF_OTD *ocsp_log_data)
   /* cache file */
   strcpy(cache_file, cache_dir);
   strcat(cache_file, PATH_SEP);
-  strcat(cache_file, OCSP_RESPONSE_CACHE_JSON);
+  strcat(cache_file, OCSP_RESPONSE_CACHE_BIN);
   infof(data, "OCSP cache file: %s\n", cache_file);
 
-  if (ocsp_cache_root != NULL)
+  if (access(cache_file, F_OK) != -1)
   {
-    infof(data, "OCSP cache was already read onto memory\n");
+    loadOCSPCacheFile(cache_file, data, ocsp_log_data, 0);
     goto end;
   }
+
+  /* fall back to the json cache file of earlier versions */
+  strcpy(cache_file, cache_dir);
+  strcat(cache_file, PATH_SEP);
+  strcat(cache_file, OCSP_RESPONSE_CACHE_JSON);
   if (access(cache_file, F_OK) == -1)
   {
     infof(data, "No OCSP cache file found on disk. file: %s\n", cache_file);
     sf_otd_set_event_sub_type(OCSP_CACHE_READ_FAILURE, ocsp_log_data);
     goto end;
   }
+  loadLegacyOCSPCacheFile(cache_file, data, ocsp_log_data);
+end:
+  _mutex_unlock(&ocsp_response_cache_mutex);
+  return;
+}
 
-  pfile = fopen(cache_file, "r");
-  if (pfile == NULL)
+/**
+ * Seconds the cached response for the cert id stays usable, limited by
+ * both the lifetime of the cache entry and the next update time of the
+ * response. 0 if there is no usable response.
+ *
+ * @param certid OCSP CertID
+ * @return remaining seconds
+ */
+static long getCacheEntryRemainingTime(OCSP_CERTID *certid)
+{
+  long remaining = 0;
+  unsigned long now = (unsigned long)time(NULL);
+  OCSP_CACHE_ENTRY *found = NULL;
+  OCSP_RESPONSE *resp = NULL;
+  OCSP_BASICRESP *br = NULL;
+  int i;
+
+  _rwlock_rdlock(&ocsp_response_cache_lock);
+  found = getCacheEntry(certid, hashOCSPCertID(certid));
+  if (found != NULL && found->resp_der != NULL &&
+      now - found->timestamp < OCSP_CACHE_ENTRY_LIFETIME)
   {
-    infof(data, "Failed to open OCSP response cache file. Ignored.\n");
-    sf_otd_set_event_sub_type(OCSP_CACHE_READ_FAILURE, ocsp_log_data);
+    const unsigned char *p = found->resp_der;
+    remaining = (long)(found->timestamp + OCSP_CACHE_ENTRY_LIFETIME - now);
+    resp = d2i_OCSP_RESPONSE(NULL, &p, (long)found->resp_der_len);
+  }
+  _rwlock_rdunlock(&ocsp_response_cache_lock);
+
+  if (resp == NULL || (br = OCSP_response_get1_basic(resp)) == NULL)
+  {
+    remaining = 0;
     goto end;
   }
+  for (i = 0; i < OCSP_resp_count(br); i++)
+  {
+    int pday, psec;
+    ASN1_GENERALIZEDTIME *thisupd, *nextupd = NULL;
+    OCSP_SINGLERESP *single = OCSP_resp_get0(br, i);
+    if (!single)
+      continue;
+    OCSP_single_get0_status(single, NULL, NULL, &thisupd, &nextupd);
+    if (nextupd && ASN1_TIME_diff(&pday, &psec, NULL, nextupd))
+    {
+      long left = (long)pday*24*60*60 + psec;
+      remaining = left < remaining ? left : remaining;
+    }
+  }
+  if (remaining < 0)
+  {
+    remaining = 0;
+  }
+end:
+  if (br) OCSP_BASICRESP_free(br);
+  if (resp) OCSP_RESPONSE_free(resp);
+  return remaining;
+}
+
+/**
+ * Whether the cached response of any registered certificate expires within
+ * the lead time. Responses of certificates not registered for refresh are
+ * not looked at, they are refreshed on their next use.
+ *
+ * @param entries registered certificates
+ * @param lead_time seconds
+ * @return 1 if any response is due for a refresh otherwise 0
+ */
+static int hasDueRefreshEntries(OCSP_REFRESH_ENTRY *entries, long lead_time)
+{
+  OCSP_REFRESH_ENTRY *entry;
+  for (entry = entries; entry != NULL; entry = entry->next)
+  {
+    if (getCacheEntryRemainingTime(entry->certid) < lead_time)
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
 
-  if (fgets(ocsp_resp_cache_str, sizeof(ocsp_resp_cache_str), pfile) == NULL) {
-    infof(data, "Failed to read OCSP response cache file. Ignored\n");
-    goto file_close;
+/**
+ * Register a certificate that passed the OCSP check for background
+ * refresh. Does nothing unless the refresh thread runs.
+ *
+ * @param cert subject certificate
+ * @param issuer issuer certificate
+ * @param ch certificate chain
+ * @param st CA certificates
+ * @param hostname host the certificate was presented for
+ * @param data curl handle
+ */
+void addRefreshEntry(X509 *cert, X509 *issuer, STACK_OF(X509) *ch,
+                     X509_STORE *st, char *hostname, struct Curl_easy *data)
+{
+  OCSP_REFRESH_ENTRY *entry = NULL;
+  OCSP_CERTID *certid = OCSP_cert_to_id(EVP_sha1(), cert, issuer);
+
+  if (certid == NULL)
+  {
+    return;
   }
-  /* just attached the whole JSON object */
-  ocsp_cache_root = cJSON_Parse(ocsp_resp_cache_str);
-  if (ocsp_cache_root == NULL)
+
+  _critical_section_lock(&ocsp_refresh_lock);
+  if (!ocsp_refresh_started ||
+      ocsp_refresh_entry_count >= OCSP_REFRESH_MAX_CERTS)
   {
-    infof(data, "Failed to parse cache file content in json format\n");
-    sf_otd_set_event_sub_type(OCSP_CACHE_READ_FAILURE, ocsp_log_data);
+    goto end;
   }
-  else
+  for (entry = ocsp_refresh_entries; entry != NULL; entry = entry->next)
   {
-    infof(data, "OCSP cache file was successfully loaded\n");
+    if (OCSP_id_cmp(entry->certid, certid) == 0)
+    {
+      goto end;
+    }
   }
-file_close:
-  if (fclose(pfile) != 0)
+
+  entry = (OCSP_REFRESH_ENTRY *)calloc(1, sizeof(OCSP_REFRESH_ENTRY));
+  if (entry == NULL)
   {
-    infof(data, "Failed to close cache file. Ignored.\n");
     goto end;
   }
+  entry->hostname = strdup(hostname);
+  entry->chain = X509_chain_up_ref(ch);
+  if (entry->hostname == NULL || entry->chain == NULL)
+  {
+    if (entry->chain) sk_X509_pop_free(entry->chain, X509_free);
+    free(entry->hostname);
+    free(entry);
+    goto end;
+  }
+  X509_up_ref(cert);
+  entry->cert = cert;
+  X509_STORE_up_ref(st);
+  entry->store = st;
+  entry->certid = certid;
+  certid = NULL;
+  entry->next = ocsp_refresh_entries;
+  ocsp_refresh_entries = entry;
+  ocsp_refresh_entry_count++;
+  infof(data, "Added OCSP refresh entry for %s\n", hostname);
 end:
-  if (ocsp_cache_root == NULL) ocsp_cache_root = cJSON_CreateObject();
-  _mutex_unlock(&ocsp_response_cache_mutex);
-  return;
+  _critical_section_unlock(&ocsp_refresh_lock);
+  if (certid) OCSP_CERTID_free(certid);
+}
+
+/**
+ * Fetch a new response for a registered certificate from its OCSP
+ * responder and cache it if it verifies. The current response stays in
+ * the cache otherwise.
+ *
+ * @param entry refresh entry
+ * @param data curl handle
+ * @param ocsp_log_data OCSP telemetry data
+ * @return 1 if the cached response was updated otherwise 0
+ */
+static int refreshOneCert(OCSP_REFRESH_ENTRY *entry, struct Curl_easy *data,
+                          SF_OTD *ocsp_log_data)
+{
+  OCSP_REQUEST *req = NULL;
+  OCSP_RESPONSE *resp = NULL;
+  OCSP_CERTID *certid = OCSP_CERTID_dup(entry->certid);
+  STACK_OF(OPENSSL_STRING) *ocsp_list = NULL;
+  int refreshed = 0;
+  int i;
+
+  if (certid == NULL)
+  {
+    return 0;
+  }
+  if (!prepareRequest(&req, certid, data))
+  {
+    /* not attached to the request */
+    OCSP_CERTID_free(certid);
+    goto end;
+  }
+
+  ocsp_list = X509_get1_ocsp(entry->cert);
+  for (i = 0; i < sk_OPENSSL_STRING_num(ocsp_list); i++)
+  {
+    int use_ssl;
+    char *host = NULL, *port = NULL, *path = NULL;
+    char *ocsp_url = sk_OPENSSL_STRING_value(ocsp_list, i);
+
+    if (ocsp_url == NULL ||
+        !OCSP_parse_url(ocsp_url, &host, &port, &path, &use_ssl))
+    {
+      continue;
+    }
+    OPENSSL_free(host);
+    OPENSSL_free(path);
+    OPENSSL_free(port);
+
+    resp = queryResponderUsingCurl(ocsp_url, entry->certid, entry->hostname,
+                                   req, data, ENABLED, ocsp_log_data);
+    break;
+  }
+
+  if (resp == NULL ||
+      OCSP_response_status(resp) != OCSP_RESPONSE_STATUS_SUCCESSFUL)
+  {
+    infof(data, "Failed to refresh OCSP response for %s\n", entry->hostname);
+    goto end;
+  }
+  switch (checkResponse(resp, entry->chain, entry->store, data, ocsp_log_data))
+  {
+    case CERT_STATUS_GOOD:
+    case CERT_STATUS_REVOKED:
+      updateOCSPResponseInMem(entry->certid, resp, data);
+      infof(data, "Refreshed OCSP response for %s\n", entry->hostname);
+      refreshed = 1;
+      break;
+    default:
+      infof(data, "Refreshed OCSP response for %s is not valid\n",
+            entry->hostname);
+      break;
+  }
+
+end:
+  if (ocsp_list) X509_email_free(ocsp_list);
+  if (resp) OCSP_RESPONSE_free(resp);
+  if (req) OCSP_REQUEST_free(req);
+  return refreshed;
+}
+
+static int isOCSPRefreshStopped(void)
+{
+  int stopped;
+  _critical_section_lock(&ocsp_refresh_lock);
+  stopped = ocsp_refresh_stop;
+  _critical_section_unlock(&ocsp_refresh_lock);
+  return stopped;
+}
+
+/**
+ * One background refresh pass. Downloads the cache server content if the
+ * response of any registered certificate is due, then fetches responses
+ * that are still due from their OCSP responders.
+ *
+ * @param data curl handle
+ * @param lead_time refresh responses expiring within this many seconds
+ */
+void refreshOCSPCache(struct Curl_easy *data, long lead_time)
+{
+  OCSP_REFRESH_ENTRY *entry;
+  int updated = 0;
+  SF_OTD *ocsp_log_data = (SF_OTD *)calloc(1, sizeof(SF_OTD));
+
+  if (ocsp_log_data == NULL)
+  {
+    return;
+  }
+
+  _critical_section_lock(&ocsp_refresh_lock);
+  entry = ocsp_refresh_entries;
+  _critical_section_unlock(&ocsp_refresh_lock);
+
+  if (ocsp_cache_server_enabled && hasDueRefreshEntries(entry, lead_time))
+  {
+    infof(data, "Refreshing OCSP cache from the cache server\n");
+    downloadOCSPCache(data, ocsp_log_data);
+    updated = 1;
+  }
+
+  for (; entry != NULL && !isOCSPRefreshStopped(); entry = entry->next)
+  {
+    if (getCacheEntryRemainingTime(entry->certid) < lead_time)
+    {
+      updated |= refreshOneCert(entry, data, ocsp_log_data);
+    }
+  }
+
+  if (updated)
+  {
+    writeOCSPCacheFile(data);
+  }
+  free(ocsp_log_data);
+}
+
+static void runOCSPRefresh(void)
+{
+  long interval;
+  long lead_time;
+  CURL *curlh = curl_easy_init();
+
+  if (curlh == NULL)
+  {
+    return;
+  }
+  /* transfers made for this handle abort once the refresh stops */
+  curl_easy_setopt(curlh, CURLOPT_PRIVATE, (char *)&ocsp_refresh_stop);
+
+  _critical_section_lock(&ocsp_refresh_lock);
+  while (!ocsp_refresh_stop)
+  {
+    interval = OCSP_REFRESH_INTERVAL;
+    lead_time = OCSP_REFRESH_LEAD_TIME;
+    if (getTestStatus(SF_OCSP_TEST_MODE) == TEST_ENABLED)
+    {
+      if (getTestStatus(SF_TEST_OCSP_REFRESH_INTERVAL))
+      {
+        interval = getTestStatus(SF_TEST_OCSP_REFRESH_INTERVAL);
+      }
+      if (getTestStatus(SF_TEST_OCSP_REFRESH_LEAD_TIME))
+      {
+        lead_time = getTestStatus(SF_TEST_OCSP_REFRESH_LEAD_TIME);
+      }
+    }
+    _critical_section_unlock(&ocsp_refresh_lock);
+
+    refreshOCSPCache(curlh, lead_time);
+
+    _critical_section_lock(&ocsp_refresh_lock);
+    if (!ocsp_refresh_stop)
+    {
+      _cond_timedwait(&ocsp_refresh_cond, &ocsp_refresh_lock, interval);
+    }
+  }
+  _critical_section_unlock(&ocsp_refresh_lock);
+  curl_easy_cleanup(curlh);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI ocspRefreshThread(LPVOID arg)
+{
+  (void)arg;
+  runOCSPRefresh();
+  return 0;
+}
+#else
+static void *ocspRefreshThread(void *arg)
+{
+  (void)arg;
+  runOCSPRefresh();
+  return NULL;
+}
+#endif
+
+/**
+ * Start the thread refreshing cached responses before they expire, so
+ * that handshakes find fresh responses in the cache. The first pass runs
+ * right away to warm up the cache loaded from the cache file.
+ * SF_OCSP_RESPONSE_CACHE_REFRESH_ENABLED=false disables it.
+ *
+ * @param data curl handle
+ */
+void startOCSPRefresh(struct Curl_easy *data)
+{
+  char *refresh_enabled_env = getenv("SF_OCSP_RESPONSE_CACHE_REFRESH_ENABLED");
+
+  if (refresh_enabled_env != NULL && strcmp(refresh_enabled_env, "false") == 0)
+  {
+    return;
+  }
+
+  _critical_section_lock(&ocsp_refresh_lock);
+  if (!ocsp_refresh_started)
+  {
+    ocsp_refresh_stop = 0;
+#ifdef _WIN32
+    ocsp_refresh_thread = CreateThread(NULL, 0, ocspRefreshThread, NULL, 0, NULL);
+    ocsp_refresh_started = ocsp_refresh_thread != NULL;
+#else
+    ocsp_refresh_started = pthread_create(&ocsp_refresh_thread, NULL,
+                                          ocspRefreshThread, NULL) == 0;
+#endif
+    if (ocsp_refresh_started)
+    {
+      infof(data, "Started OCSP cache refresh\n");
+    }
+    else
+    {
+      failf(data, "Failed to start OCSP cache refresh\n");
+    }
+  }
+  _critical_section_unlock(&ocsp_refresh_lock);
+}
+
+/**
+ * Stop the refresh thread and forget the registered certificates. Queries
+ * of a running refresh are aborted.
+ */
+SF_PUBLIC(void) stopCertOCSPRefresh()
+{
+  OCSP_REFRESH_ENTRY *entry;
+
+  if (!ocsp_refresh_initialized)
+  {
+    return;
+  }
+
+  _critical_section_lock(&ocsp_refresh_lock);
+  if (!ocsp_refresh_started)
+  {
+    _critical_section_unlock(&ocsp_refresh_lock);
+    return;
+  }
+  ocsp_refresh_stop = 1;
+  _cond_broadcast(&ocsp_refresh_cond);
+  _critical_section_unlock(&ocsp_refresh_lock);
+
+#ifdef _WIN32
+  WaitForSingleObject(ocsp_refresh_thread, INFINITE);
+  CloseHandle(ocsp_refresh_thread);
+#else
+  pthread_join(ocsp_refresh_thread, NULL);
+#endif
+
+  _critical_section_lock(&ocsp_refresh_lock);
+  ocsp_refresh_started = 0;
+  while ((entry = ocsp_refresh_entries) != NULL)
+  {
+    ocsp_refresh_entries = entry->next;
+    OCSP_CERTID_free(entry->certid);
+    X509_free(entry->cert);
+    sk_X509_pop_free(entry->chain, X509_free);
+    X509_STORE_free(entry->store);
+    free(entry->hostname);
+    free(entry);
+  }
+  ocsp_refresh_entry_count = 0;
+  _critical_section_unlock(&ocsp_refresh_lock);
 }
 
 /**
@@ -2093,6 +3216,10 @@ SF_PUBLIC(CURLcode) initCertOCSP()
 {
   /* must call only once. not thread safe */
   _mutex_init(&ocsp_response_cache_mutex);
+  _rwlock_init(&ocsp_response_cache_lock);
+  _critical_section_init(&ocsp_refresh_lock);
+  _cond_init(&ocsp_refresh_cond);
+  ocsp_refresh_initialized = 1;
   atexit(termCertOCSP);
   return CURLE_OK;
 }
@@ -2102,7 +3229,16 @@ SF_PUBLIC(CURLcode) initCertOCSP()
  */
 static void termCertOCSP()
 {
+  stopCertOCSPRefresh();
+  if (ocsp_refresh_initialized)
+  {
+    ocsp_refresh_initialized = 0;
+    _cond_term(&ocsp_refresh_cond);
+    _critical_section_term(&ocsp_refresh_lock);
+  }
+  clearCache();
   /* terminate the mutex */
+  _rwlock_term(&ocsp_response_cache_lock);
   _mutex_term(&ocsp_response_cache_mutex);
 }
 
@@ -2167,6 +3303,7 @@ SF_PUBLIC(CURLcode) checkCertOCSP(struct connectdata *conn, STACK_OF(X509) *ch,
 
   infof(data, "Start SF OCSP Validation...\n");
   readOCSPCacheFile(data, ocsp_log_data);
+  startOCSPRefresh(data);
 
   numcerts = sk_X509_num(ch);
   infof(data, "Number of certificates in the chain: %d\n", numcerts);
@@ -16,6 +16,7 @@
 
 SF_PUBLIC(CURLcode) initCertOCSP();
 SF_PUBLIC(CURLcode) checkCertOCSP(struct connectdata *conn, STACK_OF(X509) *ch, X509_STORE *st, int ocsp_failopen);
+SF_PUBLIC(void) stopCertOCSPRefresh();
 
 
 #endif
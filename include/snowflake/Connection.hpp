@@ -10,8 +10,11 @@
 
 namespace Snowflake {
     namespace Client {
+        class ConnectionPool;
+
         class Connection {
             friend class Statement;
+            friend class ConnectionPool;
         public:
 
             /* Construct a blank Snowflake Connection */
@@ -41,7 +44,35 @@ namespace Snowflake {
             const std::string err_msg();
 
         private:
+            /* Wrap a session borrowed from the pool, given back on destruction */
+            Connection(SF_CONNECT *connection_, ConnectionPool *pool_);
+
             SF_CONNECT *m_connection;
+            ConnectionPool *m_pool;
+        };
+
+        class ConnectionPool {
+            friend class Connection;
+        public:
+
+            /*
+             * Log in sessions with the attributes of the connection in the
+             * background, see snowflake_pool_init
+             */
+            ConnectionPool(Connection &config_, uint64 minSize_,
+                           uint64 maxSize_, int64 maxIdleTime_ = 0);
+
+            ~ConnectionPool(void);
+
+            /*
+             * Borrow a logged in session. It goes back to the pool when the
+             * returned connection is deleted, which must happen before the
+             * pool is.
+             */
+            Connection *borrow(int64 timeout_ = -1);
+
+        private:
+            SF_CONNECT_POOL *m_pool;
         };
     }
 }
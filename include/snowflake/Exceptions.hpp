@@ -6,12 +6,16 @@
 #define SNOWFLAKECLIENT_EXCEPTIONS_HPP
 
 #include <exception>
+#include <memory>
 #include "client.h"
 
 class SnowflakeException: public std::exception {
 public:
     SnowflakeException(SF_ERROR_STRUCT *error);
 
+    /* Keep an error owned by the exception, freed with its last copy */
+    SnowflakeException(std::shared_ptr<SF_ERROR_STRUCT> error);
+
     const char * what() const throw();
 
     SF_STATUS code();
@@ -28,11 +32,13 @@ public:
 
 protected:
     SF_ERROR_STRUCT *error;
+    std::shared_ptr<SF_ERROR_STRUCT> m_ownedError;
 };
 
 class GeneralException: public SnowflakeException {
 public:
     GeneralException(SF_ERROR_STRUCT *error) : SnowflakeException(error) {};
+    GeneralException(std::shared_ptr<SF_ERROR_STRUCT> error) : SnowflakeException(error) {};
 };
 
 #endif //SNOWFLAKECLIENT_EXCEPTIONS_HPP
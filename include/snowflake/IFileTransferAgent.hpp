@@ -55,6 +55,25 @@ public:
    */
   static void injectExternalLogger(ISFLogger * logger);
 
+  /**
+   * Storage clients are cached and reused across put/get commands. Call this
+   * before unloading the library to release them, shut down cloud sdks and
+   * stop threads of the transfer executor.
+   */
+  static void releaseCachedStorageClients();
+
+  /**
+   * Set limits of the executor that put/get commands of all transfer agents
+   * share. Each command still runs at most its own parallel setting.
+   * @param maxThreads max number of files transferred at the same time over
+   *        all commands, 0 to keep the current value
+   * @param maxInFlightBytes max total size of files being transferred at the
+   *        same time, 0 for no limit. A single file larger than the limit is
+   *        transferred alone.
+   */
+  static void setTransferExecutorLimits(unsigned int maxThreads,
+                                        size_t maxInFlightBytes);
+
   /**
    * Set useUrand to true to use /dev/urandom device
    * Set it to false to use /dev/random device
@@ -23,6 +23,16 @@ public:
   void logLine(SF_LOG_LEVEL logLevel, const char * fileName, const char * msgFmt,
                ...);
 
+  /**
+   * Override to skip formatting and masking of records the external logger
+   * would discard anyway.
+   * @return true if records of the level are logged
+   */
+  virtual bool isLevelEnabled(SF_LOG_LEVEL logLevel)
+  {
+    return true;
+  }
+
   /**
    * Method implemented by external logger
    */
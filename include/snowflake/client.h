@@ -61,6 +61,17 @@ extern "C" {
  */
 #define SF_LOGIN_TIMEOUT 120
 
+/**
+ * Request bodies from this size in bytes on are sent gzip compressed, see
+ * SF_GLOBAL_REQUEST_COMPRESSION_THRESHOLD
+ */
+#define SF_DEFAULT_REQUEST_COMPRESSION_THRESHOLD 16384
+
+/**
+ * Idle time in seconds after which pooled sessions are deleted
+ */
+#define SF_POOL_DEFAULT_MAX_IDLE_TIME 3600
+
 /**
  * Snowflake Data types
  *
@@ -224,14 +235,25 @@ typedef enum SF_GLOBAL_ATTRIBUTE {
     SF_GLOBAL_CA_BUNDLE_FILE,
     SF_GLOBAL_SSL_VERSION,
     SF_GLOBAL_DEBUG,
-    SF_GLOBAL_OCSP_CHECK
+    SF_GLOBAL_OCSP_CHECK,
+    SF_GLOBAL_LOG_ASYNC,
+    SF_GLOBAL_LOG_OVERFLOW_POLICY,
+    SF_GLOBAL_LOG_MAX_FILE_SIZE,
+    SF_GLOBAL_MAX_DOWNLOAD_THREADS,
+    SF_GLOBAL_MAX_DOWNLOAD_BYTES,
+    SF_GLOBAL_REQUEST_COMPRESSION_THRESHOLD
 } SF_GLOBAL_ATTRIBUTE;
 
 /**
  * Attributes for Snowflake statement context.
  */
 typedef enum SF_STMT_ATTRIBUTE {
-    SF_STMT_USER_REALLOC_FUNC
+    SF_STMT_USER_REALLOC_FUNC,
+    // uint64, max estimated memory of the result chunks downloaded ahead of
+    // snowflake_fetch, 0 for no limit. Chunks past the budget are kept
+    // compressed in a temporary file until fetched. Applies to the
+    // statements executed afterwards.
+    SF_STMT_CHUNK_MEMORY_BUDGET
 } SF_STMT_ATTRIBUTE;
 
 /**
@@ -302,8 +324,20 @@ typedef struct SF_CONNECT {
 
     // Error
     SF_ERROR_STRUCT error;
+
+    // Whether a statement failed with a connection error, sqlstate class 08
+    sf_bool connection_failed;
+
+    // Whether a statement changed session parameters or variables, or
+    // created temporary objects
+    sf_bool session_changed;
 } SF_CONNECT;
 
+/**
+ * Pool of sessions logged in ahead of time, see snowflake_pool_init.
+ */
+typedef struct SF_CONNECT_POOL SF_CONNECT_POOL;
+
 /**
  * Column description context. idx is indexed from 1.
  */
@@ -341,6 +375,25 @@ typedef struct SF_QUERY_RESULT_CAPTURE {
     size_t actual_response_size;
 } SF_QUERY_RESULT_CAPTURE;
 
+/**
+ * Part of a result set that can be downloaded and consumed independently of
+ * the other parts. The first partition holds the rows returned with the
+ * query response, the following ones the chunks of the result set. Strings
+ * belong to the statement and stay valid until it is reset or terminated.
+ */
+typedef struct SF_RESULT_PARTITION {
+    // Zero based index of the first row of the partition in the result set
+    int64 first_row;
+    int64 row_count;
+    // URL the rows are downloaded from, NULL for the first partition
+    const char *url;
+    // Query result master key, NULL if not given
+    const char *qrmk;
+    // Headers to send with the download, as "name: value" lines
+    const char *const *headers;
+    size_t header_count;
+} SF_RESULT_PARTITION;
+
 /**
  * Chunk downloader context
  */
@@ -382,6 +435,12 @@ typedef struct SF_STMT {
 
     SF_CHUNK_DOWNLOADER *chunk_downloader;
     SF_PUT_GET_RESPONSE *put_get_response;
+
+    // snowflake_fetch returns SF_STATUS_EOF at this row index, -1 for no limit
+    int64 row_limit;
+
+    // See SF_STMT_CHUNK_MEMORY_BUDGET
+    uint64 chunk_memory_budget;
 } SF_STMT;
 
 /**
@@ -442,7 +501,8 @@ SF_STATUS STDCALL
 snowflake_global_init(const char *log_path, SF_LOG_LEVEL log_level, SF_USER_MEM_HOOKS *hooks);
 
 /**
- * Global Snowflake cleanup.
+ * Global Snowflake cleanup. Connections and connection pools must be
+ * terminated before, as they share state released here.
  *
  * @return 0 if successful, errno otherwise
  */
@@ -490,6 +550,69 @@ SF_STATUS STDCALL snowflake_term(SF_CONNECT *sf);
  */
 SF_STATUS STDCALL snowflake_connect(SF_CONNECT *sf);
 
+/**
+ * Creates a pool of sessions logged in with the attributes of a connection.
+ * The attributes are copied, so the connection may be purged afterwards.
+ * Background threads keep min_size sessions logged in and log in more, up to
+ * max_size, while callers wait to borrow one. Passcodes and direct query
+ * attributes are not copied.
+ *
+ * Sessions idle for more than a few minutes, or half of max_idle_time, are
+ * checked with a heartbeat before being lent, and deleted if the server
+ * dropped them.
+ *
+ * @param config SNOWFLAKE context with the connection attributes set.
+ * @param min_size number of sessions kept logged in.
+ * @param max_size maximum number of sessions.
+ * @param max_idle_time seconds after which idle sessions are deleted, or 0
+ *        for SF_POOL_DEFAULT_MAX_IDLE_TIME.
+ * @return the pool if success, otherwise NULL with the error set in config.
+ */
+SF_CONNECT_POOL *STDCALL snowflake_pool_init(
+    SF_CONNECT *config, uint64 min_size, uint64 max_size, int64 max_idle_time);
+
+/**
+ * Deletes the sessions of the pool and frees it. Connections still borrowed
+ * are purged as well.
+ *
+ * @param pool connection pool.
+ * @return 0 if success, otherwise an errno is returned.
+ */
+SF_STATUS STDCALL snowflake_pool_term(SF_CONNECT_POOL *pool);
+
+/**
+ * Borrows a logged in session from the pool. Fails right away while the
+ * pool can't log in sessions, with the error of the last login.
+ *
+ * @param pool connection pool.
+ * @param sf pointer set to the borrowed SNOWFLAKE context.
+ * @param timeout milliseconds to wait for a session, or -1 to wait until one
+ *        is available.
+ * @param error error context of the caller, zero initialized or cleared
+ *        with snowflake_clear_error, set if the borrow fails. May be NULL.
+ * @return 0 if success, otherwise an errno is returned.
+ */
+SF_STATUS STDCALL snowflake_pool_borrow(
+    SF_CONNECT_POOL *pool, SF_CONNECT **sf, int64 timeout,
+    SF_ERROR_STRUCT *error);
+
+/**
+ * Returns a borrowed session to the pool. Sessions without autocommit are
+ * rolled back. Sessions that lost their tokens, failed with a connection
+ * error, in a statement as well, or use other objects or autocommit mode
+ * than they logged in with are deleted instead of being lent again.
+ *
+ * So are sessions that ran ALTER SESSION, SET or UNSET, or created temporary
+ * objects, as told by the statement type of each query. Other session state,
+ * like an explicit transaction begun with autocommit on, is not tracked and
+ * is seen by the next borrower.
+ *
+ * @param pool connection pool.
+ * @param sf SNOWFLAKE context borrowed from the pool.
+ * @return 0 if success, otherwise an errno is returned.
+ */
+SF_STATUS STDCALL snowflake_pool_return(SF_CONNECT_POOL *pool, SF_CONNECT *sf);
+
 /**
  * Sets the attribute to the session.
  *
@@ -576,6 +699,13 @@ SF_ERROR_STRUCT *STDCALL snowflake_stmt_error(SF_STMT *sfstmt);
  */
 SF_ERROR_STRUCT *STDCALL snowflake_error(SF_CONNECT *sf);
 
+/**
+ * Frees the message of an error context owned by the caller and resets it.
+ *
+ * @param error error context.
+ */
+void STDCALL snowflake_clear_error(SF_ERROR_STRUCT *error);
+
 /**
  * Propagate SF_STMT error to SF_CONNECT so that the latest statement
  * error is visible in the connection context.
@@ -708,6 +838,67 @@ SF_STATUS STDCALL snowflake_describe_with_capture(SF_STMT *sfstmt,
  */
 SF_STATUS STDCALL snowflake_fetch(SF_STMT *sfstmt);
 
+/**
+ * Positions the result set so that the next snowflake_fetch returns the row
+ * at the given index. The chunks of the result set before the row are not
+ * downloaded. Rows of the first rowset, returned with the query response,
+ * can't be sought back to once fetched.
+ *
+ * @param sfstmt SNOWFLAKE_RESULTSET context.
+ * @param row_index Zero based index of the row, up to the number of rows.
+ * @return 0 if success, otherwise an errno is returned.
+ */
+SF_STATUS STDCALL snowflake_fetch_seek(SF_STMT *sfstmt, int64 row_index);
+
+/**
+ * Restricts snowflake_fetch to limit rows starting at offset, for paging
+ * through a large result set. Chunks outside of the window are not
+ * downloaded.
+ *
+ * @param sfstmt SNOWFLAKE_RESULTSET context.
+ * @param offset Zero based index of the first row of the window.
+ * @param limit Number of rows of the window, negative for no limit.
+ * @return 0 if success, otherwise an errno is returned.
+ */
+SF_STATUS STDCALL snowflake_fetch_window(SF_STMT *sfstmt, int64 offset, int64 limit);
+
+/**
+ * Returns the number of partitions of the result set, see SF_RESULT_PARTITION.
+ *
+ * @param sfstmt SNOWFLAKE_RESULTSET context.
+ * @return the number of partitions, -1 if there is no result set.
+ */
+int64 STDCALL snowflake_num_partitions(SF_STMT *sfstmt);
+
+/**
+ * Describes a partition of the result set, so that it can be downloaded
+ * and decoded elsewhere, for example by another process.
+ *
+ * @param sfstmt SNOWFLAKE_RESULTSET context.
+ * @param index Zero based index of the partition.
+ * @param partition Set to the description of the partition.
+ * @return 0 if success, otherwise an errno is returned.
+ */
+SF_STATUS STDCALL snowflake_get_partition(SF_STMT *sfstmt, int64 index, SF_RESULT_PARTITION *partition);
+
+/**
+ * Creates a statement fetching only the rows of a partition of the result
+ * set, with the same columns. Each partition statement downloads its rows
+ * on its own, so that partitions can be consumed by different threads with
+ * snowflake_fetch and the column functions. The first partition is only
+ * available before any row of the result set was fetched.
+ *
+ * The statement still prefetches its own chunks; call
+ * snowflake_fetch_window(sfstmt, 0, 0) first when consuming all the rows
+ * through partitions.
+ *
+ * @param sfstmt SNOWFLAKE_RESULTSET context.
+ * @param index Zero based index of the partition.
+ * @param partition_stmt Set to the partition statement, to be released with snowflake_stmt_term.
+ * @return 0 if success, otherwise an errno is returned.
+ */
+SF_STATUS STDCALL snowflake_partition_stmt(SF_STMT *sfstmt, int64 index, SF_STMT **partition_stmt);
+
 /**
  * Returns the number of binding parameters in the statement.
  *
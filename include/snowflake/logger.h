@@ -39,8 +39,29 @@
  */
 #define SF_LOG_TIMESTAMP_FORMAT_COLOR "%s %s%-5s\x1b[0m \x1b[90m%-5s %-16s %4d:\x1b[0m "
 
+/**
+ * Default size in bytes of the buffer that holds log records waiting to be
+ * written by the asynchronous logger.
+ */
+#define SF_LOG_ASYNC_DEFAULT_BUFFER_SIZE (1024 * 1024)
+
+/**
+ * Size of the stack buffer a log record is formatted into. Longer records
+ * are formatted on the heap.
+ */
+#define SF_LOG_LINE_BUFFER_SIZE 2048
+
 typedef void (*log_LockFn)(void *udata, int lock);
 
+/**
+ * What the asynchronous logger does when its buffer is full.
+ * WARN and above are never dropped.
+ */
+typedef enum SF_LOG_OVERFLOW_POLICY {
+    SF_LOG_OVERFLOW_DROP,
+    SF_LOG_OVERFLOW_BLOCK
+} SF_LOG_OVERFLOW_POLICY;
+
 typedef enum SF_LOG_LEVEL {
     SF_LOG_TRACE,
     SF_LOG_DEBUG,
@@ -52,24 +73,43 @@ typedef enum SF_LOG_LEVEL {
 
 #define CXX_LOG_NS "C++"
 
-#define log_trace(...) log_log(SF_LOG_TRACE, __FILE__, __LINE__, "C", __VA_ARGS__)
-#define log_debug(...) log_log(SF_LOG_DEBUG, __FILE__, __LINE__, "C", __VA_ARGS__)
-#define log_info(...)  log_log(SF_LOG_INFO,  __FILE__, __LINE__, "C", __VA_ARGS__)
-#define log_warn(...)  log_log(SF_LOG_WARN,  __FILE__, __LINE__, "C", __VA_ARGS__)
-#define log_error(...) log_log(SF_LOG_ERROR, __FILE__, __LINE__, "C", __VA_ARGS__)
-#define log_fatal(...) log_log(SF_LOG_FATAL, __FILE__, __LINE__, "C", __VA_ARGS__)
+/**
+ * True if records of the level are logged. Reads the level directly so
+ * that a disabled log statement costs one comparison.
+ */
+#define log_is_enabled(level) ((level) >= log_current_level)
 
-#define sf_log_trace(ns, ...) log_log(SF_LOG_TRACE, __FILE__, __LINE__, ns, __VA_ARGS__)
-#define sf_log_debug(ns, ...) log_log(SF_LOG_DEBUG, __FILE__, __LINE__, ns, __VA_ARGS__)
-#define sf_log_info(ns, ...)  log_log(SF_LOG_INFO, __FILE__, __LINE__, ns, __VA_ARGS__)
-#define sf_log_warn(ns, ...)  log_log(SF_LOG_WARN,  __FILE__, __LINE__, ns, __VA_ARGS__)
-#define sf_log_error(ns, ...) log_log(SF_LOG_ERROR, __FILE__, __LINE__, ns, __VA_ARGS__)
-#define sf_log_fatal(ns, ...) log_log(SF_LOG_FATAL, __FILE__, __LINE__, ns, __VA_ARGS__)
+/**
+ * Log only if the level is enabled. Arguments are not evaluated otherwise.
+ */
+#define SF_LOG_IF_ENABLED(level, ns, ...) \
+    (log_is_enabled(level) ? \
+     log_log(level, __FILE__, __LINE__, ns, __VA_ARGS__) : (void) 0)
+
+#define log_trace(...) SF_LOG_IF_ENABLED(SF_LOG_TRACE, "C", __VA_ARGS__)
+#define log_debug(...) SF_LOG_IF_ENABLED(SF_LOG_DEBUG, "C", __VA_ARGS__)
+#define log_info(...)  SF_LOG_IF_ENABLED(SF_LOG_INFO,  "C", __VA_ARGS__)
+#define log_warn(...)  SF_LOG_IF_ENABLED(SF_LOG_WARN,  "C", __VA_ARGS__)
+#define log_error(...) SF_LOG_IF_ENABLED(SF_LOG_ERROR, "C", __VA_ARGS__)
+#define log_fatal(...) SF_LOG_IF_ENABLED(SF_LOG_FATAL, "C", __VA_ARGS__)
+
+#define sf_log_trace(ns, ...) SF_LOG_IF_ENABLED(SF_LOG_TRACE, ns, __VA_ARGS__)
+#define sf_log_debug(ns, ...) SF_LOG_IF_ENABLED(SF_LOG_DEBUG, ns, __VA_ARGS__)
+#define sf_log_info(ns, ...)  SF_LOG_IF_ENABLED(SF_LOG_INFO,  ns, __VA_ARGS__)
+#define sf_log_warn(ns, ...)  SF_LOG_IF_ENABLED(SF_LOG_WARN,  ns, __VA_ARGS__)
+#define sf_log_error(ns, ...) SF_LOG_IF_ENABLED(SF_LOG_ERROR, ns, __VA_ARGS__)
+#define sf_log_fatal(ns, ...) SF_LOG_IF_ENABLED(SF_LOG_FATAL, ns, __VA_ARGS__)
 
 #if defined(__cplusplus)
 extern "C" {
 #endif
 
+/**
+ * Lowest level that is logged, set by log_set_level(). Read by the log
+ * macros, do not change directly.
+ */
+extern int log_current_level;
+
 void log_set_udata(void *udata);
 
 void log_set_lock(log_LockFn fn);
@@ -92,12 +132,49 @@ log_log_va_list(int level, const char *file, int line, const char *ns,
 
 void log_masked_va_list(FILE* fp, const char *fmt, va_list args);
 
+/**
+ * Format a log message with secrets masked into a buffer. At most size - 1
+ * characters are written, the buffer is always null terminated.
+ *
+ * @return length of the whole masked message
+ */
+size_t log_masked_vsnprintf(char *buf, size_t size, const char *fmt,
+                            va_list args);
+
 SF_LOG_LEVEL log_from_str_to_level(const char *level_in_str);
 
 void log_set_path(const char* path);
 
 void log_close();
 
+/**
+ * Turn asynchronous logging on or off. When on, log records for the log
+ * file are copied into a buffer and written in batches by a writer thread.
+ * Turning it off writes out buffered records before returning.
+ *
+ * @param enable 1 to turn on, 0 to turn off
+ * @param buffer_size buffer size in bytes, 0 for default
+ * @return 0 on success
+ */
+int log_set_async(int enable, size_t buffer_size);
+
+void log_set_overflow_policy(SF_LOG_OVERFLOW_POLICY policy);
+
+/**
+ * Rotate the log file once it reaches max_size bytes. The file is renamed
+ * with suffix .1, older files shifted up to suffix .max_backups and the
+ * oldest removed. Only applies to the file opened from log path.
+ *
+ * @param max_size max size in bytes, 0 for no rotation
+ * @param max_backups number of rotated files kept
+ */
+void log_set_max_file_size(size_t max_size, int max_backups);
+
+/**
+ * Wait for buffered log records to be written to the log file.
+ */
+void log_flush();
+
 #if defined(__cplusplus)
 }
 #endif
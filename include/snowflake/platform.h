@@ -79,6 +79,10 @@ int STDCALL _cond_signal(SF_CONDITION_HANDLE *cond);
 int STDCALL
 _cond_wait(SF_CONDITION_HANDLE *cond, SF_CRITICAL_SECTION_HANDLE *lock);
 
+int STDCALL
+_cond_timed_wait(SF_CONDITION_HANDLE *cond, SF_CRITICAL_SECTION_HANDLE *lock,
+                 unsigned int timeout_ms);
+
 int STDCALL _cond_term(SF_CONDITION_HANDLE *cond);
 
 int STDCALL _critical_section_init(SF_CRITICAL_SECTION_HANDLE *lock);
@@ -119,6 +123,11 @@ char *STDCALL sf_filename_from_path(const char *path);
 
 void STDCALL sf_log_timestamp(char* tsbuf, size_t tsbufsize);
 
+/**
+ * @return milliseconds from a monotonic clock, for measuring elapsed time.
+ */
+unsigned long long STDCALL sf_monotonic_time_ms();
+
 int STDCALL sf_create_directory_if_not_exists(const char * directoryName);
 
 int STDCALL sf_delete_directory_if_exists(const char * directoryName);
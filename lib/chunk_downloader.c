@@ -3,17 +3,27 @@
  */
 
 #include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <zlib.h>
 #include "chunk_downloader.h"
 #include "memory.h"
 #include "connection.h"
 #include "error.h"
 #include "client_int.h"
+#include <snowflake/logger.h>
 
-static void* chunk_downloader_thread(void *downloader);
+static void STDCALL download_chunk_job(void *downloader, uint64 index);
 static void STDCALL set_shutdown(SF_CHUNK_DOWNLOADER *chunk_downloader, sf_bool value);
 static void STDCALL set_error(SF_CHUNK_DOWNLOADER *chunk_downloader, sf_bool value);
 
+#ifdef _WIN32
+#define spill_seek _fseeki64
+#else
+#define spill_seek fseeko
+#endif
+
 #define PTHREAD_LOCK_INIT_ERROR_MSG(e, em) \
 switch(e) \
 { \
@@ -96,12 +106,12 @@ sf_bool STDCALL init_locks(struct SF_CHUNK_DOWNLOADER *chunk_downloader) {
         SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_PTHREAD, error_msg, "");
         goto cleanup;
     }
-    if ((pthread_ret = _cond_init(&chunk_downloader->producer_cond)) != 0) {
+    if ((pthread_ret = _cond_init(&chunk_downloader->consumer_cond)) != 0) {
         PTHREAD_LOCK_INIT_ERROR_MSG(pthread_ret, error_msg);
         SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_PTHREAD, error_msg, "");
         goto cleanup;
     }
-    if ((pthread_ret = _cond_init(&chunk_downloader->consumer_cond)) != 0) {
+    if ((pthread_ret = _critical_section_init(&chunk_downloader->spill_lock)) != 0) {
         PTHREAD_LOCK_INIT_ERROR_MSG(pthread_ret, error_msg);
         SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_PTHREAD, error_msg, "");
         goto cleanup;
@@ -114,15 +124,16 @@ sf_bool STDCALL init_locks(struct SF_CHUNK_DOWNLOADER *chunk_downloader) {
 cleanup:
     // We may destroy some uninitialized locks/conds, but we don't care.
     _critical_section_term(&chunk_downloader->queue_lock);
-    _cond_term(&chunk_downloader->producer_cond);
     _cond_term(&chunk_downloader->consumer_cond);
     _rwlock_term(&chunk_downloader->attr_lock);
+    _critical_section_term(&chunk_downloader->spill_lock);
     return ret;
 }
 
 sf_bool STDCALL fill_queue(struct SF_CHUNK_DOWNLOADER *chunk_downloader, cJSON *chunks, int chunk_count) {
     int i;
     cJSON *chunk = NULL;
+    cJSON *size_item = NULL;
 
     // We want to detach each chunk object so that after we create the queue item,
     // we free the memory associated with the JSON blob
@@ -134,7 +145,13 @@ sf_bool STDCALL fill_queue(struct SF_CHUNK_DOWNLOADER *chunk_downloader, cJSON *
 
         chunk_downloader->queue[i].url = NULL;
         chunk_downloader->queue[i].row_count = 0;
+        chunk_downloader->queue[i].byte_size = 0;
         chunk_downloader->queue[i].chunk = NULL;
+        chunk_downloader->queue[i].start_time = 0;
+        chunk_downloader->queue[i].downloads = 0;
+        chunk_downloader->queue[i].hedged = SF_BOOLEAN_FALSE;
+        memset(chunk_downloader->queue[i].cancel_tokens, 0,
+               sizeof(chunk_downloader->queue[i].cancel_tokens));
 
         if (json_copy_string(&chunk_downloader->queue[i].url, chunk, "url")) {
             goto cleanup;
@@ -149,6 +166,12 @@ sf_bool STDCALL fill_queue(struct SF_CHUNK_DOWNLOADER *chunk_downloader, cJSON *
             goto cleanup;
         }
 
+        // Optional, used to bound the bytes being downloaded at the same time
+        size_item = snowflake_cJSON_GetObjectItem(chunk, "uncompressedSize");
+        if (size_item && snowflake_cJSON_IsNumber(size_item) && size_item->valuedouble > 0) {
+            chunk_downloader->queue[i].byte_size = (uint64) size_item->valuedouble;
+        }
+
         // Free detached chunk
       snowflake_cJSON_Delete(chunk);
         chunk = NULL;
@@ -164,6 +187,18 @@ cleanup:
     return SF_BOOLEAN_FALSE;
 }
 
+static void STDCALL free_header_lines(struct SF_CHUNK_DOWNLOADER *chunk_downloader) {
+    uint64 i;
+    if (!chunk_downloader->header_lines) {
+        return;
+    }
+    for (i = 0; i < chunk_downloader->header_count; i++) {
+        SF_FREE(chunk_downloader->header_lines[i]);
+    }
+    SF_FREE(chunk_downloader->header_lines);
+    chunk_downloader->header_count = 0;
+}
+
 sf_bool STDCALL create_chunk_headers(struct SF_CHUNK_DOWNLOADER *chunk_downloader, cJSON *json_headers) {
     sf_bool ret = SF_BOOLEAN_FALSE;
     size_t header_field_size;
@@ -173,6 +208,11 @@ sf_bool STDCALL create_chunk_headers(struct SF_CHUNK_DOWNLOADER *chunk_downloade
     ARRAY_LIST *keys = json_get_object_keys(json_headers);
     char *key;
 
+    chunk_downloader->header_lines = (char **) SF_CALLOC(keys->used + 1, sizeof(char *));
+    if (!chunk_downloader->header_lines) {
+        goto cleanup;
+    }
+
     for (i = 0; i < keys->used; i++) {
         key = (char *) sf_array_list_get(keys, i);
         // Since I know that these keys are correct from a case sensitive view,
@@ -189,7 +229,9 @@ sf_bool STDCALL create_chunk_headers(struct SF_CHUNK_DOWNLOADER *chunk_downloade
         header_item = (char *) SF_CALLOC(1, header_field_size + 1);
         sb_sprintf(header_item, header_field_size + 1, "%s: %s", key, item->valuestring);
         chunk_downloader->chunk_headers->header = curl_slist_append(chunk_downloader->chunk_headers->header, header_item);
-        SF_FREE(header_item);
+        // Kept to describe the chunks to other consumers
+        chunk_downloader->header_lines[chunk_downloader->header_count++] = header_item;
+        header_item = NULL;
     }
 
     ret = SF_BOOLEAN_TRUE;
@@ -201,12 +243,14 @@ cleanup:
     return ret;
 }
 
-sf_bool STDCALL download_chunk(char *url, SF_HEADER *headers, cJSON **chunk, SF_ERROR_STRUCT *error, sf_bool insecure_mode) {
+sf_bool STDCALL download_chunk(char *url, SF_HEADER *headers, RAW_JSON_BUFFER *chunk_text, SF_ERROR_STRUCT *error,
+                               sf_bool insecure_mode, SF_CANCEL_TOKEN *cancel_token) {
     sf_bool ret = SF_BOOLEAN_FALSE;
     CURL *curl = NULL;
     curl = curl_easy_init();
 
-    if (!curl || !http_perform(curl, GET_REQUEST_TYPE, url, headers, NULL, chunk, DEFAULT_SNOWFLAKE_REQUEST_TIMEOUT, SF_BOOLEAN_TRUE, error, insecure_mode, 0)) {
+    if (!curl || !http_perform_raw(curl, GET_REQUEST_TYPE, url, headers, NULL, chunk_text, DEFAULT_SNOWFLAKE_REQUEST_TIMEOUT,
+                                   SF_BOOLEAN_TRUE, error, insecure_mode, 0, cancel_token)) {
         // Error set in perform function
         goto cleanup;
     }
@@ -229,8 +273,9 @@ SF_CHUNK_DOWNLOADER *STDCALL chunk_downloader_init(const char *qrmk,
     struct SF_CHUNK_DOWNLOADER *chunk_downloader = NULL;
     const char *error_msg = NULL;
     int chunk_count;
-    int i;
+    uint64 i;
     int pthread_ret;
+    sf_bool scheduled;
     size_t qrmk_len = 1;
     // We need thread_count, fetch_slots, chunks, and either qrmk or chunk_headers
     if (thread_count <= 0 ||
@@ -246,14 +291,14 @@ SF_CHUNK_DOWNLOADER *STDCALL chunk_downloader_init(const char *qrmk,
     }
 
     // Initialize default values
-    chunk_downloader->threads = NULL;
     chunk_downloader->queue = NULL;
     chunk_downloader->qrmk = NULL;
     chunk_downloader->chunk_headers = sf_header_create();
-    chunk_downloader->thread_count = 0;
+    chunk_downloader->thread_count = thread_count;
     chunk_downloader->queue_size = 0;
     chunk_downloader->producer_head = 0;
     chunk_downloader->consumer_head = 0;
+    chunk_downloader->latency_count = 0;
     chunk_downloader->is_shutdown = SF_BOOLEAN_FALSE;
     chunk_downloader->has_error = SF_BOOLEAN_FALSE;
     chunk_downloader->sf_error = sf_error;
@@ -275,11 +320,10 @@ SF_CHUNK_DOWNLOADER *STDCALL chunk_downloader_init(const char *qrmk,
         goto cleanup;
     }
 
-    // Initialize queue and thread memory
+    // Initialize queue memory
     chunk_count = snowflake_cJSON_GetArraySize(chunks);
-    chunk_downloader->threads = (SF_THREAD_HANDLE *)SF_CALLOC((int)thread_count, sizeof(SF_THREAD_HANDLE));
     chunk_downloader->queue = (SF_QUEUE_ITEM *) SF_CALLOC(chunk_count, sizeof(SF_QUEUE_ITEM));
-    if (!chunk_downloader->threads || !chunk_downloader->queue) {
+    if (!chunk_downloader->queue) {
         goto cleanup;
     }
 
@@ -288,20 +332,29 @@ SF_CHUNK_DOWNLOADER *STDCALL chunk_downloader_init(const char *qrmk,
         goto cleanup;
     }
 
-    // Initialize threads
-    for (i = 0; i < thread_count; i++) {
-        // If non-zero exit code, terminate chunk downloader
-        if ((pthread_ret = _thread_init(
-              &chunk_downloader->threads[i],
-              chunk_downloader_thread,
-              (void *)chunk_downloader)) != 0) {
-            chunk_downloader_term(chunk_downloader);
-            PTHREAD_CREATE_ERROR_MSG(pthread_ret, error_msg);
-            SET_SNOWFLAKE_ERROR(sf_error, SF_STATUS_ERROR_PTHREAD, error_msg, "");
-            return NULL;
+    chunk_downloader->chunk_limit = chunk_downloader->queue_size;
+
+    // Register with the download executor shared by all the statements
+    if ((pthread_ret = download_group_init(&chunk_downloader->download_group,
+                                           thread_count,
+                                           download_chunk_job,
+                                           (void *) chunk_downloader)) != 0) {
+        PTHREAD_CREATE_ERROR_MSG(pthread_ret, error_msg);
+        SET_SNOWFLAKE_ERROR(sf_error, SF_STATUS_ERROR_PTHREAD, error_msg, "");
+        for (i = 0; i < chunk_downloader->queue_size; i++) {
+            SF_FREE(chunk_downloader->queue[i].url);
         }
+        goto cleanup;
+    }
 
-        chunk_downloader->thread_count++;
+    _critical_section_lock(&chunk_downloader->queue_lock);
+    scheduled = schedule_chunk_downloads(chunk_downloader);
+    _critical_section_unlock(&chunk_downloader->queue_lock);
+    if (!scheduled) {
+        chunk_downloader_term(chunk_downloader);
+        SET_SNOWFLAKE_ERROR(sf_error, SF_STATUS_ERROR_PTHREAD,
+                            "Unable to schedule chunk download", "");
+        return NULL;
     }
 
     return chunk_downloader;
@@ -310,14 +363,446 @@ cleanup:
     if (chunk_downloader) {
         SF_FREE(chunk_downloader->qrmk);
         sf_header_destroy(chunk_downloader->chunk_headers);
+        free_header_lines(chunk_downloader);
         SF_FREE(chunk_downloader->queue);
-        SF_FREE(chunk_downloader->threads);
     }
     SF_FREE(chunk_downloader);
 
     return NULL;
 }
 
+SF_CHUNK_DOWNLOADER *STDCALL chunk_downloader_init_partition(struct SF_CHUNK_DOWNLOADER *source,
+                                                             uint64 index,
+                                                             SF_ERROR_STRUCT *sf_error,
+                                                             sf_bool insecure_mode) {
+    struct SF_CHUNK_DOWNLOADER *chunk_downloader = NULL;
+    cJSON *result = NULL;
+    cJSON *chunks = NULL;
+    cJSON *chunk = NULL;
+    cJSON *headers = NULL;
+    char *value;
+    char *name;
+    size_t name_len;
+    uint64 i;
+
+    if (!source || index >= source->queue_size) {
+        return NULL;
+    }
+
+    // Describe the chunk the way the query response does
+    result = snowflake_cJSON_CreateObject();
+    chunks = snowflake_cJSON_CreateArray();
+    chunk = snowflake_cJSON_CreateObject();
+    snowflake_cJSON_AddItemToObject(result, "chunks", chunks);
+    snowflake_cJSON_AddItemToArray(chunks, chunk);
+    snowflake_cJSON_AddStringToObject(chunk, "url", source->queue[index].url);
+    snowflake_cJSON_AddNumberToObject(chunk, "rowCount", (double) source->queue[index].row_count);
+    if (source->queue[index].byte_size > 0) {
+        snowflake_cJSON_AddNumberToObject(chunk, "uncompressedSize",
+                                          (double) source->queue[index].byte_size);
+    }
+
+    if (source->header_count > 0) {
+        headers = snowflake_cJSON_CreateObject();
+        for (i = 0; i < source->header_count; i++) {
+            // Lines are "name: value", see create_chunk_headers
+            value = strstr(source->header_lines[i], ": ");
+            if (!value) {
+                continue;
+            }
+            name_len = (size_t) (value - source->header_lines[i]);
+            name = (char *) SF_CALLOC(1, name_len + 1);
+            if (!name) {
+                continue;
+            }
+            memcpy(name, source->header_lines[i], name_len);
+            snowflake_cJSON_AddStringToObject(headers, name, value + 2);
+            SF_FREE(name);
+        }
+    }
+
+    chunk_downloader = chunk_downloader_init(source->qrmk, headers, chunks, 1, 1,
+                                             sf_error, insecure_mode);
+    snowflake_cJSON_Delete(headers);
+    snowflake_cJSON_Delete(result);
+    return chunk_downloader;
+}
+
+/**
+ * @return Whether the chunk was downloaded, parsed or spilled to disk.
+ */
+static sf_bool STDCALL is_chunk_ready(SF_QUEUE_ITEM *item) {
+    return item->chunk != NULL || item->spilled;
+}
+
+/**
+ * Lets the download of a chunk be cancelled through the token. Must be
+ * called with the queue lock held.
+ */
+static void STDCALL add_cancel_token(SF_QUEUE_ITEM *item, SF_CANCEL_TOKEN *cancel_token) {
+    int i;
+    for (i = 0; i < SF_CHUNK_MAX_DOWNLOADS; i++) {
+        if (!item->cancel_tokens[i]) {
+            item->cancel_tokens[i] = cancel_token;
+            return;
+        }
+    }
+}
+
+/**
+ * Must be called with the queue lock held.
+ */
+static void STDCALL remove_cancel_token(SF_QUEUE_ITEM *item, SF_CANCEL_TOKEN *cancel_token) {
+    int i;
+    for (i = 0; i < SF_CHUNK_MAX_DOWNLOADS; i++) {
+        if (item->cancel_tokens[i] == cancel_token) {
+            item->cancel_tokens[i] = NULL;
+        }
+    }
+}
+
+/**
+ * Cancels the running downloads of a chunk. Must be called with the queue
+ * lock held.
+ */
+static void STDCALL cancel_downloads(SF_QUEUE_ITEM *item) {
+    int i;
+    for (i = 0; i < SF_CHUNK_MAX_DOWNLOADS; i++) {
+        if (item->cancel_tokens[i]) {
+            cancel_token_cancel(item->cancel_tokens[i]);
+        }
+    }
+}
+
+/**
+ * Reserves space for a compressed chunk in the spill file, reusing the
+ * space of the chunks already taken first. Must be called with the queue
+ * lock held.
+ *
+ * @return Offset of the space in the spill file.
+ */
+static int64 STDCALL spill_alloc(struct SF_CHUNK_DOWNLOADER *chunk_downloader, uint64 size) {
+    SF_SPILL_REGION **link;
+    SF_SPILL_REGION *region;
+    int64 offset;
+
+    for (link = &chunk_downloader->spill_free; *link; link = &(*link)->next) {
+        region = *link;
+        if (region->size >= size) {
+            offset = region->offset;
+            region->offset += (int64) size;
+            region->size -= size;
+            if (region->size == 0) {
+                *link = region->next;
+                SF_FREE(region);
+            }
+            return offset;
+        }
+    }
+    offset = chunk_downloader->spill_end;
+    chunk_downloader->spill_end += (int64) size;
+    return offset;
+}
+
+/**
+ * Gives back space of the spill file. Free space at the end of the file
+ * moves the end back, so that the file starts over once all spilled chunks
+ * were taken. Must be called with the queue lock held.
+ */
+static void STDCALL spill_release(struct SF_CHUNK_DOWNLOADER *chunk_downloader, int64 offset, uint64 size) {
+    SF_SPILL_REGION *prev = NULL;
+    SF_SPILL_REGION *next = chunk_downloader->spill_free;
+    SF_SPILL_REGION *region;
+
+    if (size == 0) {
+        return;
+    }
+    while (next && next->offset < offset) {
+        prev = next;
+        next = next->next;
+    }
+    if (prev && prev->offset + (int64) prev->size == offset) {
+        region = prev;
+        region->size += size;
+    } else {
+        region = (SF_SPILL_REGION *) SF_MALLOC(sizeof(SF_SPILL_REGION));
+        if (!region) {
+            // Lost until the spill file is closed
+            return;
+        }
+        region->offset = offset;
+        region->size = size;
+        region->next = next;
+        if (prev) {
+            prev->next = region;
+        } else {
+            chunk_downloader->spill_free = region;
+        }
+    }
+    if (next && region->offset + (int64) region->size == next->offset) {
+        region->size += next->size;
+        region->next = next->next;
+        SF_FREE(next);
+    }
+
+    if (!region->next && region->offset + (int64) region->size == chunk_downloader->spill_end) {
+        chunk_downloader->spill_end = region->offset;
+        for (prev = NULL, next = chunk_downloader->spill_free; next != region; next = next->next) {
+            prev = next;
+        }
+        if (prev) {
+            prev->next = NULL;
+        } else {
+            chunk_downloader->spill_free = NULL;
+        }
+        SF_FREE(region);
+    }
+}
+
+/**
+ * Drops a downloaded chunk and gives back its space in the spill file. Must
+ * be called with the queue lock held.
+ */
+static void STDCALL release_chunk(struct SF_CHUNK_DOWNLOADER *chunk_downloader, SF_QUEUE_ITEM *item) {
+    snowflake_cJSON_Delete(item->chunk);
+    item->chunk = NULL;
+    chunk_downloader->memory_used -= item->memory_size;
+    item->memory_size = 0;
+    if (item->spilled) {
+        spill_release(chunk_downloader, item->spill_offset, item->spill_size);
+    }
+    item->spilled = SF_BOOLEAN_FALSE;
+}
+
+/**
+ * Compresses the text of a chunk for the spill file. Called without the
+ * queue lock held.
+ *
+ * @return The compressed text, NULL on failure.
+ */
+static Bytef *STDCALL compress_chunk(RAW_JSON_BUFFER *chunk_text, uLongf *compressed_size) {
+    Bytef *compressed;
+
+    *compressed_size = compressBound((uLong) chunk_text->size);
+    compressed = (Bytef *) SF_MALLOC(*compressed_size);
+    if (compressed &&
+        compress2(compressed, compressed_size, (const Bytef *) chunk_text->buffer,
+                  (uLong) chunk_text->size, Z_BEST_SPEED) != Z_OK) {
+        SF_FREE(compressed);
+        compressed = NULL;
+    }
+    return compressed;
+}
+
+/**
+ * Writes a compressed chunk to the space reserved for it in the spill file,
+ * creating the file first if needed. Called without the queue lock held.
+ *
+ * @return Success/failure. 1 = Success; 0 = Failure
+ */
+static sf_bool STDCALL write_spilled_chunk(struct SF_CHUNK_DOWNLOADER *chunk_downloader, int64 offset,
+                                           const Bytef *compressed, uint64 compressed_size) {
+    sf_bool ret = SF_BOOLEAN_FALSE;
+
+    _critical_section_lock(&chunk_downloader->spill_lock);
+    if (!chunk_downloader->spill_file) {
+        chunk_downloader->spill_file = tmpfile();
+    }
+    if (!chunk_downloader->spill_file) {
+        log_warn("Unable to create the chunk spill file, keeping chunks in memory.");
+    } else if (spill_seek(chunk_downloader->spill_file, offset, SEEK_SET) != 0 ||
+               fwrite(compressed, 1, (size_t) compressed_size,
+                      chunk_downloader->spill_file) != compressed_size) {
+        log_warn("Unable to write to the chunk spill file, keeping chunks in memory.");
+    } else {
+        ret = SF_BOOLEAN_TRUE;
+    }
+    _critical_section_unlock(&chunk_downloader->spill_lock);
+    return ret;
+}
+
+/**
+ * Reads a chunk back from the spill file and parses it. Called without the
+ * queue lock held.
+ *
+ * @return The chunk, NULL on failure.
+ */
+static cJSON *STDCALL read_spilled_chunk(struct SF_CHUNK_DOWNLOADER *chunk_downloader, int64 offset,
+                                         uint64 compressed_size, uint64 text_size) {
+    Bytef *compressed = (Bytef *) SF_MALLOC(compressed_size);
+    char *text = (char *) SF_MALLOC(text_size + 1);
+    uLongf inflated_size = (uLongf) text_size;
+    sf_bool read = SF_BOOLEAN_FALSE;
+    cJSON *chunk = NULL;
+
+    if (compressed && text) {
+        _critical_section_lock(&chunk_downloader->spill_lock);
+        read = chunk_downloader->spill_file &&
+               spill_seek(chunk_downloader->spill_file, offset, SEEK_SET) == 0 &&
+               fread(compressed, 1, (size_t) compressed_size,
+                     chunk_downloader->spill_file) == compressed_size;
+        _critical_section_unlock(&chunk_downloader->spill_lock);
+    }
+    if (read && uncompress((Bytef *) text, &inflated_size, compressed, (uLong) compressed_size) == Z_OK) {
+        text[inflated_size] = '\0';
+        chunk = snowflake_cJSON_Parse(text);
+    }
+    SF_FREE(compressed);
+    SF_FREE(text);
+    return chunk;
+}
+
+void STDCALL chunk_downloader_set_memory_budget(struct SF_CHUNK_DOWNLOADER *chunk_downloader, uint64 memory_budget) {
+    chunk_downloader->memory_budget = memory_budget;
+}
+
+cJSON *STDCALL chunk_downloader_take_chunk(struct SF_CHUNK_DOWNLOADER *chunk_downloader, uint64 index) {
+    SF_QUEUE_ITEM *item = &chunk_downloader->queue[index];
+    cJSON *chunk = item->chunk;
+
+    if (chunk || !item->spilled) {
+        item->chunk = NULL;
+        release_chunk(chunk_downloader, item);
+        return chunk;
+    }
+
+    // Parse the chunk spilled to disk now that the consumer needs it, without
+    // holding back the downloads. The item stays ready meanwhile, so that the
+    // other download of a hedged chunk doesn't set it again.
+    _critical_section_unlock(&chunk_downloader->queue_lock);
+    chunk = read_spilled_chunk(chunk_downloader, item->spill_offset, item->spill_size, item->text_size);
+    _critical_section_lock(&chunk_downloader->queue_lock);
+    release_chunk(chunk_downloader, item);
+
+    if (!chunk) {
+        _rwlock_wrlock(&chunk_downloader->attr_lock);
+        if (!chunk_downloader->has_error) {
+            SET_SNOWFLAKE_ERROR(chunk_downloader->sf_error, SF_STATUS_ERROR_BAD_JSON,
+                                "Unable to read chunk from the spill file.",
+                                SF_SQLSTATE_GENERAL_ERROR);
+            chunk_downloader->has_error = SF_BOOLEAN_TRUE;
+        }
+        _rwlock_wrunlock(&chunk_downloader->attr_lock);
+    }
+    return chunk;
+}
+
+sf_bool STDCALL schedule_chunk_downloads(struct SF_CHUNK_DOWNLOADER *chunk_downloader) {
+    SF_QUEUE_ITEM *item;
+    // Keep up to thread_count chunks downloaded or downloading ahead of the consumer
+    while (chunk_downloader->producer_head < chunk_downloader->chunk_limit &&
+           chunk_downloader->producer_head - chunk_downloader->consumer_head < chunk_downloader->thread_count &&
+           !get_shutdown_or_error(chunk_downloader)) {
+        item = &chunk_downloader->queue[chunk_downloader->producer_head];
+        // Already there, or still queued or running since before a seek
+        if (!is_chunk_ready(item) && item->downloads == 0) {
+            if (!download_group_add_job(&chunk_downloader->download_group,
+                                        chunk_downloader->producer_head,
+                                        item->byte_size)) {
+                return SF_BOOLEAN_FALSE;
+            }
+            item->start_time = 0;
+            item->hedged = SF_BOOLEAN_FALSE;
+            item->downloads++;
+        }
+        chunk_downloader->producer_head++;
+    }
+    return SF_BOOLEAN_TRUE;
+}
+
+sf_bool STDCALL chunk_downloader_seek(struct SF_CHUNK_DOWNLOADER *chunk_downloader, uint64 index, uint64 end) {
+    uint64 i;
+
+    if (end > chunk_downloader->queue_size) {
+        end = chunk_downloader->queue_size;
+    }
+    if (index > end) {
+        index = end;
+    }
+
+    for (i = 0; i < chunk_downloader->queue_size; i++) {
+        if (i < index || i >= end) {
+            // Abort running downloads, they are not needed anymore
+            cancel_downloads(&chunk_downloader->queue[i]);
+            if (is_chunk_ready(&chunk_downloader->queue[i])) {
+                release_chunk(chunk_downloader, &chunk_downloader->queue[i]);
+            }
+        }
+    }
+
+    // Downloads still queued for chunks out of the new window are skipped
+    // when they start, see is_chunk_wanted
+    chunk_downloader->consumer_head = index;
+    chunk_downloader->producer_head = index;
+    chunk_downloader->chunk_limit = end;
+    return schedule_chunk_downloads(chunk_downloader);
+}
+
+static int compare_latency(const void *a, const void *b) {
+    uint64 left = *(const uint64 *) a;
+    uint64 right = *(const uint64 *) b;
+    return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+/**
+ * @return Time after which a chunk download is hedged, 0 if not enough
+ * chunks were downloaded yet.
+ */
+static uint64 STDCALL get_hedge_delay(struct SF_CHUNK_DOWNLOADER *chunk_downloader) {
+    uint64 samples[SF_CHUNK_LATENCY_SAMPLES];
+    uint64 count = chunk_downloader->latency_count;
+    uint64 delay;
+
+    if (count > SF_CHUNK_LATENCY_SAMPLES) {
+        count = SF_CHUNK_LATENCY_SAMPLES;
+    }
+    if (count < SF_CHUNK_HEDGE_MIN_SAMPLES) {
+        return 0;
+    }
+    memcpy(samples, chunk_downloader->latencies, (size_t) count * sizeof(uint64));
+    qsort(samples, (size_t) count, sizeof(uint64), compare_latency);
+    delay = samples[(count - 1) * SF_CHUNK_HEDGE_PERCENTILE / 100];
+    return delay < SF_CHUNK_HEDGE_MIN_DELAY_MS ? SF_CHUNK_HEDGE_MIN_DELAY_MS : delay;
+}
+
+void STDCALL wait_for_chunk(struct SF_CHUNK_DOWNLOADER *chunk_downloader, uint64 index) {
+    SF_QUEUE_ITEM *item = &chunk_downloader->queue[index];
+    uint64 delay;
+    uint64 elapsed;
+
+    while (!is_chunk_ready(item) && !get_shutdown_or_error(chunk_downloader)) {
+        if (item->start_time == 0) {
+            // Queued behind other downloads, run it next. The download
+            // signals when it starts.
+            download_group_prioritize(&chunk_downloader->download_group, index);
+            _cond_wait(&chunk_downloader->consumer_cond, &chunk_downloader->queue_lock);
+            continue;
+        }
+
+        delay = item->hedged ? 0 : get_hedge_delay(chunk_downloader);
+        if (delay == 0) {
+            _cond_wait(&chunk_downloader->consumer_cond, &chunk_downloader->queue_lock);
+            continue;
+        }
+
+        elapsed = sf_monotonic_time_ms() - item->start_time;
+        if (elapsed < delay) {
+            _cond_timed_wait(&chunk_downloader->consumer_cond, &chunk_downloader->queue_lock,
+                             (unsigned int) (delay - elapsed));
+            continue;
+        }
+
+        // Slower than most chunks so far, download it again and take
+        // whichever download finishes first
+        log_debug("Chunk %llu not downloaded after %llu ms, starting another download.",
+                  index, elapsed);
+        if (download_group_add_urgent_job(&chunk_downloader->download_group, index,
+                                          item->byte_size)) {
+            item->downloads++;
+        }
+        item->hedged = SF_BOOLEAN_TRUE;
+    }
+}
 
 sf_bool STDCALL chunk_downloader_term(struct SF_CHUNK_DOWNLOADER *chunk_downloader) {
     int pthread_ret;
@@ -338,138 +823,239 @@ sf_bool STDCALL chunk_downloader_term(struct SF_CHUNK_DOWNLOADER *chunk_download
         return SF_BOOLEAN_FALSE;
     }
 
-    do {
-        // Already shutting down, just return false
-        if (get_shutdown(chunk_downloader)) {
-            return SF_BOOLEAN_FALSE;
-        }
+    // Already shutting down, just return false
+    if (get_shutdown(chunk_downloader)) {
+        _critical_section_unlock(&chunk_downloader->queue_lock);
+        return SF_BOOLEAN_FALSE;
+    }
 
-        set_shutdown(chunk_downloader, SF_BOOLEAN_TRUE);
+    set_shutdown(chunk_downloader, SF_BOOLEAN_TRUE);
+    // Abort the chunks being downloaded rather than waiting for them
+    for (i = 0; i < chunk_downloader->queue_size; i++) {
+        cancel_downloads(&chunk_downloader->queue[i]);
+    }
 
-        if (_cond_broadcast(&chunk_downloader->consumer_cond) ||
-            _cond_broadcast(&chunk_downloader->producer_cond) ||
-                (_critical_section_unlock(&chunk_downloader->queue_lock))) {
-            // Something went wrong with either notifying the producer/consumer or releasing the queue lock
-            // Set and error and then try to continue with cleanup
-            _rwlock_wrlock(&chunk_downloader->attr_lock);
-            if (!chunk_downloader->has_error) {
-                SET_SNOWFLAKE_ERROR(chunk_downloader->sf_error, SF_STATUS_ERROR_PTHREAD, "Error during condition broadcast", "");
-                chunk_downloader->has_error = SF_BOOLEAN_TRUE;
-            }
-            _rwlock_wrunlock(&chunk_downloader->attr_lock);
+    if (_cond_broadcast(&chunk_downloader->consumer_cond) ||
+            (_critical_section_unlock(&chunk_downloader->queue_lock))) {
+        // Something went wrong with either notifying the consumer or releasing the queue lock
+        // Set and error and then try to continue with cleanup
+        _rwlock_wrlock(&chunk_downloader->attr_lock);
+        if (!chunk_downloader->has_error) {
+            SET_SNOWFLAKE_ERROR(chunk_downloader->sf_error, SF_STATUS_ERROR_PTHREAD, "Error during condition broadcast", "");
+            chunk_downloader->has_error = SF_BOOLEAN_TRUE;
         }
+        _rwlock_wrunlock(&chunk_downloader->attr_lock);
+    }
 
-        // Join all the threads
-        for (i = 0; i < chunk_downloader->thread_count; i++) {
-            if ((pthread_ret = _thread_join(chunk_downloader->threads[i])) != 0) {
-                if (!get_error(chunk_downloader)) {
-                    PTHREAD_JOIN_ERROR_MSG(pthread_ret, error_msg);
-                    SET_SNOWFLAKE_ERROR(chunk_downloader->sf_error, SF_STATUS_ERROR_PTHREAD, error_msg, "");
-                }
-                _rwlock_wrlock(&chunk_downloader->attr_lock);
-                if (!chunk_downloader->has_error) {
-                    PTHREAD_JOIN_ERROR_MSG(pthread_ret, error_msg);
-                    SET_SNOWFLAKE_ERROR(chunk_downloader->sf_error, SF_STATUS_ERROR_PTHREAD, error_msg, "");
-                    chunk_downloader->has_error = SF_BOOLEAN_TRUE;
-                }
-                _rwlock_wrunlock(&chunk_downloader->attr_lock);
-            }
-        }
-    } while (0);
+    // Drop the chunks not started yet and wait for the cancelled ones
+    download_group_term(&chunk_downloader->download_group);
 
-    // Free chunk downloader memory
-    SF_FREE(chunk_downloader->threads);
     // Free all the memory of the items in the queue before freeing queue memory
     for (i = 0; i < chunk_downloader->queue_size; i++) {
         SF_FREE(chunk_downloader->queue[i].url);
       snowflake_cJSON_Delete(chunk_downloader->queue[i].chunk);
     }
+    if (chunk_downloader->spill_file) {
+        fclose(chunk_downloader->spill_file);
+    }
+    while (chunk_downloader->spill_free) {
+        SF_SPILL_REGION *region = chunk_downloader->spill_free;
+        chunk_downloader->spill_free = region->next;
+        SF_FREE(region);
+    }
     SF_FREE(chunk_downloader->queue);
     SF_FREE(chunk_downloader->qrmk);
     sf_header_destroy(chunk_downloader->chunk_headers);
+    free_header_lines(chunk_downloader);
     _critical_section_term(&chunk_downloader->queue_lock);
-    _cond_term(&chunk_downloader->producer_cond);
     _cond_term(&chunk_downloader->consumer_cond);
     _rwlock_term(&chunk_downloader->attr_lock);
+    _critical_section_term(&chunk_downloader->spill_lock);
     SF_FREE(chunk_downloader);
 
     return SF_BOOLEAN_TRUE;
 }
 
-static void * chunk_downloader_thread(void *downloader) {
+/**
+ * @return Whether the consumer still needs a download of the chunk. It does
+ * not once the other download of a hedged chunk finished, or when a seek
+ * moved the consumer away from the chunk. Must be called with the queue
+ * lock held.
+ */
+static sf_bool STDCALL is_chunk_wanted(struct SF_CHUNK_DOWNLOADER *chunk_downloader, uint64 index) {
+    return !is_chunk_ready(&chunk_downloader->queue[index]) &&
+           index >= chunk_downloader->consumer_head &&
+           index < chunk_downloader->producer_head;
+}
+
+static void STDCALL download_chunk_job(void *downloader, uint64 index) {
     struct SF_CHUNK_DOWNLOADER *chunk_downloader = (SF_CHUNK_DOWNLOADER *) downloader;
+    SF_QUEUE_ITEM *item = &chunk_downloader->queue[index];
     cJSON *chunk = NULL;
-    uint64 index;
-    // Create err per thread so we don't have to lock the chunk downloader err
+    RAW_JSON_BUFFER chunk_text = {NULL, 0};
+    uint64 start_time;
+    uint64 memory_size = 0;
+    sf_bool success;
+    sf_bool cancelled;
+    sf_bool spill = SF_BOOLEAN_FALSE;
+    // Memory of the parsed chunk was counted before parsing it
+    sf_bool counted = SF_BOOLEAN_FALSE;
+    Bytef *compressed = NULL;
+    uLongf compressed_size = 0;
+    int64 spill_offset = 0;
+    // Cancelled on shutdown, on seek, or once the other download of a hedged chunk finished
+    SF_CANCEL_TOKEN cancel_token;
+    // Create err per job so we don't have to lock the chunk downloader err
     SF_ERROR_STRUCT err;
     memset(&err, 0, sizeof(err));
     clear_snowflake_error(&err);
 
-    // Loop forever until shutdown
-    while (1) {
-        // Reset from previous loop
-        chunk = NULL;
-        _critical_section_lock(&chunk_downloader->queue_lock);
-
-        // If we've downloaded chunks == # of threads, wait until the consumer consumes a chunk.
-        // Ensure that the producer_head is less than the queue_size to ensure that we still have items to process
-        // If we're shutting down or an err has occurred, skip
-        while ((chunk_downloader->producer_head - chunk_downloader->consumer_head) >= chunk_downloader->thread_count &&
-                chunk_downloader->producer_head < chunk_downloader->queue_size &&
-                !get_shutdown_or_error(chunk_downloader)) {
-            _cond_wait(&chunk_downloader->producer_cond, &chunk_downloader->queue_lock);
-        }
-
-        // If we're shutting down, or we have reached the end of the results, then break
-        if (get_shutdown_or_error(chunk_downloader) || chunk_downloader->producer_head >= chunk_downloader->queue_size) {
-            break;
+    _critical_section_lock(&chunk_downloader->queue_lock);
+    if (get_shutdown_or_error(chunk_downloader) || !is_chunk_wanted(chunk_downloader, index) ||
+        cancel_token_init(&cancel_token) != 0) {
+        item->downloads--;
+        _critical_section_unlock(&chunk_downloader->queue_lock);
+        return;
+    }
+    add_cancel_token(item, &cancel_token);
+    start_time = sf_monotonic_time_ms();
+    if (item->start_time == 0) {
+        item->start_time = start_time;
+        // The consumer times hedging from the start of the chunk it waits for
+        if (index == chunk_downloader->consumer_head) {
+            _cond_signal(&chunk_downloader->consumer_cond);
         }
+    }
+    _critical_section_unlock(&chunk_downloader->queue_lock);
 
-        // Get queue item and set it locally
-        index = chunk_downloader->producer_head++;
+    // Download chunk
+    success = download_chunk(item->url, chunk_downloader->chunk_headers,
+                             &chunk_text, &err, chunk_downloader->insecure_mode,
+                             &cancel_token);
 
-        // Unlock since we have our queue item, and don't need the lock while we're processing the queue
+    if (success) {
+        // Parse the chunk unless it is past the memory budget. The chunk the
+        // consumer waits for is always parsed.
+        memory_size = (uint64) chunk_text.size * SF_CHUNK_PARSED_SIZE_FACTOR;
+        _critical_section_lock(&chunk_downloader->queue_lock);
+        spill = chunk_downloader->memory_budget > 0 &&
+                index != chunk_downloader->consumer_head &&
+                chunk_downloader->memory_used + memory_size > chunk_downloader->memory_budget;
+        if (!spill) {
+            chunk_downloader->memory_used += memory_size;
+            counted = SF_BOOLEAN_TRUE;
+        }
         _critical_section_unlock(&chunk_downloader->queue_lock);
 
-        // Download chunk
-        if (!download_chunk(chunk_downloader->queue[index].url, chunk_downloader->chunk_headers,
-                            &chunk, &err, chunk_downloader->insecure_mode)) {
-            _rwlock_wrlock(&chunk_downloader->attr_lock);
-            if (!chunk_downloader->has_error) {
-                copy_snowflake_error(chunk_downloader->sf_error, &err);
-                chunk_downloader->has_error = SF_BOOLEAN_TRUE;
+        if (spill) {
+            compressed = compress_chunk(&chunk_text, &compressed_size);
+            if (compressed) {
+                // Only the space is reserved under the lock, the chunk is
+                // written without it
+                _critical_section_lock(&chunk_downloader->queue_lock);
+                spill_offset = spill_alloc(chunk_downloader, compressed_size);
+                _critical_section_unlock(&chunk_downloader->queue_lock);
+                // Keep the chunk in memory rather than failing the statement
+                if (!write_spilled_chunk(chunk_downloader, spill_offset, compressed, compressed_size)) {
+                    _critical_section_lock(&chunk_downloader->queue_lock);
+                    spill_release(chunk_downloader, spill_offset, compressed_size);
+                    _critical_section_unlock(&chunk_downloader->queue_lock);
+                    spill = SF_BOOLEAN_FALSE;
+                }
+                SF_FREE(compressed);
+            } else {
+                spill = SF_BOOLEAN_FALSE;
             }
-            _rwlock_wrunlock(&chunk_downloader->attr_lock);
-            break;
         }
 
-        // Gain back lock to set cJSON blob
-        _critical_section_lock(&chunk_downloader->queue_lock);
-
-        if (get_error(chunk_downloader)) {
-            break;
+        if (!spill) {
+            chunk = snowflake_cJSON_Parse(chunk_text.buffer);
+            if (!chunk) {
+                SET_SNOWFLAKE_ERROR(&err, SF_STATUS_ERROR_BAD_JSON,
+                                    "Unable to parse JSON text response.",
+                                    SF_SQLSTATE_UNABLE_TO_CONNECT);
+                success = SF_BOOLEAN_FALSE;
+            }
         }
+    }
+    SF_FREE(chunk_text.buffer);
+
+    // Gain back lock to set cJSON blob
+    _critical_section_lock(&chunk_downloader->queue_lock);
+    item->downloads--;
+    remove_cancel_token(item, &cancel_token);
+    cancelled = cancel_token_is_cancelled(&cancel_token);
+    cancel_token_term(&cancel_token);
+    if (counted) {
+        // Counted again below if the chunk is kept
+        chunk_downloader->memory_used -= memory_size;
+    }
 
-        // Set the chunk
-        chunk_downloader->queue[index].chunk = chunk;
-
-        // Notify the consumer that we have a chunk ready
-        if (_cond_signal(&chunk_downloader->consumer_cond)) {
+    if (!success) {
+        snowflake_cJSON_Delete(chunk);
+        if (cancelled && !get_shutdown_or_error(chunk_downloader) &&
+            is_chunk_wanted(chunk_downloader, index) && item->downloads == 0) {
+            // Cancelled by a seek away from the chunk, then seeked back to it
+            if (download_group_add_job(&chunk_downloader->download_group, index, item->byte_size)) {
+                item->start_time = 0;
+                item->hedged = SF_BOOLEAN_FALSE;
+                item->downloads++;
+                _critical_section_unlock(&chunk_downloader->queue_lock);
+                return;
+            }
+        }
+        // Only an error if the other download of a hedged chunk can't make up for it
+        if (is_chunk_wanted(chunk_downloader, index) && item->downloads == 0) {
             _rwlock_wrlock(&chunk_downloader->attr_lock);
-            if (!chunk_downloader->has_error) {
-                SET_SNOWFLAKE_ERROR(chunk_downloader->sf_error, SF_STATUS_ERROR_PTHREAD,
-                                    "Error sending consumer signal to notify of chunk downloaded", "");
+            // A download cancelled on shutdown is not an error of the statement
+            if (!chunk_downloader->has_error && !chunk_downloader->is_shutdown) {
+                copy_snowflake_error(chunk_downloader->sf_error, &err);
                 chunk_downloader->has_error = SF_BOOLEAN_TRUE;
             }
             _rwlock_wrunlock(&chunk_downloader->attr_lock);
-            break;
+            // Wake up the consumer so that it sees the error
+            _cond_broadcast(&chunk_downloader->consumer_cond);
         }
+        _critical_section_unlock(&chunk_downloader->queue_lock);
+        return;
+    }
 
-        // Drop the lock
+    if (get_shutdown_or_error(chunk_downloader) || !is_chunk_wanted(chunk_downloader, index)) {
+        // Lost the race against the other download of the chunk, or not needed anymore
+        snowflake_cJSON_Delete(chunk);
+        if (spill) {
+            spill_release(chunk_downloader, spill_offset, compressed_size);
+        }
         _critical_section_unlock(&chunk_downloader->queue_lock);
+        return;
+    }
+
+    // Set the chunk
+    if (spill) {
+        item->spill_offset = spill_offset;
+        item->spill_size = compressed_size;
+        item->text_size = chunk_text.size;
+        item->spilled = SF_BOOLEAN_TRUE;
+    } else {
+        item->chunk = chunk;
+        item->memory_size = memory_size;
+        chunk_downloader->memory_used += memory_size;
+    }
+    chunk_downloader->latencies[chunk_downloader->latency_count++ % SF_CHUNK_LATENCY_SAMPLES] =
+      sf_monotonic_time_ms() - start_time;
+    // The other download of a hedged chunk is not needed anymore
+    cancel_downloads(item);
+
+    // Notify the consumer that we have a chunk ready
+    if (_cond_signal(&chunk_downloader->consumer_cond)) {
+        _rwlock_wrlock(&chunk_downloader->attr_lock);
+        if (!chunk_downloader->has_error) {
+            SET_SNOWFLAKE_ERROR(chunk_downloader->sf_error, SF_STATUS_ERROR_PTHREAD,
+                                "Error sending consumer signal to notify of chunk downloaded", "");
+            chunk_downloader->has_error = SF_BOOLEAN_TRUE;
+        }
+        _rwlock_wrunlock(&chunk_downloader->attr_lock);
     }
 
     _critical_section_unlock(&chunk_downloader->queue_lock);
-    _thread_exit();
-    return NULL;
 }
@@ -19,22 +19,63 @@ extern "C" {
 #include "snowflake/platform.h"
 #include "cJSON.h"
 #include "connection.h"
+#include "download_executor.h"
+
+// Number of chunk download times kept to derive when to hedge a download
+#define SF_CHUNK_LATENCY_SAMPLES 32
+// Chunks downloaded before slow downloads are hedged
+#define SF_CHUNK_HEDGE_MIN_SAMPLES 4
+// Percentile of the download times after which the chunk the consumer waits for is downloaded again
+#define SF_CHUNK_HEDGE_PERCENTILE 95
+// Lower bound of the time before a download is hedged
+#define SF_CHUNK_HEDGE_MIN_DELAY_MS 500
+// Estimate of the memory taken by a parsed chunk per byte of its JSON text
+#define SF_CHUNK_PARSED_SIZE_FACTOR 4
+// Downloads of a chunk running at the same time, the first one and its hedge
+#define SF_CHUNK_MAX_DOWNLOADS 2
+
+// Free space in the spill file
+typedef struct SF_SPILL_REGION {
+    int64 offset;
+    uint64 size;
+    struct SF_SPILL_REGION *next;
+} SF_SPILL_REGION;
 
 typedef struct SF_QUEUE_ITEM {
     char *url;
     int64 row_count;
+    // Uncompressed size of the chunk, 0 if unknown
+    uint64 byte_size;
     cJSON *chunk;
+    // When the first download of the chunk started, 0 if not started yet
+    uint64 start_time;
+    // Downloads of the chunk queued or running
+    uint32 downloads;
+    // A second download of the chunk was started
+    sf_bool hedged;
+    // Cancel tokens of the running downloads, to abort the other download of
+    // a hedged chunk once one of them finished
+    SF_CANCEL_TOKEN *cancel_tokens[SF_CHUNK_MAX_DOWNLOADS];
+    // Memory counted against the memory budget for the parsed chunk
+    uint64 memory_size;
+    // The chunk was written to the spill file instead of being parsed
+    sf_bool spilled;
+    // Position of the compressed chunk text in the spill file
+    int64 spill_offset;
+    uint64 spill_size;
+    // Length of the chunk text
+    uint64 text_size;
 } SF_QUEUE_ITEM;
 
 struct SF_CHUNK_DOWNLOADER {
+    // Max number of chunks downloaded ahead of the consumer
     uint64 thread_count;
 
-    // Threads
-    SF_THREAD_HANDLE *threads;
+    // Chunk downloads run on the process wide download executor
+    SF_DOWNLOAD_GROUP download_group;
 
     // Queue
     SF_CRITICAL_SECTION_HANDLE queue_lock;
-    SF_CONDITION_HANDLE producer_cond;
     SF_CONDITION_HANDLE consumer_cond;
 
     // A "queue" that is actually just a locked array
@@ -44,10 +85,33 @@ struct SF_CHUNK_DOWNLOADER {
     uint64 producer_head;
     uint64 consumer_head;
     uint64 queue_size;
+    // Chunks from this one on are not downloaded
+    uint64 chunk_limit;
+
+    // Max estimated memory of the chunks parsed ahead of the consumer, 0 for
+    // no limit. Chunks past the budget go to the spill file and are parsed
+    // when the consumer takes them. Guarded by queue_lock, as the fields below.
+    uint64 memory_budget;
+    uint64 memory_used;
+    // End of the space of the spill file in use or free
+    int64 spill_end;
+    // Space of the spill file given back by the chunks taken, sorted by offset
+    SF_SPILL_REGION *spill_free;
+    // Created on first write, guarded by spill_lock. Reads and writes of the
+    // spill file run without queue_lock held.
+    FILE *spill_file;
+    SF_CRITICAL_SECTION_HANDLE spill_lock;
+
+    // Times of the last chunk downloads in milliseconds, guarded by queue_lock
+    uint64 latencies[SF_CHUNK_LATENCY_SAMPLES];
+    uint64 latency_count;
 
     // Chunk downloader connection attributes
     char *qrmk;
     SF_HEADER *chunk_headers;
+    // Chunk headers as "name: value" lines, the ones in chunk_headers
+    char **header_lines;
+    uint64 header_count;
 
     // Error/shutdown flags
     sf_bool is_shutdown;
@@ -72,6 +136,69 @@ SF_CHUNK_DOWNLOADER *STDCALL chunk_downloader_init(const char *qrmk,
                                                    SF_ERROR_STRUCT *sf_error,
                                                    sf_bool insecure_mode);
 sf_bool STDCALL chunk_downloader_term(SF_CHUNK_DOWNLOADER *chunk_downloader);
+/**
+ * Creates a chunk downloader for one chunk of another chunk downloader, with
+ * the same key and headers. Used to consume the chunks of a result set
+ * independently of each other.
+ *
+ * @param source Chunk downloader of the result set.
+ * @param index Index of the chunk.
+ * @param sf_error Error of the statement consuming the chunk.
+ * @param insecure_mode Snowflake connection insecure mode flag.
+ * @return Chunk downloader or NULL on failure.
+ */
+SF_CHUNK_DOWNLOADER *STDCALL chunk_downloader_init_partition(SF_CHUNK_DOWNLOADER *source,
+                                                             uint64 index,
+                                                             SF_ERROR_STRUCT *sf_error,
+                                                             sf_bool insecure_mode);
+/**
+ * Queues downloads of the chunks following the consumer head, up to thread
+ * count chunks ahead. Must be called with the queue lock held.
+ *
+ * @param chunk_downloader Chunk downloader.
+ * @return Success/failure. 1 = Success; 0 = Failure
+ */
+sf_bool STDCALL schedule_chunk_downloads(SF_CHUNK_DOWNLOADER *chunk_downloader);
+/**
+ * Moves the consumer to the chunk at index and restricts downloads to the
+ * chunks before end. Chunks outside of that range are not downloaded, and
+ * the ones already downloaded are released. Must be called with the queue
+ * lock held.
+ *
+ * @param chunk_downloader Chunk downloader.
+ * @param index Index of the next chunk the consumer takes.
+ * @param end Index of the first chunk not needed by the consumer.
+ * @return Success/failure. 1 = Success; 0 = Failure
+ */
+sf_bool STDCALL chunk_downloader_seek(SF_CHUNK_DOWNLOADER *chunk_downloader, uint64 index, uint64 end);
+/**
+ * Sets the memory budget of the chunks downloaded ahead of the consumer.
+ * Must be called with the queue lock held.
+ *
+ * @param chunk_downloader Chunk downloader.
+ * @param memory_budget Max estimated memory of parsed chunks, 0 for no limit.
+ */
+void STDCALL chunk_downloader_set_memory_budget(SF_CHUNK_DOWNLOADER *chunk_downloader, uint64 memory_budget);
+/**
+ * Takes a downloaded chunk from the queue, parsing it if it was spilled to
+ * disk. Must be called with the queue lock held. The lock is released while
+ * a spilled chunk is read back and parsed.
+ *
+ * @param chunk_downloader Chunk downloader.
+ * @param index Index of the chunk.
+ * @return The chunk, owned by the caller, NULL on failure with the error of the chunk downloader set.
+ */
+cJSON *STDCALL chunk_downloader_take_chunk(SF_CHUNK_DOWNLOADER *chunk_downloader, uint64 index);
+/**
+ * Waits until the chunk is downloaded, or the chunk downloader shuts down or
+ * fails. The download of the chunk runs before other queued downloads, and
+ * is started again when it takes longer than most chunks so far, taking
+ * whichever download finishes first. Must be called with the queue lock held.
+ *
+ * @param chunk_downloader Chunk downloader.
+ * @param index Index of the chunk the consumer needs.
+ */
+void STDCALL wait_for_chunk(SF_CHUNK_DOWNLOADER *chunk_downloader, uint64 index);
 sf_bool STDCALL get_shutdown_or_error(SF_CHUNK_DOWNLOADER *chunk_downloader);
 sf_bool STDCALL get_shutdown(SF_CHUNK_DOWNLOADER *chunk_downloader);
 sf_bool STDCALL get_error(SF_CHUNK_DOWNLOADER *chunk_downloader);
@@ -3,6 +3,7 @@
  */
 
 #include <assert.h>
+#include <ctype.h>
 #include <time.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,6 +17,7 @@
 #include "results.h"
 #include "error.h"
 #include "chunk_downloader.h"
+#include "ssl_context.h"
 
 #define curl_easier_escape(curl, string) curl_easy_escape(curl, string, 0)
 
@@ -26,9 +28,18 @@ int32 SSL_VERSION;
 sf_bool DEBUG;
 sf_bool SF_OCSP_CHECK;
 char *SF_HEADER_USER_AGENT = NULL;
+uint64 SF_REQUEST_COMPRESSION_THRESHOLD = SF_DEFAULT_REQUEST_COMPRESSION_THRESHOLD;
 
 static char *LOG_PATH = NULL;
 static FILE *LOG_FP = NULL;
+static sf_bool LOG_ASYNC;
+static int32 LOG_OVERFLOW_POLICY = (int32) SF_LOG_OVERFLOW_BLOCK;
+static uint64 LOG_MAX_FILE_SIZE = 0;
+static uint64 MAX_DOWNLOAD_THREADS = SF_DOWNLOAD_EXECUTOR_DEFAULT_THREADS;
+static uint64 MAX_DOWNLOAD_BYTES = 0;
+
+// Number of rotated log files kept when max log file size is set
+#define SF_LOG_MAX_BACKUPS 5
 
 static SF_MUTEX_HANDLE log_lock;
 static SF_MUTEX_HANDLE gmlocaltime_lock;
@@ -51,6 +62,12 @@ _reset_connection_parameters(SF_CONNECT *sf, cJSON *parameters,
 #define _SF_STMT_TYPE_DELETE (_SF_STMT_TYPE_DML + 0x300)
 #define _SF_STMT_TYPE_MERGE (_SF_STMT_TYPE_DML + 0x400)
 #define _SF_STMT_TYPE_MULTI_TABLE_INSERT (_SF_STMT_TYPE_DML + 0x500)
+#define _SF_STMT_TYPE_SCL 0x4000
+#define _SF_STMT_TYPE_USE (_SF_STMT_TYPE_SCL + 0x300)
+#define _SF_STMT_TYPE_SHOW (_SF_STMT_TYPE_SCL + 0x400)
+#define _SF_STMT_TYPE_DESCRIBE (_SF_STMT_TYPE_SCL + 0x500)
+#define _SF_STMT_TYPE_LIST (_SF_STMT_TYPE_SCL + 0x700)
+#define _SF_STMT_TYPE_DDL 0x6000
 
 /**
  * Checks whether the client is running in force_arrow mode.
@@ -92,6 +109,72 @@ static sf_bool detect_stmt_type(int64 stmt_type_id) {
     return ret;
 }
 
+/**
+ * Checks whether the leading keywords of a create statement make a temporary
+ * object: CREATE [OR REPLACE] [LOCAL | GLOBAL] {TEMP | TEMPORARY | VOLATILE}
+ * @param sql statement text
+ * @return SF_BOOLEAN_TRUE if the statement creates a temporary object
+ */
+static sf_bool is_temporary_ddl(const char *sql) {
+    static const char *modifiers[] = {"create", "or", "replace", "local", "global"};
+    static const char *temporary[] = {"temp", "temporary", "volatile"};
+    size_t len;
+    size_t i;
+    sf_bool modifier;
+
+    while (sql && *sql) {
+        while (*sql && !isalpha((unsigned char) *sql)) {
+            sql++;
+        }
+        for (len = 0; isalpha((unsigned char) sql[len]); len++);
+        for (i = 0; i < sizeof(temporary) / sizeof(temporary[0]); i++) {
+            if (len == strlen(temporary[i]) &&
+                sf_strncasecmp(sql, temporary[i], len) == 0) {
+                return SF_BOOLEAN_TRUE;
+            }
+        }
+        modifier = SF_BOOLEAN_FALSE;
+        for (i = 0; i < sizeof(modifiers) / sizeof(modifiers[0]); i++) {
+            if (len == strlen(modifiers[i]) &&
+                sf_strncasecmp(sql, modifiers[i], len) == 0) {
+                modifier = SF_BOOLEAN_TRUE;
+            }
+        }
+        if (!modifier) {
+            break;
+        }
+        sql += len;
+    }
+    return SF_BOOLEAN_FALSE;
+}
+
+/**
+ * Detects statements changing the session beyond its current objects, so
+ * that connection pools don't lend the session again
+ * @param stmt_type_id statement type id
+ * @param sql statement text
+ * @return SF_BOOLEAN_TRUE if the statement changes session parameters,
+ *         variables or creates a temporary object
+ */
+static sf_bool detect_session_change(int64 stmt_type_id, const char *sql) {
+    if (stmt_type_id >= _SF_STMT_TYPE_SCL && stmt_type_id < _SF_STMT_TYPE_SCL + 0x1000) {
+        switch (stmt_type_id & 0xff00) {
+            // Current objects are checked by the pools, the others only read
+            case _SF_STMT_TYPE_USE:
+            case _SF_STMT_TYPE_SHOW:
+            case _SF_STMT_TYPE_DESCRIBE:
+            case _SF_STMT_TYPE_LIST:
+                return SF_BOOLEAN_FALSE;
+            default:
+                return SF_BOOLEAN_TRUE;
+        }
+    }
+    if (stmt_type_id >= _SF_STMT_TYPE_DDL && stmt_type_id < _SF_STMT_TYPE_DDL + 0x1000) {
+        return is_temporary_ddl(sql);
+    }
+    return SF_BOOLEAN_FALSE;
+}
+
 #define _SF_STMT_SQL_BEGIN "begin"
 #define _SF_STMT_SQL_COMMIT "commit"
 #define _SF_STMT_SQL_ROLLBACK "rollback"
@@ -337,6 +420,8 @@ static sf_bool STDCALL log_init(const char *log_path, SF_LOG_LEVEL log_level) {
     }
     log_set_level(sf_log_level);
     log_set_lock(&log_lock_func);
+    log_set_overflow_policy((SF_LOG_OVERFLOW_POLICY) LOG_OVERFLOW_POLICY);
+    log_set_max_file_size((size_t) LOG_MAX_FILE_SIZE, SF_LOG_MAX_BACKUPS);
 
     // If log path is specified, use absolute path. Otherwise set logging dir to be relative to current directory
     log_path_size += 30; // Size of static format characters
@@ -494,6 +579,12 @@ SF_STATUS STDCALL snowflake_global_init(
     SSL_VERSION = CURL_SSLVERSION_TLSv1_2;
     DEBUG = SF_BOOLEAN_FALSE;
     SF_OCSP_CHECK = SF_BOOLEAN_TRUE;
+    LOG_ASYNC = SF_BOOLEAN_FALSE;
+    LOG_OVERFLOW_POLICY = SF_LOG_OVERFLOW_BLOCK;
+    LOG_MAX_FILE_SIZE = 0;
+    MAX_DOWNLOAD_THREADS = SF_DOWNLOAD_EXECUTOR_DEFAULT_THREADS;
+    MAX_DOWNLOAD_BYTES = 0;
+    SF_REQUEST_COMPRESSION_THRESHOLD = SF_DEFAULT_REQUEST_COMPRESSION_THRESHOLD;
 
     _snowflake_memory_hooks_setup(hooks);
     sf_memory_init();
@@ -509,6 +600,15 @@ SF_STATUS STDCALL snowflake_global_init(
                   curl_easy_strerror(curl_ret));
         goto cleanup;
     }
+    if (download_executor_init() != 0) {
+        log_fatal("Unable to initialize the download executor");
+        goto cleanup;
+    }
+    if (ssl_context_init() != 0) {
+        log_fatal("Unable to initialize the shared TLS state");
+        goto cleanup;
+    }
+    download_executor_configure(MAX_DOWNLOAD_THREADS, MAX_DOWNLOAD_BYTES);
 
     if (SF_HEADER_USER_AGENT == NULL) {
 #ifdef __STDC__
@@ -530,6 +630,8 @@ cleanup:
 }
 
 SF_STATUS STDCALL snowflake_global_term() {
+    download_executor_term();
+    ssl_context_term();
     curl_global_cleanup();
 
     // Cleanup Constants
@@ -566,6 +668,35 @@ snowflake_global_set_attribute(SF_GLOBAL_ATTRIBUTE type, const void *value) {
         case SF_GLOBAL_OCSP_CHECK:
             SF_OCSP_CHECK = *(sf_bool *) value;
             break;
+        case SF_GLOBAL_LOG_ASYNC:
+            LOG_ASYNC = *(sf_bool *) value;
+            if (log_set_async(LOG_ASYNC, 0) != 0) {
+                LOG_ASYNC = SF_BOOLEAN_FALSE;
+                return SF_STATUS_ERROR_OUT_OF_MEMORY;
+            }
+            break;
+        case SF_GLOBAL_LOG_OVERFLOW_POLICY:
+            LOG_OVERFLOW_POLICY = *(int32 *) value;
+            log_set_overflow_policy((SF_LOG_OVERFLOW_POLICY) LOG_OVERFLOW_POLICY);
+            break;
+        case SF_GLOBAL_LOG_MAX_FILE_SIZE:
+            LOG_MAX_FILE_SIZE = *(uint64 *) value;
+            log_set_max_file_size((size_t) LOG_MAX_FILE_SIZE, SF_LOG_MAX_BACKUPS);
+            break;
+        case SF_GLOBAL_MAX_DOWNLOAD_THREADS:
+            if (*(uint64 *) value == 0) {
+                return SF_STATUS_ERROR_BAD_ATTRIBUTE_TYPE;
+            }
+            MAX_DOWNLOAD_THREADS = *(uint64 *) value;
+            download_executor_configure(MAX_DOWNLOAD_THREADS, MAX_DOWNLOAD_BYTES);
+            break;
+        case SF_GLOBAL_MAX_DOWNLOAD_BYTES:
+            MAX_DOWNLOAD_BYTES = *(uint64 *) value;
+            download_executor_configure(MAX_DOWNLOAD_THREADS, MAX_DOWNLOAD_BYTES);
+            break;
+        case SF_GLOBAL_REQUEST_COMPRESSION_THRESHOLD:
+            SF_REQUEST_COMPRESSION_THRESHOLD = *(uint64 *) value;
+            break;
         default:
             break;
     }
@@ -592,6 +723,24 @@ snowflake_global_get_attribute(SF_GLOBAL_ATTRIBUTE type, void *value, size_t siz
         case SF_GLOBAL_OCSP_CHECK:
             *((sf_bool *) value) = SF_OCSP_CHECK;
             break;
+        case SF_GLOBAL_LOG_ASYNC:
+            *((sf_bool *) value) = LOG_ASYNC;
+            break;
+        case SF_GLOBAL_LOG_OVERFLOW_POLICY:
+            *((int32 *) value) = LOG_OVERFLOW_POLICY;
+            break;
+        case SF_GLOBAL_LOG_MAX_FILE_SIZE:
+            *((uint64 *) value) = LOG_MAX_FILE_SIZE;
+            break;
+        case SF_GLOBAL_MAX_DOWNLOAD_THREADS:
+            *((uint64 *) value) = MAX_DOWNLOAD_THREADS;
+            break;
+        case SF_GLOBAL_MAX_DOWNLOAD_BYTES:
+            *((uint64 *) value) = MAX_DOWNLOAD_BYTES;
+            break;
+        case SF_GLOBAL_REQUEST_COMPRESSION_THRESHOLD:
+            *((uint64 *) value) = SF_REQUEST_COMPRESSION_THRESHOLD;
+            break;
         default:
             break;
     }
@@ -663,8 +812,10 @@ SF_STATUS STDCALL snowflake_term(SF_CONNECT *sf) {
         if (request(sf, &resp, DELETE_SESSION_URL, url_params,
                     sizeof(url_params) / sizeof(URL_KEY_VALUE), NULL, NULL,
                     POST_REQUEST_TYPE, &sf->error, SF_BOOLEAN_FALSE)) {
-            s_resp = snowflake_cJSON_Print(resp);
-            log_trace("JSON response:\n%s", s_resp);
+            if (log_is_enabled(SF_LOG_TRACE)) {
+                s_resp = snowflake_cJSON_Print(resp);
+                log_trace("JSON response:\n%s", s_resp);
+            }
             /* Even if the session deletion fails, it will be cleaned after 7 days.
              * Catching error here won't help
              */
@@ -781,8 +932,10 @@ SF_STATUS STDCALL snowflake_connect(SF_CONNECT *sf) {
     if (request(sf, &resp, SESSION_URL, url_params,
                 sizeof(url_params) / sizeof(URL_KEY_VALUE), s_body, NULL,
                 POST_REQUEST_TYPE, &sf->error, SF_BOOLEAN_FALSE)) {
-        s_resp = snowflake_cJSON_Print(resp);
-        log_trace("Here is JSON response:\n%s", s_resp);
+        if (log_is_enabled(SF_LOG_TRACE)) {
+            s_resp = snowflake_cJSON_Print(resp);
+            log_trace("Here is JSON response:\n%s", s_resp);
+        }
         if ((json_error = json_copy_bool(&success, resp, "success")) !=
             SF_JSON_ERROR_NONE) {
             log_error("JSON error: %d", json_error);
@@ -1262,6 +1415,7 @@ static void STDCALL _snowflake_stmt_reset(SF_STMT *sfstmt) {
     sfstmt->total_rowcount = -1;
     sfstmt->total_fieldcount = -1;
     sfstmt->total_row_index = -1;
+    sfstmt->row_limit = -1;
 
     // Destroy chunk downloader
     chunk_downloader_term(sfstmt->chunk_downloader);
@@ -1499,6 +1653,71 @@ SF_STATUS STDCALL snowflake_query(
     return SF_STATUS_SUCCESS;
 }
 
+/**
+ * Takes the next chunk of the result set from the chunk downloader.
+ *
+ * @param sfstmt SNOWFLAKE_STMT context.
+ * @return SF_STATUS_SUCCESS, SF_STATUS_EOF if there are no more chunks, or
+ * an error.
+ */
+static SF_STATUS STDCALL _snowflake_next_chunk(SF_STMT *sfstmt) {
+    SF_STATUS ret = SF_STATUS_ERROR_GENERAL;
+    SF_CHUNK_DOWNLOADER *chunk_downloader = sfstmt->chunk_downloader;
+    uint64 index;
+
+    if (!chunk_downloader) {
+        // If there is no chunk downloader set, then we've truly reached the end of the results and should set EOL
+        log_debug("No chunk downloader set, end of results.");
+        return SF_STATUS_EOF;
+    }
+
+    log_debug("Fetching next chunk from chunk downloader.");
+    _critical_section_lock(&chunk_downloader->queue_lock);
+    do {
+        if (chunk_downloader->consumer_head >= chunk_downloader->chunk_limit) {
+            // No more chunks, set EOL and break
+            log_debug("Out of chunks, setting EOL.");
+            snowflake_cJSON_Delete(sfstmt->raw_results);
+            sfstmt->raw_results = NULL;
+            ret = SF_STATUS_EOF;
+            break;
+        }
+
+        // Get index and increment
+        index = chunk_downloader->consumer_head;
+        wait_for_chunk(chunk_downloader, index);
+
+        if (get_error(chunk_downloader) || get_shutdown(chunk_downloader)) {
+            break;
+        }
+
+        chunk_downloader->consumer_head++;
+
+        // Delete old cJSON results struct
+        snowflake_cJSON_Delete((cJSON *) sfstmt->raw_results);
+        // Set new chunk and remove chunk reference from locked array
+        sfstmt->raw_results = chunk_downloader_take_chunk(chunk_downloader, index);
+        if (!sfstmt->raw_results) {
+            break;
+        }
+        sfstmt->chunk_rowcount = chunk_downloader->queue[index].row_count;
+        log_debug("Acquired chunk %llu from chunk downloader", index);
+        // A chunk slot was freed, queue the next download
+        if (!schedule_chunk_downloads(chunk_downloader)) {
+            SET_SNOWFLAKE_ERROR(&sfstmt->error,
+                                SF_STATUS_ERROR_PTHREAD,
+                                "Unable to schedule chunk download",
+                                "");
+            break;
+        }
+        ret = SF_STATUS_SUCCESS;
+    }
+    while (0);
+    _critical_section_unlock(&chunk_downloader->queue_lock);
+
+    return ret;
+}
+
 SF_STATUS STDCALL snowflake_fetch(SF_STMT *sfstmt) {
     if (!sfstmt) {
         return SF_STATUS_ERROR_STATEMENT_NOT_EXIST;
@@ -1516,8 +1735,6 @@ SF_STATUS STDCALL snowflake_fetch(SF_STMT *sfstmt) {
 
     clear_snowflake_error(&sfstmt->error);
     SF_STATUS ret = SF_STATUS_ERROR_GENERAL;
-    sf_bool get_chunk_success = SF_BOOLEAN_TRUE;
-    uint64 index;
     if (sfstmt->cur_row != NULL) {
         snowflake_cJSON_Delete(sfstmt->cur_row);
         sfstmt->cur_row = NULL;
@@ -1528,71 +1745,17 @@ SF_STATUS STDCALL snowflake_fetch(SF_STMT *sfstmt) {
         goto cleanup;
     }
 
+    // End of the window set with snowflake_fetch_window
+    if (sfstmt->row_limit >= 0 && sfstmt->total_row_index >= sfstmt->row_limit) {
+        ret = SF_STATUS_EOF;
+        goto cleanup;
+    }
+
     // If no more results, set return to SF_STATUS_EOF
     if (sfstmt->chunk_rowcount == 0) {
-        if (sfstmt->chunk_downloader) {
-            log_debug("Fetching next chunk from chunk downloader.");
-            _critical_section_lock(&sfstmt->chunk_downloader->queue_lock);
-            do {
-                if (sfstmt->chunk_downloader->consumer_head >=
-                    sfstmt->chunk_downloader->queue_size) {
-                    // No more chunks, set EOL and break
-                    log_debug("Out of chunks, setting EOL.");
-                    snowflake_cJSON_Delete(sfstmt->raw_results);
-                    sfstmt->raw_results = NULL;
-                    ret = SF_STATUS_EOF;
-                    break;
-                } else {
-                    // Get index and increment
-                    index = sfstmt->chunk_downloader->consumer_head;
-                    while (
-                        sfstmt->chunk_downloader->queue[index].chunk == NULL &&
-                        !get_shutdown_or_error(
-                            sfstmt->chunk_downloader)) {
-                        _cond_wait(
-                            &sfstmt->chunk_downloader->consumer_cond,
-                            &sfstmt->chunk_downloader->queue_lock);
-                    }
-
-                    if (get_error(sfstmt->chunk_downloader)) {
-                        get_chunk_success = SF_BOOLEAN_FALSE;
-                        break;
-                    } else if (get_shutdown(sfstmt->chunk_downloader)) {
-                        get_chunk_success = SF_BOOLEAN_FALSE;
-                        break;
-                    }
-
-                    sfstmt->chunk_downloader->consumer_head++;
-
-                    // Delete old cJSON results struct
-                    snowflake_cJSON_Delete((cJSON *) sfstmt->raw_results);
-                    // Set new chunk and remove chunk reference from locked array
-                    sfstmt->raw_results = sfstmt->chunk_downloader->queue[index].chunk;
-                    sfstmt->chunk_downloader->queue[index].chunk = NULL;
-                    sfstmt->chunk_rowcount = sfstmt->chunk_downloader->queue[index].row_count;
-                    log_debug("Acquired chunk %llu from chunk downloader",
-                              index);
-                    if (_cond_signal(
-                        &sfstmt->chunk_downloader->producer_cond)) {
-                        SET_SNOWFLAKE_ERROR(&sfstmt->error,
-                                            SF_STATUS_ERROR_PTHREAD,
-                                            "Unable to send signal using produce_cond",
-                                            "");
-                        get_chunk_success = SF_BOOLEAN_FALSE;
-                        break;
-                    }
-                }
-            }
-            while (0);
-            _critical_section_unlock(&sfstmt->chunk_downloader->queue_lock);
-        } else {
-            // If there is no chunk downloader set, then we've truly reached the end of the results and should set EOL
-            log_debug("No chunk downloader set, end of results.");
-            ret = SF_STATUS_EOF;
-        }
-
+        ret = _snowflake_next_chunk(sfstmt);
         // If we've reached the end, or we have an error getting the next chunk, goto cleanup and return status
-        if (ret == SF_STATUS_EOF || !get_chunk_success) {
+        if (ret != SF_STATUS_SUCCESS) {
             goto cleanup;
         }
     }
@@ -1607,6 +1770,318 @@ cleanup:
     return ret;
 }
 
+/**
+ * Finds the chunk holding a row of the result set.
+ *
+ * @param chunk_downloader Chunk downloader of the statement.
+ * @param first_row Index of the first row of the first chunk.
+ * @param row_index Index of the row.
+ * @param chunk_first_row Set to the index of the first row of the chunk.
+ * @return Index of the chunk, the number of chunks if the row is past the last one.
+ */
+static uint64 STDCALL _snowflake_chunk_of_row(SF_CHUNK_DOWNLOADER *chunk_downloader,
+                                              int64 first_row,
+                                              int64 row_index,
+                                              int64 *chunk_first_row) {
+    uint64 index;
+    for (index = 0;
+         index < chunk_downloader->queue_size &&
+         row_index >= first_row + chunk_downloader->queue[index].row_count;
+         index++) {
+        first_row += chunk_downloader->queue[index].row_count;
+    }
+    *chunk_first_row = first_row;
+    return index;
+}
+
+/**
+ * Drops rows from the front of the current chunk.
+ *
+ * @param sfstmt SNOWFLAKE_STMT context.
+ * @param count Number of rows to drop.
+ */
+static void STDCALL _snowflake_skip_rows(SF_STMT *sfstmt, int64 count) {
+    for (; count > 0 && sfstmt->chunk_rowcount > 0; count--) {
+        snowflake_cJSON_DeleteItemFromArray(sfstmt->raw_results, 0);
+        sfstmt->chunk_rowcount--;
+        sfstmt->total_row_index++;
+    }
+}
+
+/**
+ * Moves the chunk downloader to a chunk, keeping it within the window.
+ */
+static SF_STATUS STDCALL _snowflake_seek_chunk(SF_STMT *sfstmt, uint64 index, uint64 end) {
+    sf_bool scheduled;
+    _critical_section_lock(&sfstmt->chunk_downloader->queue_lock);
+    scheduled = chunk_downloader_seek(sfstmt->chunk_downloader, index, end > index ? end : index);
+    _critical_section_unlock(&sfstmt->chunk_downloader->queue_lock);
+    if (!scheduled) {
+        SET_SNOWFLAKE_ERROR(&sfstmt->error, SF_STATUS_ERROR_PTHREAD,
+                            "Unable to schedule chunk download", "");
+        return SF_STATUS_ERROR_PTHREAD;
+    }
+    return SF_STATUS_SUCCESS;
+}
+
+/**
+ * @return Number of rows returned with the query response, before the rows
+ * of the chunks.
+ */
+static int64 STDCALL _snowflake_first_chunk_row(SF_STMT *sfstmt) {
+    int64 first_chunk_row = sfstmt->total_rowcount;
+    uint64 index;
+    if (sfstmt->chunk_downloader) {
+        for (index = 0; index < sfstmt->chunk_downloader->queue_size; index++) {
+            first_chunk_row -= sfstmt->chunk_downloader->queue[index].row_count;
+        }
+    }
+    return first_chunk_row;
+}
+
+static SF_STATUS STDCALL _snowflake_fetch_seek(SF_STMT *sfstmt, int64 row_index) {
+    SF_CHUNK_DOWNLOADER *chunk_downloader = sfstmt->chunk_downloader;
+    SF_STATUS ret;
+    int64 first_chunk_row;
+    int64 chunk_first_row;
+    uint64 index;
+    uint64 end = 0;
+
+    if (sfstmt->total_row_index < 0 || row_index < 0 || row_index > sfstmt->total_rowcount) {
+        SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_OUT_OF_RANGE,
+                                 "Row index is out of the result set.",
+                                 SF_SQLSTATE_INVALID_CURSOR_POSITION, sfstmt->sfqid);
+        return SF_STATUS_ERROR_OUT_OF_RANGE;
+    }
+    if (chunk_downloader && get_error(chunk_downloader)) {
+        return SF_STATUS_ERROR_GENERAL;
+    }
+    if (sfstmt->cur_row != NULL) {
+        snowflake_cJSON_Delete(sfstmt->cur_row);
+        sfstmt->cur_row = NULL;
+    }
+
+    first_chunk_row = _snowflake_first_chunk_row(sfstmt);
+    if (chunk_downloader) {
+        end = chunk_downloader->queue_size;
+        if (sfstmt->row_limit >= 0) {
+            end = sfstmt->row_limit > first_chunk_row ?
+                  _snowflake_chunk_of_row(chunk_downloader, first_chunk_row,
+                                          sfstmt->row_limit - 1, &chunk_first_row) + 1 : 0;
+        }
+    }
+
+    // Forward within the rows left of the current chunk
+    if (row_index >= sfstmt->total_row_index &&
+        row_index - sfstmt->total_row_index <= sfstmt->chunk_rowcount) {
+        _snowflake_skip_rows(sfstmt, row_index - sfstmt->total_row_index);
+        // Drop the prefetched chunks past the window, if it changed
+        return chunk_downloader ?
+               _snowflake_seek_chunk(sfstmt, chunk_downloader->consumer_head, end) :
+               SF_STATUS_SUCCESS;
+    }
+
+    if (!chunk_downloader || row_index < first_chunk_row) {
+        // The rows of the query response are released once fetched
+        SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_OUT_OF_RANGE,
+                                 "Unable to seek back to a row of the first rowset already fetched.",
+                                 SF_SQLSTATE_INVALID_CURSOR_POSITION, sfstmt->sfqid);
+        return SF_STATUS_ERROR_OUT_OF_RANGE;
+    }
+
+    index = _snowflake_chunk_of_row(chunk_downloader, first_chunk_row, row_index, &chunk_first_row);
+    log_debug("Seeking to row %lld in chunk %llu", row_index, index);
+
+    snowflake_cJSON_Delete(sfstmt->raw_results);
+    sfstmt->raw_results = NULL;
+    sfstmt->chunk_rowcount = 0;
+    sfstmt->total_row_index = chunk_first_row;
+
+    // Start downloading from the chunk holding the row
+    ret = _snowflake_seek_chunk(sfstmt, index, end);
+    if (ret != SF_STATUS_SUCCESS || row_index == chunk_first_row) {
+        return ret;
+    }
+
+    ret = _snowflake_next_chunk(sfstmt);
+    if (ret == SF_STATUS_SUCCESS) {
+        _snowflake_skip_rows(sfstmt, row_index - chunk_first_row);
+    }
+    // Past the window, the next fetch returns SF_STATUS_EOF
+    return ret == SF_STATUS_EOF ? SF_STATUS_SUCCESS : ret;
+}
+
+SF_STATUS STDCALL snowflake_fetch_seek(SF_STMT *sfstmt, int64 row_index) {
+    if (!sfstmt) {
+        return SF_STATUS_ERROR_STATEMENT_NOT_EXIST;
+    }
+    clear_snowflake_error(&sfstmt->error);
+    return _snowflake_fetch_seek(sfstmt, row_index);
+}
+
+SF_STATUS STDCALL snowflake_fetch_window(SF_STMT *sfstmt, int64 offset, int64 limit) {
+    if (!sfstmt) {
+        return SF_STATUS_ERROR_STATEMENT_NOT_EXIST;
+    }
+    clear_snowflake_error(&sfstmt->error);
+    sfstmt->row_limit = limit < 0 ? -1 : offset + limit;
+    return _snowflake_fetch_seek(sfstmt, offset);
+}
+
+int64 STDCALL snowflake_num_partitions(SF_STMT *sfstmt) {
+    if (!sfstmt || sfstmt->total_row_index < 0) {
+        return -1;
+    }
+    return sfstmt->chunk_downloader ?
+           (int64) sfstmt->chunk_downloader->queue_size + 1 : 1;
+}
+
+SF_STATUS STDCALL snowflake_get_partition(SF_STMT *sfstmt, int64 index, SF_RESULT_PARTITION *partition) {
+    SF_CHUNK_DOWNLOADER *chunk_downloader;
+    int64 i;
+
+    if (!sfstmt) {
+        return SF_STATUS_ERROR_STATEMENT_NOT_EXIST;
+    }
+    clear_snowflake_error(&sfstmt->error);
+    if (!partition) {
+        SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_NULL_POINTER,
+                                 "Partition is NULL.", "", sfstmt->sfqid);
+        return SF_STATUS_ERROR_NULL_POINTER;
+    }
+    if (index < 0 || index >= snowflake_num_partitions(sfstmt)) {
+        SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_OUT_OF_RANGE,
+                                 "Partition index must be between 0 and snowflake_num_partitions() - 1.",
+                                 SF_SQLSTATE_ROW_VALUE_OUT_OF_RANGE, sfstmt->sfqid);
+        return SF_STATUS_ERROR_OUT_OF_RANGE;
+    }
+
+    memset(partition, 0, sizeof(SF_RESULT_PARTITION));
+    partition->first_row = 0;
+    partition->row_count = _snowflake_first_chunk_row(sfstmt);
+    chunk_downloader = sfstmt->chunk_downloader;
+    if (index == 0) {
+        return SF_STATUS_SUCCESS;
+    }
+
+    // Chunk URLs, row counts and headers don't change once the chunk downloader is created
+    for (i = 0; i < index - 1; i++) {
+        partition->first_row += partition->row_count;
+        partition->row_count = chunk_downloader->queue[i].row_count;
+    }
+    partition->first_row += partition->row_count;
+    partition->row_count = chunk_downloader->queue[index - 1].row_count;
+    partition->url = chunk_downloader->queue[index - 1].url;
+    partition->qrmk = chunk_downloader->qrmk;
+    partition->headers = (const char *const *) chunk_downloader->header_lines;
+    partition->header_count = (size_t) chunk_downloader->header_count;
+    return SF_STATUS_SUCCESS;
+}
+
+SF_STATUS STDCALL snowflake_partition_stmt(SF_STMT *sfstmt, int64 index, SF_STMT **partition_stmt) {
+    SF_RESULT_PARTITION partition;
+    SF_STMT *stmt = NULL;
+    SF_STATUS ret;
+    int64 i;
+    size_t name_len;
+
+    if (!sfstmt) {
+        return SF_STATUS_ERROR_STATEMENT_NOT_EXIST;
+    }
+    if (!partition_stmt) {
+        SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_NULL_POINTER,
+                                 "Partition statement is NULL.", "", sfstmt->sfqid);
+        return SF_STATUS_ERROR_NULL_POINTER;
+    }
+    *partition_stmt = NULL;
+
+    ret = snowflake_get_partition(sfstmt, index, &partition);
+    if (ret != SF_STATUS_SUCCESS) {
+        return ret;
+    }
+    if (index == 0 && sfstmt->total_row_index != 0) {
+        // The rows of the query response are released once fetched
+        SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_OUT_OF_RANGE,
+                                 "The first partition is not available once rows were fetched.",
+                                 SF_SQLSTATE_INVALID_CURSOR_POSITION, sfstmt->sfqid);
+        return SF_STATUS_ERROR_OUT_OF_RANGE;
+    }
+
+    stmt = snowflake_stmt(sfstmt->connection);
+    if (!stmt) {
+        SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_OUT_OF_MEMORY,
+                                 "Out of memory in creating SF_STMT. ",
+                                 SF_SQLSTATE_MEMORY_ALLOCATION_ERROR, sfstmt->sfqid);
+        return SF_STATUS_ERROR_OUT_OF_MEMORY;
+    }
+    sb_strncpy(stmt->sfqid, SF_UUID4_LEN, sfstmt->sfqid, SF_UUID4_LEN);
+    stmt->is_dml = sfstmt->is_dml;
+    stmt->chunk_memory_budget = sfstmt->chunk_memory_budget;
+
+    // Same columns as the result set
+    if (sfstmt->desc && sfstmt->total_fieldcount > 0) {
+        stmt->desc = (SF_COLUMN_DESC *) SF_CALLOC((size_t) sfstmt->total_fieldcount, sizeof(SF_COLUMN_DESC));
+        if (!stmt->desc) {
+            goto oom;
+        }
+        stmt->total_fieldcount = sfstmt->total_fieldcount;
+        for (i = 0; i < sfstmt->total_fieldcount; i++) {
+            stmt->desc[i] = sfstmt->desc[i];
+            stmt->desc[i].name = NULL;
+            if (sfstmt->desc[i].name) {
+                name_len = strlen(sfstmt->desc[i].name) + 1;
+                stmt->desc[i].name = (char *) SF_CALLOC(1, name_len);
+                if (!stmt->desc[i].name) {
+                    goto oom;
+                }
+                sb_strncpy(stmt->desc[i].name, name_len, sfstmt->desc[i].name, name_len);
+            }
+        }
+    } else {
+        stmt->total_fieldcount = sfstmt->total_fieldcount;
+    }
+
+    stmt->total_rowcount = partition.row_count;
+    stmt->total_row_index = 0;
+    stmt->row_limit = -1;
+    if (index == 0) {
+        stmt->raw_results = sfstmt->raw_results ?
+                            snowflake_cJSON_Duplicate((cJSON *) sfstmt->raw_results, 1) :
+                            snowflake_cJSON_CreateArray();
+        if (!stmt->raw_results) {
+            goto oom;
+        }
+        stmt->chunk_rowcount = snowflake_cJSON_GetArraySize(stmt->raw_results);
+    } else {
+        stmt->chunk_rowcount = 0;
+        stmt->chunk_downloader = chunk_downloader_init_partition(
+          sfstmt->chunk_downloader, (uint64) (index - 1), &stmt->error,
+          sfstmt->connection->insecure_mode);
+        if (!stmt->chunk_downloader) {
+            if (stmt->error.error_code != SF_STATUS_SUCCESS) {
+                copy_snowflake_error(&sfstmt->error, &stmt->error);
+            } else {
+                SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_GENERAL,
+                                         "Unable to create the chunk downloader of the partition.",
+                                         "", sfstmt->sfqid);
+            }
+            ret = sfstmt->error.error_code;
+            snowflake_stmt_term(stmt);
+            return ret;
+        }
+    }
+
+    *partition_stmt = stmt;
+    return SF_STATUS_SUCCESS;
+
+oom:
+    SET_SNOWFLAKE_STMT_ERROR(&sfstmt->error, SF_STATUS_ERROR_OUT_OF_MEMORY,
+                             "Out of memory in creating the partition statement.",
+                             SF_SQLSTATE_MEMORY_ALLOCATION_ERROR, sfstmt->sfqid);
+    snowflake_stmt_term(stmt);
+    return SF_STATUS_ERROR_OUT_OF_MEMORY;
+}
+
 static SF_STATUS STDCALL
 _snowflake_internal_query(SF_CONNECT *sf, const char *sql) {
     if (!sf) {
@@ -1859,8 +2334,11 @@ SF_STATUS STDCALL _snowflake_execute_ex(SF_STMT *sfstmt,
                 url_paramSize , s_body, NULL,
                 POST_REQUEST_TYPE, &sfstmt->error, is_put_get_command)) {
         // s_resp will be freed by snowflake_query_result_capture_term
-        s_resp = snowflake_cJSON_Print(resp);
-        log_trace("Here is JSON response:\n%s", s_resp);
+        // only print the response if it is captured or logged
+        if (result_capture != NULL || log_is_enabled(SF_LOG_TRACE)) {
+            s_resp = snowflake_cJSON_Print(resp);
+            log_trace("Here is JSON response:\n%s", s_resp);
+        }
 
         // Store the full query-response text in the capture buffer, if defined.
         if (result_capture != NULL) {
@@ -1976,6 +2454,9 @@ SF_STATUS STDCALL _snowflake_execute_ex(SF_STMT *sfstmt,
                     sfstmt->is_dml = SF_BOOLEAN_FALSE;
                 } else {
                     sfstmt->is_dml = detect_stmt_type(stmt_type_id);
+                    if (detect_session_change(stmt_type_id, sfstmt->sql_text)) {
+                        sfstmt->connection->session_changed = SF_BOOLEAN_TRUE;
+                    }
                 }
                rowtype = snowflake_cJSON_GetObjectItem(data, "rowtype");
                 if (snowflake_cJSON_IsArray(rowtype)) {
@@ -2018,6 +2499,7 @@ SF_STATUS STDCALL _snowflake_execute_ex(SF_STMT *sfstmt,
 
                     // Index starts at 0 and incremented each fetch
                     sfstmt->total_row_index = 0;
+                    sfstmt->row_limit = -1;
 
                     // Set large result set if one exists
                     if ((chunks = snowflake_cJSON_GetObjectItem(data, "chunks")) != NULL) {
@@ -2037,6 +2519,12 @@ SF_STATUS STDCALL _snowflake_execute_ex(SF_STMT *sfstmt,
                             // Unable to create chunk downloader. Error is set in chunk_downloader_init function.
                             goto cleanup;
                         }
+                        if (sfstmt->chunk_memory_budget > 0) {
+                            _critical_section_lock(&sfstmt->chunk_downloader->queue_lock);
+                            chunk_downloader_set_memory_budget(sfstmt->chunk_downloader,
+                                                               sfstmt->chunk_memory_budget);
+                            _critical_section_unlock(&sfstmt->chunk_downloader->queue_lock);
+                        }
                     }
                 }
             }
@@ -2083,6 +2571,11 @@ SF_STATUS STDCALL _snowflake_execute_ex(SF_STMT *sfstmt,
     ret = SF_STATUS_SUCCESS;
 
 cleanup:
+    if (ret != SF_STATUS_SUCCESS &&
+        strncmp(sfstmt->error.sqlstate, "08", 2) == 0) {
+        // Lets connection pools discard the session once returned
+        sfstmt->connection->connection_failed = SF_BOOLEAN_TRUE;
+    }
     snowflake_cJSON_Delete(body);
     snowflake_cJSON_Delete(resp);
     SF_FREE(s_body);
@@ -2108,6 +2601,13 @@ SF_ERROR_STRUCT *STDCALL snowflake_error(SF_CONNECT *sf) {
     return &sf->error;
 }
 
+void STDCALL snowflake_clear_error(SF_ERROR_STRUCT *error) {
+    if (!error) {
+        return;
+    }
+    clear_snowflake_error(error);
+}
+
 SF_ERROR_STRUCT *STDCALL snowflake_stmt_error(SF_STMT *sfstmt) {
     if (!sfstmt) {
         return NULL;
@@ -2178,6 +2678,9 @@ SF_STATUS STDCALL snowflake_stmt_get_attr(
         case SF_STMT_USER_REALLOC_FUNC:
             *value = sfstmt->user_realloc_func;
             break;
+        case SF_STMT_CHUNK_MEMORY_BUDGET:
+            *value = &sfstmt->chunk_memory_budget;
+            break;
         default:
             SET_SNOWFLAKE_ERROR(
                 &sfstmt->error, SF_STATUS_ERROR_BAD_ATTRIBUTE_TYPE,
@@ -2198,6 +2701,9 @@ SF_STATUS STDCALL snowflake_stmt_set_attr(
         case SF_STMT_USER_REALLOC_FUNC:
             sfstmt->user_realloc_func = (void*(*)(void*, size_t))value;
             break;
+        case SF_STMT_CHUNK_MEMORY_BUDGET:
+            sfstmt->chunk_memory_budget = value ? *(const uint64 *) value : 0;
+            break;
         default:
             SET_SNOWFLAKE_ERROR(
                 &sfstmt->error, SF_STATUS_ERROR_BAD_ATTRIBUTE_TYPE,
@@ -2846,7 +3352,7 @@ SF_STATUS STDCALL snowflake_raw_value_to_str_rep(SF_STMT *sfstmt, const char* co
               scale = tzOffsetPtr - scalePtr - 1;
             }
           }
-          log_info("scale is calculated as %d", scale);
+          log_trace("scale is calculated as %d", scale);
         }
 
         if (snowflake_timestamp_from_epoch_seconds(&ts,
@@ -3103,7 +3609,7 @@ SF_STATUS STDCALL snowflake_timestamp_from_epoch_seconds(SF_TIMESTAMP *ts, const
         nsec = pow10_int64[ts->scale] - nsec;
         sec--;
     }
-    log_info("sec: %lld, nsec: %lld", sec, nsec);
+    log_trace("sec: %lld, nsec: %lld", sec, nsec);
     // Transform nsec to a 9 digit number to store in the timestamp struct
     ts->nsec = (int32) (nsec * pow10_int64[9-ts->scale]);
 
@@ -18,6 +18,7 @@
 #define HEADER_C_API_USER_AGENT_MAX_LEN 256
 #define HEADER_DIRECT_QUERY_TOKEN_FORMAT "Authorization: %s"
 #define HEADER_SERVICE_NAME_FORMAT "X-Snowflake-Service: %s"
+#define HEADER_CONTENT_ENCODING_GZIP "Content-Encoding: gzip"
 
 #define DEFAULT_SNOWFLAKE_BASE_URL "snowflakecomputing.com"
 #define DEFAULT_SNOWFLAKE_REQUEST_TIMEOUT 60
@@ -26,6 +27,7 @@
 #define QUERY_URL "/queries/v1/query-request"
 #define RENEW_SESSION_URL "/session/token-request"
 #define DELETE_SESSION_URL "/session"
+#define HEARTBEAT_URL "/session/heartbeat"
 
 #define URL_QUERY_DELIMITER "?"
 #define URL_PARAM_DELIM "&"
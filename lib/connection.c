@@ -319,7 +319,7 @@ sf_bool STDCALL curl_post_call(SF_CONNECT *sf,
         if (!http_perform(curl, POST_REQUEST_TYPE, url, header, body, json,
                           sf->network_timeout, SF_BOOLEAN_FALSE, error,
                           sf->insecure_mode,
-                          sf->retry_on_curle_couldnt_connect_count) ||
+                          sf->retry_on_curle_couldnt_connect_count, NULL) ||
             !*json) {
             // Error is set in the perform function
             break;
@@ -440,7 +440,7 @@ sf_bool STDCALL curl_get_call(SF_CONNECT *sf,
         if (!http_perform(curl, GET_REQUEST_TYPE, url, header, NULL, json,
                           sf->network_timeout, SF_BOOLEAN_FALSE, error,
                           sf->insecure_mode,
-                          sf->retry_on_curle_couldnt_connect_count) ||
+                          sf->retry_on_curle_couldnt_connect_count, NULL) ||
             !*json) {
             // Error is set in the perform function
             break;
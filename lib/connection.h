@@ -124,6 +124,17 @@ typedef struct SF_HEADER {
     sf_bool renew_session;
 } SF_HEADER;
 
+/**
+ * Token to cancel running requests from another thread. Transfers abort
+ * at the next curl progress callback and retry sleeps return immediately.
+ */
+typedef struct SF_CANCEL_TOKEN {
+    SF_CRITICAL_SECTION_HANDLE lock;
+    // Signaled when the token is cancelled to wake up sleeping requests
+    SF_CONDITION_HANDLE cond;
+    sf_bool is_cancelled;
+} SF_CANCEL_TOKEN;
+
 /**
  * Debug struct from curl example. Need to update at somepoint.
  */
@@ -366,12 +377,28 @@ size_t json_resp_cb(char *data, size_t size, size_t nmemb, RAW_JSON_BUFFER *raw_
  * @param error Reference to the Snowflake Error object to set an error if one occurs.
  * @param insecure_mode Insecure mode disable OCSP check when set to true
  * @param retry_on_curle_couldnt_connect_count number of times retrying server connection on CURLE_COULDNT_CONNECT error
+ * @param cancel_token Token to cancel the request from another thread. NULL if the request can't be cancelled.
  * @return Success/failure status of http request call. 1 = Success; 0 = Failure
  */
 sf_bool STDCALL http_perform(CURL *curl, SF_REQUEST_TYPE request_type, char *url, SF_HEADER *header,
                              char *body, cJSON **json, int64 network_timeout, sf_bool chunk_downloader,
                              SF_ERROR_STRUCT *error, sf_bool insecure_mode,
-                             int8 retry_on_curle_couldnt_connect_count);
+                             int8 retry_on_curle_couldnt_connect_count,
+                             SF_CANCEL_TOKEN *cancel_token);
+
+/**
+ * Performs an HTTP request with retry like http_perform, but returns the
+ * text of the response instead of parsing it.
+ *
+ * @param raw_body Set to the text of a successful response, NUL terminated. The buffer must be freed by the caller.
+ * @see http_perform for the other parameters.
+ * @return Success/failure status of http request call. 1 = Success; 0 = Failure
+ */
+sf_bool STDCALL http_perform_raw(CURL *curl, SF_REQUEST_TYPE request_type, char *url, SF_HEADER *header,
+                                 char *body, RAW_JSON_BUFFER *raw_body, int64 network_timeout,
+                                 sf_bool chunk_downloader, SF_ERROR_STRUCT *error, sf_bool insecure_mode,
+                                 int8 retry_on_curle_couldnt_connect_count,
+                                 SF_CANCEL_TOKEN *cancel_token);
 
 /**
  * Returns true if HTTP code is retryable, false otherwise.
@@ -441,6 +468,45 @@ RETRY_CONTEXT *STDCALL retry_ctx_init(uint64 timeout);
  */
 uint32 STDCALL retry_ctx_next_sleep(RETRY_CONTEXT *retry_ctx);
 
+/**
+ * Initializes a cancel token.
+ *
+ * @param cancel_token Cancel token object.
+ * @return 0 if success, otherwise an errno.
+ */
+int STDCALL cancel_token_init(SF_CANCEL_TOKEN *cancel_token);
+
+/**
+ * Frees up the resources of a cancel token.
+ *
+ * @param cancel_token Cancel token object.
+ */
+void STDCALL cancel_token_term(SF_CANCEL_TOKEN *cancel_token);
+
+/**
+ * Cancels the requests using the token and wakes up the ones sleeping before a retry.
+ *
+ * @param cancel_token Cancel token object.
+ */
+void STDCALL cancel_token_cancel(SF_CANCEL_TOKEN *cancel_token);
+
+/**
+ * Returns true if the token was cancelled.
+ *
+ * @param cancel_token Cancel token object. May be NULL.
+ * @return Cancelled/not cancelled. 1 = Cancelled; 0 = Not cancelled
+ */
+sf_bool STDCALL cancel_token_is_cancelled(SF_CANCEL_TOKEN *cancel_token);
+
+/**
+ * Sleeps for the given time or until the token is cancelled.
+ *
+ * @param cancel_token Cancel token object. May be NULL to sleep uninterrupted.
+ * @param sleep_ms Time to sleep in milliseconds.
+ * @return Cancelled/not cancelled. 1 = Cancelled; 0 = Slept the full time
+ */
+sf_bool STDCALL cancel_token_sleep(SF_CANCEL_TOKEN *cancel_token, uint32 sleep_ms);
+
 /**
  * Convenience function to set tokens in Snowflake Connect object from cJSON blob. Returns success/failure.
  *
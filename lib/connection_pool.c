@@ -0,0 +1,675 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#include <string.h>
+#include <snowflake/client.h>
+#include <snowflake/logger.h>
+#include <snowflake/platform.h>
+#include "client_int.h"
+#include "connection.h"
+#include "memory.h"
+#include "error.h"
+
+// Sessions logged in at the same time by one pool
+#define SF_POOL_MAX_CONNECTORS 4
+
+// Longest wait before retrying failed logins, in milliseconds
+#define SF_POOL_MAX_BACKOFF (60 * 1000)
+
+// Idle time after which sessions are checked before being lent, at most half
+// of the max idle time, in milliseconds
+#define SF_POOL_HEARTBEAT_IDLE_TIME (5 * 60 * 1000)
+
+typedef enum SF_POOL_MEMBER_STATE {
+    SF_POOL_MEMBER_FREE,
+    SF_POOL_MEMBER_CONNECTING,
+    SF_POOL_MEMBER_IDLE,
+    SF_POOL_MEMBER_BORROWED,
+    // Waiting for a connector to delete the session
+    SF_POOL_MEMBER_CLOSING
+} SF_POOL_MEMBER_STATE;
+
+typedef struct SF_POOL_MEMBER {
+    SF_CONNECT *sf;
+    SF_POOL_MEMBER_STATE state;
+    unsigned long long last_used;
+
+    // Current objects right after login, to detect sessions changed by callers
+    char *database;
+    char *schema;
+    char *warehouse;
+    char *role;
+    sf_bool autocommit;
+} SF_POOL_MEMBER;
+
+struct SF_CONNECT_POOL {
+    // Never connected, holds the attributes every member logs in with
+    SF_CONNECT *config;
+    uint64 min_size;
+    uint64 max_size;
+    unsigned long long max_idle_time;
+    unsigned long long heartbeat_idle_time;
+
+    // Guards all the pool state below
+    SF_CRITICAL_SECTION_HANDLE lock;
+    SF_CONDITION_HANDLE work_available;
+    SF_CONDITION_HANDLE member_available;
+    SF_POOL_MEMBER *members;
+    SF_THREAD_HANDLE *threads;
+    uint64 thread_count;
+    uint64 waiters;
+    sf_bool finished;
+
+    // Consecutive failed logins, and when the next one may start
+    uint64 failures;
+    uint64 failed_connects;
+    unsigned long long retry_at;
+    // Error of the last failed login, copied for the borrowers failing on it
+    SF_ERROR_STRUCT error;
+};
+
+// Attributes copied from the template, passcodes are good for one login only
+static const SF_ATTRIBUTE pool_attributes[] = {
+    SF_CON_ACCOUNT,
+    SF_CON_REGION,
+    SF_CON_USER,
+    SF_CON_PASSWORD,
+    SF_CON_DATABASE,
+    SF_CON_SCHEMA,
+    SF_CON_WAREHOUSE,
+    SF_CON_ROLE,
+    SF_CON_HOST,
+    SF_CON_PORT,
+    SF_CON_PROTOCOL,
+    SF_CON_PASSCODE_IN_PASSWORD,
+    SF_CON_APPLICATION_NAME,
+    SF_CON_APPLICATION_VERSION,
+    SF_CON_AUTHENTICATOR,
+    SF_CON_INSECURE_MODE,
+    SF_CON_LOGIN_TIMEOUT,
+    SF_CON_NETWORK_TIMEOUT,
+    SF_CON_TIMEZONE,
+    SF_CON_AUTOCOMMIT,
+    SF_RETRY_ON_CURLE_COULDNT_CONNECT_COUNT
+};
+
+static sf_bool STDCALL copy_string(char **dst, const char *src) {
+    SF_FREE(*dst);
+    if (src) {
+        *dst = (char *) SF_CALLOC(1, strlen(src) + 1);
+        if (!*dst) {
+            return SF_BOOLEAN_FALSE;
+        }
+        strcpy(*dst, src);
+    }
+    return SF_BOOLEAN_TRUE;
+}
+
+static sf_bool STDCALL same_string(const char *s1, const char *s2) {
+    if (!s1 || !s2) {
+        return s1 == s2 ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+    }
+    return strcmp(s1, s2) == 0 ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+}
+
+static SF_STATUS STDCALL copy_attributes(SF_CONNECT *dst, SF_CONNECT *src) {
+    SF_STATUS ret;
+    void *value;
+    size_t i;
+    for (i = 0; i < sizeof(pool_attributes) / sizeof(SF_ATTRIBUTE); i++) {
+        ret = snowflake_get_attribute(src, pool_attributes[i], &value);
+        if (ret == SF_STATUS_SUCCESS) {
+            ret = snowflake_set_attribute(dst, pool_attributes[i], value);
+        }
+        if (ret != SF_STATUS_SUCCESS) {
+            return ret;
+        }
+    }
+    return SF_STATUS_SUCCESS;
+}
+
+static void STDCALL clear_member(SF_POOL_MEMBER *member) {
+    member->sf = NULL;
+    member->state = SF_POOL_MEMBER_FREE;
+    SF_FREE(member->database);
+    SF_FREE(member->schema);
+    SF_FREE(member->warehouse);
+    SF_FREE(member->role);
+}
+
+static uint64 STDCALL count_members(SF_CONNECT_POOL *pool,
+                                    SF_POOL_MEMBER_STATE state) {
+    uint64 count = 0;
+    uint64 i;
+    for (i = 0; i < pool->max_size; i++) {
+        if (pool->members[i].state == state) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static SF_POOL_MEMBER *STDCALL find_member(SF_CONNECT_POOL *pool,
+                                           SF_POOL_MEMBER_STATE state) {
+    uint64 i;
+    for (i = 0; i < pool->max_size; i++) {
+        if (pool->members[i].state == state) {
+            return &pool->members[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Picks the idle member used last, so that the sessions not needed any more
+ * age out. Must be called with the pool lock held.
+ */
+static SF_POOL_MEMBER *STDCALL find_idle_member(SF_CONNECT_POOL *pool) {
+    SF_POOL_MEMBER *found = NULL;
+    uint64 i;
+    for (i = 0; i < pool->max_size; i++) {
+        if (pool->members[i].state == SF_POOL_MEMBER_IDLE &&
+            (!found || pool->members[i].last_used > found->last_used)) {
+            found = &pool->members[i];
+        }
+    }
+    return found;
+}
+
+/**
+ * Hands the idle members past the max idle time, or all of them once the
+ * pool is finished, to the connectors to delete. Must be called with the pool
+ * lock held.
+ *
+ * @return milliseconds until the next idle member expires.
+ */
+static unsigned long long STDCALL retire_idle_members(SF_CONNECT_POOL *pool,
+                                                      unsigned long long now) {
+    unsigned long long next = pool->max_idle_time;
+    unsigned long long idle;
+    sf_bool retired = SF_BOOLEAN_FALSE;
+    uint64 i;
+
+    for (i = 0; i < pool->max_size; i++) {
+        if (pool->members[i].state != SF_POOL_MEMBER_IDLE) {
+            continue;
+        }
+        idle = now - pool->members[i].last_used;
+        if (pool->finished || idle >= pool->max_idle_time) {
+            pool->members[i].state = SF_POOL_MEMBER_CLOSING;
+            retired = SF_BOOLEAN_TRUE;
+        } else if (pool->max_idle_time - idle < next) {
+            next = pool->max_idle_time - idle;
+        }
+    }
+    if (retired) {
+        _cond_broadcast(&pool->work_available);
+    }
+    return next;
+}
+
+/**
+ * Whether a connector should log in another member, either to keep the
+ * minimum size or for callers waiting to borrow one. Must be called with the
+ * pool lock held.
+ */
+static sf_bool STDCALL needs_member(SF_CONNECT_POOL *pool,
+                                    unsigned long long now) {
+    uint64 size = pool->max_size - count_members(pool, SF_POOL_MEMBER_FREE);
+    uint64 available = count_members(pool, SF_POOL_MEMBER_IDLE) +
+                       count_members(pool, SF_POOL_MEMBER_CONNECTING);
+    if (pool->finished || size >= pool->max_size || now < pool->retry_at) {
+        return SF_BOOLEAN_FALSE;
+    }
+    return (size < pool->min_size || available < pool->waiters) ?
+           SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+}
+
+/**
+ * Keeps the objects a session logged in with. Must be called with the pool
+ * lock held.
+ */
+static sf_bool STDCALL set_member_session(SF_POOL_MEMBER *member,
+                                          SF_CONNECT *sf) {
+    member->sf = sf;
+    member->autocommit = sf->autocommit;
+    return (copy_string(&member->database, sf->database) &&
+            copy_string(&member->schema, sf->schema) &&
+            copy_string(&member->warehouse, sf->warehouse) &&
+            copy_string(&member->role, sf->role)) ?
+           SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+}
+
+/**
+ * A returned session is reused only if it is still logged in, didn't fail
+ * on the connection, itself or in a statement, didn't change its parameters,
+ * variables or temporary objects, and still has the objects and the
+ * autocommit mode it logged in with.
+ */
+static sf_bool STDCALL is_reusable(SF_POOL_MEMBER *member) {
+    SF_CONNECT *sf = member->sf;
+    if (!sf->token || !sf->master_token || sf->connection_failed ||
+        sf->session_changed) {
+        return SF_BOOLEAN_FALSE;
+    }
+    if (sf->error.error_code != SF_STATUS_SUCCESS &&
+        strncmp(sf->error.sqlstate, "08", 2) == 0) {
+        return SF_BOOLEAN_FALSE;
+    }
+    return (same_string(sf->database, member->database) &&
+            same_string(sf->schema, member->schema) &&
+            same_string(sf->warehouse, member->warehouse) &&
+            same_string(sf->role, member->role) &&
+            sf->autocommit == member->autocommit) ?
+           SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+}
+
+/**
+ * Checks that the server still knows an idle session, renewing its token if
+ * expired. Called without the pool lock, on a member taken by the caller.
+ */
+static sf_bool STDCALL heartbeat(SF_CONNECT *sf) {
+    cJSON *resp = NULL;
+    sf_bool success = SF_BOOLEAN_FALSE;
+
+    if (request(sf, &resp, HEARTBEAT_URL, NULL, 0, NULL, NULL,
+                POST_REQUEST_TYPE, &sf->error, SF_BOOLEAN_FALSE) &&
+        json_copy_bool(&success, resp, "success") != SF_JSON_ERROR_NONE) {
+        success = SF_BOOLEAN_FALSE;
+    }
+    if (!success) {
+        log_warn("Pooled connection failed its heartbeat: %s",
+                 sf->error.msg ? sf->error.msg : "");
+    }
+    snowflake_cJSON_Delete(resp);
+    clear_snowflake_error(&sf->error);
+    return success;
+}
+
+/**
+ * Backs off the next login after a failed one. Must be called with the pool
+ * lock held.
+ */
+static void STDCALL login_failed(SF_CONNECT_POOL *pool, SF_ERROR_STRUCT *error) {
+    unsigned long long backoff;
+
+    log_error("Unable to log in a pooled connection: %s", error->msg);
+    copy_snowflake_error(&pool->error, error);
+    pool->failures++;
+    pool->failed_connects++;
+    backoff = pool->failures < 16 ?
+              (1000ULL << (pool->failures - 1)) : SF_POOL_MAX_BACKOFF;
+    if (backoff > SF_POOL_MAX_BACKOFF) {
+        backoff = SF_POOL_MAX_BACKOFF;
+    }
+    pool->retry_at = sf_monotonic_time_ms() + backoff;
+}
+
+static SF_CONNECT *STDCALL login(SF_CONNECT_POOL *pool, SF_ERROR_STRUCT *error) {
+    SF_CONNECT *sf = snowflake_init();
+    if (!sf) {
+        SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_OUT_OF_MEMORY,
+                            "Unable to allocate a connection",
+                            SF_SQLSTATE_MEMORY_ALLOCATION_ERROR);
+        return NULL;
+    }
+    if (copy_attributes(sf, pool->config) != SF_STATUS_SUCCESS ||
+        snowflake_connect(sf) != SF_STATUS_SUCCESS) {
+        if (sf->error.error_code != SF_STATUS_SUCCESS && sf->error.msg) {
+            copy_snowflake_error(error, &sf->error);
+        } else {
+            SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_BAD_CONNECTION_PARAMS,
+                                "Unable to log in a pooled connection",
+                                SF_SQLSTATE_UNABLE_TO_CONNECT);
+        }
+        snowflake_term(sf);
+        return NULL;
+    }
+    return sf;
+}
+
+static void *pool_connector_thread(void *arg) {
+    SF_CONNECT_POOL *pool = (SF_CONNECT_POOL *) arg;
+    SF_POOL_MEMBER *member;
+    SF_CONNECT *sf;
+    SF_ERROR_STRUCT error;
+    unsigned long long now;
+    unsigned long long wait;
+
+    _critical_section_lock(&pool->lock);
+    while (1) {
+        now = sf_monotonic_time_ms();
+        wait = retire_idle_members(pool, now);
+
+        member = find_member(pool, SF_POOL_MEMBER_CLOSING);
+        if (member) {
+            // Deleting the session is a round trip, so frees the slot first
+            sf = member->sf;
+            clear_member(member);
+            _critical_section_unlock(&pool->lock);
+            snowflake_term(sf);
+            _critical_section_lock(&pool->lock);
+            _cond_broadcast(&pool->work_available);
+            continue;
+        }
+        if (pool->finished) {
+            break;
+        }
+
+        if (needs_member(pool, now)) {
+            member = find_member(pool, SF_POOL_MEMBER_FREE);
+            member->state = SF_POOL_MEMBER_CONNECTING;
+            _critical_section_unlock(&pool->lock);
+
+            memset(&error, 0, sizeof(error));
+            clear_snowflake_error(&error);
+            sf = login(pool, &error);
+
+            _critical_section_lock(&pool->lock);
+            if (!sf) {
+                clear_member(member);
+                login_failed(pool, &error);
+            } else if (!set_member_session(member, sf)) {
+                // Without its objects the session can't be checked on return
+                member->state = SF_POOL_MEMBER_CLOSING;
+                SET_SNOWFLAKE_ERROR(&error, SF_STATUS_ERROR_OUT_OF_MEMORY,
+                                    "Unable to allocate a pooled connection",
+                                    SF_SQLSTATE_MEMORY_ALLOCATION_ERROR);
+                login_failed(pool, &error);
+            } else {
+                member->last_used = sf_monotonic_time_ms();
+                member->state = pool->finished ?
+                                SF_POOL_MEMBER_CLOSING : SF_POOL_MEMBER_IDLE;
+                pool->failures = 0;
+                pool->retry_at = 0;
+            }
+            clear_snowflake_error(&error);
+            _cond_broadcast(&pool->member_available);
+            continue;
+        }
+
+        if (pool->retry_at > now && pool->retry_at - now < wait) {
+            wait = pool->retry_at - now;
+        }
+        _cond_timed_wait(&pool->work_available, &pool->lock, (unsigned int) wait);
+    }
+    _critical_section_unlock(&pool->lock);
+    return NULL;
+}
+
+/**
+ * Frees the pool once its connectors are stopped, or never started, along
+ * with its lock and conditions.
+ */
+static void STDCALL free_pool(SF_CONNECT_POOL *pool) {
+    uint64 i;
+    if (pool->members) {
+        for (i = 0; i < pool->max_size; i++) {
+            clear_member(&pool->members[i]);
+        }
+    }
+    clear_snowflake_error(&pool->error);
+    snowflake_term(pool->config);
+    SF_FREE(pool->threads);
+    SF_FREE(pool->members);
+    SF_FREE(pool);
+}
+
+SF_CONNECT_POOL *STDCALL snowflake_pool_init(SF_CONNECT *config,
+                                             uint64 min_size,
+                                             uint64 max_size,
+                                             int64 max_idle_time) {
+    SF_CONNECT_POOL *pool;
+    uint64 i;
+
+    if (!config) {
+        return NULL;
+    }
+    clear_snowflake_error(&config->error);
+    if (max_size == 0 || min_size > max_size) {
+        log_error("Invalid connection pool size: min %llu, max %llu",
+                  (unsigned long long) min_size, (unsigned long long) max_size);
+        SET_SNOWFLAKE_ERROR(&config->error, SF_STATUS_ERROR_BAD_CONNECTION_PARAMS,
+                            "Invalid connection pool size",
+                            SF_SQLSTATE_UNABLE_TO_CONNECT);
+        return NULL;
+    }
+
+    pool = (SF_CONNECT_POOL *) SF_CALLOC(1, sizeof(SF_CONNECT_POOL));
+    if (!pool) {
+        SET_SNOWFLAKE_ERROR(&config->error, SF_STATUS_ERROR_OUT_OF_MEMORY,
+                            "Unable to allocate a connection pool",
+                            SF_SQLSTATE_MEMORY_ALLOCATION_ERROR);
+        return NULL;
+    }
+    clear_snowflake_error(&pool->error);
+    pool->min_size = min_size;
+    pool->max_size = max_size;
+    pool->max_idle_time = (unsigned long long)
+        (max_idle_time > 0 ? max_idle_time : SF_POOL_DEFAULT_MAX_IDLE_TIME) * 1000;
+    pool->heartbeat_idle_time = pool->max_idle_time / 2 < SF_POOL_HEARTBEAT_IDLE_TIME ?
+                                pool->max_idle_time / 2 : SF_POOL_HEARTBEAT_IDLE_TIME;
+    pool->config = snowflake_init();
+    pool->members = (SF_POOL_MEMBER *) SF_CALLOC(max_size, sizeof(SF_POOL_MEMBER));
+    pool->threads = (SF_THREAD_HANDLE *) SF_CALLOC(SF_POOL_MAX_CONNECTORS,
+                                                   sizeof(SF_THREAD_HANDLE));
+    if (!pool->config || !pool->members || !pool->threads) {
+        SET_SNOWFLAKE_ERROR(&config->error, SF_STATUS_ERROR_OUT_OF_MEMORY,
+                            "Unable to allocate a connection pool",
+                            SF_SQLSTATE_MEMORY_ALLOCATION_ERROR);
+        free_pool(pool);
+        return NULL;
+    }
+    if (copy_attributes(pool->config, config) != SF_STATUS_SUCCESS) {
+        if (pool->config->error.error_code != SF_STATUS_SUCCESS &&
+            pool->config->error.msg) {
+            copy_snowflake_error(&config->error, &pool->config->error);
+        }
+        free_pool(pool);
+        return NULL;
+    }
+
+    if (_critical_section_init(&pool->lock) != 0) {
+        SET_SNOWFLAKE_ERROR(&config->error, SF_STATUS_ERROR_PTHREAD,
+                            "Unable to initialize a connection pool lock",
+                            SF_SQLSTATE_UNABLE_TO_CONNECT);
+        free_pool(pool);
+        return NULL;
+    }
+    if (_cond_init(&pool->work_available) != 0) {
+        _critical_section_term(&pool->lock);
+        SET_SNOWFLAKE_ERROR(&config->error, SF_STATUS_ERROR_PTHREAD,
+                            "Unable to initialize a connection pool condition",
+                            SF_SQLSTATE_UNABLE_TO_CONNECT);
+        free_pool(pool);
+        return NULL;
+    }
+    if (_cond_init(&pool->member_available) != 0) {
+        _cond_term(&pool->work_available);
+        _critical_section_term(&pool->lock);
+        SET_SNOWFLAKE_ERROR(&config->error, SF_STATUS_ERROR_PTHREAD,
+                            "Unable to initialize a connection pool condition",
+                            SF_SQLSTATE_UNABLE_TO_CONNECT);
+        free_pool(pool);
+        return NULL;
+    }
+
+    for (i = 0; i < max_size && i < SF_POOL_MAX_CONNECTORS; i++) {
+        if (_thread_init(&pool->threads[i], pool_connector_thread, pool) != 0) {
+            log_error("Unable to start a connection pool thread");
+            SET_SNOWFLAKE_ERROR(&config->error, SF_STATUS_ERROR_PTHREAD,
+                                "Unable to start a connection pool thread",
+                                SF_SQLSTATE_UNABLE_TO_CONNECT);
+            snowflake_pool_term(pool);
+            return NULL;
+        }
+        pool->thread_count++;
+    }
+    return pool;
+}
+
+SF_STATUS STDCALL snowflake_pool_term(SF_CONNECT_POOL *pool) {
+    uint64 i;
+    if (!pool) {
+        return SF_STATUS_ERROR_CONNECTION_NOT_EXIST;
+    }
+
+    // The connectors delete the idle sessions before they exit
+    _critical_section_lock(&pool->lock);
+    pool->finished = SF_BOOLEAN_TRUE;
+    _cond_broadcast(&pool->work_available);
+    _cond_broadcast(&pool->member_available);
+    _critical_section_unlock(&pool->lock);
+    for (i = 0; i < pool->thread_count; i++) {
+        _thread_join(pool->threads[i]);
+    }
+
+    for (i = 0; i < pool->max_size; i++) {
+        if (pool->members[i].state == SF_POOL_MEMBER_BORROWED) {
+            log_warn("Terminating a connection pool with borrowed connections");
+            snowflake_term(pool->members[i].sf);
+        }
+    }
+    _cond_term(&pool->member_available);
+    _cond_term(&pool->work_available);
+    _critical_section_term(&pool->lock);
+    free_pool(pool);
+    return SF_STATUS_SUCCESS;
+}
+
+SF_STATUS STDCALL snowflake_pool_borrow(SF_CONNECT_POOL *pool, SF_CONNECT **sf,
+                                        int64 timeout, SF_ERROR_STRUCT *error) {
+    SF_POOL_MEMBER *member;
+    SF_STATUS ret;
+    unsigned long long start = sf_monotonic_time_ms();
+    unsigned long long now = start;
+    uint64 failed_connects;
+    sf_bool alive;
+
+    if (error) {
+        clear_snowflake_error(error);
+    }
+    if (!pool) {
+        return SF_STATUS_ERROR_CONNECTION_NOT_EXIST;
+    }
+    if (!sf) {
+        return SF_STATUS_ERROR_NULL_POINTER;
+    }
+    *sf = NULL;
+
+    _critical_section_lock(&pool->lock);
+    failed_connects = pool->failed_connects;
+    while (1) {
+        retire_idle_members(pool, now);
+        member = find_idle_member(pool);
+        if (member) {
+            member->state = SF_POOL_MEMBER_BORROWED;
+            alive = SF_BOOLEAN_TRUE;
+            if (now - member->last_used >= pool->heartbeat_idle_time) {
+                // The server may have dropped the session meanwhile
+                _critical_section_unlock(&pool->lock);
+                alive = heartbeat(member->sf);
+                _critical_section_lock(&pool->lock);
+            }
+            if (alive) {
+                *sf = member->sf;
+                ret = SF_STATUS_SUCCESS;
+                break;
+            }
+            member->state = SF_POOL_MEMBER_CLOSING;
+            _cond_broadcast(&pool->work_available);
+            now = sf_monotonic_time_ms();
+            continue;
+        }
+        if (pool->finished) {
+            if (error) {
+                SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_CONNECTION_NOT_EXIST,
+                                    "Connection pool is terminated",
+                                    SF_SQLSTATE_CONNECTION_NOT_EXIST);
+            }
+            ret = SF_STATUS_ERROR_CONNECTION_NOT_EXIST;
+            break;
+        }
+        // Fails fast on logins failing since, or until the next retry
+        if (pool->failures > 0 &&
+            count_members(pool, SF_POOL_MEMBER_CONNECTING) == 0 &&
+            (pool->failed_connects != failed_connects || now < pool->retry_at)) {
+            // Copied under the lock, as the next failed login replaces it
+            if (error) {
+                copy_snowflake_error(error, &pool->error);
+            }
+            ret = pool->error.error_code;
+            break;
+        }
+        if (timeout >= 0 && now - start >= (unsigned long long) timeout) {
+            if (error) {
+                SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_REQUEST_TIMEOUT,
+                                    "Timed out waiting for a pooled connection",
+                                    SF_SQLSTATE_UNABLE_TO_CONNECT);
+            }
+            ret = SF_STATUS_ERROR_REQUEST_TIMEOUT;
+            break;
+        }
+
+        pool->waiters++;
+        _cond_signal(&pool->work_available);
+        if (timeout >= 0) {
+            _cond_timed_wait(&pool->member_available, &pool->lock,
+                             (unsigned int) ((unsigned long long) timeout - (now - start)));
+        } else {
+            _cond_wait(&pool->member_available, &pool->lock);
+        }
+        pool->waiters--;
+        now = sf_monotonic_time_ms();
+    }
+    _critical_section_unlock(&pool->lock);
+    return ret;
+}
+
+SF_STATUS STDCALL snowflake_pool_return(SF_CONNECT_POOL *pool, SF_CONNECT *sf) {
+    SF_POOL_MEMBER *member = NULL;
+    sf_bool reusable;
+    uint64 i;
+
+    if (!pool || !sf) {
+        return SF_STATUS_ERROR_CONNECTION_NOT_EXIST;
+    }
+
+    _critical_section_lock(&pool->lock);
+    for (i = 0; i < pool->max_size; i++) {
+        if (pool->members[i].sf == sf &&
+            pool->members[i].state == SF_POOL_MEMBER_BORROWED) {
+            member = &pool->members[i];
+            break;
+        }
+    }
+    _critical_section_unlock(&pool->lock);
+    if (!member) {
+        return SF_STATUS_ERROR_CONNECTION_NOT_EXIST;
+    }
+
+    // Still borrowed, so the session is only used here. Without autocommit a
+    // transaction may be left open, which the next borrower would inherit.
+    reusable = is_reusable(member);
+    if (reusable && !sf->autocommit &&
+        snowflake_trans_rollback(sf) != SF_STATUS_SUCCESS) {
+        log_warn("Unable to roll back a pooled connection: %s",
+                 sf->error.msg ? sf->error.msg : "");
+        reusable = SF_BOOLEAN_FALSE;
+    }
+
+    _critical_section_lock(&pool->lock);
+    if (reusable) {
+        clear_snowflake_error(&sf->error);
+        member->last_used = sf_monotonic_time_ms();
+        member->state = SF_POOL_MEMBER_IDLE;
+        _cond_signal(&pool->member_available);
+    } else {
+        log_debug("Discarding a pooled connection");
+        member->state = SF_POOL_MEMBER_CLOSING;
+        _cond_broadcast(&pool->work_available);
+    }
+    _critical_section_unlock(&pool->lock);
+    return SF_STATUS_SUCCESS;
+}
@@ -17,6 +17,7 @@ extern int32 SSL_VERSION;
 extern sf_bool DEBUG;
 extern sf_bool SF_OCSP_CHECK;
 extern char *SF_HEADER_USER_AGENT;
+extern uint64 SF_REQUEST_COMPRESSION_THRESHOLD;
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,334 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include "download_executor.h"
+#include "memory.h"
+#include <snowflake/logger.h>
+
+// Guards all the executor state below and the groups
+static SF_CRITICAL_SECTION_HANDLE executor_lock;
+static SF_CONDITION_HANDLE job_available;
+static sf_bool executor_initialized;
+static sf_bool executor_finished;
+
+static SF_THREAD_HANDLE *executor_threads = NULL;
+static uint64 executor_thread_count = 0;
+static uint64 executor_thread_capacity = 0;
+static uint64 executor_idle_threads = 0;
+
+static uint64 executor_max_threads = SF_DOWNLOAD_EXECUTOR_DEFAULT_THREADS;
+static uint64 executor_max_bytes = 0;
+static uint64 executor_running_jobs = 0;
+static uint64 executor_in_flight_bytes = 0;
+
+// Registered groups, served round robin starting at next_group
+static SF_DOWNLOAD_GROUP *executor_groups = NULL;
+static SF_DOWNLOAD_GROUP *executor_next_group = NULL;
+
+static SF_DOWNLOAD_GROUP *STDCALL group_after(SF_DOWNLOAD_GROUP *group) {
+    return group->next ? group->next : executor_groups;
+}
+
+/**
+ * Takes the next job to run off the groups, if any may start now. Must be
+ * called with the executor lock held.
+ */
+static sf_bool STDCALL pick_job(SF_DOWNLOAD_GROUP **group, SF_DOWNLOAD_JOB **job) {
+    SF_DOWNLOAD_GROUP *start;
+    SF_DOWNLOAD_GROUP *candidate;
+    SF_DOWNLOAD_JOB *head;
+
+    if (executor_running_jobs >= executor_max_threads || !executor_groups) {
+        return SF_BOOLEAN_FALSE;
+    }
+
+    start = executor_next_group ? executor_next_group : executor_groups;
+    candidate = start;
+    do {
+        head = candidate->head;
+        if (head && (candidate->running < candidate->parallel || head->urgent)) {
+            if (executor_max_bytes > 0 && executor_in_flight_bytes > 0 &&
+                executor_in_flight_bytes + head->bytes > executor_max_bytes) {
+                // Keep its turn so that it starts as soon as enough bytes finish
+                executor_next_group = candidate;
+                return SF_BOOLEAN_FALSE;
+            }
+
+            candidate->head = head->next;
+            if (!candidate->head) {
+                candidate->tail = NULL;
+            }
+            *group = candidate;
+            *job = head;
+            executor_next_group = group_after(candidate);
+            return SF_BOOLEAN_TRUE;
+        }
+        candidate = group_after(candidate);
+    } while (candidate != start);
+
+    return SF_BOOLEAN_FALSE;
+}
+
+static void *download_executor_thread(void *arg) {
+    SF_DOWNLOAD_GROUP *group;
+    SF_DOWNLOAD_JOB *job;
+
+    _critical_section_lock(&executor_lock);
+    while (1) {
+        if (!pick_job(&group, &job)) {
+            if (executor_finished) {
+                break;
+            }
+            executor_idle_threads++;
+            _cond_wait(&job_available, &executor_lock);
+            executor_idle_threads--;
+            continue;
+        }
+
+        group->running++;
+        executor_running_jobs++;
+        executor_in_flight_bytes += job->bytes;
+        _critical_section_unlock(&executor_lock);
+
+        group->func(group->arg, job->index);
+
+        _critical_section_lock(&executor_lock);
+        group->running--;
+        executor_running_jobs--;
+        executor_in_flight_bytes -= job->bytes;
+        if (group->running == 0) {
+            _cond_broadcast(&group->idle);
+        }
+        SF_FREE(job);
+        // Freed bytes and slots may let several queued jobs start
+        _cond_broadcast(&job_available);
+    }
+    _critical_section_unlock(&executor_lock);
+    return NULL;
+}
+
+int STDCALL download_executor_init() {
+    int ret;
+    if (executor_initialized) {
+        return 0;
+    }
+    if ((ret = _critical_section_init(&executor_lock)) != 0) {
+        return ret;
+    }
+    if ((ret = _cond_init(&job_available)) != 0) {
+        _critical_section_term(&executor_lock);
+        return ret;
+    }
+    executor_finished = SF_BOOLEAN_FALSE;
+    executor_initialized = SF_BOOLEAN_TRUE;
+    return 0;
+}
+
+void STDCALL download_executor_term() {
+    uint64 i;
+    if (!executor_initialized) {
+        return;
+    }
+
+    _critical_section_lock(&executor_lock);
+    executor_finished = SF_BOOLEAN_TRUE;
+    _cond_broadcast(&job_available);
+    _critical_section_unlock(&executor_lock);
+
+    for (i = 0; i < executor_thread_count; i++) {
+        _thread_join(executor_threads[i]);
+    }
+    log_debug("Download executor stopped %llu threads.", executor_thread_count);
+
+    SF_FREE(executor_threads);
+    executor_thread_count = 0;
+    executor_thread_capacity = 0;
+    executor_idle_threads = 0;
+    executor_groups = NULL;
+    executor_next_group = NULL;
+    _cond_term(&job_available);
+    _critical_section_term(&executor_lock);
+    executor_initialized = SF_BOOLEAN_FALSE;
+}
+
+void STDCALL download_executor_configure(uint64 max_threads, uint64 max_bytes) {
+    if (!executor_initialized) {
+        if (max_threads > 0) {
+            executor_max_threads = max_threads;
+        }
+        executor_max_bytes = max_bytes;
+        return;
+    }
+
+    _critical_section_lock(&executor_lock);
+    if (max_threads > 0) {
+        executor_max_threads = max_threads;
+    }
+    executor_max_bytes = max_bytes;
+    // A raised limit may let queued jobs start
+    _cond_broadcast(&job_available);
+    _critical_section_unlock(&executor_lock);
+    log_info("Download executor max threads: %llu, max in flight bytes: %llu",
+             max_threads, max_bytes);
+}
+
+uint64 STDCALL download_executor_get_in_flight_bytes() {
+    uint64 bytes;
+    if (!executor_initialized) {
+        return 0;
+    }
+    _critical_section_lock(&executor_lock);
+    bytes = executor_in_flight_bytes;
+    _critical_section_unlock(&executor_lock);
+    return bytes;
+}
+
+int STDCALL download_group_init(SF_DOWNLOAD_GROUP *group, uint64 parallel,
+                                SF_DOWNLOAD_JOB_FUNC func, void *arg) {
+    int ret;
+    if (!executor_initialized) {
+        return EINVAL;
+    }
+
+    memset(group, 0, sizeof(*group));
+    group->func = func;
+    group->arg = arg;
+    group->parallel = parallel > 0 ? parallel : 1;
+    if ((ret = _cond_init(&group->idle)) != 0) {
+        return ret;
+    }
+
+    _critical_section_lock(&executor_lock);
+    group->next = executor_groups;
+    executor_groups = group;
+    _critical_section_unlock(&executor_lock);
+    return 0;
+}
+
+static sf_bool STDCALL add_job(SF_DOWNLOAD_GROUP *group, uint64 index, uint64 bytes, sf_bool urgent) {
+    SF_DOWNLOAD_JOB *job;
+    SF_THREAD_HANDLE *threads;
+
+    job = (SF_DOWNLOAD_JOB *) SF_CALLOC(1, sizeof(SF_DOWNLOAD_JOB));
+    if (!job) {
+        return SF_BOOLEAN_FALSE;
+    }
+    job->index = index;
+    job->bytes = bytes;
+    job->urgent = urgent;
+
+    _critical_section_lock(&executor_lock);
+    if (executor_idle_threads == 0 && executor_thread_count < executor_max_threads) {
+        if (executor_thread_count == executor_thread_capacity) {
+            threads = (SF_THREAD_HANDLE *) SF_REALLOC(
+              executor_threads,
+              (executor_thread_capacity + 8) * sizeof(SF_THREAD_HANDLE));
+            if (threads) {
+                executor_threads = threads;
+                executor_thread_capacity += 8;
+            }
+        }
+        if (executor_thread_count < executor_thread_capacity &&
+            _thread_init(&executor_threads[executor_thread_count],
+                         download_executor_thread, NULL) == 0) {
+            executor_thread_count++;
+        } else if (executor_thread_count == 0) {
+            // Nothing would ever run the job
+            _critical_section_unlock(&executor_lock);
+            SF_FREE(job);
+            return SF_BOOLEAN_FALSE;
+        } else {
+            log_warn("Unable to start download thread, continuing with %llu threads.",
+                     executor_thread_count);
+        }
+    }
+
+    if (urgent) {
+        job->next = group->head;
+        group->head = job;
+        if (!group->tail) {
+            group->tail = job;
+        }
+        executor_next_group = group;
+    } else if (group->tail) {
+        group->tail->next = job;
+        group->tail = job;
+    } else {
+        group->head = job;
+        group->tail = job;
+    }
+    _cond_signal(&job_available);
+    _critical_section_unlock(&executor_lock);
+    return SF_BOOLEAN_TRUE;
+}
+
+sf_bool STDCALL download_group_add_job(SF_DOWNLOAD_GROUP *group, uint64 index, uint64 bytes) {
+    return add_job(group, index, bytes, SF_BOOLEAN_FALSE);
+}
+
+sf_bool STDCALL download_group_add_urgent_job(SF_DOWNLOAD_GROUP *group, uint64 index, uint64 bytes) {
+    return add_job(group, index, bytes, SF_BOOLEAN_TRUE);
+}
+
+sf_bool STDCALL download_group_prioritize(SF_DOWNLOAD_GROUP *group, uint64 index) {
+    SF_DOWNLOAD_JOB **link;
+    SF_DOWNLOAD_JOB *job = NULL;
+    SF_DOWNLOAD_JOB *prev = NULL;
+
+    _critical_section_lock(&executor_lock);
+    for (link = &group->head; *link; prev = *link, link = &(*link)->next) {
+        if ((*link)->index == index) {
+            job = *link;
+            break;
+        }
+    }
+    if (job) {
+        // Move it to the front of the group and serve the group next
+        if (job != group->head) {
+            *link = job->next;
+            if (group->tail == job) {
+                group->tail = prev;
+            }
+            job->next = group->head;
+            group->head = job;
+        }
+        job->urgent = SF_BOOLEAN_TRUE;
+        executor_next_group = group;
+        _cond_signal(&job_available);
+    }
+    _critical_section_unlock(&executor_lock);
+    return job ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+}
+
+void STDCALL download_group_term(SF_DOWNLOAD_GROUP *group) {
+    SF_DOWNLOAD_GROUP **link;
+    SF_DOWNLOAD_JOB *job;
+
+    _critical_section_lock(&executor_lock);
+    while (group->head) {
+        job = group->head;
+        group->head = job->next;
+        SF_FREE(job);
+    }
+    group->tail = NULL;
+
+    while (group->running > 0) {
+        _cond_wait(&group->idle, &executor_lock);
+    }
+
+    for (link = &executor_groups; *link; link = &(*link)->next) {
+        if (*link == group) {
+            *link = group->next;
+            break;
+        }
+    }
+    if (executor_next_group == group) {
+        executor_next_group = group->next;
+    }
+    _critical_section_unlock(&executor_lock);
+
+    _cond_term(&group->idle);
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#ifndef SNOWFLAKE_DOWNLOAD_EXECUTOR_H
+#define SNOWFLAKE_DOWNLOAD_EXECUTOR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <snowflake/basic_types.h>
+#include "snowflake/platform.h"
+
+// Default max number of threads downloading result chunks in the process
+#define SF_DOWNLOAD_EXECUTOR_DEFAULT_THREADS 16
+
+/**
+ * Function running a job of a download group.
+ *
+ * @param arg Argument the group was created with.
+ * @param index Index of the job given when it was added.
+ */
+typedef void (STDCALL *SF_DOWNLOAD_JOB_FUNC)(void *arg, uint64 index);
+
+typedef struct SF_DOWNLOAD_JOB {
+    uint64 index;
+    uint64 bytes;
+    // Someone is waiting for the job, run it before any other
+    sf_bool urgent;
+    struct SF_DOWNLOAD_JOB *next;
+} SF_DOWNLOAD_JOB;
+
+/**
+ * Jobs of one statement run on the process wide download executor. All
+ * fields are guarded by the executor lock.
+ */
+typedef struct SF_DOWNLOAD_GROUP {
+    SF_DOWNLOAD_JOB_FUNC func;
+    void *arg;
+
+    // Max number of jobs of the group running at the same time
+    uint64 parallel;
+    uint64 running;
+
+    // Jobs waiting to start
+    SF_DOWNLOAD_JOB *head;
+    SF_DOWNLOAD_JOB *tail;
+
+    // Signaled when no job of the group is running
+    SF_CONDITION_HANDLE idle;
+
+    // Next group served by the executor
+    struct SF_DOWNLOAD_GROUP *next;
+} SF_DOWNLOAD_GROUP;
+
+/**
+ * Initializes the process wide download executor. Threads are started
+ * when jobs are added.
+ *
+ * Groups are served round robin, one job at a time, so a statement with
+ * many chunks does not hold back other statements. A group never runs more
+ * jobs at the same time than its own parallel setting, and all groups
+ * together never run more than max threads jobs.
+ *
+ * A job is not started while that would take the bytes of running jobs
+ * above max bytes, except when nothing else is running. A job that does
+ * not fit holds back jobs of other groups until it does.
+ *
+ * @return 0 if success, otherwise an errno.
+ */
+int STDCALL download_executor_init();
+
+/**
+ * Stops the threads of the download executor. All groups must have been
+ * terminated.
+ */
+void STDCALL download_executor_term();
+
+/**
+ * Sets limits of the download executor. Takes effect for jobs started
+ * afterwards.
+ *
+ * @param max_threads Max number of jobs running at the same time, 0 to keep the current value.
+ * @param max_bytes Max number of bytes of running jobs, 0 for no limit.
+ */
+void STDCALL download_executor_configure(uint64 max_threads, uint64 max_bytes);
+
+/**
+ * @return Bytes of jobs currently running.
+ */
+uint64 STDCALL download_executor_get_in_flight_bytes();
+
+/**
+ * Registers a group of jobs with the download executor.
+ *
+ * @param group Group to initialize.
+ * @param parallel Max number of jobs of the group running at the same time.
+ * @param func Function running the jobs of the group.
+ * @param arg Argument passed to func.
+ * @return 0 if success, otherwise an errno.
+ */
+int STDCALL download_group_init(SF_DOWNLOAD_GROUP *group, uint64 parallel,
+                                SF_DOWNLOAD_JOB_FUNC func, void *arg);
+
+/**
+ * Queues a job of the group.
+ *
+ * @param group Download group.
+ * @param index Index passed to the job function.
+ * @param bytes Number of bytes the job downloads, counted against max bytes while it runs.
+ * @return Success/failure. 1 = Success; 0 = Failure
+ */
+sf_bool STDCALL download_group_add_job(SF_DOWNLOAD_GROUP *group, uint64 index, uint64 bytes);
+
+/**
+ * Queues a job of the group ahead of all the queued jobs. The executor runs
+ * it next, even when the group already runs parallel jobs.
+ *
+ * @param group Download group.
+ * @param index Index passed to the job function.
+ * @param bytes Number of bytes the job downloads, counted against max bytes while it runs.
+ * @return Success/failure. 1 = Success; 0 = Failure
+ */
+sf_bool STDCALL download_group_add_urgent_job(SF_DOWNLOAD_GROUP *group, uint64 index, uint64 bytes);
+
+/**
+ * Makes a queued job of the group urgent, see download_group_add_urgent_job.
+ *
+ * @param group Download group.
+ * @param index Index of the job.
+ * @return 1 if the job was queued, 0 if it already started or is unknown.
+ */
+sf_bool STDCALL download_group_prioritize(SF_DOWNLOAD_GROUP *group, uint64 index);
+
+/**
+ * Drops the queued jobs of the group, waits for its running jobs to finish
+ * and unregisters it from the executor.
+ *
+ * @param group Download group.
+ */
+void STDCALL download_group_term(SF_DOWNLOAD_GROUP *group);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SNOWFLAKE_DOWNLOAD_EXECUTOR_H
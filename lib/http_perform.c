@@ -18,6 +18,7 @@
 #endif
 
 #include <string.h>
+#include <zlib.h>
 #include <snowflake/basic_types.h>
 #include <snowflake/client.h>
 #include <snowflake/logger.h>
@@ -28,8 +29,12 @@
 #include "memory.h"
 #include "constants.h"
 #include "client_int.h"
+#include "ssl_context.h"
 
 #define REQUEST_GUID_KEY_SIZE 13
+// Largest slice of a request body given to zlib at a time, small enough for
+// deflateBound on platforms with a 32 bit uLong
+#define GZIP_SLICE_SIZE ((size_t) 1 << 30)
 
 static void
 dump(const char *text, FILE *stream, unsigned char *ptr, size_t size,
@@ -40,6 +45,9 @@ static int my_trace(CURL *handle, curl_infotype type, char *data, size_t size,
 
 static void my_sleep_ms(uint32 sleepMs);
 
+static int cancel_xferinfo(void *clientp, curl_off_t dltotal, curl_off_t dlnow,
+                           curl_off_t ultotal, curl_off_t ulnow);
+
 static
 void dump(const char *text,
           FILE *stream, unsigned char *ptr, size_t size,
@@ -140,17 +148,173 @@ void my_sleep_ms(uint32 sleepMs)
 #endif
 }
 
-sf_bool STDCALL http_perform(CURL *curl,
-                             SF_REQUEST_TYPE request_type,
-                             char *url,
-                             SF_HEADER *header,
-                             char *body,
-                             cJSON **json,
-                             int64 network_timeout,
-                             sf_bool chunk_downloader,
-                             SF_ERROR_STRUCT *error,
-                             sf_bool insecure_mode,
-                             int8 retry_on_curle_couldnt_connect_count) {
+int STDCALL cancel_token_init(SF_CANCEL_TOKEN *cancel_token) {
+    int ret;
+    cancel_token->is_cancelled = SF_BOOLEAN_FALSE;
+    if ((ret = _critical_section_init(&cancel_token->lock)) != 0) {
+        return ret;
+    }
+    if ((ret = _cond_init(&cancel_token->cond)) != 0) {
+        _critical_section_term(&cancel_token->lock);
+    }
+    return ret;
+}
+
+void STDCALL cancel_token_term(SF_CANCEL_TOKEN *cancel_token) {
+    _cond_term(&cancel_token->cond);
+    _critical_section_term(&cancel_token->lock);
+}
+
+void STDCALL cancel_token_cancel(SF_CANCEL_TOKEN *cancel_token) {
+    _critical_section_lock(&cancel_token->lock);
+    cancel_token->is_cancelled = SF_BOOLEAN_TRUE;
+    _cond_broadcast(&cancel_token->cond);
+    _critical_section_unlock(&cancel_token->lock);
+}
+
+sf_bool STDCALL cancel_token_is_cancelled(SF_CANCEL_TOKEN *cancel_token) {
+    sf_bool ret;
+    if (!cancel_token) {
+        return SF_BOOLEAN_FALSE;
+    }
+    _critical_section_lock(&cancel_token->lock);
+    ret = cancel_token->is_cancelled;
+    _critical_section_unlock(&cancel_token->lock);
+    return ret;
+}
+
+sf_bool STDCALL cancel_token_sleep(SF_CANCEL_TOKEN *cancel_token, uint32 sleep_ms) {
+    sf_bool ret;
+    if (!cancel_token) {
+        my_sleep_ms(sleep_ms);
+        return SF_BOOLEAN_FALSE;
+    }
+    _critical_section_lock(&cancel_token->lock);
+    // A spurious wake up ends the sleep early, same as a signal does for usleep
+    if (!cancel_token->is_cancelled) {
+        _cond_timed_wait(&cancel_token->cond, &cancel_token->lock, sleep_ms);
+    }
+    ret = cancel_token->is_cancelled;
+    _critical_section_unlock(&cancel_token->lock);
+    return ret;
+}
+
+static
+int cancel_xferinfo(void *clientp, curl_off_t dltotal, curl_off_t dlnow,
+                    curl_off_t ultotal, curl_off_t ulnow) {
+    (void) dltotal;
+    (void) dlnow;
+    (void) ultotal;
+    (void) ulnow;
+    // Non-zero aborts the transfer with CURLE_ABORTED_BY_CALLBACK
+    return cancel_token_is_cancelled((SF_CANCEL_TOKEN *) clientp) ? 1 : 0;
+}
+
+static
+size_t min_size(size_t a, size_t b) {
+    return a < b ? a : b;
+}
+
+/**
+ * Compresses a request body in the gzip format. zlib counts the input and
+ * output in uInt, so bodies are fed and bounded in slices that fit.
+ *
+ * @return Success/failure. 1 = Success; 0 = Failure
+ */
+static
+sf_bool STDCALL gzip_body(const char *body, size_t body_size, RAW_JSON_BUFFER *compressed) {
+    z_stream stream;
+    size_t in_left = body_size;
+    size_t out_left = 0;
+    size_t slice;
+    int status;
+    sf_bool ret = SF_BOOLEAN_FALSE;
+
+    memset(&stream, 0, sizeof(stream));
+    // 16 + max window bits selects the gzip wrapper
+    if (deflateInit2(&stream, Z_BEST_SPEED, Z_DEFLATED, 16 + MAX_WBITS, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        return SF_BOOLEAN_FALSE;
+    }
+    for (slice = 0; slice < body_size; slice += GZIP_SLICE_SIZE) {
+        out_left += deflateBound(&stream, (uLong) min_size(body_size - slice, GZIP_SLICE_SIZE));
+    }
+    compressed->size = out_left ? out_left : deflateBound(&stream, 0);
+    out_left = compressed->size;
+    compressed->buffer = (char *) SF_MALLOC(compressed->size);
+    if (compressed->buffer) {
+        stream.next_in = (Bytef *) body;
+        stream.next_out = (Bytef *) compressed->buffer;
+        for (;;) {
+            if (stream.avail_in == 0 && in_left > 0) {
+                stream.avail_in = (uInt) min_size(in_left, GZIP_SLICE_SIZE);
+                in_left -= stream.avail_in;
+            }
+            if (stream.avail_out == 0 && out_left > 0) {
+                stream.avail_out = (uInt) min_size(out_left, GZIP_SLICE_SIZE);
+                out_left -= stream.avail_out;
+            }
+            status = deflate(&stream, in_left == 0 ? Z_FINISH : Z_NO_FLUSH);
+            if (status == Z_STREAM_END) {
+                compressed->size = (size_t) ((char *) stream.next_out - compressed->buffer);
+                ret = SF_BOOLEAN_TRUE;
+                break;
+            }
+            // Out of room, or no progress possible
+            if ((status != Z_OK && status != Z_BUF_ERROR) ||
+                (stream.avail_out == 0 && out_left == 0)) {
+                break;
+            }
+        }
+    }
+    deflateEnd(&stream);
+
+    if (!ret) {
+        SF_FREE(compressed->buffer);
+        compressed->size = 0;
+    }
+    return ret;
+}
+
+/**
+ * Copies request headers, adding the gzip content encoding.
+ */
+static
+struct curl_slist *STDCALL gzip_headers(SF_HEADER *header) {
+    struct curl_slist *headers = NULL;
+    struct curl_slist *item;
+    struct curl_slist *appended;
+
+    for (item = header ? header->header : NULL; item; item = item->next) {
+        appended = curl_slist_append(headers, item->data);
+        if (!appended) {
+            curl_slist_free_all(headers);
+            return NULL;
+        }
+        headers = appended;
+    }
+    appended = curl_slist_append(headers, HEADER_CONTENT_ENCODING_GZIP);
+    if (!appended) {
+        curl_slist_free_all(headers);
+        return NULL;
+    }
+    return appended;
+}
+
+static
+sf_bool STDCALL _http_perform(CURL *curl,
+                              SF_REQUEST_TYPE request_type,
+                              char *url,
+                              SF_HEADER *header,
+                              char *body,
+                              cJSON **json,
+                              RAW_JSON_BUFFER *raw_body,
+                              int64 network_timeout,
+                              sf_bool chunk_downloader,
+                              SF_ERROR_STRUCT *error,
+                              sf_bool insecure_mode,
+                              int8 retry_on_curle_couldnt_connect_count,
+                              SF_CANCEL_TOKEN *cancel_token) {
     CURLcode res;
     sf_bool ret = SF_BOOLEAN_FALSE;
     sf_bool retry = SF_BOOLEAN_FALSE;
@@ -168,6 +332,9 @@ sf_bool STDCALL http_perform(CURL *curl,
     };
     time_t elapsedRetryTime = time(NULL);
     RAW_JSON_BUFFER buffer = {NULL, 0};
+    RAW_JSON_BUFFER compressed_body = {NULL, 0};
+    struct curl_slist *compressed_headers = NULL;
+    size_t body_size;
     struct data config;
     config.trace_ascii = 1;
 
@@ -175,6 +342,22 @@ sf_bool STDCALL http_perform(CURL *curl,
         return SF_BOOLEAN_FALSE;
     }
 
+    // Compress large bodies once for all the attempts. The body is sent as
+    // is if compression fails.
+    body_size = body ? strlen(body) : 0;
+    if (request_type == POST_REQUEST_TYPE && SF_REQUEST_COMPRESSION_THRESHOLD > 0 &&
+        body_size >= SF_REQUEST_COMPRESSION_THRESHOLD) {
+        if (gzip_body(body, body_size, &compressed_body)) {
+            compressed_headers = gzip_headers(header);
+            if (compressed_headers) {
+                log_debug("Compressed request body from %zu to %zu bytes",
+                          body_size, compressed_body.size);
+            } else {
+                SF_FREE(compressed_body.buffer);
+            }
+        }
+    }
+
     //TODO set error buffer
 
     // Find request GUID in the supplied URL
@@ -189,6 +372,14 @@ sf_bool STDCALL http_perform(CURL *curl,
         SF_FREE(buffer.buffer);
         buffer.size = 0;
 
+        if (cancel_token_is_cancelled(cancel_token)) {
+            log_debug("Request cancelled");
+            SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_GENERAL,
+                                "Request cancelled",
+                                SF_SQLSTATE_UNABLE_TO_CONNECT);
+            break;
+        }
+
         // Generate new request guid, if request guid exists in url
         if (request_guid_ptr && uuid4_generate_non_terminated(request_guid_ptr)) {
             log_error("Failed to generate new request GUID");
@@ -210,7 +401,13 @@ sf_bool STDCALL http_perform(CURL *curl,
             curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
         }
 
-        if (header) {
+        if (compressed_headers) {
+            res = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, compressed_headers);
+            if (res != CURLE_OK) {
+                log_error("Failed to set header [%s]", curl_easy_strerror(res));
+                break;
+            }
+        } else if (header) {
             res = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, header->header);
             if (res != CURLE_OK) {
                 log_error("Failed to set header [%s]", curl_easy_strerror(res));
@@ -226,7 +423,13 @@ sf_bool STDCALL http_perform(CURL *curl,
                 break;
             }
 
-            if (body) {
+            if (compressed_body.buffer) {
+                res = curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE,
+                                       (curl_off_t) compressed_body.size);
+                if (res == CURLE_OK) {
+                    res = curl_easy_setopt(curl, CURLOPT_POSTFIELDS, compressed_body.buffer);
+                }
+            } else if (body) {
                 res = curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
             } else {
                 res = curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "");
@@ -258,13 +461,11 @@ sf_bool STDCALL http_perform(CURL *curl,
             }
         }
 
-        if (CA_BUNDLE_FILE) {
-            res = curl_easy_setopt(curl, CURLOPT_CAINFO, CA_BUNDLE_FILE);
-            if (res != CURLE_OK) {
-                log_error("Unable to set certificate file [%s]",
-                          curl_easy_strerror(res));
-                break;
-            }
+        res = ssl_context_setopt(curl);
+        if (res != CURLE_OK) {
+            log_error("Unable to set certificate file [%s]",
+                      curl_easy_strerror(res));
+            break;
         }
 
         res = curl_easy_setopt(curl, CURLOPT_SSLVERSION, SSL_VERSION);
@@ -306,6 +507,21 @@ sf_bool STDCALL http_perform(CURL *curl,
             sb_strncpy(buffer.buffer, 2, "[", 2);
         }
 
+        if (cancel_token) {
+            res = curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, cancel_xferinfo);
+            if (res == CURLE_OK) {
+                res = curl_easy_setopt(curl, CURLOPT_XFERINFODATA, (void *) cancel_token);
+            }
+            if (res == CURLE_OK) {
+                res = curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+            }
+            if (res != CURLE_OK) {
+                log_error("Unable to set cancel callback [%s]",
+                          curl_easy_strerror(res));
+                break;
+            }
+        }
+
         // Be optimistic
         retry = SF_BOOLEAN_FALSE;
 
@@ -313,7 +529,12 @@ sf_bool STDCALL http_perform(CURL *curl,
         res = curl_easy_perform(curl);
         /* Check for errors */
         if (res != CURLE_OK) {
-          if (res == CURLE_COULDNT_CONNECT && curl_retry_ctx.retry_count <
+          if (res == CURLE_ABORTED_BY_CALLBACK && cancel_token_is_cancelled(cancel_token)) {
+              log_debug("Request cancelled during transfer");
+              SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_GENERAL,
+                                  "Request cancelled",
+                                  SF_SQLSTATE_UNABLE_TO_CONNECT);
+          } else if (res == CURLE_COULDNT_CONNECT && curl_retry_ctx.retry_count <
                                               retry_on_curle_couldnt_connect_count)
             {
               retry = SF_BOOLEAN_TRUE;
@@ -323,7 +544,8 @@ sf_bool STDCALL http_perform(CURL *curl,
                       "will retry after %d second",
                       curl_retry_ctx.retry_count,
                       next_sleep_in_secs);
-              my_sleep_ms(next_sleep_in_secs*1000);
+              // The cancellation is reported at the start of the next attempt
+              cancel_token_sleep(cancel_token, next_sleep_in_secs * 1000);
             } else {
               char msg[1024];
               if (res == CURLE_SSL_CACERT_BADFILE) {
@@ -368,7 +590,7 @@ sf_bool STDCALL http_perform(CURL *curl,
                     "will retry after %d seconds", http_code,
                     curl_retry_ctx.retry_count,
                     next_sleep_in_secs);
-                my_sleep_ms(next_sleep_in_secs * 1000);
+                cancel_token_sleep(cancel_token, next_sleep_in_secs * 1000);
               }
               else {
                 retry = SF_BOOLEAN_FALSE;
@@ -394,24 +616,67 @@ sf_bool STDCALL http_perform(CURL *curl,
             // Set null terminator
             buffer.buffer[buffer.size] = '\0';
         }
-        snowflake_cJSON_Delete(*json);
-        *json = NULL;
-        *json = snowflake_cJSON_Parse(buffer.buffer);
-        if (*json) {
-            ret = SF_BOOLEAN_TRUE;
+        if (raw_body) {
+            // The caller parses the text when it needs it
+            *raw_body = buffer;
+            buffer.buffer = NULL;
+            buffer.size = 0;
         } else {
-            SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_BAD_JSON,
-                                "Unable to parse JSON text response.",
-                                SF_SQLSTATE_UNABLE_TO_CONNECT);
-            ret = SF_BOOLEAN_FALSE;
+            snowflake_cJSON_Delete(*json);
+            *json = NULL;
+            *json = snowflake_cJSON_Parse(buffer.buffer);
+            if (*json) {
+                ret = SF_BOOLEAN_TRUE;
+            } else {
+                SET_SNOWFLAKE_ERROR(error, SF_STATUS_ERROR_BAD_JSON,
+                                    "Unable to parse JSON text response.",
+                                    SF_SQLSTATE_UNABLE_TO_CONNECT);
+                ret = SF_BOOLEAN_FALSE;
+            }
         }
     }
 
     SF_FREE(buffer.buffer);
+    SF_FREE(compressed_body.buffer);
+    curl_slist_free_all(compressed_headers);
 
     return ret;
 }
 
+sf_bool STDCALL http_perform(CURL *curl,
+                             SF_REQUEST_TYPE request_type,
+                             char *url,
+                             SF_HEADER *header,
+                             char *body,
+                             cJSON **json,
+                             int64 network_timeout,
+                             sf_bool chunk_downloader,
+                             SF_ERROR_STRUCT *error,
+                             sf_bool insecure_mode,
+                             int8 retry_on_curle_couldnt_connect_count,
+                             SF_CANCEL_TOKEN *cancel_token) {
+    return _http_perform(curl, request_type, url, header, body, json, NULL,
+                         network_timeout, chunk_downloader, error, insecure_mode,
+                         retry_on_curle_couldnt_connect_count, cancel_token);
+}
+
+sf_bool STDCALL http_perform_raw(CURL *curl,
+                                 SF_REQUEST_TYPE request_type,
+                                 char *url,
+                                 SF_HEADER *header,
+                                 char *body,
+                                 RAW_JSON_BUFFER *raw_body,
+                                 int64 network_timeout,
+                                 sf_bool chunk_downloader,
+                                 SF_ERROR_STRUCT *error,
+                                 sf_bool insecure_mode,
+                                 int8 retry_on_curle_couldnt_connect_count,
+                                 SF_CANCEL_TOKEN *cancel_token) {
+    return _http_perform(curl, request_type, url, header, body, NULL, raw_body,
+                         network_timeout, chunk_downloader, error, insecure_mode,
+                         retry_on_curle_couldnt_connect_count, cancel_token);
+}
+
 #ifdef MOCK_ENABLED
 
 sf_bool STDCALL __wrap_http_perform(CURL *curl,
@@ -423,7 +688,9 @@ sf_bool STDCALL __wrap_http_perform(CURL *curl,
                                     int64 network_timeout,
                                     sf_bool chunk_downloader,
                                     SF_ERROR_STRUCT *error,
-                                    sf_bool insecure_mode) {
+                                    sf_bool insecure_mode,
+                                    int8 retry_on_curle_couldnt_connect_count,
+                                    SF_CANCEL_TOKEN *cancel_token) {
     char *resp;
     const char *request_type_str = request_type == POST_REQUEST_TYPE ? "POST" : "GET";
 
@@ -33,11 +33,44 @@ static struct {
     void *udata;
     log_LockFn lock;
     FILE *fp;
-    int level;
     int quiet;
     const char *path;
+    /* fp was opened from path and can be rotated */
+    int fp_owned;
+    size_t file_size;
+    size_t max_file_size;
+    int max_backups;
+    int async;
 } L;
 
+/*
+ * Buffer of the asynchronous logger. Producers copy complete log lines in
+ * under the buffer mutex, the writer thread takes out everything buffered
+ * at once and writes it to the log file with a single call.
+ */
+static struct {
+    SF_CRITICAL_SECTION_HANDLE mutex;
+    SF_CONDITION_HANDLE data_available;
+    SF_CONDITION_HANDLE space_available;
+    SF_CONDITION_HANDLE flushed;
+    SF_THREAD_HANDLE writer;
+    int initialized;
+    int active;
+    /* writer thread is writing a batch out of the buffer */
+    int writing;
+    SF_LOG_OVERFLOW_POLICY policy;
+    char *buf;
+    /* batch being written by the writer thread */
+    char *batch;
+    size_t capacity;
+    size_t head;
+    size_t used;
+    unsigned long dropped;
+} R;
+
+
+int log_current_level = SF_LOG_TRACE;
+
 
 static const char *level_names[] = {
     "TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"
@@ -76,15 +109,16 @@ void log_set_lock(log_LockFn fn) {
 
 void log_set_fp(FILE *fp) {
     L.fp = fp;
+    L.fp_owned = 0;
 }
 
 int log_get_level()
 {
-    return L.level;
+    return log_current_level;
 }
 
 void log_set_level(int level) {
-    L.level = level;
+    log_current_level = level;
 }
 
 
@@ -102,10 +136,190 @@ void log_log(int level, const char *file, int line, const char *ns,
 }
 
 
+/*
+ * Open log file from log path if not yet. Called with log lock held.
+ * Delay the log file creation to when there is log needs to write
+ * to avoid empty log files.
+ */
+static void log_open_file(void) {
+    if (!(L.fp) && L.path)
+    {
+        L.fp = fopen(L.path, "w+");
+        if (!(L.fp))
+        {
+            fprintf(stderr,
+                "Error opening file from file path: %s\nError code: %s\n",
+                L.path, strerror(errno));
+            L.path = NULL;
+        }
+        L.fp_owned = 1;
+        L.file_size = 0;
+    }
+}
+
+
+/*
+ * Close the log file and shift it and its backups by one suffix. The next
+ * write creates a new file. Called with log lock held.
+ */
+static void log_rotate(void) {
+    size_t name_size = strlen(L.path) + 16;
+    char *from = (char *) malloc(name_size);
+    char *to = (char *) malloc(name_size);
+    int i;
+
+    fclose(L.fp);
+    L.fp = NULL;
+
+    if (from && to)
+    {
+        for (i = L.max_backups; i >= 1; --i)
+        {
+            if (i == 1)
+            {
+                sb_sprintf(from, name_size, "%s", L.path);
+            }
+            else
+            {
+                sb_sprintf(from, name_size, "%s.%d", L.path, i - 1);
+            }
+            sb_sprintf(to, name_size, "%s.%d", L.path, i);
+            remove(to);
+            rename(from, to);
+        }
+    }
+    free(from);
+    free(to);
+}
+
+
+/*
+ * Write complete log lines to the log file. Called with log lock held.
+ */
+static void log_write_file(const char *data, size_t len) {
+    log_open_file();
+    if (L.fp) {
+        fwrite(data, 1, len, L.fp);
+        fflush(L.fp);
+        L.file_size += len;
+        if (L.fp_owned && L.path && L.max_file_size > 0 &&
+            L.file_size >= L.max_file_size)
+        {
+            log_rotate();
+        }
+    }
+}
+
+
+/*
+ * Copy a log line into the buffer of the asynchronous logger.
+ * @return 0 if the asynchronous logger is off and the line must be written
+ *         by the caller
+ */
+static int log_enqueue(int level, const char *data, size_t len) {
+    size_t tail, first;
+
+    _critical_section_lock(&R.mutex);
+    if (!R.active)
+    {
+        _critical_section_unlock(&R.mutex);
+        return 0;
+    }
+
+    if (len > R.capacity)
+    {
+        /* keep what fits, the last byte is replaced by the line end */
+        len = R.capacity;
+    }
+
+    while (R.capacity - R.used < len)
+    {
+        if (R.policy == SF_LOG_OVERFLOW_DROP && level < SF_LOG_WARN)
+        {
+            R.dropped++;
+            _critical_section_unlock(&R.mutex);
+            return 1;
+        }
+        _cond_wait(&R.space_available, &R.mutex);
+        if (!R.active)
+        {
+            _critical_section_unlock(&R.mutex);
+            return 0;
+        }
+    }
+
+    tail = (R.head + R.used) % R.capacity;
+    first = R.capacity - tail < len ? R.capacity - tail : len;
+    memcpy(R.buf + tail, data, first);
+    memcpy(R.buf, data + first, len - first);
+    R.buf[(tail + len - 1) % R.capacity] = '\n';
+    R.used += len;
+
+    /* writer thread only sleeps on an empty buffer */
+    if (R.used == len)
+    {
+        _cond_signal(&R.data_available);
+    }
+    _critical_section_unlock(&R.mutex);
+    return 1;
+}
+
+
+static void *log_writer_thread(void *arg) {
+    char dropped_msg[64];
+    size_t len, first;
+    unsigned long dropped;
+
+    _critical_section_lock(&R.mutex);
+    while (1)
+    {
+        while (R.used == 0 && R.dropped == 0 && R.active)
+        {
+            _cond_wait(&R.data_available, &R.mutex);
+        }
+        if (R.used == 0 && R.dropped == 0)
+        {
+            break;
+        }
+
+        len = R.used;
+        first = R.capacity - R.head < len ? R.capacity - R.head : len;
+        memcpy(R.batch, R.buf + R.head, first);
+        memcpy(R.batch + first, R.buf, len - first);
+        R.head = (R.head + len) % R.capacity;
+        R.used = 0;
+        dropped = R.dropped;
+        R.dropped = 0;
+        R.writing = 1;
+        _cond_broadcast(&R.space_available);
+        _critical_section_unlock(&R.mutex);
+
+        lock();
+        if (len > 0)
+        {
+            log_write_file(R.batch, len);
+        }
+        if (dropped > 0)
+        {
+            sb_sprintf(dropped_msg, sizeof(dropped_msg),
+                       "%lu log records dropped\n", dropped);
+            log_write_file(dropped_msg, strlen(dropped_msg));
+        }
+        unlock();
+
+        _critical_section_lock(&R.mutex);
+        R.writing = 0;
+        _cond_broadcast(&R.flushed);
+    }
+    _critical_section_unlock(&R.mutex);
+    return NULL;
+}
+
+
 void
 log_log_va_list(int level, const char *file, int line, const char *ns,
                 const char *fmt, va_list args) {
-    if (level < L.level) {
+    if (!log_is_enabled(level)) {
         return;
     }
 
@@ -114,58 +328,66 @@ log_log_va_list(int level, const char *file, int line, const char *ns,
 
     char *basename = sf_filename_from_path(file);
 
-    /* Acquire lock */
-    lock();
+    /* Format the whole line once, on the stack unless it is too long */
+    char stack_line[SF_LOG_LINE_BUFFER_SIZE];
+    char *log_line = stack_line;
+    int header_len = sb_sprintf(
+        stack_line, sizeof(stack_line), SF_LOG_TIMESTAMP_FORMAT,
+        tsbuf, level_names[level], ns, basename, line);
+    if (header_len < 0) {
+        header_len = 0;
+        stack_line[0] = '\0';
+    }
+
+    // va_list can only be consumed once. Make a copy here in case the
+    // message has to be formatted again into a larger buffer.
+    va_list copy;
+    va_copy(copy, args);
+    size_t room = sizeof(stack_line) - (size_t) header_len - 1;
+    size_t msg_len = log_masked_vsnprintf(stack_line + header_len, room,
+                                          fmt, copy);
+    va_end(copy);
+    if (msg_len >= room) {
+        log_line = (char *) malloc((size_t) header_len + msg_len + 2);
+        if (log_line) {
+            memcpy(log_line, stack_line, (size_t) header_len);
+            log_masked_vsnprintf(log_line + header_len, msg_len + 1, fmt,
+                                 args);
+        } else {
+            log_line = stack_line;
+            msg_len = room - 1;
+        }
+    }
+    size_t line_len = (size_t) header_len + msg_len;
+    log_line[line_len++] = '\n';
 
     /* Log to stderr */
     if (!L.quiet) {
+        lock();
 #ifdef LOG_USE_COLOR
         fprintf(
             stderr, SF_LOG_TIMESTAMP_FORMAT_COLOR,
             tsbuf, level_colors[level], level_names[level], ns, basename,
             line);
+        fwrite(log_line + header_len, 1, line_len - header_len, stderr);
 #else
-        fprintf(
-            stderr, SF_LOG_TIMESTAMP_FORMAT,
-             buf, level_names[level], namespace, basename, line);
+        fwrite(log_line, 1, line_len, stderr);
 #endif
-        // va_list can only be consumed once. Make a copy here in case both
-        // console and file logging are turned on.
-        va_list copy;
-        va_copy(copy, args);
-        log_masked_va_list(stderr, fmt, copy);
-        va_end(copy);
-        fprintf(stderr, "\n");
         fflush(stderr);
+        unlock();
     }
 
     /* Log to file */
-    /* Delay the log file creation to when there is log needs to write
-     * to avoid empty log files.
-     */
-    if (!(L.fp) && L.path)
-    {
-        L.fp = fopen(L.path, "w+");
-        if (!(L.fp))
-        {
-            fprintf(stderr,
-                "Error opening file from file path: %s\nError code: %s\n",
-                L.path, strerror(errno));
-            L.path = NULL;
-        }
+    if ((L.fp || L.path) &&
+        !(L.async && log_enqueue(level, log_line, line_len))) {
+        lock();
+        log_write_file(log_line, line_len);
+        unlock();
     }
 
-    if (L.fp) {
-        fprintf(
-            L.fp, SF_LOG_TIMESTAMP_FORMAT,
-            tsbuf, level_names[level], ns, basename, line);
-        log_masked_va_list(L.fp, fmt, args);
-        fprintf(L.fp, "\n");
-        fflush(L.fp);
+    if (log_line != stack_line) {
+        free(log_line);
     }
-
-    /* Release lock */
-    unlock();
 }
 
 SF_LOG_LEVEL log_from_str_to_level(const char *level_in_str) {
@@ -187,6 +409,8 @@ void log_set_path(const char *path) {
 }
 
 void log_close() {
+    log_set_async(0, 0);
+
     /* Acquire lock */
     lock();
 
@@ -200,3 +424,96 @@ void log_close() {
     /* Release lock */
     unlock();
 }
+
+int log_set_async(int enable, size_t buffer_size) {
+    if (!R.initialized)
+    {
+        if (!enable)
+        {
+            return 0;
+        }
+        _critical_section_init(&R.mutex);
+        _cond_init(&R.data_available);
+        _cond_init(&R.space_available);
+        _cond_init(&R.flushed);
+        R.initialized = 1;
+    }
+
+    _critical_section_lock(&R.mutex);
+    if ((enable != 0) == (R.active != 0))
+    {
+        _critical_section_unlock(&R.mutex);
+        return 0;
+    }
+
+    if (enable)
+    {
+        R.capacity = buffer_size > 0 ? buffer_size :
+                     SF_LOG_ASYNC_DEFAULT_BUFFER_SIZE;
+        R.buf = (char *) malloc(R.capacity);
+        R.batch = (char *) malloc(R.capacity);
+        if (!R.buf || !R.batch)
+        {
+            free(R.buf);
+            free(R.batch);
+            R.buf = R.batch = NULL;
+            _critical_section_unlock(&R.mutex);
+            return -1;
+        }
+        R.head = R.used = 0;
+        R.dropped = 0;
+        R.active = 1;
+        _critical_section_unlock(&R.mutex);
+        _thread_init(&R.writer, log_writer_thread, NULL);
+        L.async = 1;
+        return 0;
+    }
+
+    /* writer thread writes out what is buffered before exiting */
+    L.async = 0;
+    R.active = 0;
+    _cond_broadcast(&R.data_available);
+    _cond_broadcast(&R.space_available);
+    _critical_section_unlock(&R.mutex);
+    _thread_join(R.writer);
+
+    _critical_section_lock(&R.mutex);
+    free(R.buf);
+    free(R.batch);
+    R.buf = R.batch = NULL;
+    R.capacity = 0;
+    _critical_section_unlock(&R.mutex);
+    return 0;
+}
+
+void log_set_overflow_policy(SF_LOG_OVERFLOW_POLICY policy) {
+    if (!R.initialized)
+    {
+        R.policy = policy;
+        return;
+    }
+    _critical_section_lock(&R.mutex);
+    R.policy = policy;
+    _cond_broadcast(&R.space_available);
+    _critical_section_unlock(&R.mutex);
+}
+
+void log_set_max_file_size(size_t max_size, int max_backups) {
+    lock();
+    L.max_file_size = max_size;
+    L.max_backups = max_backups > 0 ? max_backups : 0;
+    unlock();
+}
+
+void log_flush() {
+    if (!R.initialized)
+    {
+        return;
+    }
+    _critical_section_lock(&R.mutex);
+    while (R.active && (R.used > 0 || R.dropped > 0 || R.writing))
+    {
+        _cond_wait(&R.flushed, &R.mutex);
+    }
+    _critical_section_unlock(&R.mutex);
+}
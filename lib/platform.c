@@ -361,6 +361,26 @@ _cond_wait(SF_CONDITION_HANDLE *cond, SF_CRITICAL_SECTION_HANDLE *crit) {
 #endif
 }
 
+int STDCALL
+_cond_timed_wait(SF_CONDITION_HANDLE *cond, SF_CRITICAL_SECTION_HANDLE *crit,
+                 unsigned int timeout_ms) {
+#ifdef _WIN32
+    BOOL ret = SleepConditionVariableCS(cond, crit, timeout_ms);
+    return ret ? 0 : 1;
+#else
+    struct timeval now;
+    struct timespec deadline;
+    gettimeofday(&now, NULL);
+    deadline.tv_sec = now.tv_sec + timeout_ms / 1000;
+    deadline.tv_nsec = now.tv_usec * 1000 + (long) (timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    return pthread_cond_timedwait(cond, crit, &deadline);
+#endif
+}
+
 int STDCALL _cond_term(SF_CONDITION_HANDLE *cond) {
 #ifdef _WIN32
     // nop
@@ -710,6 +730,20 @@ void STDCALL sf_log_timestamp(char *tsbuf, size_t tsbufsize) {
 #endif
 }
 
+unsigned long long STDCALL sf_monotonic_time_ms() {
+#ifdef _WIN32
+    return (unsigned long long) GetTickCount64();
+#elif defined(__APPLE__) && !defined(CLOCK_MONOTONIC)
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (unsigned long long) now.tv_sec * 1000 + now.tv_usec / 1000;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+#endif
+}
+
 int STDCALL sf_create_directory_if_not_exists(const char * directoryName)
 {
 #ifdef _WIN32
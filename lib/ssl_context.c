@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#include <string.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <openssl/x509_vfy.h>
+#include "ssl_context.h"
+#include "constants.h"
+#include "memory.h"
+#include <snowflake/logger.h>
+#include <snowflake/platform.h>
+
+static sf_bool ssl_context_initialized;
+
+// TLS sessions and resolved names shared by all handles, so that new handles
+// resume the sessions and skip the lookups
+static CURLSH *share = NULL;
+static SF_CRITICAL_SECTION_HANDLE share_locks[CURL_LOCK_DATA_LAST];
+
+// Guards the CA store and the path it was loaded from
+static SF_CRITICAL_SECTION_HANDLE store_lock;
+static X509_STORE *ca_store = NULL;
+static char *ca_store_file = NULL;
+
+static void share_lock(CURL *curl, curl_lock_data data,
+                       curl_lock_access access, void *arg) {
+    _critical_section_lock(&share_locks[data]);
+}
+
+static void share_unlock(CURL *curl, curl_lock_data data, void *arg) {
+    _critical_section_unlock(&share_locks[data]);
+}
+
+/**
+ * Parses the bundle into a new store, set up with the verification flags
+ * curl gives the store of each SSL context it creates.
+ */
+static X509_STORE *STDCALL load_ca_store(const char *file) {
+    X509_STORE *store = X509_STORE_new();
+    if (!store) {
+        return NULL;
+    }
+    if (X509_STORE_load_locations(store, file, NULL) != 1) {
+        log_warn("Unable to load certificate file %s, leaving it to curl", file);
+        X509_STORE_free(store);
+        return NULL;
+    }
+#if defined(X509_V_FLAG_TRUSTED_FIRST) && !defined(X509_V_FLAG_NO_ALT_CHAINS)
+    X509_STORE_set_flags(store, X509_V_FLAG_TRUSTED_FIRST);
+#endif
+#ifdef X509_V_FLAG_PARTIAL_CHAIN
+    X509_STORE_set_flags(store, X509_V_FLAG_PARTIAL_CHAIN);
+#endif
+    log_debug("Loaded certificate file %s", file);
+    return store;
+}
+
+/**
+ * Makes sure the store matches the current CA_BUNDLE_FILE. Must be called
+ * with the store lock held.
+ */
+static sf_bool STDCALL refresh_ca_store() {
+    X509_STORE *store;
+    char *file;
+    if (ca_store && strcmp(ca_store_file, CA_BUNDLE_FILE) == 0) {
+        return SF_BOOLEAN_TRUE;
+    }
+
+    store = load_ca_store(CA_BUNDLE_FILE);
+    if (!store) {
+        return SF_BOOLEAN_FALSE;
+    }
+    file = (char *) SF_CALLOC(1, strlen(CA_BUNDLE_FILE) + 1);
+    if (!file) {
+        // curl loads the bundle itself
+        X509_STORE_free(store);
+        return SF_BOOLEAN_FALSE;
+    }
+    strcpy(file, CA_BUNDLE_FILE);
+    // Contexts still using the previous store hold their own reference
+    X509_STORE_free(ca_store);
+    SF_FREE(ca_store_file);
+    ca_store = store;
+    ca_store_file = file;
+    return SF_BOOLEAN_TRUE;
+}
+
+static CURLcode ssl_ctx_callback(CURL *curl, void *ssl_ctx, void *arg) {
+    CURLcode res = CURLE_OK;
+    _critical_section_lock(&store_lock);
+    if (ca_store) {
+        SSL_CTX_set1_cert_store((SSL_CTX *) ssl_ctx, ca_store);
+    } else {
+        res = CURLE_SSL_CACERT_BADFILE;
+    }
+    _critical_section_unlock(&store_lock);
+    return res;
+}
+
+int STDCALL ssl_context_init() {
+    int i;
+    if (ssl_context_initialized) {
+        return 0;
+    }
+
+    share = curl_share_init();
+    if (!share) {
+        return -1;
+    }
+    for (i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        _critical_section_init(&share_locks[i]);
+    }
+    _critical_section_init(&store_lock);
+    if (curl_share_setopt(share, CURLSHOPT_LOCKFUNC, share_lock) != CURLSHE_OK ||
+        curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, share_unlock) != CURLSHE_OK ||
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION) != CURLSHE_OK ||
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS) != CURLSHE_OK) {
+        curl_share_cleanup(share);
+        share = NULL;
+        for (i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+            _critical_section_term(&share_locks[i]);
+        }
+        _critical_section_term(&store_lock);
+        return -1;
+    }
+    ssl_context_initialized = SF_BOOLEAN_TRUE;
+    return 0;
+}
+
+void STDCALL ssl_context_term() {
+    int i;
+    if (!ssl_context_initialized) {
+        return;
+    }
+
+    // Handles still attached use the share, its locks and the store
+    if (curl_share_cleanup(share) == CURLSHE_IN_USE) {
+        log_warn("TLS sessions still shared by open connections, keeping them. "
+                 "Terminate connections and connection pools before snowflake_global_term.");
+        return;
+    }
+    share = NULL;
+    X509_STORE_free(ca_store);
+    ca_store = NULL;
+    SF_FREE(ca_store_file);
+
+    for (i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        _critical_section_term(&share_locks[i]);
+    }
+    _critical_section_term(&store_lock);
+    ssl_context_initialized = SF_BOOLEAN_FALSE;
+}
+
+CURLcode STDCALL ssl_context_setopt(CURL *curl) {
+    CURLcode res;
+    sf_bool cached;
+
+    if (!ssl_context_initialized) {
+        return CA_BUNDLE_FILE ? curl_easy_setopt(curl, CURLOPT_CAINFO, CA_BUNDLE_FILE) : CURLE_OK;
+    }
+
+    res = curl_easy_setopt(curl, CURLOPT_SHARE, share);
+    if (res != CURLE_OK || !CA_BUNDLE_FILE) {
+        return res;
+    }
+
+    _critical_section_lock(&store_lock);
+    cached = refresh_ca_store();
+    _critical_section_unlock(&store_lock);
+
+    if (!cached) {
+        return curl_easy_setopt(curl, CURLOPT_CAINFO, CA_BUNDLE_FILE);
+    }
+    // The callback installs the cached store in place of the bundle
+    res = curl_easy_setopt(curl, CURLOPT_CAINFO, NULL);
+    if (res == CURLE_OK) {
+        res = curl_easy_setopt(curl, CURLOPT_SSL_CTX_FUNCTION, ssl_ctx_callback);
+    }
+    return res;
+}
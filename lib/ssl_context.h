@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#ifndef SNOWFLAKE_SSL_CONTEXT_H
+#define SNOWFLAKE_SSL_CONTEXT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <curl/curl.h>
+#include <snowflake/basic_types.h>
+
+/**
+ * Initializes the process wide TLS state shared by all curl handles. Must be
+ * called after curl_global_init.
+ *
+ * @return 0 if successful, otherwise an error code.
+ */
+int STDCALL ssl_context_init();
+
+/**
+ * Releases the cached CA store and the shared TLS sessions. Must be called
+ * before curl_global_cleanup, once all curl handles are cleaned up. Keeps
+ * them, with a warning, if handles still use them.
+ */
+void STDCALL ssl_context_term();
+
+/**
+ * Sets up a curl handle to verify peers against the CA store parsed once
+ * from CA_BUNDLE_FILE, and to resume TLS sessions and reuse resolved names
+ * of other handles. Falls back to letting curl load CA_BUNDLE_FILE if it
+ * can't be parsed, so that the error surfaces on the request.
+ *
+ * @param curl curl handle.
+ * @return CURLE_OK if successful, otherwise the curl error.
+ */
+CURLcode STDCALL ssl_context_setopt(CURL *curl);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SNOWFLAKE_SSL_CONTEXT_H
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#include <string.h>
+#include <snowflake/client.h>
+#include <snowflake/logger.h>
+#include "utils/test_setup.h"
+
+#define MASK_ITERATIONS 100000
+#define DISABLED_LOG_ITERATIONS 10000000
+
+static int evaluated_args = 0;
+
+static int count_evaluation(int value) {
+    evaluated_args++;
+    return value;
+}
+
+static size_t mask(char *buf, size_t size, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    size_t len = log_masked_vsnprintf(buf, size, fmt, args);
+    va_end(args);
+    return len;
+}
+
+/**
+ * Masking cost of a typical log record without any secret
+ */
+void test_mask_secrets_plain_record(void **unused) {
+    struct timespec begin, end;
+    clockid_t clk_id = CLOCK_MONOTONIC;
+    char buf[SF_LOG_LINE_BUFFER_SIZE];
+
+    clock_gettime(clk_id, &begin);
+    for (int i = 0; i < MASK_ITERATIONS; i++) {
+        mask(buf, sizeof(buf),
+             "Chunk %d downloaded, row count: %d, uncompressed size: %d, "
+             "elapsed time: %d ms", i, 12000, 10485760, 35);
+    }
+    clock_gettime(clk_id, &end);
+
+    process_results(begin, end, MASK_ITERATIONS,
+                    "test_mask_secrets_plain_record");
+}
+
+/**
+ * Masking cost of a log record with a presigned url
+ */
+void test_mask_secrets_url_record(void **unused) {
+    struct timespec begin, end;
+    clockid_t clk_id = CLOCK_MONOTONIC;
+    char buf[SF_LOG_LINE_BUFFER_SIZE];
+
+    clock_gettime(clk_id, &begin);
+    for (int i = 0; i < MASK_ITERATIONS; i++) {
+        mask(buf, sizeof(buf), "Download url: %s",
+             "https://sfc-fake.s3.fakeamazon.com/012345xx-012x-012x-0123-1a2b3c4d/"
+             "fake/data_fake?x-amz-server-side-encryption-customer-algorithm=fakealgo"
+             "&AWSAccessKeyId=ABCD%efg+1234/567&Expires=123456789"
+             "&Signature=ABCD%efg+1234/567ABCD%efg+1234/567");
+    }
+    clock_gettime(clk_id, &end);
+    assert_non_null(strstr(buf, "Signature=****"));
+
+    process_results(begin, end, MASK_ITERATIONS,
+                    "test_mask_secrets_url_record");
+}
+
+/**
+ * Cost of log statements below the log level, compared with the same loop
+ * without them. Arguments of disabled statements are not evaluated.
+ */
+void test_disabled_log_statement(void **unused) {
+    struct timespec begin, end;
+    clockid_t clk_id = CLOCK_MONOTONIC;
+    volatile int sum = 0;
+    int level = log_get_level();
+    log_set_level(SF_LOG_INFO);
+
+    clock_gettime(clk_id, &begin);
+    for (int i = 0; i < DISABLED_LOG_ITERATIONS; i++) {
+        sum += i;
+    }
+    clock_gettime(clk_id, &end);
+    process_results(begin, end, DISABLED_LOG_ITERATIONS,
+                    "test_disabled_log_statement_baseline");
+
+    clock_gettime(clk_id, &begin);
+    for (int i = 0; i < DISABLED_LOG_ITERATIONS; i++) {
+        sum += i;
+        log_debug("value: %d", count_evaluation(i));
+        log_trace("value: %d", count_evaluation(i));
+    }
+    clock_gettime(clk_id, &end);
+    process_results(begin, end, DISABLED_LOG_ITERATIONS,
+                    "test_disabled_log_statement");
+
+    assert_int_equal(evaluated_args, 0);
+    log_set_level(level);
+}
+
+int main(void) {
+    initialize_test(SF_BOOLEAN_FALSE);
+    const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_mask_secrets_plain_record),
+      cmocka_unit_test(test_mask_secrets_url_record),
+      cmocka_unit_test(test_disabled_log_statement),
+    };
+    int ret = cmocka_run_group_tests(tests, NULL, NULL);
+    snowflake_global_term();
+    return ret;
+}
@@ -0,0 +1,387 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#include <string.h>
+#include "utils/test_setup.h"
+#include "utils/test_server.h"
+#include <connection.h>
+#include <chunk_downloader.h>
+#include <memory.h>
+#include <error.h>
+#include <client_int.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+
+#define MAX_CHUNKS 16
+
+/**
+ * Requests the chunk server got. The first request for the chunk at /slow
+ * gets no answer until the client gives up on it, the following ones do.
+ */
+typedef struct CHUNK_REQUESTS {
+    int slow_requests;
+    // The client closed the connection of the first request for /slow
+    int slow_cancelled;
+    // Number of requests for each chunk at /chunk<index>
+    int chunk_requests[MAX_CHUNKS];
+    // Number of requests with the test chunk header
+    int header_requests;
+} CHUNK_REQUESTS;
+
+/**
+ * Answers with a chunk holding a single row with the path of the request.
+ */
+static void serve_chunk(TEST_SERVER_CONNECTION *connection, const TEST_SERVER_REQUEST *request) {
+    TEST_SERVER *server = connection->server;
+    CHUNK_REQUESTS *requests = (CHUNK_REQUESTS *) server->user_data;
+    const char *test_header = test_server_header(request, "x-test-header");
+    char body[1100];
+    int chunk_index;
+
+    if (sscanf(request->path, "/chunk%d", &chunk_index) == 1 &&
+        chunk_index >= 0 && chunk_index < MAX_CHUNKS) {
+        _critical_section_lock(&server->lock);
+        requests->chunk_requests[chunk_index]++;
+        if (test_header && strncmp(test_header, "42", 2) == 0) {
+            requests->header_requests++;
+        }
+        _critical_section_unlock(&server->lock);
+    }
+    if (strcmp(request->path, "/slow") == 0) {
+        int slow_request;
+        _critical_section_lock(&server->lock);
+        slow_request = requests->slow_requests++;
+        _critical_section_unlock(&server->lock);
+        // Hold the first download until the client closes the connection
+        while (slow_request == 0 && !server->stop) {
+            char byte;
+            if (recv(connection->fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) == 0) {
+                _critical_section_lock(&server->lock);
+                requests->slow_cancelled++;
+                _critical_section_unlock(&server->lock);
+                break;
+            }
+            usleep(10 * 1000);
+        }
+    }
+    snprintf(body, sizeof(body), "[\"%s\"]", request->path);
+    test_server_respond(connection, "200 OK", NULL, body, strlen(body));
+}
+
+/**
+ * Tests that a chunk download slower than the previous ones is started
+ * again, that the consumer gets the chunk from the second download and that
+ * the first download is then cancelled
+ */
+void test_hedge_slow_chunk(void **unused) {
+    TEST_SERVER server;
+    CHUNK_REQUESTS requests;
+    SF_ERROR_STRUCT error;
+    SF_CHUNK_DOWNLOADER *chunk_downloader;
+    char chunks_json[1024];
+    char url[64];
+    cJSON *result;
+    cJSON *chunk;
+    uint64 i;
+    unsigned long long start_time;
+    unsigned long long slow_chunk_time = 0;
+
+    memset(&requests, 0, sizeof(requests));
+    test_server_start(&server, serve_chunk, &requests, NULL);
+    memset(&error, 0, sizeof(error));
+    clear_snowflake_error(&error);
+    snprintf(chunks_json, sizeof(chunks_json),
+             "{\"chunks\":["
+             "{\"url\":\"http://127.0.0.1:%d/chunk0\",\"rowCount\":1},"
+             "{\"url\":\"http://127.0.0.1:%d/chunk1\",\"rowCount\":1},"
+             "{\"url\":\"http://127.0.0.1:%d/chunk2\",\"rowCount\":1},"
+             "{\"url\":\"http://127.0.0.1:%d/chunk3\",\"rowCount\":1},"
+             "{\"url\":\"http://127.0.0.1:%d/slow\",\"rowCount\":1},"
+             "{\"url\":\"http://127.0.0.1:%d/chunk5\",\"rowCount\":1}]}",
+             server.port, server.port, server.port, server.port, server.port, server.port);
+    result = snowflake_cJSON_Parse(chunks_json);
+
+    chunk_downloader = chunk_downloader_init(
+      "qrmk", NULL, snowflake_cJSON_GetObjectItem(result, "chunks"),
+      2, 2, &error, SF_BOOLEAN_TRUE);
+    assert_non_null(chunk_downloader);
+
+    _critical_section_lock(&chunk_downloader->queue_lock);
+    for (i = 0; i < chunk_downloader->queue_size; i++) {
+        start_time = sf_monotonic_time_ms();
+        wait_for_chunk(chunk_downloader, i);
+        assert_false(get_error(chunk_downloader));
+        if (i == 4) {
+            slow_chunk_time = sf_monotonic_time_ms() - start_time;
+        }
+
+        // A chunk is an array of rows, each row an array of values
+        chunk = snowflake_cJSON_GetArrayItem(
+          snowflake_cJSON_GetArrayItem(chunk_downloader->queue[i].chunk, 0), 0);
+        snprintf(url, sizeof(url), "http://127.0.0.1:%d%s", server.port,
+                 snowflake_cJSON_GetStringValue(chunk));
+        assert_string_equal(url, chunk_downloader->queue[i].url);
+
+        snowflake_cJSON_Delete(chunk_downloader->queue[i].chunk);
+        chunk_downloader->queue[i].chunk = NULL;
+        chunk_downloader->consumer_head++;
+        assert_true(schedule_chunk_downloads(chunk_downloader));
+    }
+    _critical_section_unlock(&chunk_downloader->queue_lock);
+
+    // Waited for the hedging delay, not for the first download
+    assert_true(slow_chunk_time >= SF_CHUNK_HEDGE_MIN_DELAY_MS / 2);
+    assert_true(slow_chunk_time < 5 * SF_CHUNK_HEDGE_MIN_DELAY_MS);
+    assert_int_equal(requests.slow_requests, 2);
+    assert_int_equal(test_server_wait_for(&server, &requests.slow_cancelled, 1), 1);
+
+    assert_true(chunk_downloader_term(chunk_downloader));
+    assert_int_equal(error.error_code, SF_STATUS_SUCCESS);
+    snowflake_cJSON_Delete(result);
+    test_server_stop(&server);
+}
+
+/**
+ * Tests that seeking over chunks and limiting the chunks needed don't
+ * download the chunks skipped
+ */
+void test_seek_skips_chunks(void **unused) {
+    TEST_SERVER server;
+    CHUNK_REQUESTS requests;
+    SF_ERROR_STRUCT error;
+    SF_CHUNK_DOWNLOADER *chunk_downloader;
+    char chunks_json[2048];
+    int len;
+    uint64 i;
+
+    memset(&requests, 0, sizeof(requests));
+    test_server_start(&server, serve_chunk, &requests, NULL);
+    memset(&error, 0, sizeof(error));
+    clear_snowflake_error(&error);
+    len = snprintf(chunks_json, sizeof(chunks_json), "{\"chunks\":[");
+    for (i = 0; i < 10; i++) {
+        len += snprintf(chunks_json + len, sizeof(chunks_json) - len,
+                        "%s{\"url\":\"http://127.0.0.1:%d/chunk%llu\",\"rowCount\":1}",
+                        i > 0 ? "," : "", server.port, i);
+    }
+    snprintf(chunks_json + len, sizeof(chunks_json) - len, "]}");
+    cJSON *result = snowflake_cJSON_Parse(chunks_json);
+
+    chunk_downloader = chunk_downloader_init(
+      "qrmk", NULL, snowflake_cJSON_GetObjectItem(result, "chunks"),
+      2, 2, &error, SF_BOOLEAN_TRUE);
+    assert_non_null(chunk_downloader);
+
+    _critical_section_lock(&chunk_downloader->queue_lock);
+    wait_for_chunk(chunk_downloader, 0);
+    assert_false(get_error(chunk_downloader));
+
+    // Only chunks 6 and 7 are needed from now on
+    assert_true(chunk_downloader_seek(chunk_downloader, 6, 8));
+    assert_null(chunk_downloader->queue[0].chunk);
+    for (i = 6; i < 8; i++) {
+        wait_for_chunk(chunk_downloader, i);
+        assert_false(get_error(chunk_downloader));
+        assert_non_null(chunk_downloader->queue[i].chunk);
+        chunk_downloader->consumer_head++;
+        assert_true(schedule_chunk_downloads(chunk_downloader));
+    }
+    _critical_section_unlock(&chunk_downloader->queue_lock);
+
+    assert_true(chunk_downloader_term(chunk_downloader));
+    assert_int_equal(error.error_code, SF_STATUS_SUCCESS);
+
+    // Prefetched before the seek at most
+    for (i = 2; i < 6; i++) {
+        assert_int_equal(requests.chunk_requests[i], 0);
+    }
+    for (i = 6; i < 8; i++) {
+        assert_int_equal(requests.chunk_requests[i], 1);
+    }
+    for (i = 8; i < 10; i++) {
+        assert_int_equal(requests.chunk_requests[i], 0);
+    }
+    snowflake_cJSON_Delete(result);
+    test_server_stop(&server);
+}
+
+/**
+ * Tests that a chunk downloader for one chunk of a result set downloads
+ * only that chunk, with the headers of the result set
+ */
+void test_partition_downloads_one_chunk(void **unused) {
+    TEST_SERVER server;
+    CHUNK_REQUESTS requests;
+    SF_ERROR_STRUCT error;
+    SF_CHUNK_DOWNLOADER *chunk_downloader;
+    SF_CHUNK_DOWNLOADER *partition;
+    char chunks_json[1024];
+    cJSON *result;
+    cJSON *row;
+
+    memset(&requests, 0, sizeof(requests));
+    test_server_start(&server, serve_chunk, &requests, NULL);
+    memset(&error, 0, sizeof(error));
+    clear_snowflake_error(&error);
+    snprintf(chunks_json, sizeof(chunks_json),
+             "{\"chunkHeaders\":{\"x-test-header\":\"42\"},\"chunks\":["
+             "{\"url\":\"http://127.0.0.1:%d/chunk0\",\"rowCount\":1},"
+             "{\"url\":\"http://127.0.0.1:%d/chunk1\",\"rowCount\":1},"
+             "{\"url\":\"http://127.0.0.1:%d/chunk2\",\"rowCount\":1},"
+             "{\"url\":\"http://127.0.0.1:%d/chunk3\",\"rowCount\":1}]}",
+             server.port, server.port, server.port, server.port);
+    result = snowflake_cJSON_Parse(chunks_json);
+
+    chunk_downloader = chunk_downloader_init(
+      NULL, snowflake_cJSON_GetObjectItem(result, "chunkHeaders"),
+      snowflake_cJSON_GetObjectItem(result, "chunks"),
+      1, 1, &error, SF_BOOLEAN_TRUE);
+    assert_non_null(chunk_downloader);
+    assert_int_equal(chunk_downloader->header_count, 1);
+    assert_string_equal(chunk_downloader->header_lines[0], "x-test-header: 42");
+
+    // Don't let the result set download anything
+    _critical_section_lock(&chunk_downloader->queue_lock);
+    assert_true(chunk_downloader_seek(chunk_downloader, 0, 0));
+    _critical_section_unlock(&chunk_downloader->queue_lock);
+
+    partition = chunk_downloader_init_partition(chunk_downloader, 3, &error, SF_BOOLEAN_TRUE);
+    assert_non_null(partition);
+    assert_int_equal(partition->queue_size, 1);
+    assert_int_equal(partition->header_count, 1);
+
+    _critical_section_lock(&partition->queue_lock);
+    wait_for_chunk(partition, 0);
+    assert_false(get_error(partition));
+    row = snowflake_cJSON_GetArrayItem(partition->queue[0].chunk, 0);
+    assert_string_equal(snowflake_cJSON_GetStringValue(snowflake_cJSON_GetArrayItem(row, 0)), "/chunk3");
+    _critical_section_unlock(&partition->queue_lock);
+
+    assert_true(chunk_downloader_term(partition));
+    assert_true(chunk_downloader_term(chunk_downloader));
+    assert_int_equal(error.error_code, SF_STATUS_SUCCESS);
+
+    // Chunk 0 may have started before the seek
+    assert_int_equal(requests.chunk_requests[1], 0);
+    assert_int_equal(requests.chunk_requests[2], 0);
+    assert_int_equal(requests.chunk_requests[3], 1);
+    assert_true(requests.header_requests >= 1);
+    snowflake_cJSON_Delete(result);
+    test_server_stop(&server);
+}
+
+/**
+ * Tests that chunks downloaded past the memory budget are written to the
+ * spill file, and parsed back when the consumer takes them
+ */
+void test_spill_chunks_over_budget(void **unused) {
+    TEST_SERVER server;
+    CHUNK_REQUESTS requests;
+    SF_ERROR_STRUCT error;
+    SF_CHUNK_DOWNLOADER *chunk_downloader;
+    char chunks_json[2048];
+    char path[32];
+    int len;
+    uint64 i;
+    uint64 spilled = 0;
+    cJSON *result;
+    cJSON *chunk;
+
+    memset(&requests, 0, sizeof(requests));
+    test_server_start(&server, serve_chunk, &requests, NULL);
+    memset(&error, 0, sizeof(error));
+    clear_snowflake_error(&error);
+    len = snprintf(chunks_json, sizeof(chunks_json), "{\"chunks\":[");
+    for (i = 0; i < 8; i++) {
+        len += snprintf(chunks_json + len, sizeof(chunks_json) - len,
+                        "%s{\"url\":\"http://127.0.0.1:%d/chunk%llu\",\"rowCount\":1}",
+                        i > 0 ? "," : "", server.port, i);
+    }
+    snprintf(chunks_json + len, sizeof(chunks_json) - len, "]}");
+    result = snowflake_cJSON_Parse(chunks_json);
+
+    chunk_downloader = chunk_downloader_init(
+      "qrmk", NULL, snowflake_cJSON_GetObjectItem(result, "chunks"),
+      4, 4, &error, SF_BOOLEAN_TRUE);
+    assert_non_null(chunk_downloader);
+
+    _critical_section_lock(&chunk_downloader->queue_lock);
+    // Room for a single parsed chunk
+    chunk_downloader_set_memory_budget(chunk_downloader, 20 * SF_CHUNK_PARSED_SIZE_FACTOR);
+    for (i = 0; i < chunk_downloader->queue_size; i++) {
+        wait_for_chunk(chunk_downloader, i);
+        assert_false(get_error(chunk_downloader));
+        if (chunk_downloader->queue[i].spilled) {
+            spilled++;
+        }
+
+        chunk = chunk_downloader_take_chunk(chunk_downloader, i);
+        assert_non_null(chunk);
+        snprintf(path, sizeof(path), "/chunk%llu", i);
+        assert_string_equal(snowflake_cJSON_GetStringValue(
+          snowflake_cJSON_GetArrayItem(snowflake_cJSON_GetArrayItem(chunk, 0), 0)), path);
+        snowflake_cJSON_Delete(chunk);
+
+        // Wait for the prefetched chunks so that some go past the budget
+        while (chunk_downloader->producer_head > i + 1 &&
+               chunk_downloader->queue[chunk_downloader->producer_head - 1].downloads > 0) {
+            _critical_section_unlock(&chunk_downloader->queue_lock);
+            usleep(1000);
+            _critical_section_lock(&chunk_downloader->queue_lock);
+        }
+        chunk_downloader->consumer_head++;
+        assert_true(schedule_chunk_downloads(chunk_downloader));
+    }
+    assert_int_equal(chunk_downloader->memory_used, 0);
+    // All the space of the spill file is free again
+    assert_int_equal(chunk_downloader->spill_end, 0);
+    assert_null(chunk_downloader->spill_free);
+    _critical_section_unlock(&chunk_downloader->queue_lock);
+
+    assert_true(spilled > 0);
+    assert_non_null(chunk_downloader->spill_file);
+    assert_true(chunk_downloader_term(chunk_downloader));
+    assert_int_equal(error.error_code, SF_STATUS_SUCCESS);
+    snowflake_cJSON_Delete(result);
+    test_server_stop(&server);
+}
+
+#else
+
+void test_hedge_slow_chunk(void **unused) {
+    skip();
+}
+
+void test_seek_skips_chunks(void **unused) {
+    skip();
+}
+
+void test_partition_downloads_one_chunk(void **unused) {
+    skip();
+}
+
+void test_spill_chunks_over_budget(void **unused) {
+    skip();
+}
+
+#endif
+
+int main(void) {
+    initialize_test(SF_BOOLEAN_FALSE);
+#ifndef _WIN32
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_hedge_slow_chunk),
+      cmocka_unit_test(test_seek_skips_chunks),
+      cmocka_unit_test(test_partition_downloads_one_chunk),
+      cmocka_unit_test(test_spill_chunks_over_budget),
+    };
+    int ret = cmocka_run_group_tests(tests, NULL, NULL);
+    snowflake_global_term();
+    return ret;
+}
@@ -0,0 +1,429 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#include <string.h>
+#include "utils/test_setup.h"
+#include <memory.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include "utils/test_server.h"
+
+/**
+ * Counters of the local server answering logins and session deletions.
+ */
+typedef struct LOGIN_REQUESTS {
+    int login_delay_ms;
+    sf_bool fail_logins;
+    int logins;
+    int deletes;
+    int running_logins;
+    int max_running_logins;
+    int rollbacks;
+    int heartbeats;
+    sf_bool fail_heartbeats;
+    // Queries with this text fail with an http error
+    const char *failing_query;
+} LOGIN_REQUESTS;
+
+/**
+ * Statement type the server gives to a query, from its leading keywords.
+ */
+static int statement_type(const char *body) {
+    if (strstr(body, "\"alter session ") || strstr(body, "\"set ")) {
+        return 0x4100;
+    }
+    if (strstr(body, "\"create ")) {
+        return 0x6000;
+    }
+    return 0x1000;
+}
+
+static void serve_login(TEST_SERVER_CONNECTION *connection, const TEST_SERVER_REQUEST *request) {
+    TEST_SERVER *server = connection->server;
+    LOGIN_REQUESTS *requests = (LOGIN_REQUESTS *) server->user_data;
+    const char *login_ok = "{\"success\":true,\"code\":null,\"data\":{\"token\":\"TOKEN\","
+        "\"masterToken\":\"MASTER_TOKEN\",\"parameters\":[],\"sessionInfo\":"
+        "{\"databaseName\":\"DB\",\"schemaName\":\"SCHEMA\","
+        "\"warehouseName\":\"WH\",\"roleName\":\"ROLE\"}}}";
+    const char *login_failed = "{\"success\":false,\"code\":\"390100\","
+        "\"message\":\"Incorrect username or password was specified.\"}";
+    const char *deleted = "{\"success\":true,\"code\":null}";
+    const char *session_gone = "{\"success\":false,\"code\":\"390111\","
+        "\"message\":\"Session no longer exists.\"}";
+    char query_ok[256];
+    const char *body = NULL;
+
+    if (strncmp(request->path, "/session/v1/login-request", 25) == 0) {
+        _critical_section_lock(&server->lock);
+        requests->running_logins++;
+        if (requests->running_logins > requests->max_running_logins) {
+            requests->max_running_logins = requests->running_logins;
+        }
+        _critical_section_unlock(&server->lock);
+        usleep((useconds_t) requests->login_delay_ms * 1000);
+        _critical_section_lock(&server->lock);
+        requests->running_logins--;
+        requests->logins++;
+        _critical_section_unlock(&server->lock);
+        body = requests->fail_logins ? login_failed : login_ok;
+    } else if (strncmp(request->path, "/session/heartbeat", 18) == 0) {
+        _critical_section_lock(&server->lock);
+        requests->heartbeats++;
+        _critical_section_unlock(&server->lock);
+        body = requests->fail_heartbeats ? session_gone : deleted;
+    } else if (strncmp(request->path, "/session?", 9) == 0) {
+        _critical_section_lock(&server->lock);
+        requests->deletes++;
+        _critical_section_unlock(&server->lock);
+        body = deleted;
+    } else if (strncmp(request->path, "/queries/v1/query-request", 25) == 0) {
+        if (requests->failing_query && strstr(request->body, requests->failing_query)) {
+            test_server_respond(connection, "404 Not Found", NULL, NULL, 0);
+            return;
+        }
+        if (strstr(request->body, "\"rollback\"")) {
+            _critical_section_lock(&server->lock);
+            requests->rollbacks++;
+            _critical_section_unlock(&server->lock);
+        }
+        snprintf(query_ok, sizeof(query_ok),
+                 "{\"success\":true,\"code\":null,\"data\":{\"statementTypeId\":%d,"
+                 "\"rowtype\":[],\"rowset\":[],\"total\":0}}",
+                 statement_type(request->body));
+        body = query_ok;
+    }
+
+    if (body) {
+        test_server_respond(connection, "200 OK", NULL, body, strlen(body));
+    }
+}
+
+/**
+ * Waits for the server to count the expected requests.
+ */
+static void wait_for_count(TEST_SERVER *server, int *counter, int expected) {
+    assert_int_equal(test_server_wait_for(server, counter, expected), expected);
+}
+
+static SF_CONNECT_POOL *create_pool_with_autocommit(TEST_SERVER *server, uint64 min_size,
+                                                    uint64 max_size, int64 max_idle_time,
+                                                    sf_bool autocommit) {
+    SF_CONNECT *config = snowflake_init();
+    SF_CONNECT_POOL *pool;
+    char port[16];
+    sf_bool insecure_mode = SF_BOOLEAN_TRUE;
+
+    snprintf(port, sizeof(port), "%d", server->port);
+    snowflake_set_attribute(config, SF_CON_ACCOUNT, "testaccount");
+    snowflake_set_attribute(config, SF_CON_USER, "testuser");
+    snowflake_set_attribute(config, SF_CON_PASSWORD, "testpassword");
+    snowflake_set_attribute(config, SF_CON_DATABASE, "DB");
+    snowflake_set_attribute(config, SF_CON_HOST, "127.0.0.1");
+    snowflake_set_attribute(config, SF_CON_PORT, port);
+    snowflake_set_attribute(config, SF_CON_PROTOCOL, "http");
+    snowflake_set_attribute(config, SF_CON_INSECURE_MODE, &insecure_mode);
+    snowflake_set_attribute(config, SF_CON_AUTOCOMMIT, &autocommit);
+
+    pool = snowflake_pool_init(config, min_size, max_size, max_idle_time);
+    // The pool keeps its own copy of the attributes
+    snowflake_term(config);
+    assert_non_null(pool);
+    return pool;
+}
+
+static SF_CONNECT_POOL *create_pool(TEST_SERVER *server, uint64 min_size,
+                                    uint64 max_size, int64 max_idle_time) {
+    return create_pool_with_autocommit(server, min_size, max_size, max_idle_time,
+                                       SF_BOOLEAN_TRUE);
+}
+
+/**
+ * Tests that sessions are logged in ahead of time in parallel, lent again
+ * once returned and deleted when changed by the borrower
+ */
+void test_pool_borrow_return(void **unused) {
+    LOGIN_REQUESTS requests = {0};
+    TEST_SERVER server;
+    SF_CONNECT_POOL *pool;
+    SF_CONNECT *sf1;
+    SF_CONNECT *sf2;
+    SF_CONNECT *sf3;
+    SF_CONNECT *sf4;
+    SF_ERROR_STRUCT error = {0};
+    unsigned long long start;
+
+    requests.login_delay_ms = 300;
+    test_server_start(&server, serve_login, &requests, NULL);
+    pool = create_pool(&server, 2, 3, 0);
+    wait_for_count(&server, &requests.logins, 2);
+    assert_int_equal(requests.max_running_logins, 2);
+
+    // Warm sessions are lent without a round trip
+    start = sf_monotonic_time_ms();
+    assert_int_equal(snowflake_pool_borrow(pool, &sf1, 0, NULL), SF_STATUS_SUCCESS);
+    assert_int_equal(snowflake_pool_borrow(pool, &sf2, 0, NULL), SF_STATUS_SUCCESS);
+    assert_true(sf_monotonic_time_ms() - start < 100);
+    assert_non_null(sf1->token);
+    assert_ptr_not_equal(sf1, sf2);
+
+    // Past the warm sessions, callers wait for another login up to max size
+    assert_int_equal(snowflake_pool_borrow(pool, &sf3, 5000, NULL), SF_STATUS_SUCCESS);
+    assert_int_equal(requests.logins, 3);
+    assert_int_equal(snowflake_pool_borrow(pool, &sf4, 100, &error),
+                     SF_STATUS_ERROR_REQUEST_TIMEOUT);
+    assert_null(sf4);
+    assert_int_equal(error.error_code, SF_STATUS_ERROR_REQUEST_TIMEOUT);
+    snowflake_clear_error(&error);
+
+    // Returned sessions are lent again
+    assert_int_equal(snowflake_pool_return(pool, sf2), SF_STATUS_SUCCESS);
+    assert_int_equal(snowflake_pool_borrow(pool, &sf4, 0, NULL), SF_STATUS_SUCCESS);
+    assert_ptr_equal(sf4, sf2);
+    assert_int_equal(snowflake_pool_return(pool, sf4), SF_STATUS_SUCCESS);
+    assert_int_equal(snowflake_pool_return(pool, sf4),
+                     SF_STATUS_ERROR_CONNECTION_NOT_EXIST);
+
+    // Sessions switched to other objects are deleted instead
+    snowflake_set_attribute(sf3, SF_CON_DATABASE, "OTHER_DB");
+    assert_int_equal(snowflake_pool_return(pool, sf3), SF_STATUS_SUCCESS);
+    wait_for_count(&server, &requests.deletes, 1);
+    assert_int_equal(snowflake_pool_return(pool, sf1), SF_STATUS_SUCCESS);
+    assert_int_equal(requests.logins, 3);
+
+    assert_int_equal(snowflake_pool_term(pool), SF_STATUS_SUCCESS);
+    assert_int_equal(requests.deletes, 3);
+    test_server_stop(&server);
+}
+
+/**
+ * Tests that idle sessions are deleted and replaced to keep the minimum size
+ */
+void test_pool_idle_expiry(void **unused) {
+    LOGIN_REQUESTS requests = {0};
+    TEST_SERVER server;
+    SF_CONNECT_POOL *pool;
+    SF_CONNECT *sf;
+
+    test_server_start(&server, serve_login, &requests, NULL);
+    pool = create_pool(&server, 1, 2, 1);
+    wait_for_count(&server, &requests.logins, 1);
+
+    wait_for_count(&server, &requests.deletes, 1);
+    wait_for_count(&server, &requests.logins, 2);
+    assert_int_equal(snowflake_pool_borrow(pool, &sf, 5000, NULL), SF_STATUS_SUCCESS);
+    assert_int_equal(snowflake_pool_return(pool, sf), SF_STATUS_SUCCESS);
+
+    assert_int_equal(snowflake_pool_term(pool), SF_STATUS_SUCCESS);
+    assert_int_equal(requests.deletes, requests.logins);
+    test_server_stop(&server);
+}
+
+/**
+ * Tests that callers get the login error instead of waiting while logins fail
+ */
+void test_pool_login_failure(void **unused) {
+    LOGIN_REQUESTS requests = {0};
+    TEST_SERVER server;
+    SF_CONNECT_POOL *pool;
+    SF_CONNECT *sf;
+    SF_ERROR_STRUCT error1 = {0};
+    SF_ERROR_STRUCT error2 = {0};
+
+    test_server_start(&server, serve_login, &requests, NULL);
+    requests.fail_logins = SF_BOOLEAN_TRUE;
+    pool = create_pool(&server, 0, 2, 0);
+
+    assert_int_equal(snowflake_pool_borrow(pool, &sf, -1, &error1), 390100);
+    assert_null(sf);
+    assert_int_equal(error1.error_code, 390100);
+    assert_string_equal(error1.msg, "Incorrect username or password was specified.");
+
+    // Until the next retry, callers fail without another login, each with its
+    // own copy of the error
+    assert_int_equal(snowflake_pool_borrow(pool, &sf, -1, &error2), 390100);
+    assert_int_equal(requests.logins, 1);
+    assert_ptr_not_equal(error1.msg, error2.msg);
+    assert_string_equal(error2.msg, error1.msg);
+    snowflake_clear_error(&error1);
+    snowflake_clear_error(&error2);
+
+    assert_int_equal(snowflake_pool_term(pool), SF_STATUS_SUCCESS);
+    assert_int_equal(requests.deletes, 0);
+    test_server_stop(&server);
+}
+
+/**
+ * Tests that sessions without autocommit are rolled back on return, and that
+ * sessions failing on the connection in a statement are not lent again
+ */
+void test_pool_return_session_state(void **unused) {
+    LOGIN_REQUESTS requests = {0};
+    TEST_SERVER server;
+    SF_CONNECT_POOL *pool;
+    SF_CONNECT *sf;
+    SF_CONNECT *sf2;
+    SF_STMT *sfstmt;
+    sf_bool autocommit = SF_BOOLEAN_TRUE;
+
+    requests.failing_query = "select 1";
+    test_server_start(&server, serve_login, &requests, NULL);
+    pool = create_pool_with_autocommit(&server, 1, 1, 0, SF_BOOLEAN_FALSE);
+
+    assert_int_equal(snowflake_pool_borrow(pool, &sf, 5000, NULL), SF_STATUS_SUCCESS);
+    assert_int_equal(snowflake_pool_return(pool, sf), SF_STATUS_SUCCESS);
+    assert_int_equal(requests.rollbacks, 1);
+    assert_int_equal(snowflake_pool_borrow(pool, &sf2, 0, NULL), SF_STATUS_SUCCESS);
+    assert_ptr_equal(sf2, sf);
+
+    // Statements failing on the connection leave the session to be deleted
+    sfstmt = snowflake_stmt(sf);
+    assert_int_not_equal(snowflake_query(sfstmt, "select 1", 0), SF_STATUS_SUCCESS);
+    assert_memory_equal(snowflake_stmt_error(sfstmt)->sqlstate, "08", 2);
+    snowflake_stmt_term(sfstmt);
+    assert_true(sf->connection_failed);
+    assert_int_equal(snowflake_pool_return(pool, sf), SF_STATUS_SUCCESS);
+    assert_int_equal(requests.rollbacks, 1);
+    wait_for_count(&server, &requests.deletes, 1);
+    wait_for_count(&server, &requests.logins, 2);
+
+    // So are sessions switched to autocommit
+    assert_int_equal(snowflake_pool_borrow(pool, &sf, 5000, NULL), SF_STATUS_SUCCESS);
+    snowflake_set_attribute(sf, SF_CON_AUTOCOMMIT, &autocommit);
+    assert_int_equal(snowflake_pool_return(pool, sf), SF_STATUS_SUCCESS);
+    wait_for_count(&server, &requests.deletes, 2);
+
+    assert_int_equal(snowflake_pool_term(pool), SF_STATUS_SUCCESS);
+    test_server_stop(&server);
+}
+
+/**
+ * Runs a statement on a borrowed session and returns it to the pool.
+ */
+static void run_and_return(SF_CONNECT_POOL *pool, SF_CONNECT *sf, const char *sql) {
+    SF_STMT *sfstmt = snowflake_stmt(sf);
+    assert_int_equal(snowflake_query(sfstmt, sql, 0), SF_STATUS_SUCCESS);
+    snowflake_stmt_term(sfstmt);
+    assert_int_equal(snowflake_pool_return(pool, sf), SF_STATUS_SUCCESS);
+}
+
+/**
+ * Tests that sessions which changed their parameters, variables or created
+ * temporary objects are deleted on return
+ */
+void test_pool_return_session_changes(void **unused) {
+    LOGIN_REQUESTS requests = {0};
+    TEST_SERVER server;
+    SF_CONNECT_POOL *pool;
+    SF_CONNECT *sf;
+    SF_CONNECT *sf2;
+
+    test_server_start(&server, serve_login, &requests, NULL);
+    pool = create_pool(&server, 1, 1, 0);
+
+    // Queries and permanent objects leave the session reusable
+    assert_int_equal(snowflake_pool_borrow(pool, &sf, 5000, NULL), SF_STATUS_SUCCESS);
+    run_and_return(pool, sf, "select c1 from t");
+    assert_int_equal(snowflake_pool_borrow(pool, &sf2, 0, NULL), SF_STATUS_SUCCESS);
+    assert_ptr_equal(sf2, sf);
+    run_and_return(pool, sf, "create table t (c1 int)");
+    assert_int_equal(snowflake_pool_borrow(pool, &sf2, 0, NULL), SF_STATUS_SUCCESS);
+    assert_ptr_equal(sf2, sf);
+
+    run_and_return(pool, sf, "alter session set timezone = 'UTC'");
+    wait_for_count(&server, &requests.deletes, 1);
+
+    assert_int_equal(snowflake_pool_borrow(pool, &sf, 5000, NULL), SF_STATUS_SUCCESS);
+    run_and_return(pool, sf, "set v = 1");
+    wait_for_count(&server, &requests.deletes, 2);
+
+    assert_int_equal(snowflake_pool_borrow(pool, &sf, 5000, NULL), SF_STATUS_SUCCESS);
+    run_and_return(pool, sf, "create or replace temporary table t2 (c1 int)");
+    wait_for_count(&server, &requests.deletes, 3);
+    assert_int_equal(requests.logins, 4);
+
+    assert_int_equal(snowflake_pool_term(pool), SF_STATUS_SUCCESS);
+    test_server_stop(&server);
+}
+
+/**
+ * Tests that sessions idle for half of the max idle time are checked with a
+ * heartbeat before being lent, and replaced once the server dropped them
+ */
+void test_pool_heartbeat(void **unused) {
+    LOGIN_REQUESTS requests = {0};
+    TEST_SERVER server;
+    SF_CONNECT_POOL *pool;
+    SF_CONNECT *sf;
+    SF_CONNECT *sf2;
+
+    test_server_start(&server, serve_login, &requests, NULL);
+    pool = create_pool(&server, 1, 1, 2);
+
+    // Recently used sessions are lent without a round trip
+    assert_int_equal(snowflake_pool_borrow(pool, &sf, 5000, NULL), SF_STATUS_SUCCESS);
+    assert_int_equal(snowflake_pool_return(pool, sf), SF_STATUS_SUCCESS);
+    assert_int_equal(snowflake_pool_borrow(pool, &sf2, 0, NULL), SF_STATUS_SUCCESS);
+    assert_int_equal(requests.heartbeats, 0);
+    assert_int_equal(snowflake_pool_return(pool, sf2), SF_STATUS_SUCCESS);
+
+    usleep(1100 * 1000);
+    assert_int_equal(snowflake_pool_borrow(pool, &sf2, 0, NULL), SF_STATUS_SUCCESS);
+    assert_int_equal(requests.heartbeats, 1);
+    assert_ptr_equal(sf2, sf);
+    assert_int_equal(snowflake_pool_return(pool, sf2), SF_STATUS_SUCCESS);
+
+    requests.fail_heartbeats = SF_BOOLEAN_TRUE;
+    usleep(1100 * 1000);
+    assert_int_equal(snowflake_pool_borrow(pool, &sf2, 5000, NULL), SF_STATUS_SUCCESS);
+    assert_int_equal(requests.heartbeats, 2);
+    assert_int_equal(requests.logins, 2);
+    assert_int_equal(snowflake_pool_return(pool, sf2), SF_STATUS_SUCCESS);
+
+    assert_int_equal(snowflake_pool_term(pool), SF_STATUS_SUCCESS);
+    test_server_stop(&server);
+}
+
+#else
+
+void test_pool_borrow_return(void **unused) {
+    skip();
+}
+
+void test_pool_idle_expiry(void **unused) {
+    skip();
+}
+
+void test_pool_login_failure(void **unused) {
+    skip();
+}
+
+void test_pool_return_session_state(void **unused) {
+    skip();
+}
+
+void test_pool_return_session_changes(void **unused) {
+    skip();
+}
+
+void test_pool_heartbeat(void **unused) {
+    skip();
+}
+
+#endif
+
+int main(void) {
+    initialize_test(SF_BOOLEAN_FALSE);
+    const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_pool_borrow_return),
+      cmocka_unit_test(test_pool_idle_expiry),
+      cmocka_unit_test(test_pool_login_failure),
+      cmocka_unit_test(test_pool_return_session_state),
+      cmocka_unit_test(test_pool_return_session_changes),
+      cmocka_unit_test(test_pool_heartbeat),
+    };
+    int ret = cmocka_run_group_tests(tests, NULL, NULL);
+    snowflake_global_term();
+    return ret;
+}
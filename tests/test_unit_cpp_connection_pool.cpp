@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#include <string>
+#include <memory>
+#include "utils/test_setup.h"
+#include "utils/test_server.h"
+#include <snowflake/Connection.hpp>
+#include <snowflake/Exceptions.hpp>
+
+using Snowflake::Client::Connection;
+using Snowflake::Client::ConnectionPool;
+
+#ifndef _WIN32
+
+/// counters of the local server answering logins and session deletions
+struct LoginRequests
+{
+  bool failLogins;
+  int logins;
+  int deletes;
+};
+
+static void serveLogin(TEST_SERVER_CONNECTION *connection,
+                       const TEST_SERVER_REQUEST *request)
+{
+  TEST_SERVER *server = connection->server;
+  LoginRequests *requests = (LoginRequests *) server->user_data;
+  std::string body;
+
+  _critical_section_lock(&server->lock);
+  if (std::string(request->path).find("/session/v1/login-request") == 0)
+  {
+    requests->logins++;
+    body = requests->failLogins ?
+      "{\"success\":false,\"code\":\"390100\","
+      "\"message\":\"Incorrect username or password was specified.\"}" :
+      "{\"success\":true,\"code\":null,\"data\":{\"token\":\"TOKEN\","
+      "\"masterToken\":\"MASTER_TOKEN\",\"parameters\":[],\"sessionInfo\":"
+      "{\"databaseName\":\"DB\",\"schemaName\":\"SCHEMA\",\"warehouseName\":\"WH\",\"roleName\":\"ROLE\"}}}";
+  }
+  else if (std::string(request->path).find("/session?") == 0)
+  {
+    requests->deletes++;
+    body = "{\"success\":true,\"code\":null}";
+  }
+  _critical_section_unlock(&server->lock);
+
+  if (!body.empty())
+  {
+    test_server_respond(connection, "200 OK", NULL, body.c_str(), body.size());
+  }
+}
+
+static ConnectionPool *createPool(TEST_SERVER *server, uint64 maxSize)
+{
+  Connection config;
+  std::string port = std::to_string(server->port);
+  sf_bool insecureMode = SF_BOOLEAN_TRUE;
+
+  config.setAttribute(SF_CON_ACCOUNT, "testaccount");
+  config.setAttribute(SF_CON_USER, "testuser");
+  config.setAttribute(SF_CON_PASSWORD, "testpassword");
+  config.setAttribute(SF_CON_DATABASE, "DB");
+  config.setAttribute(SF_CON_HOST, "127.0.0.1");
+  config.setAttribute(SF_CON_PORT, port.c_str());
+  config.setAttribute(SF_CON_PROTOCOL, "http");
+  config.setAttribute(SF_CON_INSECURE_MODE, &insecureMode);
+  // The pool keeps its own copy of the attributes
+  return new ConnectionPool(config, 0, maxSize);
+}
+
+/**
+ * Tests that connections deleted by the borrower go back to the pool, and
+ * that borrowing past the max size times out
+ */
+void test_connection_pool_borrow(void **)
+{
+  LoginRequests requests = {};
+  TEST_SERVER server;
+  test_server_start(&server, serveLogin, &requests, NULL);
+  ConnectionPool *pool = createPool(&server, 1);
+
+  Connection *connection = pool->borrow(5000);
+  delete connection;
+  connection = pool->borrow(0);
+  assert_int_equal(requests.logins, 1);
+
+  try
+  {
+    pool->borrow(100);
+    fail();
+  }
+  catch (GeneralException &e)
+  {
+    assert_int_equal(e.code(), SF_STATUS_ERROR_REQUEST_TIMEOUT);
+  }
+
+  delete connection;
+  delete pool;
+  assert_int_equal(requests.deletes, 1);
+  test_server_stop(&server);
+}
+
+/**
+ * Tests that login errors are thrown with a copy of the error, kept once the
+ * pool is deleted
+ */
+void test_connection_pool_login_failure(void **)
+{
+  LoginRequests requests = {};
+  TEST_SERVER server;
+  std::unique_ptr<GeneralException> error;
+  requests.failLogins = true;
+  test_server_start(&server, serveLogin, &requests, NULL);
+  ConnectionPool *pool = createPool(&server, 1);
+
+  try
+  {
+    pool->borrow();
+    fail();
+  }
+  catch (GeneralException &e)
+  {
+    error.reset(new GeneralException(e));
+  }
+  delete pool;
+
+  assert_int_equal(error->code(), 390100);
+  assert_string_equal(error->msg(), "Incorrect username or password was specified.");
+  test_server_stop(&server);
+}
+
+#else
+
+void test_connection_pool_borrow(void **)
+{
+  skip();
+}
+
+void test_connection_pool_login_failure(void **)
+{
+  skip();
+}
+
+#endif
+
+static int gr_setup(void **)
+{
+  initialize_test(SF_BOOLEAN_FALSE);
+  return 0;
+}
+
+int main(void) {
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_connection_pool_borrow),
+    cmocka_unit_test(test_connection_pool_login_failure),
+  };
+  int ret = cmocka_run_group_tests(tests, gr_setup, NULL);
+  snowflake_global_term();
+  return ret;
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#include <string.h>
+#include "utils/test_setup.h"
+#include "utils/test_server.h"
+#include <connection.h>
+#include <chunk_downloader.h>
+#include <memory.h>
+#include <error.h>
+#include <client_int.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+
+// Teardown must not wait for running downloads to finish
+#define MAX_CANCEL_TIME_MS 500
+
+static long now_ms() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000L + tv.tv_usec / 1000L;
+}
+
+/**
+ * Answers either with a large body sent a byte at a time, or with a
+ * retryable error, depending on the http status of the test.
+ */
+static void serve_slowly(TEST_SERVER_CONNECTION *connection, const TEST_SERVER_REQUEST *request) {
+    int http_status = *(int *) connection->server->user_data;
+    const char *header = "HTTP/1.1 200 OK\r\nContent-Length: 104857600\r\n\r\n";
+
+    if (http_status != 200) {
+        test_server_respond(connection, "503 Service Unavailable", NULL, NULL, 0);
+        return;
+    }
+    if (!test_server_send(connection, header, strlen(header))) {
+        return;
+    }
+    // Trickle the body until the client goes away
+    while (!connection->server->stop && test_server_send(connection, " ", 1)) {
+        usleep(20 * 1000);
+    }
+}
+
+typedef struct REQUEST_CONTEXT {
+    char url[256];
+    SF_CANCEL_TOKEN cancel_token;
+    SF_ERROR_STRUCT error;
+    sf_bool ret;
+    long end_time;
+} REQUEST_CONTEXT;
+
+static void *request_thread(void *arg) {
+    REQUEST_CONTEXT *ctx = (REQUEST_CONTEXT *) arg;
+    CURL *curl = curl_easy_init();
+    cJSON *json = NULL;
+
+    ctx->ret = http_perform(curl, GET_REQUEST_TYPE, ctx->url, NULL, NULL, &json,
+                            DEFAULT_SNOWFLAKE_REQUEST_TIMEOUT, SF_BOOLEAN_TRUE,
+                            &ctx->error, SF_BOOLEAN_TRUE, 0,
+                            &ctx->cancel_token);
+    ctx->end_time = now_ms();
+
+    snowflake_cJSON_Delete(json);
+    curl_easy_cleanup(curl);
+    return NULL;
+}
+
+/**
+ * Runs a request against the server and cancels it while it is running.
+ *
+ * @return time from the cancellation to the end of the request
+ */
+static long cancel_running_request(int http_status, REQUEST_CONTEXT *ctx) {
+    TEST_SERVER server;
+    SF_THREAD_HANDLE thread;
+    long cancel_time;
+
+    test_server_start(&server, serve_slowly, &http_status, NULL);
+    memset(ctx, 0, sizeof(*ctx));
+    clear_snowflake_error(&ctx->error);
+    snprintf(ctx->url, sizeof(ctx->url), "http://127.0.0.1:%d/chunk", server.port);
+    assert_int_equal(cancel_token_init(&ctx->cancel_token), 0);
+
+    assert_int_equal(_thread_init(&thread, request_thread, ctx), 0);
+    usleep(300 * 1000);
+    cancel_time = now_ms();
+    cancel_token_cancel(&ctx->cancel_token);
+    _thread_join(thread);
+
+    cancel_token_term(&ctx->cancel_token);
+    test_server_stop(&server);
+    return ctx->end_time - cancel_time;
+}
+
+/**
+ * Tests that a transfer in progress is aborted on cancellation
+ */
+void test_cancel_transfer(void **unused) {
+    REQUEST_CONTEXT ctx;
+    long elapsed = cancel_running_request(200, &ctx);
+
+    assert_false(ctx.ret);
+    assert_int_equal(ctx.error.error_code, SF_STATUS_ERROR_GENERAL);
+    assert_true(elapsed < MAX_CANCEL_TIME_MS);
+}
+
+/**
+ * Tests that the sleep before a retry is interrupted on cancellation
+ */
+void test_cancel_retry_sleep(void **unused) {
+    REQUEST_CONTEXT ctx;
+    long elapsed = cancel_running_request(503, &ctx);
+
+    assert_false(ctx.ret);
+    assert_int_equal(ctx.error.error_code, SF_STATUS_ERROR_GENERAL);
+    assert_true(elapsed < MAX_CANCEL_TIME_MS);
+}
+
+/**
+ * Tests that terminating the chunk downloader doesn't wait for the chunks
+ * being downloaded
+ */
+void test_chunk_downloader_term(void **unused) {
+    TEST_SERVER server;
+    int http_status = 200;
+    SF_ERROR_STRUCT error;
+    SF_CHUNK_DOWNLOADER *chunk_downloader;
+    char chunks_json[512];
+    cJSON *result;
+    long start_time;
+
+    test_server_start(&server, serve_slowly, &http_status, NULL);
+    memset(&error, 0, sizeof(error));
+    clear_snowflake_error(&error);
+    snprintf(chunks_json, sizeof(chunks_json),
+             "{\"chunks\":["
+             "{\"url\":\"http://127.0.0.1:%d/chunk0\",\"rowCount\":1000},"
+             "{\"url\":\"http://127.0.0.1:%d/chunk1\",\"rowCount\":1000},"
+             "{\"url\":\"http://127.0.0.1:%d/chunk2\",\"rowCount\":1000}]}",
+             server.port, server.port, server.port);
+    result = snowflake_cJSON_Parse(chunks_json);
+
+    chunk_downloader = chunk_downloader_init(
+      "qrmk", NULL, snowflake_cJSON_GetObjectItem(result, "chunks"),
+      2, 2, &error, SF_BOOLEAN_TRUE);
+    assert_non_null(chunk_downloader);
+    usleep(300 * 1000);
+
+    start_time = now_ms();
+    assert_true(chunk_downloader_term(chunk_downloader));
+    assert_true(now_ms() - start_time < MAX_CANCEL_TIME_MS);
+    // cancelled downloads are not reported as an error
+    assert_int_equal(error.error_code, SF_STATUS_SUCCESS);
+
+    snowflake_cJSON_Delete(result);
+    test_server_stop(&server);
+}
+
+#else
+
+void test_cancel_transfer(void **unused) {
+    skip();
+}
+
+void test_cancel_retry_sleep(void **unused) {
+    skip();
+}
+
+void test_chunk_downloader_term(void **unused) {
+    skip();
+}
+
+#endif
+
+int main(void) {
+    initialize_test(SF_BOOLEAN_FALSE);
+#ifndef _WIN32
+    // The server writes to connections the client aborted
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_cancel_transfer),
+      cmocka_unit_test(test_cancel_retry_sleep),
+      cmocka_unit_test(test_chunk_downloader_term),
+    };
+    int ret = cmocka_run_group_tests(tests, NULL, NULL);
+    snowflake_global_term();
+    return ret;
+}
@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#include <string.h>
+#include "utils/test_setup.h"
+#include <download_executor.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#define sleep_ms(ms) Sleep(ms)
+#else
+#include <unistd.h>
+#define sleep_ms(ms) usleep((ms) * 1000)
+#endif
+
+#define MAX_ORDER 64
+
+/**
+ * State shared by the jobs of a test
+ */
+typedef struct JOB_STATS {
+    SF_CRITICAL_SECTION_HANDLE lock;
+    int running;
+    int max_running;
+    int done;
+    int exceeded;
+    uint64 max_bytes;
+    int sleep_ms;
+    int order[MAX_ORDER];
+    uint64 index_order[MAX_ORDER];
+    int order_size;
+} JOB_STATS;
+
+typedef struct TEST_GROUP {
+    SF_DOWNLOAD_GROUP group;
+    JOB_STATS *stats;
+    int id;
+} TEST_GROUP;
+
+static void stats_init(JOB_STATS *stats, int sleep_time, uint64 max_bytes) {
+    memset(stats, 0, sizeof(*stats));
+    _critical_section_init(&stats->lock);
+    stats->sleep_ms = sleep_time;
+    stats->max_bytes = max_bytes;
+}
+
+static void STDCALL test_job(void *arg, uint64 index) {
+    TEST_GROUP *test_group = (TEST_GROUP *) arg;
+    JOB_STATS *stats = test_group->stats;
+    uint64 in_flight_bytes = download_executor_get_in_flight_bytes();
+
+    _critical_section_lock(&stats->lock);
+    stats->running++;
+    if (stats->running > stats->max_running) {
+        stats->max_running = stats->running;
+    }
+    // Only a job larger than the limit, given its size as index, may exceed it alone
+    if (stats->max_bytes > 0 && in_flight_bytes > stats->max_bytes &&
+        in_flight_bytes != index) {
+        stats->exceeded++;
+    }
+    _critical_section_unlock(&stats->lock);
+
+    sleep_ms(stats->sleep_ms);
+
+    _critical_section_lock(&stats->lock);
+    stats->running--;
+    stats->done++;
+    if (stats->order_size < MAX_ORDER) {
+        stats->index_order[stats->order_size] = index;
+        stats->order[stats->order_size++] = test_group->id;
+    }
+    _critical_section_unlock(&stats->lock);
+}
+
+static void group_init(TEST_GROUP *test_group, JOB_STATS *stats, int id, uint64 parallel) {
+    test_group->stats = stats;
+    test_group->id = id;
+    assert_int_equal(download_group_init(&test_group->group, parallel, test_job, test_group), 0);
+}
+
+static int get_done(JOB_STATS *stats) {
+    int done;
+    _critical_section_lock(&stats->lock);
+    done = stats->done;
+    _critical_section_unlock(&stats->lock);
+    return done;
+}
+
+static void wait_done(JOB_STATS *stats, int count) {
+    while (get_done(stats) < count) {
+        sleep_ms(1);
+    }
+}
+
+/**
+ * Tests that a group never runs more jobs than its own parallel setting
+ */
+void test_download_group_parallel(void **unused) {
+    JOB_STATS stats;
+    TEST_GROUP group;
+    int i;
+
+    download_executor_configure(8, 0);
+    stats_init(&stats, 10, 0);
+    group_init(&group, &stats, 1, 3);
+    for (i = 0; i < 20; i++) {
+        assert_true(download_group_add_job(&group.group, 0, 0));
+    }
+    wait_done(&stats, 20);
+    download_group_term(&group.group);
+
+    assert_true(stats.max_running <= 3);
+    _critical_section_term(&stats.lock);
+}
+
+/**
+ * Tests that all groups together never run more jobs than max threads
+ */
+void test_download_executor_max_threads(void **unused) {
+    JOB_STATS stats;
+    TEST_GROUP group1;
+    TEST_GROUP group2;
+    int i;
+
+    download_executor_configure(4, 0);
+    stats_init(&stats, 10, 0);
+    group_init(&group1, &stats, 1, 4);
+    group_init(&group2, &stats, 2, 4);
+    for (i = 0; i < 10; i++) {
+        assert_true(download_group_add_job(&group1.group, 0, 0));
+        assert_true(download_group_add_job(&group2.group, 0, 0));
+    }
+    wait_done(&stats, 20);
+    download_group_term(&group1.group);
+    download_group_term(&group2.group);
+
+    assert_true(stats.max_running <= 4);
+    _critical_section_term(&stats.lock);
+}
+
+/**
+ * Tests that the jobs of a statement don't wait for those of a statement
+ * queued before it
+ */
+void test_download_executor_fair_share(void **unused) {
+    JOB_STATS stats;
+    TEST_GROUP busy;
+    TEST_GROUP small;
+    int i;
+    int small_done = 0;
+
+    download_executor_configure(2, 0);
+    stats_init(&stats, 5, 0);
+    group_init(&busy, &stats, 1, 2);
+    group_init(&small, &stats, 2, 2);
+    for (i = 0; i < 20; i++) {
+        assert_true(download_group_add_job(&busy.group, 0, 0));
+    }
+    for (i = 0; i < 2; i++) {
+        assert_true(download_group_add_job(&small.group, 0, 0));
+    }
+    wait_done(&stats, 22);
+    download_group_term(&busy.group);
+    download_group_term(&small.group);
+
+    // Both jobs of the second group finish among the first ones
+    for (i = 0; i < 8; i++) {
+        if (stats.order[i] == 2) {
+            small_done++;
+        }
+    }
+    assert_int_equal(small_done, 2);
+    _critical_section_term(&stats.lock);
+}
+
+/**
+ * Tests that running jobs never exceed max bytes, except a job larger than
+ * the limit running alone
+ */
+void test_download_executor_in_flight_bytes(void **unused) {
+    JOB_STATS stats;
+    TEST_GROUP group1;
+    TEST_GROUP group2;
+    int i;
+
+    download_executor_configure(8, 100);
+    stats_init(&stats, 5, 100);
+    group_init(&group1, &stats, 1, 8);
+    group_init(&group2, &stats, 2, 8);
+    for (i = 0; i < 10; i++) {
+        assert_true(download_group_add_job(&group1.group, 40, 40));
+        assert_true(download_group_add_job(&group2.group, 30, 30));
+    }
+    assert_true(download_group_add_job(&group2.group, 1000, 1000));
+    wait_done(&stats, 21);
+    download_group_term(&group1.group);
+    download_group_term(&group2.group);
+
+    assert_int_equal(stats.exceeded, 0);
+    assert_int_equal(download_executor_get_in_flight_bytes(), 0);
+    download_executor_configure(SF_DOWNLOAD_EXECUTOR_DEFAULT_THREADS, 0);
+    _critical_section_term(&stats.lock);
+}
+
+/**
+ * Tests that terminating a group drops its queued jobs
+ */
+void test_download_group_term_drops_jobs(void **unused) {
+    JOB_STATS stats;
+    TEST_GROUP group;
+    int i;
+
+    download_executor_configure(1, 0);
+    stats_init(&stats, 20, 0);
+    group_init(&group, &stats, 1, 1);
+    for (i = 0; i < 10; i++) {
+        assert_true(download_group_add_job(&group.group, 0, 0));
+    }
+    wait_done(&stats, 1);
+    download_group_term(&group.group);
+
+    assert_true(stats.done < 10);
+    assert_int_equal(stats.running, 0);
+    download_executor_configure(SF_DOWNLOAD_EXECUTOR_DEFAULT_THREADS, 0);
+    _critical_section_term(&stats.lock);
+}
+
+/**
+ * Tests that a prioritized job runs before the jobs queued ahead of it,
+ * even when its group already runs parallel jobs
+ */
+void test_download_group_prioritize(void **unused) {
+    JOB_STATS stats;
+    TEST_GROUP group;
+    uint64 i;
+
+    download_executor_configure(2, 0);
+    stats_init(&stats, 20, 0);
+    group_init(&group, &stats, 1, 1);
+    for (i = 0; i < 6; i++) {
+        assert_true(download_group_add_job(&group.group, i, 0));
+    }
+    sleep_ms(5);
+    assert_true(download_group_prioritize(&group.group, 5));
+    // Already running
+    assert_false(download_group_prioritize(&group.group, 0));
+    wait_done(&stats, 6);
+    download_group_term(&group.group);
+
+    // Job 5 ran next to job 0 instead of waiting for the group
+    assert_true(stats.max_running == 2);
+    assert_true(stats.index_order[0] == 5 || stats.index_order[1] == 5);
+    download_executor_configure(SF_DOWNLOAD_EXECUTOR_DEFAULT_THREADS, 0);
+    _critical_section_term(&stats.lock);
+}
+
+int main(void) {
+    initialize_test(SF_BOOLEAN_FALSE);
+    const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_download_group_parallel),
+      cmocka_unit_test(test_download_executor_max_threads),
+      cmocka_unit_test(test_download_executor_fair_share),
+      cmocka_unit_test(test_download_executor_in_flight_bytes),
+      cmocka_unit_test(test_download_group_term_drops_jobs),
+      cmocka_unit_test(test_download_group_prioritize),
+    };
+    int ret = cmocka_run_group_tests(tests, NULL, NULL);
+    snowflake_global_term();
+    return ret;
+}
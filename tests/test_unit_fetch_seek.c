@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#include <string.h>
+#include "utils/test_setup.h"
+#include <memory.h>
+
+#ifndef _WIN32
+#include "utils/test_server.h"
+
+/**
+ * Rows 0 to 2 come with the query response, rows 3 to 5 in /chunk0 and
+ * rows 6 to 8 in /chunk1. The value of each row is its index.
+ */
+#define FIRST_ROWSET_SIZE 3
+#define CHUNK_SIZE 3
+#define TOTAL_ROWS 9
+
+static void serve_result(TEST_SERVER_CONNECTION *connection, const TEST_SERVER_REQUEST *request) {
+    TEST_SERVER *server = connection->server;
+    const char *login_ok = "{\"success\":true,\"code\":null,\"data\":{\"token\":\"TOKEN\","
+        "\"masterToken\":\"MASTER_TOKEN\",\"parameters\":[],\"sessionInfo\":"
+        "{\"databaseName\":\"DB\",\"schemaName\":\"SCHEMA\","
+        "\"warehouseName\":\"WH\",\"roleName\":\"ROLE\"}}}";
+    const char *deleted = "{\"success\":true,\"code\":null}";
+    char body[1024];
+    int chunk_index;
+    int row;
+    int len;
+
+    body[0] = '\0';
+    if (strncmp(request->path, "/session/v1/login-request", 25) == 0) {
+        snprintf(body, sizeof(body), "%s", login_ok);
+    } else if (strncmp(request->path, "/session?", 9) == 0) {
+        snprintf(body, sizeof(body), "%s", deleted);
+    } else if (strncmp(request->path, "/queries/v1/query-request", 25) == 0) {
+        snprintf(body, sizeof(body),
+                 "{\"success\":true,\"code\":null,\"data\":{\"queryId\":\"QUERY_ID\","
+                 "\"rowtype\":[{\"name\":\"C1\",\"type\":\"fixed\",\"precision\":38,"
+                 "\"scale\":0,\"nullable\":false}],"
+                 "\"rowset\":[[\"0\"],[\"1\"],[\"2\"]],\"total\":%d,\"qrmk\":\"qrmk\","
+                 "\"chunks\":[{\"url\":\"http://127.0.0.1:%d/chunk0\",\"rowCount\":%d},"
+                 "{\"url\":\"http://127.0.0.1:%d/chunk1\",\"rowCount\":%d}]}}",
+                 TOTAL_ROWS, server->port, CHUNK_SIZE, server->port, CHUNK_SIZE);
+    } else if (sscanf(request->path, "/chunk%d", &chunk_index) == 1) {
+        // Rows of a chunk are sent without the enclosing array
+        len = 0;
+        for (row = 0; row < CHUNK_SIZE; row++) {
+            len += snprintf(body + len, sizeof(body) - len, "%s[\"%d\"]", row > 0 ? "," : "",
+                            FIRST_ROWSET_SIZE + chunk_index * CHUNK_SIZE + row);
+        }
+    }
+
+    if (body[0]) {
+        test_server_respond(connection, "200 OK", NULL, body, strlen(body));
+    } else {
+        test_server_respond(connection, "404 Not Found", NULL, NULL, 0);
+    }
+}
+
+static SF_CONNECT *connect_to(TEST_SERVER *server) {
+    SF_CONNECT *sf = snowflake_init();
+    char port[16];
+    sf_bool insecure_mode = SF_BOOLEAN_TRUE;
+
+    snprintf(port, sizeof(port), "%d", server->port);
+    snowflake_set_attribute(sf, SF_CON_ACCOUNT, "testaccount");
+    snowflake_set_attribute(sf, SF_CON_USER, "testuser");
+    snowflake_set_attribute(sf, SF_CON_PASSWORD, "testpassword");
+    snowflake_set_attribute(sf, SF_CON_HOST, "127.0.0.1");
+    snowflake_set_attribute(sf, SF_CON_PORT, port);
+    snowflake_set_attribute(sf, SF_CON_PROTOCOL, "http");
+    snowflake_set_attribute(sf, SF_CON_INSECURE_MODE, &insecure_mode);
+    assert_int_equal(snowflake_connect(sf), SF_STATUS_SUCCESS);
+    return sf;
+}
+
+/**
+ * Fetches the next row and checks its value.
+ */
+static void assert_next_row(SF_STMT *sfstmt, int64 expected) {
+    int64 value = -1;
+    assert_int_equal(snowflake_fetch(sfstmt), SF_STATUS_SUCCESS);
+    assert_int_equal(snowflake_column_as_int64(sfstmt, 1, &value), SF_STATUS_SUCCESS);
+    assert_int_equal(value, expected);
+}
+
+/**
+ * Runs a test against a statement with the result set of the local server.
+ */
+static void run_with_result(void (*test)(SF_STMT *sfstmt)) {
+    TEST_SERVER server;
+    SF_CONNECT *sf;
+    SF_STMT *sfstmt;
+
+    test_server_start(&server, serve_result, NULL, NULL);
+    sf = connect_to(&server);
+    sfstmt = snowflake_stmt(sf);
+    assert_int_equal(snowflake_query(sfstmt, "select c1 from t", 0), SF_STATUS_SUCCESS);
+    assert_int_equal(snowflake_num_rows(sfstmt), TOTAL_ROWS);
+
+    test(sfstmt);
+
+    snowflake_stmt_term(sfstmt);
+    snowflake_term(sf);
+    test_server_stop(&server);
+}
+
+static void seek_in_first_rowset(SF_STMT *sfstmt) {
+    assert_next_row(sfstmt, 0);
+    assert_int_equal(snowflake_fetch_seek(sfstmt, 2), SF_STATUS_SUCCESS);
+    assert_next_row(sfstmt, 2);
+    // Continues with the first chunk
+    assert_next_row(sfstmt, 3);
+}
+
+static void seek_across_chunks(SF_STMT *sfstmt) {
+    assert_int_equal(snowflake_fetch_seek(sfstmt, 7), SF_STATUS_SUCCESS);
+    assert_next_row(sfstmt, 7);
+    assert_next_row(sfstmt, 8);
+    assert_int_equal(snowflake_fetch(sfstmt), SF_STATUS_EOF);
+
+    // Back to a chunk already dropped
+    assert_int_equal(snowflake_fetch_seek(sfstmt, 4), SF_STATUS_SUCCESS);
+    assert_next_row(sfstmt, 4);
+}
+
+static void fetch_window(SF_STMT *sfstmt) {
+    // Ends in the middle of the second chunk
+    assert_int_equal(snowflake_fetch_window(sfstmt, 4, 3), SF_STATUS_SUCCESS);
+    assert_next_row(sfstmt, 4);
+    assert_next_row(sfstmt, 5);
+    assert_next_row(sfstmt, 6);
+    assert_int_equal(snowflake_fetch(sfstmt), SF_STATUS_EOF);
+    assert_int_equal(snowflake_fetch(sfstmt), SF_STATUS_EOF);
+
+    // No limit
+    assert_int_equal(snowflake_fetch_window(sfstmt, 8, -1), SF_STATUS_SUCCESS);
+    assert_next_row(sfstmt, 8);
+    assert_int_equal(snowflake_fetch(sfstmt), SF_STATUS_EOF);
+}
+
+static void seek_out_of_range(SF_STMT *sfstmt) {
+    assert_int_equal(snowflake_fetch_seek(sfstmt, TOTAL_ROWS + 1), SF_STATUS_ERROR_OUT_OF_RANGE);
+    assert_string_equal(snowflake_stmt_error(sfstmt)->sqlstate, SF_SQLSTATE_INVALID_CURSOR_POSITION);
+    assert_int_equal(snowflake_fetch_seek(sfstmt, -1), SF_STATUS_ERROR_OUT_OF_RANGE);
+
+    // Rows of the first rowset are released once fetched
+    assert_next_row(sfstmt, 0);
+    assert_next_row(sfstmt, 1);
+    assert_int_equal(snowflake_fetch_seek(sfstmt, 0), SF_STATUS_ERROR_OUT_OF_RANGE);
+    assert_string_equal(snowflake_stmt_error(sfstmt)->sqlstate, SF_SQLSTATE_INVALID_CURSOR_POSITION);
+
+    // The statement is still usable
+    assert_next_row(sfstmt, 2);
+}
+
+/**
+ * Tests seeking to a row of the rowset that came with the query response
+ */
+void test_fetch_seek_first_rowset(void **unused) {
+    run_with_result(seek_in_first_rowset);
+}
+
+/**
+ * Tests seeking over a chunk, to the last rows and back
+ */
+void test_fetch_seek_across_chunks(void **unused) {
+    run_with_result(seek_across_chunks);
+}
+
+/**
+ * Tests that fetching past the end of the window returns SF_STATUS_EOF
+ */
+void test_fetch_window(void **unused) {
+    run_with_result(fetch_window);
+}
+
+/**
+ * Tests that seeking out of the result set fails with HY108
+ */
+void test_fetch_seek_out_of_range(void **unused) {
+    run_with_result(seek_out_of_range);
+}
+
+#else
+
+void test_fetch_seek_first_rowset(void **unused) {
+    skip();
+}
+
+void test_fetch_seek_across_chunks(void **unused) {
+    skip();
+}
+
+void test_fetch_window(void **unused) {
+    skip();
+}
+
+void test_fetch_seek_out_of_range(void **unused) {
+    skip();
+}
+
+#endif
+
+int main(void) {
+    initialize_test(SF_BOOLEAN_FALSE);
+    const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_fetch_seek_first_rowset),
+      cmocka_unit_test(test_fetch_seek_across_chunks),
+      cmocka_unit_test(test_fetch_window),
+      cmocka_unit_test(test_fetch_seek_out_of_range),
+    };
+    int ret = cmocka_run_group_tests(tests, NULL, NULL);
+    snowflake_global_term();
+    return ret;
+}
@@ -6,12 +6,18 @@
 #include <FileMetadataInitializer.hpp>
 #include "FileMetadata.hpp"
 #include "FileCompressionType.hpp"
+#include "FileTransferAgent.hpp"
+#include "StorageClientFactory.hpp"
+#include "snowflake/IStatementPutGet.hpp"
 #include "utils/test_setup.h"
 #include "utils/TestSetup.hpp"
 #include "snowflake/platform.h"
 #include <unordered_set>
 #include <iostream>
 #include <map>
+#include <atomic>
+#include <thread>
+#include <chrono>
 
 #define FILES_IN_DIR "file1.csv", "file2.csv", "file3.csv", "file4.csv", "file1.gz"
 
@@ -141,6 +147,182 @@ void test_file_pattern_match(void **unused)
 
 }
 
+/**
+ * Storage client that takes some time to return remote metadata and returns
+ * expired token once for one of the files.
+ */
+class MockedMetadataStorageClient : public Snowflake::Client::IStorageClient
+{
+public:
+  MockedMetadataStorageClient(const std::string &expireFile, int numFiles) :
+    m_expireFile(expireFile),
+    m_numFiles(numFiles),
+    m_expiredReturned(false),
+    m_numCalled(0),
+    m_numFound(0),
+    m_numRunning(0),
+    m_maxRunning(0),
+    m_numDownloadsBeforeAllFound(0)
+  {
+  }
+
+  virtual RemoteStorageRequestOutcome upload(FileMetadata *fileMetadata,
+                                 std::basic_iostream<char> *dataStream)
+  {
+    return SUCCESS;
+  }
+
+  virtual RemoteStorageRequestOutcome download(FileMetadata * fileMetadata,
+                                               std::basic_iostream<char>* dataStream)
+  {
+    if (m_numFound < m_numFiles)
+    {
+      m_numDownloadsBeforeAllFound++;
+    }
+    return SUCCESS;
+  }
+
+  virtual RemoteStorageRequestOutcome GetRemoteFileMetadata(
+    std::string * filePathFull, FileMetadata *fileMetadata)
+  {
+    m_numCalled++;
+    int running = ++m_numRunning;
+    int maxRunning = m_maxRunning;
+    while (running > maxRunning &&
+           !m_maxRunning.compare_exchange_weak(maxRunning, running));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    m_numRunning--;
+
+    if (*filePathFull == m_expireFile && !m_expiredReturned.exchange(true))
+    {
+      return TOKEN_EXPIRED;
+    }
+
+    fileMetadata->encryptionMetadata.enKekEncoded =
+      "rgANWKrHN14aKoHRxoIh9GtjXYScNdjseX4kmLZRnEc=";
+    fileMetadata->srcFileSize = 1024;
+    m_numFound++;
+    return SUCCESS;
+  }
+
+  int getNumCalled()
+  {
+    return m_numCalled;
+  }
+
+  int getMaxRunning()
+  {
+    return m_maxRunning;
+  }
+
+  int getNumDownloadsBeforeAllFound()
+  {
+    return m_numDownloadsBeforeAllFound;
+  }
+
+private:
+  std::string m_expireFile;
+
+  int m_numFiles;
+
+  std::atomic<bool> m_expiredReturned;
+
+  std::atomic<int> m_numCalled;
+
+  std::atomic<int> m_numFound;
+
+  std::atomic<int> m_numRunning;
+
+  std::atomic<int> m_maxRunning;
+
+  std::atomic<int> m_numDownloadsBeforeAllFound;
+};
+
+class MockedStatementGetMany : public Snowflake::Client::IStatementPutGet
+{
+public:
+  MockedStatementGetMany(int numFiles) :
+    Snowflake::Client::IStatementPutGet(),
+    m_numParseCalled(0)
+  {
+    m_stageInfo.stageType = StageType::MOCKED_STAGE_TYPE;
+    m_stageInfo.location = "stage/path/";
+    for (int i = 0; i < numFiles; i++)
+    {
+      m_srcLocations.push_back("file" + std::to_string(i) + ".csv");
+      m_encryptionMaterial.emplace_back((char *)"3dOoaBhkB1wSw4hyfA5DJw==",
+                                        (char *)"1234", 1234);
+    }
+  }
+
+  virtual bool parsePutGetCommand(std::string *sql,
+                                  PutGetParseResponse *putGetParseResponse)
+  {
+    putGetParseResponse->stageInfo = m_stageInfo;
+    putGetParseResponse->command = CommandType::DOWNLOAD;
+    putGetParseResponse->sourceCompression = (char *)"NONE";
+    putGetParseResponse->srcLocations = m_srcLocations;
+    putGetParseResponse->autoCompress = false;
+    putGetParseResponse->parallel = 4;
+    putGetParseResponse->encryptionMaterials = m_encryptionMaterial;
+    putGetParseResponse->localLocation = (char *)"/tmp\0";
+    m_numParseCalled++;
+    return true;
+  }
+
+  int getNumParseCalled()
+  {
+    return m_numParseCalled;
+  }
+
+private:
+  StageInfo m_stageInfo;
+
+  std::vector<EncryptionMaterial> m_encryptionMaterial;
+
+  std::vector<std::string> m_srcLocations;
+
+  int m_numParseCalled;
+};
+
+/**
+ * Remote metadata of GET files is fetched concurrently on the transfer
+ * executor, and files start downloading before all metadata is known.
+ */
+void test_parallel_download_metadata(void **unused)
+{
+  const int numFiles = 16;
+  MockedMetadataStorageClient *client =
+    new MockedMetadataStorageClient("stage/path/file5.csv", numFiles);
+  StorageClientFactory::injectMockedClient(client);
+  MockedStatementGetMany statement(numFiles);
+  FileTransferAgent agent(&statement);
+  std::string cmd = "fake get command";
+
+  ITransferResult *result = agent.execute(&cmd);
+
+  // only the expired file is fetched again, after one token renewal
+  assert_int_equal(numFiles + 1, client->getNumCalled());
+  assert_int_equal(2, statement.getNumParseCalled());
+  assert_true(client->getMaxRunning() > 1);
+  assert_true(client->getNumDownloadsBeforeAllFound() > 0);
+
+  // results are in source order
+  assert_int_equal(numFiles, result->getResultSize());
+  for (int i = 0; i < numFiles; i++)
+  {
+    std::string value;
+    assert_true(result->next());
+    result->getColumnAsString(0, value);
+    assert_string_equal(("file" + std::to_string(i) + ".csv").c_str(),
+                        value.c_str());
+    result->getColumnAsString(2, value);
+    assert_string_equal("DOWNLOADED", value.c_str());
+    remove(("/tmp/file" + std::to_string(i) + ".csv").c_str());
+  }
+}
+
 static int gr_setup(void **unused)
 {
   initialize_test(SF_BOOLEAN_FALSE);
@@ -158,6 +340,7 @@ int main(void) {
     cmocka_unit_test_setup_teardown(test_file_pattern_match,
                                     file_pattern_match_setup,
                                     file_pattern_match_teardown),
+    cmocka_unit_test(test_parallel_download_metadata),
   };
   int ret = cmocka_run_group_tests(tests, gr_setup, gr_teardown);
   return ret;
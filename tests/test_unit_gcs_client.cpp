@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+/**
+ * Testing GCS client ranged download.
+ *
+ * Note: http requests are served by a mocked statement from memory
+ */
+
+#include <sstream>
+#include <cstdlib>
+#include <mutex>
+#include "snowflake/IStatementPutGet.hpp"
+#include "SnowflakeGCSClient.hpp"
+#include "FileMetadataInitializer.hpp"
+#include "utils/test_setup.h"
+
+using namespace ::Snowflake::Client;
+
+/**
+ * Serve GET requests on an object kept in memory, honoring Range header
+ */
+class MockedGCSStatement : public Snowflake::Client::IStatementPutGet
+{
+public:
+  MockedGCSStatement(const std::string &object, long long failRangeStart) :
+    m_object(object),
+    m_failRangeStart(failRangeStart),
+    m_numRangeGet(0)
+  {
+  }
+
+  virtual bool parsePutGetCommand(std::string *sql,
+                                  PutGetParseResponse *putGetParseResponse)
+  {
+    return false;
+  }
+
+  virtual bool http_get(std::string const& url,
+                        std::vector<std::string> const& headers,
+                        std::basic_iostream<char>* payload,
+                        std::string& responseHeaders,
+                        bool headerOnly)
+  {
+    long long start = 0;
+    long long end = (long long)m_object.size() - 1;
+    for (auto const &header : headers)
+    {
+      if (header.compare(0, 13, "Range: bytes=") == 0)
+      {
+        char *dash;
+        start = strtoll(header.c_str() + 13, &dash, 10);
+        end = strtoll(dash + 1, NULL, 10);
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_numRangeGet++;
+      }
+    }
+
+    if (start == m_failRangeStart)
+    {
+      return false;
+    }
+
+    payload->write(m_object.data() + start, end - start + 1);
+    return true;
+  }
+
+  int getNumRangeGet()
+  {
+    return m_numRangeGet;
+  }
+
+private:
+  std::string m_object;
+
+  long long m_failRangeStart;
+
+  std::mutex m_mutex;
+
+  int m_numRangeGet;
+};
+
+static std::string buildObject(size_t size)
+{
+  std::string object(size, '\0');
+  for (size_t i = 0; i < size; i++)
+  {
+    object[i] = (char)(i * 31 + i / 7);
+  }
+  return object;
+}
+
+void test_gcs_ranged_download(void **unused)
+{
+  // not a multiple of part size, last part is smaller
+  std::string object = buildObject(DOWNLOAD_DATA_SIZE_THRESHOLD * 3 + 1234);
+  MockedGCSStatement statement(object, -1);
+  StageInfo stageInfo;
+  stageInfo.stageType = StageType::GCS;
+  SnowflakeGCSClient client(&stageInfo, 4, nullptr, &statement);
+
+  FileMetadata meta;
+  meta.srcFileName = "gcs_test_file";
+  meta.presignedUrl = "https://storage.googleapis.com/bucket/gcs_test_file";
+  meta.srcFileSize = (long)object.size();
+
+  std::stringstream dataStream;
+  assert_int_equal(RemoteStorageRequestOutcome::SUCCESS,
+                   client.download(&meta, &dataStream));
+  assert_int_equal(4, statement.getNumRangeGet());
+  assert_true(object == dataStream.str());
+}
+
+void test_gcs_ranged_download_failed_part(void **unused)
+{
+  std::string object = buildObject(DOWNLOAD_DATA_SIZE_THRESHOLD * 4);
+  // second part fails, later parts must not wait for it forever
+  MockedGCSStatement statement(object, DOWNLOAD_DATA_SIZE_THRESHOLD);
+  StageInfo stageInfo;
+  stageInfo.stageType = StageType::GCS;
+  SnowflakeGCSClient client(&stageInfo, 4, nullptr, &statement);
+
+  FileMetadata meta;
+  meta.srcFileName = "gcs_test_file";
+  meta.presignedUrl = "https://storage.googleapis.com/bucket/gcs_test_file";
+  meta.srcFileSize = (long)object.size();
+
+  std::stringstream dataStream;
+  assert_int_equal(RemoteStorageRequestOutcome::FAILED,
+                   client.download(&meta, &dataStream));
+}
+
+static int gr_setup(void **unused)
+{
+  initialize_test(SF_BOOLEAN_FALSE);
+  return 0;
+}
+
+int main(void) {
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_gcs_ranged_download),
+    cmocka_unit_test(test_gcs_ranged_download_failed_part),
+  };
+  int ret = cmocka_run_group_tests(tests, gr_setup, NULL);
+  return ret;
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+/**
+ * Testing local fs storage client. Data is encrypted and uploaded into a
+ * temporary stage directory, then downloaded back and decrypted.
+ */
+
+#include <sstream>
+#include <fstream>
+#include <cstring>
+#include "snowflake/platform.h"
+#include "SnowflakeLocalFSClient.hpp"
+#include "crypto/Cryptor.hpp"
+#include "crypto/CipherStreamBuf.hpp"
+#include "utils/test_setup.h"
+
+using namespace ::Snowflake::Client;
+using Snowflake::Client::Crypto::Cryptor;
+using Snowflake::Client::Crypto::CryptoRandomDevice;
+using Snowflake::Client::Crypto::CryptoOperation;
+using Snowflake::Client::Crypto::CipherIOStream;
+
+#define ENCRYPTION_BLOCK_SIZE 128
+
+static std::string getStageDir()
+{
+  char tmpDir[MAX_PATH] = {0};
+  sf_get_uniq_tmp_dir(tmpDir);
+  return std::string(tmpDir);
+}
+
+static void initMetadata(FileMetadata &meta, const std::string &data)
+{
+  meta.destFileName = "local_fs_test_file";
+  meta.srcFileToUpload = "local_fs_test_file";
+  meta.srcFileSize = (long)data.size();
+  meta.overWrite = true;
+  meta.requireCompress = false;
+  meta.sha256Digest = "digest";
+  meta.encryptionMetadata.enKekEncoded = "encrypted_key";
+  meta.encryptionMetadata.matDesc = "{\"smkId\":\"1234\"}";
+  meta.encryptionMetadata.cipherStreamSize =
+    (long long)((data.size() + 16) / 16 * 16);
+  Cryptor::generateIV(meta.encryptionMetadata.iv, CryptoRandomDevice::DEV_URANDOM);
+  Cryptor::generateKey(meta.encryptionMetadata.fileKey, 128,
+                       CryptoRandomDevice::DEV_URANDOM);
+}
+
+static void test_round_trip_core(const std::string &data, size_t uploadThreshold)
+{
+  std::string stageDir = getStageDir();
+  StageInfo stageInfo;
+  stageInfo.stageType = StageType::LOCAL_FS;
+  stageInfo.location = stageDir;
+
+  SnowflakeLocalFSClient client(&stageInfo, 4, uploadThreshold, nullptr);
+
+  FileMetadata putMeta;
+  initMetadata(putMeta, data);
+
+  std::stringstream srcStream(data);
+  CipherIOStream encryptStream(srcStream, CryptoOperation::ENCRYPT,
+                               putMeta.encryptionMetadata.fileKey,
+                               putMeta.encryptionMetadata.iv,
+                               ENCRYPTION_BLOCK_SIZE);
+  assert_int_equal(RemoteStorageRequestOutcome::SUCCESS,
+                   client.upload(&putMeta, &encryptStream));
+
+  std::string stagedFile = stageDir + putMeta.destFileName;
+  FileMetadata getMeta;
+  assert_int_equal(RemoteStorageRequestOutcome::SUCCESS,
+                   client.GetRemoteFileMetadata(&stagedFile, &getMeta));
+  assert_int_equal(putMeta.encryptionMetadata.cipherStreamSize,
+                   getMeta.srcFileSize);
+  assert_string_equal("encrypted_key",
+                      getMeta.encryptionMetadata.enKekEncoded.c_str());
+  assert_memory_equal(putMeta.encryptionMetadata.iv.data,
+                      getMeta.encryptionMetadata.iv.data,
+                      sizeof(putMeta.encryptionMetadata.iv.data));
+
+  getMeta.srcFileName = stagedFile;
+  std::stringstream dstStream;
+  CipherIOStream decryptStream(dstStream, CryptoOperation::DECRYPT,
+                               putMeta.encryptionMetadata.fileKey,
+                               getMeta.encryptionMetadata.iv,
+                               ENCRYPTION_BLOCK_SIZE);
+  assert_int_equal(RemoteStorageRequestOutcome::SUCCESS,
+                   client.download(&getMeta, &decryptStream));
+  assert_true(data == dstStream.str());
+
+  // existing file is not overwritten unless required
+  putMeta.overWrite = false;
+  std::stringstream srcStream2(data);
+  assert_int_equal(RemoteStorageRequestOutcome::SKIP_UPLOAD_FILE,
+                   client.upload(&putMeta, &srcStream2));
+
+  sf_delete_directory_if_exists(stageDir.c_str());
+}
+
+void test_local_fs_single_part(void **unused)
+{
+  test_round_trip_core("0123456789abcdefghijklmnopqrstuvwxyz", 1024);
+}
+
+void test_local_fs_multi_part(void **unused)
+{
+  std::string data;
+  for (int i = 0; i < 1000; i++)
+  {
+    data += std::to_string(i) + ",abcdefghijklmnopqrstuvwxyz\n";
+  }
+  // part size smaller than data to exercise parallel part writes
+  test_round_trip_core(data, 1024);
+}
+
+void test_local_fs_missing_file(void **unused)
+{
+  StageInfo stageInfo;
+  stageInfo.stageType = StageType::LOCAL_FS;
+  stageInfo.location = getStageDir();
+
+  SnowflakeLocalFSClient client(&stageInfo, 4, 1024, nullptr);
+  std::string missing = stageInfo.location + "no_such_file";
+  FileMetadata meta;
+  assert_int_equal(RemoteStorageRequestOutcome::FAILED,
+                   client.GetRemoteFileMetadata(&missing, &meta));
+  sf_delete_directory_if_exists(stageInfo.location.c_str());
+}
+
+static int gr_setup(void **unused)
+{
+  initialize_test(SF_BOOLEAN_FALSE);
+  return 0;
+}
+
+int main(void) {
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_local_fs_single_part),
+    cmocka_unit_test(test_local_fs_multi_part),
+    cmocka_unit_test(test_local_fs_missing_file),
+  };
+  int ret = cmocka_run_group_tests(tests, gr_setup, NULL);
+  return ret;
+}
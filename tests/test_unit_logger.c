@@ -135,6 +135,135 @@ void test_mask_secret_log(void **unused) {
     free(line);
     fclose(fp);
 }
+
+/**
+ * Count lines of a file, lines reporting dropped records are added to
+ * dropped instead.
+ */
+static int count_log_lines(const char *path, unsigned long *dropped) {
+    FILE *fp = fopen(path, "r");
+    char *line = NULL;
+    size_t len = 0;
+    int count = 0;
+    unsigned long num = 0;
+    if (!fp) {
+        return 0;
+    }
+    while (getline(&line, &len, fp) != -1) {
+        if (strstr(line, "log records dropped") != NULL) {
+            sscanf(line, "%lu", &num);
+            *dropped += num;
+        } else {
+            count++;
+        }
+    }
+    free(line);
+    fclose(fp);
+    return count;
+}
+
+/**
+ * Tests records logged from the caller are written by the writer thread
+ */
+void test_async_log(void **unused) {
+    char logname[] = "dummy_async.log";
+    unsigned long dropped = 0;
+    remove(logname);
+
+    log_set_lock(NULL);
+    log_set_level(SF_LOG_DEBUG);
+    log_set_quiet(1);
+    log_set_fp(NULL);
+    log_set_path(logname);
+    log_set_overflow_policy(SF_LOG_OVERFLOW_BLOCK);
+    // small buffer to get producers blocked on a full buffer
+    assert_int_equal(log_set_async(1, 512), 0);
+
+    for (int i = 0; i < 1000; i++) {
+        log_debug("async record %d password: secret%d", i, i);
+    }
+    log_flush();
+    assert_int_equal(count_log_lines(logname, &dropped), 1000);
+    assert_int_equal(dropped, 0);
+
+    // records are masked before they are buffered
+    FILE *fp = fopen(logname, "r");
+    char *line = NULL;
+    size_t len = 0;
+    assert_true(getline(&line, &len, fp) != -1);
+    assert_non_null(strstr(line, "async record 0 password: ****"));
+    free(line);
+    fclose(fp);
+
+    log_close();
+    remove(logname);
+}
+
+/**
+ * Tests with drop policy every record is either written or counted
+ * as dropped
+ */
+void test_async_log_drop(void **unused) {
+    char logname[] = "dummy_async_drop.log";
+    unsigned long dropped = 0;
+    remove(logname);
+
+    log_set_lock(NULL);
+    log_set_level(SF_LOG_DEBUG);
+    log_set_quiet(1);
+    log_set_fp(NULL);
+    log_set_path(logname);
+    log_set_overflow_policy(SF_LOG_OVERFLOW_DROP);
+    assert_int_equal(log_set_async(1, 256), 0);
+
+    for (int i = 0; i < 1000; i++) {
+        log_debug("async record %d", i);
+    }
+    log_warn("warning is never dropped");
+    log_close();
+
+    int lines = count_log_lines(logname, &dropped);
+    assert_int_equal(lines + dropped, 1001);
+    log_set_overflow_policy(SF_LOG_OVERFLOW_BLOCK);
+    remove(logname);
+}
+
+/**
+ * Tests log file is rotated once it reaches max size
+ */
+void test_log_rotation(void **unused) {
+    char logname[] = "dummy_rotate.log";
+    char backup1[] = "dummy_rotate.log.1";
+    char backup2[] = "dummy_rotate.log.2";
+    char backup3[] = "dummy_rotate.log.3";
+    unsigned long dropped = 0;
+    remove(logname);
+    remove(backup1);
+    remove(backup2);
+    remove(backup3);
+
+    log_set_lock(NULL);
+    log_set_level(SF_LOG_DEBUG);
+    log_set_quiet(1);
+    log_set_fp(NULL);
+    log_set_path(logname);
+    log_set_max_file_size(1024, 2);
+
+    for (int i = 0; i < 200; i++) {
+        log_debug("rotated record %d", i);
+    }
+    log_close();
+    log_set_max_file_size(0, 0);
+
+    assert_int_equal(access(backup1, F_OK), 0);
+    assert_int_equal(access(backup2, F_OK), 0);
+    assert_int_not_equal(access(backup3, F_OK), 0);
+    assert_true(count_log_lines(backup1, &dropped) > 0);
+
+    remove(logname);
+    remove(backup1);
+    remove(backup2);
+}
 #endif
 
 int main(void) {
@@ -143,6 +272,9 @@ int main(void) {
 #ifndef _WIN32
         cmocka_unit_test(test_log_creation),
         cmocka_unit_test(test_mask_secret_log),
+        cmocka_unit_test(test_async_log),
+        cmocka_unit_test(test_async_log_drop),
+        cmocka_unit_test(test_log_rotation),
 #endif
     };
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -0,0 +1,716 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#include <string.h>
+#include "utils/test_setup.h"
+#include "utils/test_server.h"
+#include <connection.h>
+#include <memory.h>
+#include <error.h>
+#include <client_int.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <openssl/ssl.h>
+#include <openssl/ocsp.h>
+#include <openssl/x509v3.h>
+#include <openssl/pem.h>
+
+// The responder answers slowly, handshakes reading the cache don't wait
+#define RESPONDER_DELAY_MS 2000
+#define MAX_CACHED_HANDSHAKE_MS 1000
+
+// Responses are due for a refresh as soon as they are issued
+#define RESPONSE_VALIDITY 30
+#define REFRESH_LEAD_TIME "60"
+
+// Layout of the binary cache file
+#define CACHE_FILE_MAGIC "SFOCSP01"
+#define CACHE_RECORD_HEADER_LEN 12
+#define MAX_CACHE_RECORDS 16
+
+// Exported by the OCSP checks of curl
+void stopCertOCSPRefresh();
+
+/**
+ * CA and a certificate for 127.0.0.1 it issued, with the local responder
+ * as OCSP responder.
+ */
+typedef struct TEST_PKI {
+    EVP_PKEY *ca_key;
+    X509 *ca;
+    EVP_PKEY *key;
+    X509 *cert;
+} TEST_PKI;
+
+/**
+ * OCSP requests the local responder got and answered.
+ */
+typedef struct OCSP_REQUESTS {
+    TEST_PKI *pki;
+    int delay_ms;
+    // Record appended to the cache file while answering, as if written by
+    // another process
+    const char *append_file;
+    unsigned char *append_record;
+    size_t append_record_len;
+    int requests;
+    int responses;
+} OCSP_REQUESTS;
+
+static uint64 now_ms() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64) tv.tv_sec * 1000 + (uint64) tv.tv_usec / 1000;
+}
+
+static EVP_PKEY *create_key() {
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+    EVP_PKEY *key = NULL;
+    assert_int_equal(EVP_PKEY_keygen_init(ctx), 1);
+    assert_int_equal(EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, 2048), 1);
+    assert_int_equal(EVP_PKEY_keygen(ctx, &key), 1);
+    EVP_PKEY_CTX_free(ctx);
+    return key;
+}
+
+static void add_extension(X509 *cert, X509 *issuer, int nid, const char *value) {
+    X509V3_CTX ctx;
+    X509_EXTENSION *ext;
+    X509V3_set_ctx(&ctx, issuer, cert, NULL, NULL, 0);
+    ext = X509V3_EXT_conf_nid(NULL, &ctx, nid, (char *) value);
+    assert_non_null(ext);
+    X509_add_ext(cert, ext, -1);
+    X509_EXTENSION_free(ext);
+}
+
+static X509 *create_cert(const char *cn, long serial, EVP_PKEY *key,
+                         X509 *issuer, EVP_PKEY *issuer_key) {
+    X509 *cert = X509_new();
+    X509_NAME *name;
+
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), serial);
+    X509_gmtime_adj(X509_getm_notBefore(cert), -60);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+    X509_set_pubkey(cert, key);
+    name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                               (const unsigned char *) cn, -1, -1, 0);
+    X509_set_issuer_name(cert, issuer ? X509_get_subject_name(issuer) : name);
+    return cert;
+}
+
+static void create_pki(TEST_PKI *pki, int responder_port) {
+    char aia[128];
+
+    pki->ca_key = create_key();
+    pki->ca = create_cert("Test OCSP CA", 1, pki->ca_key, NULL, NULL);
+    add_extension(pki->ca, pki->ca, NID_basic_constraints, "critical,CA:TRUE");
+    add_extension(pki->ca, pki->ca, NID_key_usage, "critical,keyCertSign,cRLSign,digitalSignature");
+    assert_true(X509_sign(pki->ca, pki->ca_key, EVP_sha256()) > 0);
+
+    pki->key = create_key();
+    pki->cert = create_cert("127.0.0.1", 2, pki->key, pki->ca, pki->ca_key);
+    snprintf(aia, sizeof(aia), "OCSP;URI:http://127.0.0.1:%d/ocsp", responder_port);
+    add_extension(pki->cert, pki->ca, NID_subject_alt_name, "IP:127.0.0.1");
+    add_extension(pki->cert, pki->ca, NID_info_access, aia);
+    assert_true(X509_sign(pki->cert, pki->ca_key, EVP_sha256()) > 0);
+}
+
+static void free_pki(TEST_PKI *pki) {
+    X509_free(pki->cert);
+    EVP_PKEY_free(pki->key);
+    X509_free(pki->ca);
+    EVP_PKEY_free(pki->ca_key);
+}
+
+/**
+ * Good status for the test certificate, signed by the CA and valid for the
+ * given number of seconds.
+ */
+static int create_response(TEST_PKI *pki, long validity, unsigned char **der) {
+    OCSP_BASICRESP *basic = OCSP_BASICRESP_new();
+    OCSP_CERTID *id = OCSP_cert_to_id(EVP_sha1(), pki->cert, pki->ca);
+    ASN1_TIME *this_update = X509_gmtime_adj(NULL, 0);
+    ASN1_TIME *next_update = X509_gmtime_adj(NULL, validity);
+    OCSP_RESPONSE *resp;
+    int len;
+
+    assert_non_null(OCSP_basic_add1_status(basic, id, V_OCSP_CERTSTATUS_GOOD, 0, NULL,
+                                           this_update, next_update));
+    assert_int_equal(OCSP_basic_sign(basic, pki->ca, pki->ca_key, EVP_sha256(), NULL, 0), 1);
+    resp = OCSP_response_create(OCSP_RESPONSE_STATUS_SUCCESSFUL, basic);
+    *der = NULL;
+    len = i2d_OCSP_RESPONSE(resp, der);
+    assert_true(len > 0);
+
+    OCSP_RESPONSE_free(resp);
+    ASN1_TIME_free(next_update);
+    ASN1_TIME_free(this_update);
+    OCSP_CERTID_free(id);
+    OCSP_BASICRESP_free(basic);
+    return len;
+}
+
+static char *base64(const unsigned char *der, int len) {
+    char *encoded = (char *) SF_CALLOC(1, (size_t) (len + 2) / 3 * 4 + 1);
+    EVP_EncodeBlock((unsigned char *) encoded, der, len);
+    return encoded;
+}
+
+/**
+ * Path of a file in the cache directory under the home directory, which
+ * is created if missing.
+ */
+static void cache_path(const char *home, const char *name, char *path, size_t size) {
+    snprintf(path, size, "%s/.cache", home);
+    mkdir(path, 0700);
+    snprintf(path, size, "%s/.cache/snowflake", home);
+    mkdir(path, 0700);
+    snprintf(path, size, "%s/.cache/snowflake/%s", home, name);
+}
+
+static void write_ca_bundle(TEST_PKI *pki, const char *home, char *bundle, size_t size) {
+    FILE *file;
+    snprintf(bundle, size, "%s/ca.pem", home);
+    file = fopen(bundle, "w");
+    assert_non_null(file);
+    assert_int_equal(PEM_write_X509(file, pki->ca), 1);
+    fclose(file);
+}
+
+/**
+ * Writes a cache file in the json format of earlier versions holding a
+ * response for the test certificate.
+ */
+static void write_cache_fixture(TEST_PKI *pki, const char *home) {
+    char path[1024];
+    OCSP_CERTID *id = OCSP_cert_to_id(EVP_sha1(), pki->cert, pki->ca);
+    unsigned char *id_der = NULL;
+    unsigned char *resp_der = NULL;
+    int id_len = i2d_OCSP_CERTID(id, &id_der);
+    int resp_len = create_response(pki, RESPONSE_VALIDITY, &resp_der);
+    char *id_b64 = base64(id_der, id_len);
+    char *resp_b64 = base64(resp_der, resp_len);
+    FILE *file;
+
+    cache_path(home, "ocsp_response_cache.json", path, sizeof(path));
+    file = fopen(path, "w");
+    assert_non_null(file);
+    fprintf(file, "{\"%s\":[%lu,\"%s\"]}", id_b64, (unsigned long) time(NULL), resp_b64);
+    fclose(file);
+
+    SF_FREE(resp_b64);
+    SF_FREE(id_b64);
+    OPENSSL_free(resp_der);
+    OPENSSL_free(id_der);
+    OCSP_CERTID_free(id);
+}
+
+/**
+ * Answers every request with a good status for the test certificate.
+ */
+static void serve_ocsp(TEST_SERVER_CONNECTION *connection, const TEST_SERVER_REQUEST *request) {
+    TEST_SERVER *server = connection->server;
+    OCSP_REQUESTS *requests = (OCSP_REQUESTS *) server->user_data;
+    unsigned char *der = NULL;
+    int der_len;
+
+    _critical_section_lock(&server->lock);
+    requests->requests++;
+    _critical_section_unlock(&server->lock);
+    usleep((useconds_t) requests->delay_ms * 1000);
+    if (requests->append_file) {
+        FILE *file = fopen(requests->append_file, "ab");
+        assert_non_null(file);
+        fwrite(requests->append_record, 1, requests->append_record_len, file);
+        fclose(file);
+    }
+
+    der_len = create_response(requests->pki, RESPONSE_VALIDITY, &der);
+    test_server_respond(connection, "200 OK", "Content-Type: application/ocsp-response\r\n",
+                        (const char *) der, (size_t) der_len);
+    OPENSSL_free(der);
+    _critical_section_lock(&server->lock);
+    requests->responses++;
+    _critical_section_unlock(&server->lock);
+}
+
+static void serve_tls(TEST_SERVER_CONNECTION *connection, const TEST_SERVER_REQUEST *request) {
+    test_server_respond(connection, "200 OK", NULL, "{}", 2);
+}
+
+/**
+ * Local https server presenting the test certificate and the CA.
+ */
+static SSL_CTX *tls_server_start(TEST_SERVER *server, TEST_PKI *pki) {
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    assert_int_equal(SSL_CTX_use_certificate(ctx, pki->cert), 1);
+    assert_int_equal(SSL_CTX_use_PrivateKey(ctx, pki->key), 1);
+    // The client checks the certificate against the CA sent along
+    X509_up_ref(pki->ca);
+    assert_int_equal(SSL_CTX_add_extra_chain_cert(ctx, pki->ca), 1);
+    test_server_start(server, serve_tls, NULL, ctx);
+    return ctx;
+}
+
+static sf_bool get_request(TEST_SERVER *server, uint64 *elapsed_ms) {
+    char url[64];
+    CURL *curl = curl_easy_init();
+    SF_HEADER *header = sf_header_create();
+    SF_ERROR_STRUCT error;
+    cJSON *json = NULL;
+    uint64 start = now_ms();
+    sf_bool ret;
+
+    memset(&error, 0, sizeof(error));
+    clear_snowflake_error(&error);
+    header->header = curl_slist_append(header->header, HEADER_ACCEPT_TYPE_APPLICATION_SNOWFLAKE);
+    snprintf(url, sizeof(url), "https://127.0.0.1:%d/session", server->port);
+    ret = http_perform(curl, GET_REQUEST_TYPE, url, header, NULL, &json,
+                       DEFAULT_SNOWFLAKE_REQUEST_TIMEOUT, SF_BOOLEAN_FALSE,
+                       &error, SF_BOOLEAN_FALSE, 0, NULL);
+    *elapsed_ms = now_ms() - start;
+    snowflake_cJSON_Delete(json);
+    sf_header_destroy(header);
+    curl_easy_cleanup(curl);
+    return ret;
+}
+
+static void set_ocsp_test_env(const char *home, int responder_port) {
+    char responder_url[128];
+    snprintf(responder_url, sizeof(responder_url), "http://127.0.0.1:%d/ocsp", responder_port);
+    setenv("HOME", home, 1);
+    setenv("SF_OCSP_TEST_MODE", "true", 1);
+    setenv("SF_TEST_OCSP_URL", responder_url, 1);
+    setenv("SF_OCSP_RESPONSE_CACHE_SERVER_ENABLED", "false", 1);
+    setenv("SF_OCSP_FAIL_OPEN", "false", 1);
+}
+
+/**
+ * DER encoded cert id of the test certificate, or of another certificate
+ * of the CA with the given serial number.
+ */
+static int cert_id_der(TEST_PKI *pki, long serial, unsigned char **der) {
+    OCSP_CERTID *id;
+    int len;
+
+    if (serial == 0) {
+        id = OCSP_cert_to_id(EVP_sha1(), pki->cert, pki->ca);
+    } else {
+        ASN1_INTEGER *number = ASN1_INTEGER_new();
+        ASN1_INTEGER_set(number, serial);
+        id = OCSP_cert_id_new(EVP_sha1(), X509_get_subject_name(pki->ca),
+                              X509_get0_pubkey_bitstr(pki->ca), number);
+        ASN1_INTEGER_free(number);
+    }
+    assert_non_null(id);
+    *der = NULL;
+    len = i2d_OCSP_CERTID(id, der);
+    assert_true(len > 0);
+    OCSP_CERTID_free(id);
+    return len;
+}
+
+static void put_uint32(unsigned char *p, unsigned long v) {
+    p[0] = (unsigned char) (v & 0xff);
+    p[1] = (unsigned char) ((v >> 8) & 0xff);
+    p[2] = (unsigned char) ((v >> 16) & 0xff);
+    p[3] = (unsigned char) ((v >> 24) & 0xff);
+}
+
+static unsigned long get_uint32(const unsigned char *p) {
+    return (unsigned long) p[0] | ((unsigned long) p[1] << 8) |
+           ((unsigned long) p[2] << 16) | ((unsigned long) p[3] << 24);
+}
+
+/**
+ * Record of the binary cache file with a fresh response for the cert id
+ * of the given serial number.
+ *
+ * @return length of the record
+ */
+static size_t create_record(TEST_PKI *pki, long serial, unsigned char **record) {
+    unsigned char *id_der = NULL;
+    unsigned char *resp_der = NULL;
+    int id_len = cert_id_der(pki, serial, &id_der);
+    int resp_len = create_response(pki, RESPONSE_VALIDITY, &resp_der);
+    size_t len = CACHE_RECORD_HEADER_LEN + (size_t) id_len + (size_t) resp_len;
+
+    *record = (unsigned char *) SF_CALLOC(1, len);
+    put_uint32(*record, (unsigned long) time(NULL));
+    put_uint32(*record + 4, (unsigned long) id_len);
+    put_uint32(*record + 8, (unsigned long) resp_len);
+    memcpy(*record + CACHE_RECORD_HEADER_LEN, id_der, (size_t) id_len);
+    memcpy(*record + CACHE_RECORD_HEADER_LEN + id_len, resp_der, (size_t) resp_len);
+    OPENSSL_free(resp_der);
+    OPENSSL_free(id_der);
+    return len;
+}
+
+/**
+ * Writes a binary cache file with records for the given serial numbers,
+ * followed by the given tail.
+ */
+static void write_cache_file(TEST_PKI *pki, const char *path, const long *serials,
+                             int count, const char *tail, size_t tail_len) {
+    FILE *file = fopen(path, "wb");
+    unsigned char *record;
+    size_t len;
+    int i;
+
+    assert_non_null(file);
+    fwrite(CACHE_FILE_MAGIC, 1, strlen(CACHE_FILE_MAGIC), file);
+    for (i = 0; i < count; i++) {
+        len = create_record(pki, serials[i], &record);
+        fwrite(record, 1, len, file);
+        SF_FREE(record);
+    }
+    fwrite(tail, 1, tail_len, file);
+    fclose(file);
+}
+
+/**
+ * Reads the serial numbers of the records of a binary cache file, which
+ * must end with a complete record.
+ *
+ * @return number of records
+ */
+static int read_cache_file(TEST_PKI *pki, const char *path, long *serials) {
+    static const long known[] = {0, 100, 101};
+    unsigned char buf[64 * 1024];
+    size_t len;
+    size_t pos = strlen(CACHE_FILE_MAGIC);
+    int count = 0;
+    FILE *file = fopen(path, "rb");
+
+    assert_non_null(file);
+    len = fread(buf, 1, sizeof(buf), file);
+    fclose(file);
+    assert_true(len >= pos);
+    assert_memory_equal(buf, CACHE_FILE_MAGIC, pos);
+    while (pos < len) {
+        size_t id_len;
+        size_t resp_len;
+        size_t i;
+
+        assert_true(len - pos >= CACHE_RECORD_HEADER_LEN);
+        id_len = get_uint32(buf + pos + 4);
+        resp_len = get_uint32(buf + pos + 8);
+        assert_true(len - pos - CACHE_RECORD_HEADER_LEN >= id_len + resp_len);
+        assert_true(count < MAX_CACHE_RECORDS);
+        serials[count] = -1;
+        for (i = 0; i < sizeof(known) / sizeof(known[0]); i++) {
+            unsigned char *id_der = NULL;
+            int known_len = cert_id_der(pki, known[i], &id_der);
+            if ((size_t) known_len == id_len &&
+                memcmp(id_der, buf + pos + CACHE_RECORD_HEADER_LEN, id_len) == 0) {
+                serials[count] = known[i];
+            }
+            OPENSSL_free(id_der);
+        }
+        count++;
+        pos += CACHE_RECORD_HEADER_LEN + id_len + resp_len;
+    }
+    return count;
+}
+
+static sf_bool has_serial(const long *serials, int count, long serial) {
+    int i;
+    for (i = 0; i < count; i++) {
+        if (serials[i] == serial) {
+            return SF_BOOLEAN_TRUE;
+        }
+    }
+    return SF_BOOLEAN_FALSE;
+}
+
+/**
+ * Servers and files of a cache file test, in a new home directory.
+ */
+typedef struct CACHE_FIXTURE {
+    TEST_PKI pki;
+    OCSP_REQUESTS requests;
+    TEST_SERVER responder;
+    TEST_SERVER server;
+    SSL_CTX *ctx;
+    char home[64];
+    char bundle[1024];
+    char cache_file[1024];
+} CACHE_FIXTURE;
+
+static void cache_fixture_start(CACHE_FIXTURE *fixture) {
+    memset(fixture, 0, sizeof(*fixture));
+    fixture->requests.pki = &fixture->pki;
+    test_server_start(&fixture->responder, serve_ocsp, &fixture->requests, NULL);
+    create_pki(&fixture->pki, fixture->responder.port);
+    fixture->ctx = tls_server_start(&fixture->server, &fixture->pki);
+    strcpy(fixture->home, "/tmp/sf_ocsp_cache_XXXXXX");
+    assert_non_null(mkdtemp(fixture->home));
+    write_ca_bundle(&fixture->pki, fixture->home, fixture->bundle, sizeof(fixture->bundle));
+    cache_path(fixture->home, "ocsp_response_cache.bin", fixture->cache_file,
+               sizeof(fixture->cache_file));
+}
+
+static void cache_fixture_stop(CACHE_FIXTURE *fixture) {
+    test_server_stop(&fixture->server);
+    SSL_CTX_free(fixture->ctx);
+    test_server_stop(&fixture->responder);
+    free_pki(&fixture->pki);
+}
+
+/**
+ * Makes a request to the server in a new process, as the cache file is
+ * only loaded once per process.
+ */
+static sf_bool get_request_in_child(CACHE_FIXTURE *fixture) {
+    int status;
+    pid_t pid = fork();
+
+    assert_true(pid >= 0);
+    if (pid == 0) {
+        sf_bool ocsp_check = SF_BOOLEAN_TRUE;
+        uint64 elapsed_ms;
+        set_ocsp_test_env(fixture->home, fixture->responder.port);
+        setenv("SF_OCSP_RESPONSE_CACHE_REFRESH_ENABLED", "false", 1);
+        snowflake_global_set_attribute(SF_GLOBAL_CA_BUNDLE_FILE, fixture->bundle);
+        snowflake_global_set_attribute(SF_GLOBAL_OCSP_CHECK, &ocsp_check);
+        _exit(get_request(&fixture->server, &elapsed_ms) ? 0 : 1);
+    }
+    assert_int_equal(waitpid(pid, &status, 0), pid);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+}
+
+/**
+ * Tests that responses in the cache file are used without asking the
+ * responder
+ */
+void test_cache_file_load(void **unused) {
+    CACHE_FIXTURE fixture;
+    long serials[MAX_CACHE_RECORDS] = {0};
+
+    cache_fixture_start(&fixture);
+    write_cache_file(&fixture.pki, fixture.cache_file, serials, 1, NULL, 0);
+
+    assert_true(get_request_in_child(&fixture));
+    assert_int_equal(fixture.requests.requests, 0);
+    assert_int_equal(read_cache_file(&fixture.pki, fixture.cache_file, serials), 1);
+    assert_int_equal(serials[0], 0);
+    cache_fixture_stop(&fixture);
+}
+
+/**
+ * Tests that new responses are appended to the cache file
+ */
+void test_cache_file_append(void **unused) {
+    CACHE_FIXTURE fixture;
+    long serials[MAX_CACHE_RECORDS] = {100};
+    unsigned char before[4096];
+    unsigned char after[4096];
+    size_t before_len;
+    FILE *file;
+
+    cache_fixture_start(&fixture);
+    write_cache_file(&fixture.pki, fixture.cache_file, serials, 1, NULL, 0);
+    file = fopen(fixture.cache_file, "rb");
+    before_len = fread(before, 1, sizeof(before), file);
+    fclose(file);
+
+    assert_true(get_request_in_child(&fixture));
+    assert_int_equal(fixture.requests.requests, 1);
+    assert_int_equal(read_cache_file(&fixture.pki, fixture.cache_file, serials), 2);
+    assert_int_equal(serials[0], 100);
+    assert_int_equal(serials[1], 0);
+
+    // The existing records are left as they are
+    file = fopen(fixture.cache_file, "rb");
+    assert_true(fread(after, 1, sizeof(after), file) > before_len);
+    fclose(file);
+    assert_memory_equal(before, after, before_len);
+    cache_fixture_stop(&fixture);
+}
+
+/**
+ * Tests that a torn record at the end of the cache file is ignored, and
+ * that the file is rewritten rather than appended to
+ */
+void test_cache_file_torn_tail(void **unused) {
+    CACHE_FIXTURE fixture;
+    long serials[MAX_CACHE_RECORDS] = {100};
+    // Header of a record longer than what follows
+    const char tail[] = "\x01\x02\x03\x04\x40\x00\x00\x00\x40";
+
+    cache_fixture_start(&fixture);
+    write_cache_file(&fixture.pki, fixture.cache_file, serials, 1, tail, sizeof(tail) - 1);
+
+    assert_true(get_request_in_child(&fixture));
+    assert_int_equal(fixture.requests.requests, 1);
+    assert_int_equal(read_cache_file(&fixture.pki, fixture.cache_file, serials), 2);
+    assert_true(has_serial(serials, 2, 100));
+    assert_true(has_serial(serials, 2, 0));
+    cache_fixture_stop(&fixture);
+}
+
+/**
+ * Tests that compacting the cache file drops overwritten records and keeps
+ * the records another process appended meanwhile
+ */
+void test_cache_file_compaction(void **unused) {
+    CACHE_FIXTURE fixture;
+    long serials[MAX_CACHE_RECORDS] = {100, 100, 100, 100};
+    int count;
+
+    cache_fixture_start(&fixture);
+    write_cache_file(&fixture.pki, fixture.cache_file, serials, 4, NULL, 0);
+    fixture.requests.append_file = fixture.cache_file;
+    fixture.requests.append_record_len = create_record(&fixture.pki, 101,
+                                                       &fixture.requests.append_record);
+
+    assert_true(get_request_in_child(&fixture));
+    assert_int_equal(fixture.requests.requests, 1);
+    count = read_cache_file(&fixture.pki, fixture.cache_file, serials);
+    assert_int_equal(count, 3);
+    assert_true(has_serial(serials, count, 0));
+    assert_true(has_serial(serials, count, 100));
+    assert_true(has_serial(serials, count, 101));
+    SF_FREE(fixture.requests.append_record);
+    cache_fixture_stop(&fixture);
+}
+
+/**
+ * Tests that responses of the json cache file of earlier versions are used
+ * and moved to the binary cache file
+ */
+void test_cache_file_legacy_upgrade(void **unused) {
+    CACHE_FIXTURE fixture;
+    long serials[MAX_CACHE_RECORDS];
+
+    cache_fixture_start(&fixture);
+    write_cache_fixture(&fixture.pki, fixture.home);
+
+    assert_true(get_request_in_child(&fixture));
+    assert_int_equal(fixture.requests.requests, 0);
+    assert_int_equal(read_cache_file(&fixture.pki, fixture.cache_file, serials), 1);
+    assert_int_equal(serials[0], 0);
+    cache_fixture_stop(&fixture);
+}
+
+/**
+ * Tests that handshakes are served from the cache file and that responses
+ * are refreshed in the background without holding up handshakes
+ */
+void test_ocsp_refresh(void **unused) {
+    char home[] = "/tmp/sf_ocsp_refresh_XXXXXX";
+    char bundle[1024];
+    char path[1024];
+    TEST_PKI pki;
+    OCSP_REQUESTS requests;
+    TEST_SERVER responder;
+    TEST_SERVER server;
+    SSL_CTX *ctx;
+    sf_bool ocsp_check = SF_BOOLEAN_TRUE;
+    uint64 elapsed_ms;
+    uint64 start;
+
+    memset(&requests, 0, sizeof(requests));
+    requests.pki = &pki;
+    requests.delay_ms = RESPONDER_DELAY_MS;
+    test_server_start(&responder, serve_ocsp, &requests, NULL);
+    create_pki(&pki, responder.port);
+    ctx = tls_server_start(&server, &pki);
+
+    // Fixtures: the CA bundle and a cache file with a response
+    assert_non_null(mkdtemp(home));
+    write_cache_fixture(&pki, home);
+    write_ca_bundle(&pki, home, bundle, sizeof(bundle));
+
+    set_ocsp_test_env(home, responder.port);
+    setenv("SF_TEST_OCSP_REFRESH_INTERVAL", "1", 1);
+    setenv("SF_TEST_OCSP_REFRESH_LEAD_TIME", REFRESH_LEAD_TIME, 1);
+    snowflake_global_set_attribute(SF_GLOBAL_CA_BUNDLE_FILE, bundle);
+    snowflake_global_set_attribute(SF_GLOBAL_OCSP_CHECK, &ocsp_check);
+
+    // Pre-warmed from the cache file
+    assert_true(get_request(&server, &elapsed_ms));
+    assert_true(elapsed_ms < MAX_CACHED_HANDSHAKE_MS);
+
+    // Refreshed without any handshake waiting for it
+    assert_true(test_server_wait_for(&responder, &requests.requests, 1) >= 1);
+    assert_true(get_request(&server, &elapsed_ms));
+    assert_true(elapsed_ms < MAX_CACHED_HANDSHAKE_MS);
+
+    // And again once due, with the refreshed responses written to the cache file
+    assert_true(test_server_wait_for(&responder, &requests.responses, 2) >= 2);
+    assert_true(get_request(&server, &elapsed_ms));
+    assert_true(elapsed_ms < MAX_CACHED_HANDSHAKE_MS);
+    snprintf(path, sizeof(path), "%s/.cache/snowflake/ocsp_response_cache.bin", home);
+    assert_int_equal(access(path, F_OK), 0);
+
+    // Stopping aborts the query in flight instead of waiting for the responder
+    assert_true(test_server_wait_for(&responder, &requests.requests, 3) >= 3);
+    start = now_ms();
+    stopCertOCSPRefresh();
+    assert_true(now_ms() - start < RESPONDER_DELAY_MS / 2);
+
+    ocsp_check = SF_BOOLEAN_FALSE;
+    snowflake_global_set_attribute(SF_GLOBAL_OCSP_CHECK, &ocsp_check);
+    snowflake_global_set_attribute(SF_GLOBAL_CA_BUNDLE_FILE, getenv("SNOWFLAKE_TEST_CA_BUNDLE_FILE"));
+    test_server_stop(&server);
+    SSL_CTX_free(ctx);
+    test_server_stop(&responder);
+    free_pki(&pki);
+}
+
+#else
+
+void test_cache_file_load(void **unused) {
+    skip();
+}
+
+void test_cache_file_append(void **unused) {
+    skip();
+}
+
+void test_cache_file_torn_tail(void **unused) {
+    skip();
+}
+
+void test_cache_file_compaction(void **unused) {
+    skip();
+}
+
+void test_cache_file_legacy_upgrade(void **unused) {
+    skip();
+}
+
+void test_ocsp_refresh(void **unused) {
+    skip();
+}
+
+#endif
+
+int main(void) {
+    initialize_test(SF_BOOLEAN_FALSE);
+#ifndef _WIN32
+    // The client may close connections before the servers shut them down
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    const struct CMUnitTest tests[] = {
+      // Before anything loads the cache file in this process
+      cmocka_unit_test(test_cache_file_load),
+      cmocka_unit_test(test_cache_file_append),
+      cmocka_unit_test(test_cache_file_torn_tail),
+      cmocka_unit_test(test_cache_file_compaction),
+      cmocka_unit_test(test_cache_file_legacy_upgrade),
+      cmocka_unit_test(test_ocsp_refresh),
+    };
+    int ret = cmocka_run_group_tests(tests, NULL, NULL);
+    snowflake_global_term();
+    return ret;
+}
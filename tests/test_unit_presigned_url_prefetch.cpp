@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#include <vector>
+#include "PresignedUrlPrefetcher.hpp"
+#include "snowflake/SnowflakeTransferException.hpp"
+#include "utils/test_setup.h"
+
+using namespace ::Snowflake::Client;
+
+static std::vector<FileMetadata> buildFiles(size_t num)
+{
+  std::vector<FileMetadata> files(num);
+  for (size_t i = 0; i < num; i++)
+  {
+    files[i].destFileName = "file" + std::to_string(i);
+  }
+  return files;
+}
+
+void test_prefetch_all_urls(void **unused)
+{
+  std::vector<FileMetadata> files = buildFiles(50);
+  std::vector<FileMetadata *> filePtrs;
+  for (auto &file : files)
+  {
+    filePtrs.push_back(&file);
+  }
+
+  PresignedUrlPrefetcher prefetcher(filePtrs, [](FileMetadata &meta)->void
+  {
+    meta.presignedUrl = "https://bucket/" + meta.destFileName;
+  });
+
+  // wait out of order
+  prefetcher.waitForUrl(10);
+  assert_string_equal("https://bucket/file10", files[10].presignedUrl.c_str());
+  for (size_t i = 0; i < files.size(); i++)
+  {
+    prefetcher.waitForUrl(i);
+    assert_string_equal(("https://bucket/" + files[i].destFileName).c_str(),
+                        files[i].presignedUrl.c_str());
+  }
+}
+
+void test_prefetch_failure(void **unused)
+{
+  std::vector<FileMetadata> files = buildFiles(5);
+  std::vector<FileMetadata *> filePtrs;
+  for (auto &file : files)
+  {
+    filePtrs.push_back(&file);
+  }
+
+  PresignedUrlPrefetcher prefetcher(filePtrs, [](FileMetadata &meta)->void
+  {
+    if (meta.destFileName == "file2")
+    {
+      throw SnowflakeTransferException(TransferError::INTERNAL_ERROR,
+                                       "Failed to parse response.");
+    }
+    meta.presignedUrl = "https://bucket/" + meta.destFileName;
+  });
+
+  prefetcher.waitForUrl(1);
+  assert_string_equal("https://bucket/file1", files[1].presignedUrl.c_str());
+
+  // files from the failed one on never get an url
+  for (size_t i = 2; i < files.size(); i++)
+  {
+    bool thrown = false;
+    try
+    {
+      prefetcher.waitForUrl(i);
+    }
+    catch (SnowflakeTransferException &e)
+    {
+      thrown = true;
+      assert_int_equal(TransferError::INTERNAL_ERROR, e.getCode());
+    }
+    assert_true(thrown);
+    assert_true(files[i].presignedUrl.empty());
+  }
+}
+
+static int gr_setup(void **unused)
+{
+  initialize_test(SF_BOOLEAN_FALSE);
+  return 0;
+}
+
+int main(void) {
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_prefetch_all_urls),
+    cmocka_unit_test(test_prefetch_failure),
+  };
+  int ret = cmocka_run_group_tests(tests, gr_setup, NULL);
+  return ret;
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#include <string.h>
+#include <zlib.h>
+#include "utils/test_setup.h"
+#include "utils/test_server.h"
+#include <connection.h>
+#include <memory.h>
+#include <error.h>
+#include <client_int.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+
+/**
+ * Headers and body of the last request the server got.
+ */
+typedef struct LAST_REQUEST {
+    char *data;
+    size_t header_size;
+    size_t body_size;
+} LAST_REQUEST;
+
+static void serve_echo(TEST_SERVER_CONNECTION *connection, const TEST_SERVER_REQUEST *request) {
+    LAST_REQUEST *last = (LAST_REQUEST *) connection->server->user_data;
+
+    SF_FREE(last->data);
+    last->data = (char *) SF_CALLOC(1, request->header_size + request->body_size + 1);
+    memcpy(last->data, request->data, request->header_size + request->body_size);
+    last->header_size = request->header_size;
+    last->body_size = request->body_size;
+    test_server_respond(connection, "200 OK", NULL, "{}", 2);
+}
+
+/**
+ * Posts the body to the server and returns the body the server received,
+ * inflated if it was compressed.
+ */
+static char *post_body(TEST_SERVER *server, const char *body, sf_bool *compressed) {
+    LAST_REQUEST *last = (LAST_REQUEST *) server->user_data;
+    char url[64];
+    CURL *curl = curl_easy_init();
+    SF_HEADER *header = sf_header_create();
+    SF_ERROR_STRUCT error;
+    cJSON *json = NULL;
+    char *received;
+    uLongf received_size = (uLongf) strlen(body) + 1;
+    z_stream stream;
+
+    memset(&error, 0, sizeof(error));
+    clear_snowflake_error(&error);
+    header->header = curl_slist_append(header->header, HEADER_CONTENT_TYPE_APPLICATION_JSON);
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/queries", server->port);
+    assert_true(http_perform(curl, POST_REQUEST_TYPE, url, header, (char *) body, &json,
+                             DEFAULT_SNOWFLAKE_REQUEST_TIMEOUT, SF_BOOLEAN_FALSE,
+                             &error, SF_BOOLEAN_TRUE, 0, NULL));
+    snowflake_cJSON_Delete(json);
+    sf_header_destroy(header);
+    curl_easy_cleanup(curl);
+
+    // The request headers are only changed for compressed bodies
+    last->data[last->header_size - 2] = '\0';
+    assert_non_null(strstr(last->data, HEADER_CONTENT_TYPE_APPLICATION_JSON));
+    *compressed = strstr(last->data, HEADER_CONTENT_ENCODING_GZIP) ?
+                  SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+
+    received = (char *) SF_CALLOC(1, received_size + 1);
+    if (!*compressed) {
+        memcpy(received, last->data + last->header_size, last->body_size);
+        return received;
+    }
+
+    memset(&stream, 0, sizeof(stream));
+    assert_int_equal(inflateInit2(&stream, 16 + MAX_WBITS), Z_OK);
+    stream.next_in = (Bytef *) last->data + last->header_size;
+    stream.avail_in = (uInt) last->body_size;
+    stream.next_out = (Bytef *) received;
+    stream.avail_out = (uInt) received_size;
+    assert_int_equal(inflate(&stream, Z_FINISH), Z_STREAM_END);
+    inflateEnd(&stream);
+    return received;
+}
+
+/**
+ * Tests that bodies from the threshold on are sent gzip compressed, and
+ * smaller ones as is
+ */
+void test_request_compression(void **unused) {
+    TEST_SERVER server;
+    LAST_REQUEST last;
+    uint64 threshold = 1024;
+    char *large_body;
+    char *received;
+    sf_bool compressed;
+    size_t i;
+
+    memset(&last, 0, sizeof(last));
+    test_server_start(&server, serve_echo, &last, NULL);
+    snowflake_global_set_attribute(SF_GLOBAL_REQUEST_COMPRESSION_THRESHOLD, &threshold);
+
+    received = post_body(&server, "{\"sqlText\":\"select 1\"}", &compressed);
+    assert_false(compressed);
+    assert_string_equal(received, "{\"sqlText\":\"select 1\"}");
+    SF_FREE(received);
+
+    large_body = (char *) SF_CALLOC(1, 100001);
+    memcpy(large_body, "{\"sqlText\":\"", 12);
+    for (i = 12; i < 99998; i++) {
+        large_body[i] = (char) ('a' + i % 26);
+    }
+    memcpy(large_body + 99998, "\"}", 2);
+
+    received = post_body(&server, large_body, &compressed);
+    assert_true(compressed);
+    assert_true(last.body_size < 100000 / 4);
+    assert_string_equal(received, large_body);
+    SF_FREE(received);
+
+    // Disabled
+    threshold = 0;
+    snowflake_global_set_attribute(SF_GLOBAL_REQUEST_COMPRESSION_THRESHOLD, &threshold);
+    received = post_body(&server, large_body, &compressed);
+    assert_false(compressed);
+    assert_string_equal(received, large_body);
+    SF_FREE(received);
+
+    threshold = SF_DEFAULT_REQUEST_COMPRESSION_THRESHOLD;
+    snowflake_global_set_attribute(SF_GLOBAL_REQUEST_COMPRESSION_THRESHOLD, &threshold);
+    SF_FREE(large_body);
+    test_server_stop(&server);
+    SF_FREE(last.data);
+}
+
+#else
+
+void test_request_compression(void **unused) {
+    skip();
+}
+
+#endif
+
+int main(void) {
+    initialize_test(SF_BOOLEAN_FALSE);
+    const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_request_compression),
+    };
+    int ret = cmocka_run_group_tests(tests, NULL, NULL);
+    snowflake_global_term();
+    return ret;
+}
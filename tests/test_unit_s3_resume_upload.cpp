@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+/**
+ * Testing resume of s3 multipart upload after token expired
+ *
+ * Note: s3 is mocked by a local server
+ */
+
+#include <map>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdio>
+#include "snowflake/IStatementPutGet.hpp"
+#include "snowflake/PutGetParseResponse.hpp"
+#include "FileTransferAgent.hpp"
+#include "utils/test_setup.h"
+#include "utils/test_server.h"
+
+using namespace ::Snowflake::Client;
+
+#ifndef _WIN32
+
+#define UPLOAD_THRESHOLD (64 * 1024)
+#define FILE_SIZE (200 * 1024)
+#define UPLOAD_ID "UPLOAD_ID"
+#define EXPIRED_PART 2
+
+/// requests received by the local s3
+struct S3Requests
+{
+  int creates;
+  int lists;
+  int completes;
+  int aborts;
+  int parses;
+  /// part number to bodies of all its uploads
+  std::map<int, std::vector<std::string>> partBodies;
+  /// part number to size of its last successful upload
+  std::map<int, size_t> uploadedParts;
+};
+
+static int getPartNumber(const char *path)
+{
+  const char *partNumber = strstr(path, "partNumber=");
+  return partNumber ? atoi(partNumber + strlen("partNumber=")) : 0;
+}
+
+static void serveS3(TEST_SERVER_CONNECTION *connection,
+                    const TEST_SERVER_REQUEST *request)
+{
+  TEST_SERVER *server = connection->server;
+  S3Requests *requests = (S3Requests *) server->user_data;
+  std::string method(request->method);
+  std::string path(request->path);
+  std::string status = "200 OK";
+  std::string headers;
+  std::string body;
+
+  _critical_section_lock(&server->lock);
+  if (method == "POST" && path.find("?uploads") != std::string::npos)
+  {
+    requests->creates++;
+    body = "<InitiateMultipartUploadResult><Bucket>testbucket</Bucket>"
+           "<Key>stage/resume_upload.bin</Key><UploadId>" UPLOAD_ID
+           "</UploadId></InitiateMultipartUploadResult>";
+  }
+  else if (method == "PUT" && getPartNumber(request->path) > 0)
+  {
+    int partNumber = getPartNumber(request->path);
+    std::vector<std::string> &bodies = requests->partBodies[partNumber];
+    bodies.emplace_back(request->body, request->body_size);
+    if (partNumber == EXPIRED_PART && bodies.size() == 1)
+    {
+      status = "400 Bad Request";
+      body = "<Error><Code>ExpiredToken</Code>"
+             "<Message>The provided token has expired.</Message></Error>";
+    }
+    else
+    {
+      requests->uploadedParts[partNumber] = request->body_size;
+      headers = "ETag: \"etag" + std::to_string(partNumber) + "\"\r\n";
+    }
+  }
+  else if (method == "GET" && path.find("uploadId=") != std::string::npos)
+  {
+    requests->lists++;
+    body = "<ListPartsResult><Bucket>testbucket</Bucket><UploadId>" UPLOAD_ID
+           "</UploadId><IsTruncated>false</IsTruncated>";
+    for (auto &part : requests->uploadedParts)
+    {
+      body += "<Part><PartNumber>" + std::to_string(part.first) +
+              "</PartNumber><ETag>\"etag" + std::to_string(part.first) +
+              "\"</ETag><Size>" + std::to_string(part.second) +
+              "</Size></Part>";
+    }
+    body += "</ListPartsResult>";
+  }
+  else if (method == "POST" && path.find("uploadId=") != std::string::npos)
+  {
+    requests->completes++;
+    body = "<CompleteMultipartUploadResult><Bucket>testbucket</Bucket>"
+           "<Key>stage/resume_upload.bin</Key><ETag>\"etag\"</ETag>"
+           "</CompleteMultipartUploadResult>";
+  }
+  else if (method == "DELETE")
+  {
+    requests->aborts++;
+    status = "204 No Content";
+  }
+  else
+  {
+    status = "404 Not Found";
+  }
+  _critical_section_unlock(&server->lock);
+
+  if (!body.empty())
+  {
+    headers += "Content-Type: application/xml\r\n";
+  }
+  test_server_respond(connection, status.c_str(), headers.c_str(),
+                      body.c_str(), body.size());
+}
+
+/**
+ * Put command on a s3 stage served by the local server, parsed again when
+ * the token is renewed.
+ */
+class MockedS3StatementPut : public Snowflake::Client::IStatementPutGet
+{
+public:
+  MockedS3StatementPut(TEST_SERVER *server, const std::string &fileName)
+    : IStatementPutGet(), m_server(server)
+  {
+    m_stageInfo.stageType = StageType::S3;
+    m_stageInfo.location = "testbucket/stage/";
+    m_stageInfo.region = "us-west-2";
+    m_stageInfo.endPoint = "http://127.0.0.1:" + std::to_string(server->port);
+    m_stageInfo.credentials = {{"AWS_KEY_ID", (char *)"AWS_KEY_ID"},
+                               {"AWS_SECRET_KEY", (char *)"AWS_SECRET_KEY"},
+                               {"AWS_TOKEN", (char *)"AWS_TOKEN"}};
+    m_srcLocations.push_back(fileName);
+    m_encryptionMaterial.emplace_back(
+      (char *)"3dOoaBhkB1wSw4hyfA5DJw==\0",
+      (char *)"1234\0",
+      1234);
+  }
+
+  virtual bool parsePutGetCommand(std::string *sql,
+                                  PutGetParseResponse *putGetParseResponse)
+  {
+    S3Requests *requests = (S3Requests *) m_server->user_data;
+    _critical_section_lock(&m_server->lock);
+    requests->parses++;
+    _critical_section_unlock(&m_server->lock);
+
+    putGetParseResponse->stageInfo = m_stageInfo;
+    putGetParseResponse->command = CommandType::UPLOAD;
+    putGetParseResponse->sourceCompression = (char *)"NONE";
+    putGetParseResponse->srcLocations = m_srcLocations;
+    putGetParseResponse->threshold = UPLOAD_THRESHOLD;
+    putGetParseResponse->autoCompress = false;
+    putGetParseResponse->overwrite = true;
+    putGetParseResponse->parallel = 1;
+    putGetParseResponse->encryptionMaterials = m_encryptionMaterial;
+
+    return true;
+  }
+
+private:
+  TEST_SERVER *m_server;
+
+  StageInfo m_stageInfo;
+
+  std::vector<EncryptionMaterial> m_encryptionMaterial;
+
+  std::vector<std::string> m_srcLocations;
+};
+
+/**
+ * Tests that after token expired, the multipart upload is resumed with the
+ * key and iv of its uploaded parts: ListParts is called, only the expired
+ * part is sent again and its encrypted content does not change.
+ */
+void test_resume_upload_after_token_expired(void **)
+{
+  S3Requests requests = {};
+  TEST_SERVER server;
+  char tmpDir[MAX_PATH] = {0};
+  sf_get_uniq_tmp_dir(tmpDir);
+  std::string fileName = std::string(tmpDir) + "resume_upload.bin";
+  {
+    std::ofstream file(fileName, std::ios::binary);
+    for (int i = 0; i < FILE_SIZE; i++)
+    {
+      file.put((char) (i * 31 % 251));
+    }
+  }
+
+  test_server_start(&server, serveS3, &requests, NULL);
+  {
+    MockedS3StatementPut statement(&server, fileName);
+    TransferConfig transferConfig;
+    transferConfig.caBundleFile = (char *)"cacert.pem";
+    FileTransferAgent agent(&statement, &transferConfig);
+    std::string cmd = "put file://" + fileName + " @testStage";
+
+    ITransferResult *result = agent.execute(&cmd);
+    std::string putStatus;
+    assert_true(result->next());
+    result->getColumnAsString(6, putStatus);
+    assert_string_equal("UPLOADED", putStatus.c_str());
+  }
+  test_server_stop(&server);
+
+  // parsed again to renew the token
+  assert_int_equal(requests.parses, 2);
+  assert_int_equal(requests.creates, 1);
+  assert_int_equal(requests.lists, 1);
+  assert_int_equal(requests.completes, 1);
+  assert_int_equal(requests.aborts, 0);
+  assert_int_equal(requests.partBodies.size(), 4);
+  for (auto &part : requests.partBodies)
+  {
+    if (part.first == EXPIRED_PART)
+    {
+      assert_int_equal(part.second.size(), 2);
+      assert_true(part.second[0] == part.second[1]);
+    }
+    else
+    {
+      assert_int_equal(part.second.size(), 1);
+    }
+  }
+
+  remove(fileName.c_str());
+  sf_delete_uniq_dir_if_exists(tmpDir);
+}
+
+#else
+
+void test_resume_upload_after_token_expired(void **)
+{
+  skip();
+}
+
+#endif
+
+static int gr_setup(void **unused)
+{
+  initialize_test(SF_BOOLEAN_FALSE);
+  return 0;
+}
+
+int main(void) {
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_resume_upload_after_token_expired),
+  };
+  int ret = cmocka_run_group_tests(tests, gr_setup, NULL);
+  return ret;
+}
@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#include <string.h>
+#include "utils/test_setup.h"
+#include "utils/test_server.h"
+#include <connection.h>
+#include <memory.h>
+#include <error.h>
+#include <client_int.h>
+#include <ssl_context.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <signal.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include <openssl/pem.h>
+
+/**
+ * Self signed certificate for 127.0.0.1 and the handshakes of the local
+ * https server that resumed a session.
+ */
+typedef struct TLS_FIXTURE {
+    SSL_CTX *ctx;
+    EVP_PKEY *key;
+    X509 *cert;
+    int requests;
+    int resumed;
+} TLS_FIXTURE;
+
+static void create_certificate(TLS_FIXTURE *fixture) {
+    EVP_PKEY_CTX *key_ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+    X509_NAME *name;
+    X509_EXTENSION *ext;
+    X509V3_CTX ext_ctx;
+
+    fixture->key = NULL;
+    assert_int_equal(EVP_PKEY_keygen_init(key_ctx), 1);
+    assert_int_equal(EVP_PKEY_CTX_set_rsa_keygen_bits(key_ctx, 2048), 1);
+    assert_int_equal(EVP_PKEY_keygen(key_ctx, &fixture->key), 1);
+    EVP_PKEY_CTX_free(key_ctx);
+
+    fixture->cert = X509_new();
+    X509_set_version(fixture->cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(fixture->cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(fixture->cert), -60);
+    X509_gmtime_adj(X509_getm_notAfter(fixture->cert), 3600);
+    X509_set_pubkey(fixture->cert, fixture->key);
+    name = X509_get_subject_name(fixture->cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                               (const unsigned char *) "127.0.0.1", -1, -1, 0);
+    X509_set_issuer_name(fixture->cert, name);
+
+    X509V3_set_ctx(&ext_ctx, fixture->cert, fixture->cert, NULL, NULL, 0);
+    ext = X509V3_EXT_conf_nid(NULL, &ext_ctx, NID_subject_alt_name, "IP:127.0.0.1");
+    assert_non_null(ext);
+    X509_add_ext(fixture->cert, ext, -1);
+    X509_EXTENSION_free(ext);
+    assert_true(X509_sign(fixture->cert, fixture->key, EVP_sha256()) > 0);
+}
+
+static void write_certificate(TLS_FIXTURE *fixture, const char *path) {
+    FILE *file = fopen(path, "w");
+    assert_non_null(file);
+    assert_int_equal(PEM_write_X509(file, fixture->cert), 1);
+    fclose(file);
+}
+
+static void serve_tls(TEST_SERVER_CONNECTION *connection, const TEST_SERVER_REQUEST *request) {
+    TEST_SERVER *server = connection->server;
+    TLS_FIXTURE *fixture = (TLS_FIXTURE *) server->user_data;
+
+    _critical_section_lock(&server->lock);
+    if (request->resumed) {
+        fixture->resumed++;
+    }
+    fixture->requests++;
+    _critical_section_unlock(&server->lock);
+    test_server_respond(connection, "200 OK", NULL, "{}", 2);
+}
+
+static void tls_server_start(TEST_SERVER *server, TLS_FIXTURE *fixture) {
+    memset(fixture, 0, sizeof(*fixture));
+    create_certificate(fixture);
+    fixture->ctx = SSL_CTX_new(TLS_server_method());
+    assert_int_equal(SSL_CTX_use_certificate(fixture->ctx, fixture->cert), 1);
+    assert_int_equal(SSL_CTX_use_PrivateKey(fixture->ctx, fixture->key), 1);
+    test_server_start(server, serve_tls, fixture, fixture->ctx);
+}
+
+static void tls_server_stop(TEST_SERVER *server, TLS_FIXTURE *fixture) {
+    test_server_stop(server);
+    SSL_CTX_free(fixture->ctx);
+    X509_free(fixture->cert);
+    EVP_PKEY_free(fixture->key);
+}
+
+static sf_bool get_request(TEST_SERVER *server, SF_ERROR_STRUCT *error) {
+    char url[64];
+    CURL *curl = curl_easy_init();
+    SF_HEADER *header = sf_header_create();
+    cJSON *json = NULL;
+    sf_bool ret;
+
+    memset(error, 0, sizeof(*error));
+    clear_snowflake_error(error);
+    header->header = curl_slist_append(header->header, HEADER_ACCEPT_TYPE_APPLICATION_SNOWFLAKE);
+    snprintf(url, sizeof(url), "https://127.0.0.1:%d/session", server->port);
+    // Insecure mode only turns off the OCSP check here
+    ret = http_perform(curl, GET_REQUEST_TYPE, url, header, NULL, &json,
+                       DEFAULT_SNOWFLAKE_REQUEST_TIMEOUT, SF_BOOLEAN_FALSE,
+                       error, SF_BOOLEAN_TRUE, 0, NULL);
+    snowflake_cJSON_Delete(json);
+    sf_header_destroy(header);
+    curl_easy_cleanup(curl);
+    return ret;
+}
+
+/**
+ * Tests that the bundle is parsed once and that new handles resume the TLS
+ * session of earlier ones
+ */
+void test_cached_ca_store(void **unused) {
+    const char *bundle = "test_unit_ssl_context_ca.pem";
+    TEST_SERVER server;
+    TLS_FIXTURE fixture;
+    SF_ERROR_STRUCT error;
+
+    tls_server_start(&server, &fixture);
+    write_certificate(&fixture, bundle);
+    snowflake_global_set_attribute(SF_GLOBAL_CA_BUNDLE_FILE, bundle);
+
+    assert_true(get_request(&server, &error));
+    assert_int_equal(fixture.requests, 1);
+    assert_int_equal(fixture.resumed, 0);
+
+    // Later handles neither read the bundle again nor do a full handshake
+    remove(bundle);
+    assert_true(get_request(&server, &error));
+    assert_int_equal(fixture.requests, 2);
+    assert_int_equal(fixture.resumed, 1);
+
+    // A different bundle is loaded again, and its errors still reported
+    snowflake_global_set_attribute(SF_GLOBAL_CA_BUNDLE_FILE, "test_unit_ssl_context_missing.pem");
+    assert_false(get_request(&server, &error));
+    assert_int_equal(error.error_code, SF_STATUS_ERROR_CURL);
+    assert_int_equal(fixture.requests, 2);
+
+    snowflake_global_set_attribute(SF_GLOBAL_CA_BUNDLE_FILE, getenv("SNOWFLAKE_TEST_CA_BUNDLE_FILE"));
+    tls_server_stop(&server, &fixture);
+}
+
+/**
+ * Tests that terminating while a handle still uses the shared state keeps
+ * it, and the sessions in it
+ */
+void test_term_with_handle_in_use(void **unused) {
+    const char *bundle = "test_unit_ssl_context_term_ca.pem";
+    TEST_SERVER server;
+    TLS_FIXTURE fixture;
+    SF_ERROR_STRUCT error;
+    CURL *curl = curl_easy_init();
+
+    tls_server_start(&server, &fixture);
+    write_certificate(&fixture, bundle);
+    snowflake_global_set_attribute(SF_GLOBAL_CA_BUNDLE_FILE, bundle);
+    assert_true(get_request(&server, &error));
+    assert_int_equal(ssl_context_setopt(curl), CURLE_OK);
+
+    ssl_context_term();
+    assert_true(get_request(&server, &error));
+    assert_int_equal(fixture.resumed, 1);
+
+    // Released once the last handle is gone
+    curl_easy_cleanup(curl);
+    ssl_context_term();
+    assert_true(get_request(&server, &error));
+    assert_int_equal(fixture.requests, 3);
+    assert_int_equal(fixture.resumed, 1);
+    assert_int_equal(ssl_context_init(), 0);
+
+    remove(bundle);
+    snowflake_global_set_attribute(SF_GLOBAL_CA_BUNDLE_FILE, getenv("SNOWFLAKE_TEST_CA_BUNDLE_FILE"));
+    tls_server_stop(&server, &fixture);
+}
+
+#else
+
+void test_cached_ca_store(void **unused) {
+    skip();
+}
+
+void test_term_with_handle_in_use(void **unused) {
+    skip();
+}
+
+#endif
+
+int main(void) {
+    initialize_test(SF_BOOLEAN_FALSE);
+#ifndef _WIN32
+    // The client may close connections before the server shuts them down
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_cached_ca_store),
+      cmocka_unit_test(test_term_with_handle_in_use),
+    };
+    int ret = cmocka_run_group_tests(tests, NULL, NULL);
+    snowflake_global_term();
+    return ret;
+}
@@ -5,6 +5,8 @@
 #include "util/ByteArrayStreamBuf.hpp"
 #include "utils/test_setup.h"
 #include "util/ThreadPool.hpp"
+#include "util/FilePartWriter.hpp"
+#include "EncryptionProvider.hpp"
 #include "crypto/Cryptor.hpp"
 #include "crypto/CipherStreamBuf.hpp"
 #include <thread>
@@ -37,6 +39,30 @@ void test_byte_array_stream(void **unused)
   assert_memory_equal(result, data, sizeof(data));
 }
 
+void test_byte_array_stream_seek(void **unused)
+{
+  char data[] = "0123456789";
+  Snowflake::Client::Util::ByteArrayStreamBuf buf(64);
+  memcpy(buf.getDataBuffer(), data, sizeof(data));
+  buf.updateSize(sizeof(data));
+
+  // content length computed the way http clients do
+  std::istream byteArrayStream(&buf);
+  byteArrayStream.seekg(0, std::ios_base::end);
+  assert_int_equal(sizeof(data), (long)byteArrayStream.tellg());
+  byteArrayStream.seekg(0, std::ios_base::beg);
+
+  char result[sizeof(data)];
+  byteArrayStream.read(result, 4);
+  assert_memory_equal(result, data, 4);
+  byteArrayStream.seekg(-2, std::ios_base::cur);
+  byteArrayStream.read(result, sizeof(data) - 2);
+  assert_memory_equal(result, data + 2, sizeof(data) - 2);
+
+  byteArrayStream.seekg(sizeof(data) + 1);
+  assert_false(byteArrayStream.good());
+}
+
 /**
  * Test encrypt input stream and then split into single part,
  * then append those parts and decrypt the data.
@@ -101,10 +127,114 @@ void test_stream_splitter_appender(void **unused)
   }
 }
 
+/**
+ * Split a plain stream with less buffers than parts so that the reader has
+ * to wait for consumers to give buffers back, then check parts can be put
+ * together in part index order.
+ */
+void test_stream_splitter_read_ahead_core(size_t inputSize)
+{
+  const int partSize = 16;
+  const int threadNum = 3;
+
+  std::string inputStr;
+  for (size_t i = 0; i < inputSize; i++)
+  {
+    inputStr.push_back((char)('a' + i % 26));
+  }
+  std::stringstream inputData(inputStr);
+
+  Snowflake::Client::Util::StreamSplitter splitter(&inputData, threadNum, partSize);
+  unsigned int totalParts = splitter.getTotalParts(inputSize);
+  std::vector<std::string> parts(totalParts);
+
+  Snowflake::Client::Util::ThreadPool tp(threadNum);
+  for (unsigned int i = 0; i < totalParts; i++)
+  {
+    tp.AddJob([&]() {
+      int partId;
+      ByteArrayStreamBuf *srcBuf = splitter.FillAndGetBuf(tp.GetThreadIdx(), partId);
+      std::this_thread::sleep_for(std::chrono::milliseconds(partId % 3));
+      parts[partId].assign(srcBuf->getDataBuffer(), srcBuf->getSize());
+    });
+  }
+  tp.WaitAll();
+
+  std::string result;
+  for (unsigned int i = 0; i < totalParts; i++)
+  {
+    assert_true(parts[i].size() <= partSize);
+    result += parts[i];
+  }
+  assert_string_equal(inputStr.c_str(), result.c_str());
+}
+
+void test_stream_splitter_read_ahead(void **unused)
+{
+  test_stream_splitter_read_ahead_core(16 * 20 + 5);
+  // last part is empty when stream size is a multiple of part size
+  test_stream_splitter_read_ahead_core(16 * 20);
+}
+
+/**
+ * Encrypt a stream, then decrypt its parts in reverse order using the last
+ * cipher block of previous part as iv and write them at their offset.
+ */
+void test_out_of_order_part_decrypt(void **unused)
+{
+  std::string inputStr;
+  for (int i = 0; i < 1000; i++)
+  {
+    inputStr += std::to_string(i) + ",";
+  }
+  std::stringstream inputData(inputStr);
+
+  Snowflake::Client::FileMetadata fileMetadata;
+  fileMetadata.requireCompress = false;
+  Cryptor::generateIV(fileMetadata.encryptionMetadata.iv, CryptoRandomDevice::DEV_URANDOM);
+  Cryptor::generateKey(fileMetadata.encryptionMetadata.fileKey, 128, CryptoRandomDevice::DEV_URANDOM);
+  CipherIOStream encryptedInputStream(inputData, CryptoOperation::ENCRYPT,
+                                      fileMetadata.encryptionMetadata.fileKey,
+                                      fileMetadata.encryptionMetadata.iv, 128);
+  std::stringstream cipherStream;
+  cipherStream << encryptedInputStream.rdbuf();
+  std::string cipherText = cipherStream.str();
+
+  const size_t partSize = 256;
+  const size_t blockSize = 16;
+  size_t partNum = (cipherText.size() + partSize - 1) / partSize;
+  std::string outFile = "out_of_order_part_decrypt.txt";
+  Snowflake::Client::Util::FilePartWriter writer(outFile);
+  assert_true(writer.isOpen());
+
+  std::vector<char> plainBuf(partSize + blockSize);
+  for (size_t i = partNum; i-- > 0; )
+  {
+    size_t start = i * partSize;
+    size_t len = std::min(partSize, cipherText.size() - start);
+    const char *iv = i == 0 ? fileMetadata.encryptionMetadata.iv.data
+                            : cipherText.data() + start - blockSize;
+    size_t plainSize = Snowflake::Client::EncryptionProvider::decryptPart(
+      &fileMetadata, iv, cipherText.data() + start, len, i == partNum - 1,
+      plainBuf.data());
+    assert_true(writer.WriteAt(plainBuf.data(), plainSize, start));
+  }
+  assert_true(writer.Close());
+
+  std::ifstream result(outFile.c_str(), std::ios_base::binary);
+  std::string resultStr((std::istreambuf_iterator<char>(result)),
+                        std::istreambuf_iterator<char>());
+  assert_string_equal(inputStr.c_str(), resultStr.c_str());
+  remove(outFile.c_str());
+}
+
 int main(void) {
   const struct CMUnitTest tests[] = {
     cmocka_unit_test(test_byte_array_stream),
+    cmocka_unit_test(test_byte_array_stream_seek),
     cmocka_unit_test(test_stream_splitter_appender),
+    cmocka_unit_test(test_stream_splitter_read_ahead),
+    cmocka_unit_test(test_out_of_order_part_decrypt),
   };
   int ret = cmocka_run_group_tests(tests, NULL, NULL);
   return ret;
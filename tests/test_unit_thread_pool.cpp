@@ -6,6 +6,12 @@
 #include "utils/test_setup.h"
 #include "util/ThreadPool.hpp"
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+using Snowflake::Client::Util::ThreadPool;
+using Snowflake::Client::Util::JobPriority;
 
 void test_thread_pool(void **unused)
 {
@@ -31,9 +37,172 @@ void test_thread_pool(void **unused)
 
 }
 
+void test_thread_pool_submit(void **unused)
+{
+  ThreadPool tp(4);
+  std::vector<std::future<int>> results;
+  for (int i = 0; i < 100; i++)
+  {
+    results.push_back(tp.submit([i]() { return i * i; }));
+  }
+
+  std::future<int> failed = tp.submit([]()->int {
+    throw std::runtime_error("job failed");
+  });
+
+  for (int i = 0; i < 100; i++)
+  {
+    assert_int_equal(i * i, results[i].get());
+  }
+
+  bool thrown = false;
+  try
+  {
+    failed.get();
+  }
+  catch (std::runtime_error &)
+  {
+    thrown = true;
+  }
+  assert_true(thrown);
+}
+
+/**
+ * Jobs added by a worker go to its own queue, idle workers steal them.
+ */
+void test_thread_pool_work_stealing(void **unused)
+{
+  ThreadPool tp(4);
+  std::atomic<int> done(0);
+  std::mutex mutex;
+  std::vector<int> workers;
+
+  tp.AddJob([&]() {
+    for (int i = 0; i < 8; i++)
+    {
+      tp.AddJob([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        std::lock_guard<std::mutex> guard(mutex);
+        workers.push_back(tp.GetThreadIdx());
+        done++;
+      });
+    }
+  });
+  tp.WaitAll();
+
+  assert_int_equal(8, done);
+  // more than the worker that added the jobs ran them
+  bool stolen = false;
+  for (int idx : workers)
+  {
+    stolen = stolen || idx != workers[0];
+  }
+  assert_true(stolen);
+}
+
+void test_thread_pool_priority(void **unused)
+{
+  ThreadPool tp(1);
+  std::mutex mutex;
+  std::vector<int> order;
+
+  // keep the only worker busy while jobs are queued
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  tp.AddJob([released]() { released.wait(); });
+
+  for (int i = 0; i < 3; i++)
+  {
+    tp.AddJob([&, i]() {
+      std::lock_guard<std::mutex> guard(mutex);
+      order.push_back(i);
+    });
+  }
+  tp.AddJob([&]() {
+    std::lock_guard<std::mutex> guard(mutex);
+    order.push_back(100);
+  }, JobPriority::HIGH);
+
+  release.set_value();
+  tp.WaitAll();
+
+  std::vector<int> expected = {100, 0, 1, 2};
+  assert_true(expected == order);
+}
+
+void test_thread_pool_bounded_queue(void **unused)
+{
+  ThreadPool tp(2, 2);
+  std::atomic<int> running(0);
+  std::atomic<int> maxQueued(0);
+  std::atomic<int> added(0);
+  std::atomic<int> done(0);
+
+  for (int i = 0; i < 20; i++)
+  {
+    tp.AddJob([&]() {
+      running++;
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      running--;
+      done++;
+    });
+    added++;
+    int queued = added - done - running;
+    if (queued > maxQueued)
+    {
+      maxQueued = queued;
+    }
+  }
+  tp.WaitAll();
+
+  assert_int_equal(20, done);
+  // jobs waiting to start never exceed the bound, plus jobs each worker
+  // has taken but not yet counted as running
+  assert_true(maxQueued <= 2 + 2);
+}
+
+void test_thread_pool_cancel(void **unused)
+{
+  ThreadPool tp(1);
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  std::future<void> running = tp.submit([released]() { released.wait(); });
+
+  std::vector<std::future<int>> pending;
+  for (int i = 0; i < 5; i++)
+  {
+    pending.push_back(tp.submit([i]() { return i; }));
+  }
+
+  // the running job is not cancelled, it may not have been taken yet
+  size_t cancelled = tp.CancelPendingJobs();
+  assert_true(cancelled == 5 || cancelled == 6);
+  release.set_value();
+  tp.WaitAll();
+
+  for (auto &result : pending)
+  {
+    bool broken = false;
+    try
+    {
+      result.get();
+    }
+    catch (std::future_error &e)
+    {
+      broken = e.code() == std::future_errc::broken_promise;
+    }
+    assert_true(broken);
+  }
+}
+
 int main(void) {
   const struct CMUnitTest tests[] = {
     cmocka_unit_test(test_thread_pool),
+    cmocka_unit_test(test_thread_pool_submit),
+    cmocka_unit_test(test_thread_pool_work_stealing),
+    cmocka_unit_test(test_thread_pool_priority),
+    cmocka_unit_test(test_thread_pool_bounded_queue),
+    cmocka_unit_test(test_thread_pool_cancel),
   };
   int ret = cmocka_run_group_tests(tests, NULL, NULL);
   return ret;
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#include "utils/test_setup.h"
+#include "util/TransferExecutor.hpp"
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+using Snowflake::Client::Util::TransferExecutor;
+using Snowflake::Client::Util::TransferGroup;
+
+/// keeps the max value a counter reaches
+static void updateMax(std::atomic<int> &maxValue, int value)
+{
+  int current = maxValue.load();
+  while (value > current && !maxValue.compare_exchange_weak(current, value));
+}
+
+void test_transfer_group_parallel(void **unused)
+{
+  TransferExecutor::configure(8, 0);
+  std::atomic<int> running(0), maxRunning(0), done(0);
+  {
+    TransferGroup group(3);
+    for (int i = 0; i < 20; i++)
+    {
+      group.AddJob([&]() {
+        updateMax(maxRunning, ++running);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        running--;
+        done++;
+      });
+    }
+    group.WaitAll();
+    assert_int_equal(20, done.load());
+  }
+  // a group never exceeds its own parallel setting
+  assert_true(maxRunning.load() <= 3);
+  TransferExecutor::shutdown();
+}
+
+void test_transfer_executor_max_threads(void **unused)
+{
+  TransferExecutor::configure(4, 0);
+  std::atomic<int> running(0), maxRunning(0);
+  {
+    TransferGroup group1(4);
+    TransferGroup group2(4);
+    for (int i = 0; i < 10; i++)
+    {
+      auto job = [&]() {
+        updateMax(maxRunning, ++running);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        running--;
+      };
+      group1.AddJob(job);
+      group2.AddJob(job);
+    }
+  }
+  assert_true(maxRunning.load() <= 4);
+  TransferExecutor::shutdown();
+}
+
+void test_transfer_executor_fair_share(void **unused)
+{
+  TransferExecutor::configure(2, 0);
+  std::mutex orderMutex;
+  std::vector<int> order;
+  {
+    TransferGroup busy(2);
+    TransferGroup small(2);
+    for (int i = 0; i < 20; i++)
+    {
+      busy.AddJob([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        std::lock_guard<std::mutex> guard(orderMutex);
+        order.push_back(1);
+      });
+    }
+    for (int i = 0; i < 2; i++)
+    {
+      small.AddJob([&]() {
+        std::lock_guard<std::mutex> guard(orderMutex);
+        order.push_back(2);
+      });
+    }
+    small.WaitAll();
+    // jobs of the second command do not wait for the first one to finish
+    std::lock_guard<std::mutex> guard(orderMutex);
+    assert_true(order.size() < 20);
+  }
+  assert_int_equal(22, order.size());
+  TransferExecutor::shutdown();
+}
+
+void test_transfer_executor_in_flight_bytes(void **unused)
+{
+  const size_t limit = 100;
+  TransferExecutor::configure(8, limit);
+  TransferExecutor *executor = TransferExecutor::getInstance();
+  std::atomic<int> exceeded(0), done(0);
+  {
+    TransferGroup group1(8);
+    TransferGroup group2(8);
+    for (int i = 0; i < 10; i++)
+    {
+      auto job = [&]() {
+        if (executor->getInFlightBytes() > limit)
+        {
+          exceeded++;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        done++;
+      };
+      group1.AddJob(job, 40);
+      group2.AddJob(job, 30);
+    }
+    // larger than the limit, still goes through alone
+    group2.AddJob([&]() {
+      if (executor->getInFlightBytes() != 1000)
+      {
+        exceeded++;
+      }
+      done++;
+    }, 1000);
+  }
+  assert_int_equal(0, exceeded.load());
+  assert_int_equal(21, done.load());
+  assert_int_equal(0, executor->getInFlightBytes());
+  TransferExecutor::configure(TRANSFER_EXECUTOR_DEFAULT_THREADS, 0);
+  TransferExecutor::shutdown();
+}
+
+static int gr_setup(void **unused)
+{
+  initialize_test(SF_BOOLEAN_FALSE);
+  return 0;
+}
+
+int main(void) {
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_transfer_group_parallel),
+    cmocka_unit_test(test_transfer_executor_max_threads),
+    cmocka_unit_test(test_transfer_executor_fair_share),
+    cmocka_unit_test(test_transfer_executor_in_flight_bytes),
+  };
+  int ret = cmocka_run_group_tests(tests, gr_setup, NULL);
+  return ret;
+}
@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include "test_setup.h"
+#include "test_server.h"
+#include <memory.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <openssl/ssl.h>
+
+#define INITIAL_REQUEST_SIZE 8192
+
+static ssize_t connection_recv(TEST_SERVER_CONNECTION *connection, char *buf, size_t size) {
+    if (connection->ssl) {
+        return SSL_read((SSL *) connection->ssl, buf, (int) size);
+    }
+    return recv(connection->fd, buf, size, 0);
+}
+
+static const char *find_header(const char *data, size_t header_size, const char *name) {
+    size_t name_len = strlen(name);
+    const char *line = strstr(data, "\r\n");
+
+    while (line && (size_t) (line - data) + 2 < header_size) {
+        line += 2;
+        if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':') {
+            line += name_len + 1;
+            while (*line == ' ') {
+                line++;
+            }
+            return line;
+        }
+        line = strstr(line, "\r\n");
+    }
+    return NULL;
+}
+
+/**
+ * Reads the headers, then as much body as announced.
+ */
+static sf_bool read_request(TEST_SERVER_CONNECTION *connection, TEST_SERVER_REQUEST *request) {
+    size_t capacity = INITIAL_REQUEST_SIZE;
+    size_t size = 0;
+    char *end = NULL;
+    const char *value;
+    ssize_t len;
+
+    memset(request, 0, sizeof(*request));
+    request->data = (char *) SF_CALLOC(1, capacity + 1);
+    while (!end || size < request->header_size + request->body_size) {
+        if (size == capacity) {
+            capacity = end ? request->header_size + request->body_size : capacity * 2;
+            request->data = (char *) SF_REALLOC(request->data, capacity + 1);
+        }
+        len = connection_recv(connection, request->data + size, capacity - size);
+        if (len <= 0) {
+            return SF_BOOLEAN_FALSE;
+        }
+        size += (size_t) len;
+        request->data[size] = '\0';
+        if (end || (end = strstr(request->data, "\r\n\r\n")) == NULL) {
+            continue;
+        }
+        request->header_size = (size_t) (end - request->data) + 4;
+        value = find_header(request->data, request->header_size, "Content-Length");
+        request->body_size = value ? (size_t) atol(value) : 0;
+        value = find_header(request->data, request->header_size, "Expect");
+        if (value && strncasecmp(value, "100-continue", 12) == 0 &&
+            size < request->header_size + request->body_size) {
+            const char *go_on = "HTTP/1.1 100 Continue\r\n\r\n";
+            test_server_send(connection, go_on, strlen(go_on));
+        }
+    }
+    request->body = request->data + request->header_size;
+    sscanf(request->data, "%15s %1023s", request->method, request->path);
+    return SF_BOOLEAN_TRUE;
+}
+
+static void *connection_thread(void *arg) {
+    TEST_SERVER_CONNECTION *connection = (TEST_SERVER_CONNECTION *) arg;
+    TEST_SERVER *server = connection->server;
+    TEST_SERVER_REQUEST request;
+    SSL *ssl = NULL;
+
+    if (server->ssl_ctx) {
+        ssl = SSL_new((SSL_CTX *) server->ssl_ctx);
+        SSL_set_fd(ssl, connection->fd);
+        connection->ssl = ssl;
+        if (SSL_accept(ssl) != 1) {
+            goto cleanup;
+        }
+    }
+    if (read_request(connection, &request)) {
+        request.resumed = ssl && SSL_session_reused(ssl) ? SF_BOOLEAN_TRUE : SF_BOOLEAN_FALSE;
+        server->handler(connection, &request);
+    }
+    SF_FREE(request.data);
+    if (ssl) {
+        SSL_shutdown(ssl);
+    }
+
+cleanup:
+    if (ssl) {
+        SSL_free(ssl);
+    }
+    close(connection->fd);
+    SF_FREE(connection);
+    return NULL;
+}
+
+static void *accept_thread(void *arg) {
+    TEST_SERVER *server = (TEST_SERVER *) arg;
+    while (!server->stop) {
+        fd_set fds;
+        struct timeval timeout = {0, 50 * 1000};
+        TEST_SERVER_CONNECTION *connection;
+        int fd;
+        FD_ZERO(&fds);
+        FD_SET(server->listen_fd, &fds);
+        if (select(server->listen_fd + 1, &fds, NULL, NULL, &timeout) <= 0) {
+            continue;
+        }
+        fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        if (server->connection_count == server->connection_capacity) {
+            server->connection_capacity = server->connection_capacity ? server->connection_capacity * 2 : 16;
+            server->connection_threads = (SF_THREAD_HANDLE *) SF_REALLOC(
+              server->connection_threads, server->connection_capacity * sizeof(SF_THREAD_HANDLE));
+        }
+        connection = (TEST_SERVER_CONNECTION *) SF_CALLOC(1, sizeof(TEST_SERVER_CONNECTION));
+        connection->server = server;
+        connection->fd = fd;
+        _thread_init(&server->connection_threads[server->connection_count++],
+                     connection_thread, connection);
+    }
+    return NULL;
+}
+
+void test_server_start(TEST_SERVER *server, TEST_SERVER_HANDLER handler,
+                       void *user_data, void *ssl_ctx) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    memset(server, 0, sizeof(*server));
+    server->handler = handler;
+    server->user_data = user_data;
+    server->ssl_ctx = ssl_ctx;
+    _critical_section_init(&server->lock);
+    server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert_true(server->listen_fd >= 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    assert_int_equal(bind(server->listen_fd, (struct sockaddr *) &addr, sizeof(addr)), 0);
+    assert_int_equal(listen(server->listen_fd, 16), 0);
+    assert_int_equal(getsockname(server->listen_fd, (struct sockaddr *) &addr, &len), 0);
+    server->port = ntohs(addr.sin_port);
+
+    assert_int_equal(_thread_init(&server->thread, accept_thread, server), 0);
+}
+
+void test_server_stop(TEST_SERVER *server) {
+    size_t i;
+    server->stop = 1;
+    _thread_join(server->thread);
+    for (i = 0; i < server->connection_count; i++) {
+        _thread_join(server->connection_threads[i]);
+    }
+    SF_FREE(server->connection_threads);
+    close(server->listen_fd);
+    _critical_section_term(&server->lock);
+}
+
+sf_bool test_server_send(TEST_SERVER_CONNECTION *connection, const void *data, size_t size) {
+    const char *next = (const char *) data;
+    ssize_t len;
+
+    while (size > 0) {
+        if (connection->ssl) {
+            len = SSL_write((SSL *) connection->ssl, next, (int) size);
+        } else {
+            len = send(connection->fd, next, size, 0);
+        }
+        if (len <= 0) {
+            return SF_BOOLEAN_FALSE;
+        }
+        next += len;
+        size -= (size_t) len;
+    }
+    return SF_BOOLEAN_TRUE;
+}
+
+sf_bool test_server_respond(TEST_SERVER_CONNECTION *connection, const char *status,
+                            const char *headers, const char *body, size_t body_size) {
+    char header[1024];
+
+    snprintf(header, sizeof(header),
+             "HTTP/1.1 %s\r\n%sContent-Length: %lu\r\nConnection: close\r\n\r\n",
+             status, headers ? headers : "", (unsigned long) body_size);
+    return test_server_send(connection, header, strlen(header)) &&
+           (body_size == 0 || test_server_send(connection, body, body_size));
+}
+
+const char *test_server_header(const TEST_SERVER_REQUEST *request, const char *name) {
+    return find_header(request->data, request->header_size, name);
+}
+
+int test_server_wait_for(TEST_SERVER *server, int *counter, int value) {
+    uint64 deadline = sf_monotonic_time_ms() + 10 * 1000;
+    int current;
+
+    for (;;) {
+        _critical_section_lock(&server->lock);
+        current = *counter;
+        _critical_section_unlock(&server->lock);
+        if (current >= value || sf_monotonic_time_ms() > deadline) {
+            return current;
+        }
+        usleep(10 * 1000);
+    }
+}
+
+#endif
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2021 Snowflake Computing, Inc. All rights reserved.
+ */
+
+#ifndef SNOWFLAKE_TEST_SERVER_H
+#define SNOWFLAKE_TEST_SERVER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <snowflake/basic_types.h>
+#include <snowflake/platform.h>
+
+typedef struct TEST_SERVER TEST_SERVER;
+
+/**
+ * Connection of the local server, serving one request on its own thread.
+ */
+typedef struct TEST_SERVER_CONNECTION {
+    TEST_SERVER *server;
+    int fd;
+    // SSL of https servers, NULL otherwise
+    void *ssl;
+} TEST_SERVER_CONNECTION;
+
+/**
+ * Request read by the local server. The request line and the headers are
+ * followed by as much body as announced in Content-Length.
+ */
+typedef struct TEST_SERVER_REQUEST {
+    char method[16];
+    char path[1024];
+    // Request line, headers and body, NULL terminated
+    char *data;
+    size_t header_size;
+    const char *body;
+    size_t body_size;
+    // Whether https requests came on a resumed TLS session
+    sf_bool resumed;
+} TEST_SERVER_REQUEST;
+
+/**
+ * Answers a request. Handlers run on the connection threads, and close the
+ * connection by returning.
+ */
+typedef void (*TEST_SERVER_HANDLER)(TEST_SERVER_CONNECTION *connection,
+                                    const TEST_SERVER_REQUEST *request);
+
+/**
+ * Local http(s) server listening on a free port of 127.0.0.1.
+ */
+struct TEST_SERVER {
+    int listen_fd;
+    int port;
+    // Set while stopping, handlers holding on to a request should return
+    volatile int stop;
+    TEST_SERVER_HANDLER handler;
+    void *user_data;
+    // SSL_CTX of https servers, NULL for http
+    void *ssl_ctx;
+    // Lock for the counters of the tests
+    SF_CRITICAL_SECTION_HANDLE lock;
+    SF_THREAD_HANDLE thread;
+    SF_THREAD_HANDLE *connection_threads;
+    size_t connection_count;
+    size_t connection_capacity;
+};
+
+/**
+ * Starts the server.
+ *
+ * @param server server to start
+ * @param handler request handler
+ * @param user_data data of the test, available to the handler
+ * @param ssl_ctx SSL_CTX with the certificate for https, or NULL for http
+ */
+void test_server_start(TEST_SERVER *server, TEST_SERVER_HANDLER handler,
+                       void *user_data, void *ssl_ctx);
+
+/**
+ * Stops the server and waits for the running handlers to return.
+ */
+void test_server_stop(TEST_SERVER *server);
+
+/**
+ * Sends raw data on the connection.
+ *
+ * @return SF_BOOLEAN_TRUE if all the data was sent
+ */
+sf_bool test_server_send(TEST_SERVER_CONNECTION *connection, const void *data, size_t size);
+
+/**
+ * Sends a response with the given status line, extra headers and body.
+ *
+ * @param status status and reason, e.g. "200 OK"
+ * @param headers extra headers, each ending with \r\n, or NULL
+ * @param body body, or NULL
+ * @param body_size size of the body
+ */
+sf_bool test_server_respond(TEST_SERVER_CONNECTION *connection, const char *status,
+                            const char *headers, const char *body, size_t body_size);
+
+/**
+ * Returns the value of the header with the given name, case insensitive,
+ * up to the end of the line, or NULL.
+ */
+const char *test_server_header(const TEST_SERVER_REQUEST *request, const char *name);
+
+/**
+ * Waits up to ten seconds for the counter, updated under the server lock,
+ * to reach the value.
+ *
+ * @return the last value of the counter
+ */
+int test_server_wait_for(TEST_SERVER *server, int *counter, int value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SNOWFLAKE_TEST_SERVER_H